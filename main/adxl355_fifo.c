@@ -0,0 +1,67 @@
+#include <string.h>
+
+#include "adxl355_fifo.h"
+
+
+/*======================================================================
+ * ADXL355 FIFO DECODER RESET
+ ======================================================================*/
+void adxl355_fifo_decoder_reset(adxl355_fifo_decoder_t *decoder){
+    memset(decoder,0,sizeof(adxl355_fifo_decoder_t));
+}
+
+
+/*======================================================================
+ * ADXL355 FIFO DECODE
+ *
+ * Walks the entries one by one:
+ *   - EMPTY entries are skipped (the FIFO was read faster than filled).
+ *   - An entry with X_MARK always starts a new sample, if there was an
+ *     incomplete sample it's dropped (alignment recovery).
+ *   - Y and Z entries without a previous X are dropped.
+ ======================================================================*/
+uint16_t adxl355_fifo_decode(adxl355_fifo_decoder_t *decoder, const uint8_t *raw, uint16_t entries, uint8_t *samples, uint16_t max_samples){
+    uint16_t written=0;
+    const uint8_t *entry;
+
+    for(uint16_t each_entry=0;each_entry<entries;each_entry++){
+        entry=&raw[each_entry*ADXL355_FIFO_BYTES_PER_ENTRY];
+
+        if (entry[2] & ADXL355_FIFO_EMPTY_MARKER){
+            decoder->empty_entries++;
+            continue;
+        }
+
+        if (entry[2] & ADXL355_FIFO_X_MARKER){
+            //X axis before finishing the last sample, the last one is lost
+            decoder->dropped_entries+=decoder->partial_entries;
+            decoder->partial_entries=0;
+        }
+        else if (decoder->partial_entries==0){
+            //Y or Z axis without X axis
+            decoder->dropped_entries++;
+            continue;
+        }
+
+        //copy the axis and clear the marker bits (same format as XDATA3..XDATA1 registers)
+        uint8_t *axis=&decoder->partial[decoder->partial_entries*ADXL355_FIFO_BYTES_PER_ENTRY];
+        axis[0]=entry[0];
+        axis[1]=entry[1];
+        axis[2]=entry[2] & 0xF0;
+        decoder->partial_entries++;
+
+        //X, Y and Z complete
+        if (decoder->partial_entries==3){
+            decoder->partial_entries=0;
+            if (written<max_samples){
+                memcpy(&samples[written*ADXL355_FIFO_BYTES_PER_SAMPLE],decoder->partial,ADXL355_FIFO_BYTES_PER_SAMPLE);
+                written++;
+                decoder->samples++;
+            }
+            else{
+                decoder->dropped_entries+=3;
+            }
+        }
+    }
+    return written;
+}
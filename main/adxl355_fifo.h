@@ -0,0 +1,54 @@
+#ifndef _ADXL355_FIFO_H_
+#define _ADXL355_FIFO_H_
+
+/*
+ADXL355 FIFO decoder
+
+The ADXL355 FIFO stores up to 96 entries, every entry is ONE axis (3 bytes).
+One sample (X, Y, Z) uses 3 entries, so the FIFO holds 32 samples.
+
+Entry format read from FIFO_DATA register (0x11):
+
+BYTES:     |     0      |     1     |                2                   |
+            DATA[19:12]  DATA[11:4]   DATA[3:0] | x | x | EMPTY | X_MARK
+
+    X_MARK (bit 0 of byte 2) = 1 if the entry is an X axis value (start of sample)
+    EMPTY  (bit 1 of byte 2) = 1 if the FIFO was empty when the entry was read
+
+The decoder keeps incomplete samples between calls, so a burst that ends in
+the middle of a sample doesn't lose alignment. Output samples have the same
+9 byte layout as adxl355_read_accl (the marker bits are cleared):
+
+BYTES:     |  0  |   1   |  2  |  3  |   4   |  5  |  6  |   7   |  8  |
+adxl355:    MBSX   middle LSBX   MSBY  middle LSBY  MBSZ   middle  LSBZ
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+
+#define ADXL355_FIFO_ENTRIES 96 //Maximum number of entries in the FIFO
+#define ADXL355_FIFO_BYTES_PER_ENTRY 3 //Bytes per entry (one axis)
+#define ADXL355_FIFO_BYTES_PER_SAMPLE 9 //Bytes per sample (three axis)
+
+#define ADXL355_FIFO_X_MARKER (1<<0) //bit 0 of the last byte of the entry
+#define ADXL355_FIFO_EMPTY_MARKER (1<<1) //bit 1 of the last byte of the entry
+
+typedef struct {
+    uint8_t partial[ADXL355_FIFO_BYTES_PER_SAMPLE]; //axis already received of the current sample
+    uint8_t partial_entries; //number of axis in partial (0, 1 or 2)
+
+    uint32_t samples; //total decoded samples
+    uint32_t dropped_entries; //entries discarded to recover the X, Y, Z alignment
+    uint32_t empty_entries; //entries marked as empty
+} adxl355_fifo_decoder_t;
+
+
+/*Clears the decoder state and counters*/
+void adxl355_fifo_decoder_reset(adxl355_fifo_decoder_t *decoder);
+
+/*Decodes "entries" FIFO entries from raw, writes complete samples (9 bytes each)
+into samples (maximum max_samples), returns the number of written samples*/
+uint16_t adxl355_fifo_decode(adxl355_fifo_decoder_t *decoder, const uint8_t *raw, uint16_t entries, uint8_t *samples, uint16_t max_samples);
+
+#endif
@@ -0,0 +1,364 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h> //fsync
+
+#include "backlog_index.h"
+#include "crc32c.h"
+
+#define INDEX_MAGIC "DLBI"
+#define INDEX_VERSION 1
+#define STATE_PENDING 'P'
+#define STATE_ACKED 'A'
+
+
+static void put_be(uint8_t *buffer, uint64_t value, uint8_t bytes){
+    for(int8_t i=bytes-1;i>=0;i--){
+        buffer[i]=(uint8_t)(value&0xFF);
+        value>>=8;
+    }
+}
+
+static uint64_t get_be(const uint8_t *buffer, uint8_t bytes){
+    uint64_t value=0;
+    for(uint8_t i=0;i<bytes;i++){
+        value=(value<<8)|buffer[i];
+    }
+    return value;
+}
+
+static bool flush(FILE *file){
+    return fflush(file)==0 && fsync(fileno(file))==0;
+}
+
+static bool write_at(FILE *file, uint32_t offset, const void *data, uint32_t bytes){
+    return fseek(file,(long)offset,SEEK_SET)==0 && fwrite(data,bytes,1,file)==1;
+}
+
+//1, 0 (after the end of the file) or -1 (card error)
+static int8_t read_at(FILE *file, uint32_t offset, void *data, uint32_t bytes){
+    if (fseek(file,(long)offset,SEEK_SET)==0 && fread(data,bytes,1,file)==1){
+        return 1;
+    }
+    return feof(file)?0:-1;
+}
+
+static uint32_t slot_offset(uint32_t seq){
+    return BACKLOG_INDEX_SLOTS_OFFSET+(seq%BACKLOG_INDEX_SLOTS)*BACKLOG_INDEX_SLOT_BYTES;
+}
+
+//seq is in [from, to) (sequence numbers wrap around)
+static bool seq_between(uint32_t seq, uint32_t from, uint32_t to){
+    return seq-from<to-from;
+}
+
+
+/*======================================================================
+ * HEADER (checkpoint)
+ ======================================================================*/
+static bool header_write(backlog_index_t *index){
+    uint8_t header[BACKLOG_INDEX_HEADER_BYTES]={0};
+    uint32_t generation=index->generation+1;
+
+    memcpy(header,INDEX_MAGIC,4);
+    header[4]=INDEX_VERSION;
+    put_be(&header[8],index->index_id,4);
+    put_be(&header[12],generation,4);
+    put_be(&header[16],index->head,4);
+    put_be(&header[20],index->tail,4);
+    put_be(&header[24],crc32c(0,header,24),4);
+
+    if (!write_at(index->file,(generation%2)*BACKLOG_INDEX_HEADER_SPACING,header,BACKLOG_INDEX_HEADER_BYTES) || !flush(index->file)){
+        return false;
+    }
+    index->generation=generation;
+    index->changes=0;
+    return true;
+}
+
+//copy "copy" of the header: 1 (valid), 0 or -1 (card error)
+static int8_t header_read(backlog_index_t *index, uint8_t copy){
+    uint8_t header[BACKLOG_INDEX_HEADER_BYTES];
+    int8_t result;
+
+    result=read_at(index->file,copy*BACKLOG_INDEX_HEADER_SPACING,header,BACKLOG_INDEX_HEADER_BYTES);
+    if (result!=1){
+        return result;
+    }
+    if (memcmp(header,INDEX_MAGIC,4)!=0 || header[4]!=INDEX_VERSION || crc32c(0,header,24)!=get_be(&header[24],4) ||
+        (uint32_t)get_be(&header[20],4)-(uint32_t)get_be(&header[16],4)>BACKLOG_INDEX_SLOTS){
+        return 0;
+    }
+    index->index_id=(uint32_t)get_be(&header[8],4);
+    index->generation=(uint32_t)get_be(&header[12],4);
+    index->head=(uint32_t)get_be(&header[16],4);
+    index->tail=(uint32_t)get_be(&header[20],4);
+    return 1;
+}
+
+//one more change, a checkpoint every BACKLOG_INDEX_CHECKPOINT (the slots are already in the card)
+static void changed(backlog_index_t *index){
+    index->changes++;
+    if (index->changes>=BACKLOG_INDEX_CHECKPOINT){
+        header_write(index);
+    }
+}
+
+
+/*======================================================================
+ * SLOTS
+ ======================================================================*/
+static bool slot_write(backlog_index_t *index, uint32_t seq, sd_log_location_t location, bool sync){
+    uint8_t slot[BACKLOG_INDEX_SLOT_BYTES]={0};
+
+    slot[0]=STATE_PENDING;
+    put_be(&slot[2],location.record,2);
+    put_be(&slot[4],location.segment,4);
+    put_be(&slot[8],seq,4);
+    put_be(&slot[12],crc32c(index->salt,&slot[1],11),4);
+    return write_at(index->file,slot_offset(seq),slot,BACKLOG_INDEX_SLOT_BYTES) && (!sync || flush(index->file));
+}
+
+//slot of seq: 1 (valid, state and location), 0 (other data, an older SEQ) or -1 (card error)
+static int8_t slot_read(backlog_index_t *index, uint32_t seq, uint8_t *state, sd_log_location_t *location){
+    uint8_t slot[BACKLOG_INDEX_SLOT_BYTES];
+    int8_t result;
+
+    result=read_at(index->file,slot_offset(seq),slot,BACKLOG_INDEX_SLOT_BYTES);
+    if (result!=1){
+        return result;
+    }
+    if (get_be(&slot[8],4)!=seq || crc32c(index->salt,&slot[1],11)!=get_be(&slot[12],4)){
+        return 0;
+    }
+    *state=slot[0];
+    location->record=(uint16_t)get_be(&slot[2],2);
+    location->segment=(uint32_t)get_be(&slot[4],4);
+    return 1;
+}
+
+//HEAD goes forward over the acked slots (and the ones not valid), false if the card failed
+static bool head_forward(backlog_index_t *index){
+    sd_log_location_t location;
+    uint8_t state;
+    int8_t result;
+
+    while (index->head!=index->tail){
+        result=slot_read(index,index->head,&state,&location);
+        if (result<0){
+            return false;
+        }
+        if (result==1 && state==STATE_PENDING){
+            break;
+        }
+        index->head++;
+        index->changes++;
+    }
+    if (!seq_between(index->next,index->head,index->tail+1)){
+        index->next=index->head;
+    }
+    return true;
+}
+
+
+/*======================================================================
+ * OPEN AND CLOSE
+ ======================================================================*/
+//new file with the records of the log (every one of them pending), false if the card failed
+static bool index_create(backlog_index_t *index, const char *path, sd_log_t *log, uint32_t index_id){
+    uint8_t zeros[BACKLOG_INDEX_SLOTS_OFFSET]={0};
+    sd_log_location_t location;
+
+    index->file=fopen(path,"w+b");
+    if (index->file==NULL){
+        return false;
+    }
+    //no valid header until every slot is written, the last byte allocates the ring
+    if (!write_at(index->file,0,zeros,BACKLOG_INDEX_SLOTS_OFFSET) ||
+        fseek(index->file,(long)BACKLOG_INDEX_FILE_BYTES-1,SEEK_SET)!=0 || fputc(0,index->file)==EOF){
+        return false;
+    }
+    index->index_id=index_id;
+    put_be(zeros,index_id,4);
+    index->salt=crc32c(0,zeros,4);
+    index->generation=0;
+    index->head=0;
+    index->tail=0;
+
+    location.segment=log->first;
+    location.record=0;
+    while (index->tail-index->head<BACKLOG_INDEX_SLOTS && sd_log_locate(log,&location)){
+        if (!slot_write(index,index->tail,location,false)){
+            return false;
+        }
+        index->tail++;
+        location.record++;
+    }
+    index->rebuilt=true;
+    //both copies (the clusters of the file may keep an old header)
+    return flush(index->file) && header_write(index) && header_write(index);
+}
+
+bool backlog_index_open(backlog_index_t *index, sd_log_t *log, uint32_t index_id){
+    char path[BACKLOG_INDEX_PATH_BYTES];
+    uint8_t id[4];
+    backlog_index_t copy;
+    sd_log_location_t location;
+    uint8_t state;
+    int8_t result[2], found;
+
+    memset(index,0,sizeof(backlog_index_t));
+    snprintf(path,sizeof(path),"%s/%s",log->folder,BACKLOG_INDEX_NAME);
+
+    index->file=fopen(path,"r+b");
+    if (index->file==NULL && errno!=ENOENT){
+        return false;
+    }
+    if (index->file!=NULL){
+        //newest valid copy of the header
+        result[0]=header_read(index,0);
+        copy=*index;
+        result[1]=header_read(index,1);
+        if (result[0]<0 || result[1]<0){
+            fclose(index->file);
+            index->file=NULL;
+            return false;
+        }
+        if (result[0]==1 && (result[1]!=1 || (int32_t)(copy.generation-index->generation)>0)){
+            *index=copy;
+        }
+        if (result[0]!=1 && result[1]!=1){
+            fclose(index->file);
+            index->file=NULL;
+        }
+    }
+    if (index->file==NULL){
+        if (!index_create(index,path,log,index_id)){
+            if (index->file!=NULL){
+                fclose(index->file);
+                index->file=NULL;
+            }
+            return false;
+        }
+        index->next=index->head;
+        index->open=true;
+        return true;
+    }
+    put_be(id,index->index_id,4);
+    index->salt=crc32c(0,id,4);
+
+    //slots written after the checkpoint
+    while (index->tail-index->head<BACKLOG_INDEX_SLOTS){
+        found=slot_read(index,index->tail,&state,&location);
+        if (found<0){
+            fclose(index->file);
+            index->file=NULL;
+            return false;
+        }
+        if (found==0){
+            break;
+        }
+        index->tail++;
+        index->recovered++;
+    }
+    //acks written after the checkpoint
+    index->next=index->head;
+    if (!head_forward(index)){
+        fclose(index->file);
+        index->file=NULL;
+        return false;
+    }
+    index->open=true;
+
+    //a reset between the last slot and its record
+    if (index->head!=index->tail && slot_read(index,index->tail-1,&state,&location)==1 && state==STATE_PENDING &&
+        sd_log_read_at(log,location,NULL,0)==SD_LOG_CORRUPTED){
+        backlog_index_ack(index,index->tail-1);
+    }
+    header_write(index);
+    return true;
+}
+
+void backlog_index_close(backlog_index_t *index){
+    if (index->file!=NULL){
+        header_write(index);
+        fclose(index->file);
+        index->file=NULL;
+    }
+    index->open=false;
+}
+
+
+/*======================================================================
+ * ADD, TAKE AND ACK
+ ======================================================================*/
+bool backlog_index_add(backlog_index_t *index, sd_log_location_t location, uint32_t *seq){
+    if (!index->open || index->tail-index->head>=BACKLOG_INDEX_SLOTS){
+        return false;
+    }
+    if (!slot_write(index,index->tail,location,true)){
+        return false;
+    }
+    *seq=index->tail;
+    index->tail++;
+    changed(index);
+    return true;
+}
+
+bool backlog_index_take(backlog_index_t *index, sd_log_location_t *location, uint32_t *seq){
+    uint8_t state;
+    int8_t result;
+
+    if (!index->open){
+        return false;
+    }
+    while (index->next!=index->tail){
+        result=slot_read(index,index->next,&state,location);
+        if (result<0){
+            return false;
+        }
+        *seq=index->next;
+        index->next++;
+        if (result==1 && state==STATE_PENDING){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool backlog_index_ack(backlog_index_t *index, uint32_t seq){
+    uint8_t state=STATE_ACKED;
+
+    if (!index->open){
+        return false;
+    }
+    //an older ack (uploaded twice) or a slot of other index
+    if (!seq_between(seq,index->head,index->tail)){
+        return true;
+    }
+    if (!write_at(index->file,slot_offset(seq),&state,1) || !flush(index->file)){
+        return false;
+    }
+    if (seq==index->head && !head_forward(index)){
+        return false;
+    }
+    changed(index);
+    return true;
+}
+
+void backlog_index_rewind(backlog_index_t *index){
+    index->next=index->head;
+}
+
+uint32_t backlog_index_pending(const backlog_index_t *index){
+    return index->open?index->tail-index->head:0;
+}
+
+bool backlog_index_available(const backlog_index_t *index){
+    return index->open && index->next!=index->tail;
+}
+
+bool backlog_index_oldest(backlog_index_t *index, sd_log_location_t *location){
+    uint8_t state;
+
+    return index->open && index->head!=index->tail && slot_read(index,index->head,&state,location)==1;
+}
@@ -0,0 +1,112 @@
+#ifndef _BACKLOG_INDEX_H_
+#define _BACKLOG_INDEX_H_
+
+/*
+Persistent index of the backlog: the locations (sd_log.h) of the records still to upload
+
+One file (BACKLOG.IDX in the backlog folder) with a ring of BACKLOG_INDEX_SLOTS slots. Every
+record appended to the backlog gets the next sequence number SEQ (TAIL) and its slot SEQ %
+BACKLOG_INDEX_SLOTS is written (and flushed) BEFORE the record, so a record in the log always
+has its slot. The upload of the record (ACK) changes the STATE byte of its slot. HEAD is the
+oldest slot not ACKED: the next record to upload is found without a readdir or reading the
+log, and the segments before the one of HEAD are removed (sd_log_trim). All values big endian:
+
+Header (two copies, offsets 0 and BACKLOG_INDEX_HEADER_SPACING, the newest one is valid)
+ 0      | 4     | MAGIC "DLBI"
+ 4      | 1     | VERSION (1)
+ 5      | 3     | 0
+ 8      | 4     | INDEX_ID, random number of the file (backlog_index_open)
+ 12     | 4     | GENERATION, + 1 every checkpoint (copy GENERATION % 2 is written)
+ 16     | 4     | HEAD
+ 20     | 4     | TAIL
+ 24     | 4     | CRC, CRC-32C (crc32c.h) of bytes 0-23
+
+Slot (offset BACKLOG_INDEX_SLOTS_OFFSET + (SEQ % BACKLOG_INDEX_SLOTS) * BACKLOG_INDEX_SLOT_BYTES)
+ 0      | 1     | STATE, 'P' pending, 'A' acked (one byte: an ACK can't be cut by a reset)
+ 1      | 1     | 0
+ 2      | 2     | RECORD of the location
+ 4      | 4     | SEGMENT of the location
+ 8      | 4     | SEQ
+ 12     | 4     | CRC, CRC-32C of bytes 1-11 starting with SALT (CRC of INDEX_ID)
+
+The header is a checkpoint written every BACKLOG_INDEX_CHECKPOINT changes and by
+backlog_index_close, not with every record. After a reset backlog_index_open starts at the
+checkpoint: TAIL goes forward over the valid slots with the next SEQ (their slot was written
+after the checkpoint) and HEAD over the acked ones, only the slots after the checkpoint
+are read. The last slot is cancelled (acked) if its record isn't in the log (reset between the
+slot and the record). A file that doesn't exist or without a valid header is made again from
+the records of the log (every one of them pending, also the logs of the firmware before
+the index).
+
+Records are uploaded at least once: an ACK lost by a reset (or a record taken and never
+acked, backlog_index_rewind) uploads the record again.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sd_log.h"
+
+#define BACKLOG_INDEX_NAME "BACKLOG.IDX"
+#define BACKLOG_INDEX_SLOTS 65536            //records pending (65536*16 bytes = 1 MB file)
+#define BACKLOG_INDEX_SLOT_BYTES 16
+#define BACKLOG_INDEX_HEADER_BYTES 28
+#define BACKLOG_INDEX_HEADER_SPACING 512     //one sector per header copy
+#define BACKLOG_INDEX_SLOTS_OFFSET 1024
+#define BACKLOG_INDEX_FILE_BYTES (BACKLOG_INDEX_SLOTS_OFFSET+(uint32_t)BACKLOG_INDEX_SLOTS*BACKLOG_INDEX_SLOT_BYTES)
+#define BACKLOG_INDEX_CHECKPOINT 32          //changes (slots written, HEAD moved) between checkpoints
+#define BACKLOG_INDEX_PATH_BYTES (SD_LOG_FOLDER_BYTES+1+sizeof(BACKLOG_INDEX_NAME))
+
+typedef struct {
+    FILE *file;
+    bool open;
+    uint32_t index_id;
+    uint32_t salt;
+    uint32_t generation; //of the last checkpoint
+
+    //sequence numbers: HEAD <= next <= TAIL
+    uint32_t head;       //oldest slot not acked
+    uint32_t next;       //next slot to take (backlog_index_take)
+    uint32_t tail;       //slot of the next record
+
+    uint16_t changes;    //since the last checkpoint
+    uint32_t recovered;  //slots found after the checkpoint by backlog_index_open
+    bool rebuilt;        //the index was made again from the log
+} backlog_index_t;
+
+
+/*Opens the index of "log" (the backlog, already open) in its folder, index_id is the INDEX_ID
+if the file is made again. False if the file can't be read or written*/
+bool backlog_index_open(backlog_index_t *index, sd_log_t *log, uint32_t index_id);
+
+/*Writes a checkpoint and closes the file*/
+void backlog_index_close(backlog_index_t *index);
+
+/*Writes the slot of the record that is going to be appended at "location"
+(sd_log_append_location), seq = its SEQ. False if the ring is full or the card failed, the
+record must not be appended then*/
+bool backlog_index_add(backlog_index_t *index, sd_log_location_t location, uint32_t *seq);
+
+/*Next pending slot not taken yet (oldest first), false if there is none or the card failed*/
+bool backlog_index_take(backlog_index_t *index, sd_log_location_t *location, uint32_t *seq);
+
+/*The record of slot "seq" was uploaded (or cancelled: the record wasn't appended, it isn't
+valid), HEAD moves over the acked slots. False if the card failed (the record is uploaded again)*/
+bool backlog_index_ack(backlog_index_t *index, uint32_t seq);
+
+/*The slots taken and not acked are taken again (their uploads were lost)*/
+void backlog_index_rewind(backlog_index_t *index);
+
+/*Slots not acked (taken or not)*/
+uint32_t backlog_index_pending(const backlog_index_t *index);
+
+/*True if there are slots not taken yet*/
+bool backlog_index_available(const backlog_index_t *index);
+
+/*Location of HEAD (the oldest record to keep), false if every slot is acked*/
+bool backlog_index_oldest(backlog_index_t *index, sd_log_location_t *location);
+
+#endif
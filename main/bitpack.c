@@ -0,0 +1,225 @@
+#include "bitpack.h"
+
+
+/*======================================================================
+ * BITPACK PACK
+ ======================================================================*/
+uint32_t bitpack_pack(const int32_t *samples, uint16_t count, uint8_t bits, uint8_t *packed){
+    uint32_t mask;
+    uint64_t accumulator=0;
+    uint8_t pending=0; //bits in the accumulator
+    uint8_t *output=packed;
+
+    if (bits==0 || bits>BITPACK_MAX_BITS){
+        return 0;
+    }
+    mask=0xFFFFFFFFu>>(32-bits);
+
+    for(uint16_t each_sample=0;each_sample<count;each_sample++){
+        accumulator=(accumulator<<bits)|((uint32_t)samples[each_sample]&mask);
+        pending+=bits;
+        //4 bytes at once when there are at least 32 bits (pending <= 31+32)
+        if (pending>=32){
+            pending-=32;
+            output[0]=(uint8_t)(accumulator>>(pending+24));
+            output[1]=(uint8_t)(accumulator>>(pending+16));
+            output[2]=(uint8_t)(accumulator>>(pending+8));
+            output[3]=(uint8_t)(accumulator>>pending);
+            output+=4;
+        }
+    }
+    //bits left, the last byte completed with 0
+    while(pending>=8){
+        pending-=8;
+        *output++=(uint8_t)(accumulator>>pending);
+    }
+    if (pending>0){
+        *output++=(uint8_t)(accumulator<<(8-pending));
+    }
+    return (uint32_t)(output-packed);
+}
+
+
+/*======================================================================
+ * BITPACK SCALAR UNPACK
+ ======================================================================*/
+/*sign = bit of the sign (sign extension) or 0 (unsigned values)*/
+static uint32_t unpack(const uint8_t *packed, uint16_t count, uint8_t bits, uint32_t sign, uint32_t *values){
+    uint32_t mask=0xFFFFFFFFu>>(32-bits);
+    uint32_t total=BITPACK_BYTES(count,bits);
+    uint32_t position=0; //bytes read
+    uint64_t accumulator=0;
+    uint8_t available=0; //bits in the accumulator
+    uint32_t value;
+
+    for(uint16_t each_sample=0;each_sample<count;each_sample++){
+        if (available<bits){
+            //4 bytes at once while they are in the block (available < 32, so it fits in 64 bits)
+            if (position+4<=total){
+                accumulator=(accumulator<<32)|((uint32_t)packed[position]<<24)|((uint32_t)packed[position+1]<<16)
+                    |((uint32_t)packed[position+2]<<8)|packed[position+3];
+                position+=4;
+                available+=32;
+            }
+            else{
+                while(available<bits){
+                    accumulator=(accumulator<<8)|packed[position++];
+                    available+=8;
+                }
+            }
+        }
+        available-=bits;
+        value=(uint32_t)(accumulator>>available)&mask;
+        values[each_sample]=(value^sign)-sign; //sign extension (nothing if sign = 0)
+    }
+    return total;
+}
+
+
+
+/*======================================================================
+ * BITPACK VECTOR UNPACK (x86-64 hosts)
+ *
+ * Groups of 8 samples (they start at a byte): the low half of the vector
+ * has the bytes of samples 0-3, the high half the ones of samples 4-7
+ * (from byte high_offset), the rest of the samples are unpacked by unpack.
+ ======================================================================*/
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BITPACK_X86 1
+#include <immintrin.h>
+
+typedef struct {
+    uint8_t shuffle[32];  //bytes of every sample, big endian to the lane
+    uint32_t shift[8];    //first bit of every sample in its 4 bytes
+    uint32_t multiply[8]; //1 << shift
+    uint32_t high_offset; //first byte of sample 4
+} group_t;
+
+static void group_init(group_t *group, uint8_t bits){
+    uint32_t offset, byte;
+
+    group->high_offset=(4u*bits)>>3;
+    for(uint8_t each_sample=0;each_sample<8;each_sample++){
+        offset=(uint32_t)each_sample*bits;
+        byte=(offset>>3)-((each_sample<4)?0:group->high_offset);
+        for(uint8_t each_byte=0;each_byte<4;each_byte++){
+            group->shuffle[4*each_sample+each_byte]=(uint8_t)(byte+3-each_byte);
+        }
+        group->shift[each_sample]=offset&7;
+        group->multiply[each_sample]=1u<<(offset&7);
+    }
+}
+
+__attribute__((target("sse4.1")))
+static uint32_t unpack_sse41(const uint8_t *packed, uint16_t count, uint8_t bits, uint32_t sign, uint32_t *values){
+    uint32_t total=BITPACK_BYTES(count,bits), position=0;
+    uint16_t each_sample=0;
+    group_t group;
+
+    if (bits<=BITPACK_VECTOR_MAX_BITS){
+        group_init(&group,bits);
+        const __m128i shuffle_low=_mm_loadu_si128((const __m128i *)&group.shuffle[0]);
+        const __m128i shuffle_high=_mm_loadu_si128((const __m128i *)&group.shuffle[16]);
+        const __m128i multiply_low=_mm_loadu_si128((const __m128i *)&group.multiply[0]);
+        const __m128i multiply_high=_mm_loadu_si128((const __m128i *)&group.multiply[4]);
+        const __m128i right=_mm_cvtsi32_si128(32-bits);
+        __m128i low, high;
+
+        //16 bytes of each half are read, they must be in the block
+        for(;each_sample+8<=count && position+group.high_offset+16<=total;each_sample+=8,position+=bits){
+            low=_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&packed[position]),shuffle_low);
+            high=_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&packed[position+group.high_offset]),shuffle_high);
+            low=_mm_mullo_epi32(low,multiply_low);
+            high=_mm_mullo_epi32(high,multiply_high);
+            low=(sign!=0)?_mm_sra_epi32(low,right):_mm_srl_epi32(low,right);
+            high=(sign!=0)?_mm_sra_epi32(high,right):_mm_srl_epi32(high,right);
+            _mm_storeu_si128((__m128i *)&values[each_sample],low);
+            _mm_storeu_si128((__m128i *)&values[each_sample+4],high);
+        }
+    }
+    unpack(&packed[position],count-each_sample,bits,sign,&values[each_sample]);
+    return total;
+}
+
+__attribute__((target("avx2")))
+static uint32_t unpack_avx2(const uint8_t *packed, uint16_t count, uint8_t bits, uint32_t sign, uint32_t *values){
+    uint32_t total=BITPACK_BYTES(count,bits), position=0;
+    uint16_t each_sample=0;
+    group_t group;
+
+    if (bits<=BITPACK_VECTOR_MAX_BITS){
+        group_init(&group,bits);
+        const __m256i shuffle=_mm256_loadu_si256((const __m256i *)group.shuffle);
+        const __m256i shift=_mm256_loadu_si256((const __m256i *)group.shift);
+        const __m128i right=_mm_cvtsi32_si128(32-bits);
+        __m256i vector;
+
+        for(;each_sample+8<=count && position+group.high_offset+16<=total;each_sample+=8,position+=bits){
+            vector=_mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)&packed[position])),
+                _mm_loadu_si128((const __m128i *)&packed[position+group.high_offset]),1);
+            vector=_mm256_sllv_epi32(_mm256_shuffle_epi8(vector,shuffle),shift);
+            vector=(sign!=0)?_mm256_sra_epi32(vector,right):_mm256_srl_epi32(vector,right);
+            _mm256_storeu_si256((__m256i *)&values[each_sample],vector);
+        }
+        _mm256_zeroupper(); //unpack isn't AVX (no transition penalty)
+    }
+    unpack(&packed[position],count-each_sample,bits,sign,&values[each_sample]);
+    return total;
+}
+#endif
+
+typedef uint32_t (*unpack_t)(const uint8_t *packed, uint16_t count, uint8_t bits, uint32_t sign, uint32_t *values);
+
+static const unpack_t unpackers[]={
+    unpack,
+#ifdef BITPACK_X86
+    unpack_sse41,
+    unpack_avx2,
+#endif
+};
+
+uint8_t bitpack_unpacker(void){
+#ifdef BITPACK_X86
+    static int8_t best=-1; //checked once
+
+    if (best<0){
+        __builtin_cpu_init();
+        best=__builtin_cpu_supports("avx2")?BITPACK_UNPACKER_AVX2:
+            __builtin_cpu_supports("sse4.1")?BITPACK_UNPACKER_SSE41:BITPACK_UNPACKER_SCALAR;
+    }
+    return (uint8_t)best;
+#else
+    return BITPACK_UNPACKER_SCALAR;
+#endif
+}
+
+const char *bitpack_unpacker_name(uint8_t unpacker){
+    static const char *names[]={"scalar","SSE4.1","AVX2"};
+
+    return (unpacker<sizeof(names)/sizeof(names[0]))?names[unpacker]:"?";
+}
+
+
+/*======================================================================
+ * BITPACK UNPACK
+ ======================================================================*/
+uint32_t bitpack_unpack(const uint8_t *packed, uint16_t count, uint8_t bits, int32_t *samples){
+    if (bits==0 || bits>BITPACK_MAX_BITS){
+        return 0;
+    }
+    return unpackers[bitpack_unpacker()](packed,count,bits,1u<<(bits-1),(uint32_t *)samples);
+}
+
+uint32_t bitpack_unpack_unsigned(const uint8_t *packed, uint16_t count, uint8_t bits, uint32_t *values){
+    if (bits==0 || bits>BITPACK_MAX_BITS){
+        return 0;
+    }
+    return unpackers[bitpack_unpacker()](packed,count,bits,0,values);
+}
+
+uint32_t bitpack_unpack_with(uint8_t unpacker, const uint8_t *packed, uint16_t count, uint8_t bits, int32_t *samples){
+    if (bits==0 || bits>BITPACK_MAX_BITS || unpacker>bitpack_unpacker()){
+        return 0;
+    }
+    return unpackers[unpacker](packed,count,bits,1u<<(bits-1),(uint32_t *)samples);
+}
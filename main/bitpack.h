@@ -0,0 +1,63 @@
+#ifndef _BITPACK_H_
+#define _BITPACK_H_
+
+/*
+Bit packing of samples at their real resolution
+
+The ADXL355 has 20 bit samples (left justified in 3 bytes, bits 3-0 always 0) and the
+MMA8451Q 14 bit samples (left justified in 2 bytes, bits 1-0 always 0), so the raw
+packet sends 4 and 2 bits per sample that are always 0. Here every sample uses only
+"bits" bits, one after the other without padding, most significant bit first:
+
+    bits = 20:  | s0 (20) | s1 (20) | s2 (20) | ...      2 samples = 5 bytes
+    bits = 14:  | s0 (14) | s1 (14) | s2 (14) | ...      4 samples = 7 bytes
+
+The last byte is completed with 0. The samples are the values already shifted to the
+right (sign extended int32, for example -524288..524287 for 20 bits).
+
+Both directions use a 64 bit accumulator, whole bytes are written/read at once (no
+loop per bit), it's the same code for every width from 1 to 32 bits.
+
+On x86-64 hosts (the server side) the unpack also has vector versions for widths up to
+BITPACK_VECTOR_MAX_BITS: 8 samples are 8*bits bits, so every group of 8 starts at a byte.
+One byte shuffle puts the 4 bytes of every sample in its lane, a left shift (its first bit)
+and a right shift of 32-bits (arithmetic for the sign extension) give the value. SSE4.1
+shifts left with a multiply, AVX2 with a variable shift. The best one of the CPU is checked
+once at runtime, the scalar code does the rest of the samples and is the only one of the ESP32.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+
+#define BITPACK_MAX_BITS 32
+#define BITPACK_BYTES(count, bits) (((uint32_t)(count)*(bits)+7)/8) //bytes of "count" samples
+
+/*Packs the "bits" least significant bits of every sample. Returns the bytes written
+(BITPACK_BYTES) or 0 if bits isn't 1..BITPACK_MAX_BITS*/
+uint32_t bitpack_pack(const int32_t *samples, uint16_t count, uint8_t bits, uint8_t *packed);
+
+/*Unpacks "count" samples of "bits" bits into sign extended int32. Returns the bytes 
+read or 0 if bits isn't 1..BITPACK_MAX_BITS*/
+uint32_t bitpack_unpack(const uint8_t *packed, uint16_t count, uint8_t bits, int32_t *samples);
+
+/*Same as bitpack_unpack without sign extension (unsigned values, for example zigzag)*/
+uint32_t bitpack_unpack_unsigned(const uint8_t *packed, uint16_t count, uint8_t bits, uint32_t *values);
+
+//Unpackers of bitpack_unpack and bitpack_unpack_unsigned
+#define BITPACK_UNPACKER_SCALAR 0
+#define BITPACK_UNPACKER_SSE41 1 //x86-64 hosts with SSE4.1
+#define BITPACK_UNPACKER_AVX2 2  //x86-64 hosts with AVX2
+#define BITPACK_VECTOR_MAX_BITS 25 //a sample and its first bit (0-7) fit in 4 bytes
+
+/*Best unpacker of this CPU, the one used by bitpack_unpack*/
+uint8_t bitpack_unpacker(void);
+
+/*Name of an unpacker ("scalar", "SSE4.1", "AVX2")*/
+const char *bitpack_unpacker_name(uint8_t unpacker);
+
+/*Same as bitpack_unpack with one unpacker (tests and benchmarks), 0 if this CPU doesn't
+have it (unpacker > bitpack_unpacker())*/
+uint32_t bitpack_unpack_with(uint8_t unpacker, const uint8_t *packed, uint16_t count, uint8_t bits, int32_t *samples);
+
+#endif
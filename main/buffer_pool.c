@@ -0,0 +1,205 @@
+#include "buffer_pool.h"
+
+#define BUFFER_POOL_ABANDONED (1u<<31) //flag in "sinks": a sink abandoned the packet
+
+
+static buffer_pool_slot_t *slot_of(buffer_pool_t *pool, const char *buffer){
+    int16_t index=buffer_pool_index(pool,buffer);
+    return (index<0)?NULL:&pool->slots[index];
+}
+
+static uint8_t sink_count(uint32_t sinks){
+    uint8_t count=0;
+    for(;sinks!=0;sinks&=sinks-1){
+        count++;
+    }
+    return count;
+}
+
+
+/*======================================================================
+ * BUFFER POOL INIT / ADD
+ ======================================================================*/
+void buffer_pool_init(buffer_pool_t *pool, uint32_t size){
+    pool->count=0;
+    pool->tier_count[BUFFER_TIER_HOT]=0;
+    pool->tier_count[BUFFER_TIER_COLD]=0;
+    pool->size=size;
+    for(uint16_t i=0;i<BUFFER_POOL_MAX;i++){
+        pool->slots[i].data=NULL;
+        pool->slots[i].tier=BUFFER_TIER_HOT;
+        atomic_init(&pool->slots[i].sinks,0);
+        atomic_init(&pool->slots[i].references,0);
+    }
+}
+
+uint16_t buffer_pool_add(buffer_pool_t *pool, uint16_t count, uint8_t tier, buffer_pool_alloc_t allocate){
+    uint16_t added=0;
+
+    if (tier!=BUFFER_TIER_HOT && tier!=BUFFER_TIER_COLD){
+        return 0;
+    }
+    while(added<count && pool->count<BUFFER_POOL_MAX){
+        char *data=(char *)allocate(pool->size);
+        if (data==NULL){
+            break;
+        }
+        pool->slots[pool->count].data=data;
+        pool->slots[pool->count].tier=tier;
+        pool->count++;
+        pool->tier_count[tier]++;
+        added++;
+    }
+    return added;
+}
+
+char *buffer_pool_get(buffer_pool_t *pool, uint16_t index){
+    return (index<pool->count)?pool->slots[index].data:NULL;
+}
+
+int16_t buffer_pool_index(const buffer_pool_t *pool, const char *buffer){
+    for(uint16_t i=0;i<pool->count;i++){
+        if (pool->slots[i].data==buffer){
+            return (int16_t)i;
+        }
+    }
+    return -1;
+}
+
+uint8_t buffer_pool_tier(const buffer_pool_t *pool, const char *buffer){
+    int16_t index=buffer_pool_index(pool,buffer);
+    return (index<0)?BUFFER_TIER_HOT:pool->slots[index].tier;
+}
+
+
+/*======================================================================
+ * BUFFER POOL HOLD
+ *
+ * The bits are set with a compare and swap (all or nothing), the
+ * references are added before the bits are visible so a sink that
+ * releases its bit right away never sees the count at 0.
+ ======================================================================*/
+bool buffer_pool_hold(buffer_pool_t *pool, const char *buffer, uint32_t sinks){
+    buffer_pool_slot_t *slot=slot_of(pool,buffer);
+    uint32_t pending;
+
+    if (slot==NULL || sinks==0 || (sinks & ~BUFFER_SINK_ALL)!=0){
+        return false;
+    }
+    atomic_fetch_add_explicit(&slot->references,sink_count(sinks),memory_order_relaxed);
+
+    pending=atomic_load_explicit(&slot->sinks,memory_order_relaxed);
+    do{
+        if ((pending & sinks)!=0){
+            atomic_fetch_sub_explicit(&slot->references,sink_count(sinks),memory_order_relaxed);
+            return false;
+        }
+    }while(!atomic_compare_exchange_weak_explicit(&slot->sinks,&pending,pending|sinks,memory_order_release,memory_order_relaxed));
+    return true;
+}
+
+
+/*======================================================================
+ * BUFFER POOL RELEASE / ABANDON
+ *
+ * acq_rel on the last reference: every read of the other sinks happens
+ * before the buffer is reused.
+ ======================================================================*/
+static int8_t release(buffer_pool_t *pool, const char *buffer, uint32_t sink, bool abandoned){
+    buffer_pool_slot_t *slot=slot_of(pool,buffer);
+    uint32_t previous;
+
+    if (slot==NULL || sink==0 || (sink & ~BUFFER_SINK_ALL)!=0 || (sink & (sink-1))!=0){
+        return BUFFER_POOL_ERROR;
+    }
+    previous=atomic_load_explicit(&slot->sinks,memory_order_relaxed);
+    do{
+        if ((previous & sink)==0){
+            return BUFFER_POOL_ERROR;
+        }
+    }while(!atomic_compare_exchange_weak_explicit(&slot->sinks,&previous,(previous & ~sink)|(abandoned?BUFFER_POOL_ABANDONED:0),
+        memory_order_acq_rel,memory_order_relaxed));
+    if (atomic_fetch_sub_explicit(&slot->references,1,memory_order_acq_rel)!=1){
+        return BUFFER_POOL_HELD;
+    }
+
+    //last reference, nobody else can touch the slot until the buffer is selected again
+    previous=atomic_fetch_and_explicit(&slot->sinks,~BUFFER_POOL_ABANDONED,memory_order_acquire);
+    return (previous & BUFFER_POOL_ABANDONED)?BUFFER_POOL_REDELIVER:BUFFER_POOL_FREE;
+}
+
+int8_t buffer_pool_release(buffer_pool_t *pool, const char *buffer, uint32_t sink){
+    return release(pool,buffer,sink,false);
+}
+
+int8_t buffer_pool_abandon(buffer_pool_t *pool, const char *buffer, uint32_t sink){
+    return release(pool,buffer,sink,true);
+}
+
+uint32_t buffer_pool_pending(buffer_pool_t *pool, const char *buffer){
+    buffer_pool_slot_t *slot=slot_of(pool,buffer);
+    return (slot==NULL)?0:(atomic_load_explicit(&slot->sinks,memory_order_acquire) & BUFFER_SINK_ALL);
+}
+
+
+/*======================================================================
+ * COLD TIER SIZE
+ *
+ * Every buffer costs size + BUFFER_POOL_ALLOC_OVERHEAD bytes of the
+ * heap, a buffer bigger than the largest free block can't be allocated.
+ ======================================================================*/
+uint16_t buffer_pool_cold_count(size_t free_bytes, size_t largest_block, size_t reserve, uint32_t size, uint16_t max){
+    size_t count;
+
+    if (size==0 || largest_block<size || free_bytes<=reserve){
+        return 0;
+    }
+    count=(free_bytes-reserve)/((size_t)size+BUFFER_POOL_ALLOC_OVERHEAD);
+    return (count<max)?(uint16_t)count:max;
+}
+
+
+/*======================================================================
+ * ROUTE OF A FULL PACKET
+ *
+ * Only one sink takes the packet now (WiFi, or the SD backlog if WiFi
+ * is lost). A hot packet never waits behind a busy sink if a cold buffer
+ * can keep it: the sensors need the hot buffers back. Cold packets go
+ * out only when their sink isn't busy, so the hot packets go first.
+ ======================================================================*/
+uint8_t buffer_pool_route(const buffer_route_state_t *state, uint32_t *sinks){
+    uint32_t target=0;
+    bool busy=false;
+
+    *sinks=0;
+    if (state->wifi){
+        target=BUFFER_SINK_WIFI;
+        busy=(state->wifi_waiting>=state->busy_waiting);
+        if (state->sd && state->archive && state->sensor_data){
+            target|=BUFFER_SINK_SD_ARCHIVE;
+        }
+    }
+    else if (state->sd){
+        target=BUFFER_SINK_SD_BACKLOG;
+        busy=(state->sd_waiting>=state->busy_waiting);
+    }
+
+    if (target!=0 && !busy){
+        *sinks=target;
+        return BUFFER_ROUTE_SINKS;
+    }
+    if (state->cold){
+        return BUFFER_ROUTE_KEEP;
+    }
+    if (state->cold_free!=0){
+        return BUFFER_ROUTE_COLD;
+    }
+    if (target!=0){
+        *sinks=target; //no cold buffer, waits in the sink queue
+        return BUFFER_ROUTE_SINKS;
+    }
+    if (state->cold_used!=0){
+        return BUFFER_ROUTE_RECYCLE;
+    }
+    return BUFFER_ROUTE_DROP;
+}
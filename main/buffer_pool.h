@@ -0,0 +1,141 @@
+#ifndef _BUFFER_POOL_H_
+#define _BUFFER_POOL_H_
+
+/*
+Pool of packet buffers shared by several sinks (WiFi upload, SD archive, SD backlog)
+
+Every buffer has a bitmap of the sinks that still have to use it and a reference count
+(one per sink). One full buffer can be in queue_to_send_wifi and queue_to_save_in_sd at
+the same time, it goes back to queue_empty_buffers only when the last sink releases it:
+
+    selection task:  buffer_pool_hold(pool,buffer,SINK_A|SINK_B)  -> references = 2
+                     send the pointer to the queue of SINK_A and SINK_B
+    sink A task:     buffer_pool_release(pool,buffer,SINK_A)       -> BUFFER_POOL_HELD
+    sink B task:     buffer_pool_release(pool,buffer,SINK_B)       -> BUFFER_POOL_FREE (to the empty queue)
+
+A sink that can't deliver the packet (WiFi or SD lost) uses buffer_pool_abandon(), then the
+last release returns BUFFER_POOL_REDELIVER and the buffer goes back to the full buffers queue
+(the packet is selected again) instead of the empty queue.
+
+The buffers have a tier: HOT buffers (internal RAM) are filled by the sensors and sent right
+away, COLD buffers (PSRAM, optional) keep the backlog of a long WiFi outage (or a slow SD
+card) so the hot buffers are free again. buffer_pool_cold_count() sizes the cold tier from
+the free PSRAM and buffer_pool_route() decides where every full packet goes:
+
+    WiFi connected         -> WiFi (+ SD archive copy of sensor packets)
+    WiFi lost, SD mounted  -> SD backlog
+    sink busy or no sink   -> hot packet: copied to a cold buffer (COLD), the oldest cold packet
+                              is replaced if the cold tier is full and there is no sink (RECYCLE)
+                              cold packet: stays in the cold backlog (KEEP)
+    no cold tier           -> the sink queue anyway (waits), or lost if there is no sink (DROP)
+
+Rules:
+    - Sinks are only added (hold) by a task that owns the buffer: the selection task before
+      sending it to any queue, or a sink that still holds its own reference.
+    - Every sink bit is released once per hold, the sinks only read the buffer.
+    - Hold, release and abandon are lock-free (C11 atomics), any task or core.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define BUFFER_POOL_MAX 512 //maximum number of buffers (hot + cold), short packets give many cold buffers
+#define BUFFER_POOL_ALLOC_OVERHEAD 16 //bytes of the heap per allocated buffer (cold tier sizing)
+
+//Tiers
+#define BUFFER_TIER_HOT 0  //internal RAM, filled by the sensors
+#define BUFFER_TIER_COLD 1 //PSRAM, backlog of packets waiting for a sink
+
+//Sinks (one bit each)
+#define BUFFER_SINK_WIFI (1u<<0)       //upload to the server (send_buffer_wifi_task)
+#define BUFFER_SINK_SD_ARCHIVE (1u<<1) //copy of an uploaded packet (send_buffer_to_SD_task, ARCHIVE_FOLDER)
+#define BUFFER_SINK_SD_BACKLOG (1u<<2) //packet to upload later (send_buffer_to_SD_task, FOLDER)
+#define BUFFER_SINK_ALL (BUFFER_SINK_WIFI|BUFFER_SINK_SD_ARCHIVE|BUFFER_SINK_SD_BACKLOG)
+
+//Routes of buffer_pool_route
+#define BUFFER_ROUTE_SINKS 0   //hold the sinks and send the buffer to their queues
+#define BUFFER_ROUTE_COLD 1    //copy the packet to a free cold buffer (the hot one is empty again)
+#define BUFFER_ROUTE_RECYCLE 2 //copy the packet to the oldest cold buffer (its packet is lost)
+#define BUFFER_ROUTE_KEEP 3    //cold packet: back to the cold backlog, it's tried again later
+#define BUFFER_ROUTE_DROP 4    //hot packet without sink nor cold buffer: lost
+
+//Results of buffer_pool_release and buffer_pool_abandon
+#define BUFFER_POOL_ERROR -1    //unknown buffer or the sink didn't hold it
+#define BUFFER_POOL_HELD 0      //other sinks still use the buffer
+#define BUFFER_POOL_FREE 1      //last reference, the buffer is empty
+#define BUFFER_POOL_REDELIVER 2 //last reference but a sink abandoned the packet, select it again
+
+typedef void *(*buffer_pool_alloc_t)(size_t size);
+
+typedef struct {
+    char *data;             //size bytes (allocated by buffer_pool_add)
+    uint8_t tier;           //BUFFER_TIER_xxx
+    atomic_uint sinks;      //pending sinks (BUFFER_SINK_xxx) + abandoned flag
+    atomic_uint references; //number of pending sinks
+} buffer_pool_slot_t;
+
+typedef struct {
+    buffer_pool_slot_t slots[BUFFER_POOL_MAX];
+    uint16_t count;         //allocated buffers
+    uint16_t tier_count[2]; //allocated buffers per tier
+    uint32_t size;          //bytes per buffer
+} buffer_pool_t;
+
+//State seen by the selection task for one full packet (buffer_pool_route)
+typedef struct {
+    bool wifi;              //WiFi connected
+    bool sd;                //SD mounted
+    bool archive;           //SD archive copy of the packets uploaded (sensor data only)
+    bool sensor_data;       //the packet was filled with sensor data (not read from SD)
+    bool cold;              //the packet is in a cold buffer
+    uint8_t wifi_waiting;   //messages waiting in the WiFi queue
+    uint8_t sd_waiting;     //messages waiting in the SD queue
+    uint8_t busy_waiting;   //a sink with this number of messages waiting is busy
+    uint16_t cold_free;     //free cold buffers
+    uint16_t cold_used;     //cold buffers in the backlog
+} buffer_route_state_t;
+
+
+/*Empty pool of "size" bytes buffers*/
+void buffer_pool_init(buffer_pool_t *pool, uint32_t size);
+
+/*Allocates "count" buffers of the tier with "allocate", returns the buffers added (less than
+count if the memory ran out or the pool has BUFFER_POOL_MAX buffers)*/
+uint16_t buffer_pool_add(buffer_pool_t *pool, uint16_t count, uint8_t tier, buffer_pool_alloc_t allocate);
+
+/*Buffer "index" (NULL if it wasn't allocated), the buffers of a tier have consecutive indexes*/
+char *buffer_pool_get(buffer_pool_t *pool, uint16_t index);
+
+/*Index of the buffer, -1 if it isn't from the pool*/
+int16_t buffer_pool_index(const buffer_pool_t *pool, const char *buffer);
+
+/*Tier of the buffer (BUFFER_TIER_HOT if it isn't from the pool)*/
+uint8_t buffer_pool_tier(const buffer_pool_t *pool, const char *buffer);
+
+/*Cold buffers of "size" bytes that fit in free_bytes (largest_block: biggest free block) 
+leaving "reserve" bytes for the rest of the firmware, at most "max"*/
+uint16_t buffer_pool_cold_count(size_t free_bytes, size_t largest_block, size_t reserve, uint32_t size, uint16_t max);
+
+/*Where a full packet goes (BUFFER_ROUTE_xxx), *sinks = sinks to hold with BUFFER_ROUTE_SINKS*/
+uint8_t buffer_pool_route(const buffer_route_state_t *state, uint32_t *sinks);
+
+/*Adds the sinks to the buffer (one reference each), returns false if any of them is
+already pending or the buffer isn't from the pool (then nothing is added)*/
+bool buffer_pool_hold(buffer_pool_t *pool, const char *buffer, uint32_t sinks);
+
+/*The sink is done with the buffer, returns BUFFER_POOL_FREE or BUFFER_POOL_REDELIVER if
+it was the last reference, BUFFER_POOL_HELD or BUFFER_POOL_ERROR*/
+int8_t buffer_pool_release(buffer_pool_t *pool, const char *buffer, uint32_t sink);
+
+/*Same as buffer_pool_release but the packet wasn't delivered by the sink, the last
+release returns BUFFER_POOL_REDELIVER*/
+int8_t buffer_pool_abandon(buffer_pool_t *pool, const char *buffer, uint32_t sink);
+
+/*Pending sinks of the buffer (0 if it isn't from the pool)*/
+uint32_t buffer_pool_pending(buffer_pool_t *pool, const char *buffer);
+
+#endif
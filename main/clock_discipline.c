@@ -0,0 +1,141 @@
+#include "clock_discipline.h"
+
+//weight of every new |PHASE| in offset_mean (1/16)
+#define OFFSET_FILTER_SHIFT 4
+
+
+static int64_t clamp(int64_t value, int64_t limit){
+    if (value>limit) return limit;
+    if (value<-limit) return -limit;
+    return value;
+}
+
+//EDGE - nearest tick, between -period/2 and +period/2
+static int32_t phase_of(const clock_discipline_t *clock, uint64_t edge, uint64_t last_tick){
+    int64_t phase=(int64_t)(edge-last_tick)%(int64_t)clock->period;
+
+    if (phase<0){
+        phase+=clock->period;
+    }
+    if (phase>(int64_t)(clock->period/2)){
+        phase-=clock->period;
+    }
+    return (int32_t)phase;
+}
+
+
+/*======================================================================
+ * CLOCK DISCIPLINE INIT
+ ======================================================================*/
+void clock_discipline_init(clock_discipline_t *clock, uint32_t period, uint16_t rate, uint32_t counts_per_second){
+    clock->period=period;
+    clock->rate=rate;
+    clock->counts_per_second=counts_per_second;
+    clock->limit=(int64_t)counts_per_second*CLOCK_DISCIPLINE_MAX_PPM/1000000;
+
+    clock->last_edge=0;
+    clock->started=false;
+    clock->frequency_known=false;
+
+    clock->frequency=0;
+    clock->trim=0;
+
+    clock->offset=0;
+    clock->offset_mean=0;
+    clock->locked=false;
+    clock->locked_edges=0;
+
+    clock->edges=0;
+    clock->rejected=0;
+    clock->rejected_in_row=0;
+}
+
+
+/*======================================================================
+ * CLOCK DISCIPLINE EDGE
+ *
+ * One update per RTC second. The error of one second between edges is
+ * only used to start FREQUENCY (the phase has the same information
+ * without the jitter of two edges), then the PI loop follows the phase.
+ ======================================================================*/
+int32_t clock_discipline_edge(clock_discipline_t *clock, uint64_t edge, uint64_t last_tick){
+    uint64_t seconds;
+    int64_t second_error;
+    int64_t phase;
+    int64_t correction;
+    int64_t limit=clock->limit*CLOCK_DISCIPLINE_ONE;
+
+    if (!clock->started){
+        clock->last_edge=edge;
+        clock->started=true;
+        return clock->trim;
+    }
+
+    /*whole RTC seconds since the last edge (more than one if edges were lost), more than MAX_PPM 
+    away from them: noise in the SQW line. The last good edge is kept, but two bad edges in a 
+    row (the timer was stopped or restarted) start the measurement again*/
+    seconds=((edge-clock->last_edge)+clock->counts_per_second/2)/clock->counts_per_second;
+    second_error=(int64_t)(edge-clock->last_edge)-(int64_t)seconds*clock->counts_per_second;
+    if (seconds==0 || second_error>clock->limit*(int64_t)seconds || second_error<-clock->limit*(int64_t)seconds){
+        clock->rejected++;
+        if (++clock->rejected_in_row>=2){
+            clock->last_edge=edge;
+        }
+        return clock->trim;
+    }
+    clock->last_edge=edge;
+    clock->rejected_in_row=0;
+
+    //counts of one RTC second - counts of RATE nominal periods
+    if (!clock->frequency_known){
+        second_error=second_error/(int64_t)seconds+(int64_t)clock->counts_per_second-(int64_t)clock->rate*clock->period;
+        clock->frequency=clamp(second_error*CLOCK_DISCIPLINE_ONE,limit);
+        clock->frequency_known=true;
+    }
+
+    phase=phase_of(clock,edge,last_tick);
+    clock->offset=(int32_t)phase;
+    clock->offset_mean=clock->offset_mean-(clock->offset_mean>>OFFSET_FILTER_SHIFT)+(uint32_t)(phase<0?-phase:phase);
+    clock->edges++;
+
+    //PI loop (Q16 counts per second)
+    clock->frequency=clamp(clock->frequency+phase*CLOCK_DISCIPLINE_ONE/(1<<CLOCK_DISCIPLINE_KI_SHIFT),limit);
+    correction=clamp(clock->frequency+phase*CLOCK_DISCIPLINE_ONE/(1<<CLOCK_DISCIPLINE_KP_SHIFT),limit);
+    clock->trim=(int32_t)(correction/clock->rate);
+
+    if (phase<=CLOCK_DISCIPLINE_LOCK_COUNTS && phase>=-CLOCK_DISCIPLINE_LOCK_COUNTS){
+        if (clock->locked_edges<CLOCK_DISCIPLINE_LOCK_EDGES){
+            clock->locked_edges++;
+        }
+        clock->locked=(clock->locked_edges>=CLOCK_DISCIPLINE_LOCK_EDGES);
+    }
+    else{
+        clock->locked_edges=0;
+        clock->locked=false;
+    }
+    return clock->trim;
+}
+
+
+/*======================================================================
+ * CLOCK DISCIPLINE LOST
+ *
+ * Holdover: TRIM keeps the last frequency of the timer, the next edge
+ * starts the measurement again (the phase is pulled in from there).
+ ======================================================================*/
+void clock_discipline_lost(clock_discipline_t *clock){
+    clock->started=false;
+    clock->locked=false;
+    clock->locked_edges=0;
+    clock->rejected_in_row=0;
+}
+
+
+/*======================================================================
+ * CLOCK DISCIPLINE PPB
+ ======================================================================*/
+int32_t clock_discipline_ppb(const clock_discipline_t *clock){
+    int64_t counts_per_second=(int64_t)clock->trim*clock->rate; //Q16
+
+    return (int32_t)(counts_per_second*1000000000LL/clock->counts_per_second/CLOCK_DISCIPLINE_ONE);
+}
@@ -0,0 +1,82 @@
+#ifndef _CLOCK_DISCIPLINE_H_
+#define _CLOCK_DISCIPLINE_H_
+
+/*
+Sample clock discipline with the 1 Hz square wave of the DS3231 (INT/SQW pin)
+
+The sample timer (timer_conf.h) counts the APB clock, its crystal has tens of ppm of error
+and it changes with the temperature; the DS3231 (TCXO) has +-2 ppm. The falling edge of SQW
+is the start of every RTC second: the GPIO ISR latches the timer counter (EDGE) and the
+alarm value of the last sample tick (TICK), and this servo trims the timer period so one
+sample tick falls on every edge (RATE ticks per RTC second, phase locked):
+
+    PHASE     = EDGE - nearest tick (timer counts, + = the ticks come before the edge)
+    FREQUENCY = FREQUENCY + PHASE/2^CLOCK_DISCIPLINE_KI_SHIFT    (integral, counts per second)
+    TRIM      = (FREQUENCY + PHASE/2^CLOCK_DISCIPLINE_KP_SHIFT) / RATE   (counts per tick, Q16)
+
+and the timer adds TRIM/65536 counts to every period (timer_set_trim). With KI = 2*KP + 2
+the loop is critically damped (double root 1 - 2^-(KP+1)), KP = 3 removes a phase error
+with a time constant of ~15 s. FREQUENCY starts with the first measurement (counts between
+two edges - RATE*period), so only the phase has to be pulled in. TRIM and FREQUENCY are
+limited to CLOCK_DISCIPLINE_MAX_PPM, edges further than that from a whole number of seconds
+(noise in the SQW line, the timer not started yet) are discarded, a lost edge only makes
+the measurement two seconds long. Without edges the last TRIM is kept (holdover).
+
+The residual OFFSET (PHASE of the last edge) and its mean tell the timing quality: the
+samples are OFFSET counts away from the RTC second (plus the DS3231 error).
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CLOCK_DISCIPLINE_TRIM_SHIFT 16 //TRIM in 1/65536 timer counts per tick
+#define CLOCK_DISCIPLINE_ONE (1<<CLOCK_DISCIPLINE_TRIM_SHIFT) //one timer count in Q16
+#define CLOCK_DISCIPLINE_KP_SHIFT 3    //proportional gain 1/8 (per second)
+#define CLOCK_DISCIPLINE_KI_SHIFT 8    //integral gain 1/256 (2*KP+2, critically damped)
+#define CLOCK_DISCIPLINE_MAX_PPM 500   //maximum trim and maximum error of one second between edges
+#define CLOCK_DISCIPLINE_LOCK_COUNTS 20 //|OFFSET| of a locked clock (timer counts)
+#define CLOCK_DISCIPLINE_LOCK_EDGES 8  //edges in a row within LOCK_COUNTS to be locked
+
+typedef struct {
+    uint32_t period;             //nominal timer counts per tick (timer_get_period)
+    uint16_t rate;               //ticks per RTC second
+    uint32_t counts_per_second;  //nominal timer counts per second (TIMER_SCALE)
+    int64_t limit;               //CLOCK_DISCIPLINE_MAX_PPM in counts per second
+
+    uint64_t last_edge;          //EDGE of the last edge (timer counts)
+    bool started;                //false until the first edge
+    bool frequency_known;        //false until the first measurement between two edges
+
+    int64_t frequency;           //integral (Q16 counts per second)
+    int32_t trim;                //output, Q16 counts per tick (timer_set_trim)
+
+    int32_t offset;              //PHASE of the last edge (timer counts), residual offset
+    uint32_t offset_mean;        //mean of |PHASE| (1/16 counts, 1/16 of every new edge)
+    bool locked;                 //LOCK_EDGES edges in a row within LOCK_COUNTS
+    uint8_t locked_edges;        //edges in a row within LOCK_COUNTS
+
+    uint32_t edges;              //edges used
+    uint32_t rejected;           //edges discarded
+    uint8_t rejected_in_row;     //edges discarded since the last good one
+} clock_discipline_t;
+
+
+/*Prepares the servo (TRIM = 0), period = nominal timer counts per tick, rate = ticks per
+second, counts_per_second = timer counts of one second*/
+void clock_discipline_init(clock_discipline_t *clock, uint32_t period, uint16_t rate, uint32_t counts_per_second);
+
+/*One SQW edge: edge = timer counter at the edge, last_tick = alarm value of the last tick
+(it can be a tick before or after the edge). Returns the new TRIM (Q16 counts per tick)*/
+int32_t clock_discipline_edge(clock_discipline_t *clock, uint64_t edge, uint64_t last_tick);
+
+/*No edges for some seconds (SQW disconnected, DS3231 without power): not locked, TRIM is kept
+(holdover with the last frequency), the next edge starts again*/
+void clock_discipline_lost(clock_discipline_t *clock);
+
+/*Frequency error of the sample timer corrected by TRIM, in parts per billion (+ = the timer
+is fast, the periods are longer)*/
+int32_t clock_discipline_ppb(const clock_discipline_t *clock);
+
+#endif
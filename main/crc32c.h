@@ -0,0 +1,19 @@
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+/*
+CRC-32C (Castagnoli, reflected polynomial 0x82F63B78), the CRC of the miniSEED 3 
+records (mseed.h) and of the packet header (packet_header.h).
+
+One table of 256 values (1 KB of flash), one lookup per byte. The CRC can be computed
+in parts: crc32c(crc32c(0,a,n),b,m) = CRC of a followed by b.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+
+/*CRC-32C of "length" bytes, crc = 0 the first time (or the CRC of the previous bytes)*/
+uint32_t crc32c(uint32_t crc, const uint8_t *data, uint32_t length);
+
+#endif
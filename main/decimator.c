@@ -0,0 +1,173 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "decimator.h"
+
+
+/*
+Built-in coefficient sets (Q15, sum = 32768), taps = 8*ratio+1
+
+ ratio | taps | cut off (of the output rate)
+ 2     | 17   | 0.4
+ 5     | 41   | 0.4
+ 10    | 81   | 0.4
+*/
+static const int16_t coeffs_ratio_2[17] = {
+    -9, 45, 215, 0, -1070, -1287, 2504, 9434, 13104, 9434,
+    2504, -1287, -1070, 0, 215, 45, -9,
+};
+
+static const int16_t coeffs_ratio_5[41] = {
+    -1, -1, 4, 17, 38, 60, 66, 36, -51, -197,
+    -375, -523, -547, -346, 156, 972, 2035, 3194, 4245, 4980,
+    5244, 4980, 4245, 3194, 2035, 972, 156, -346, -547, -523,
+    -375, -197, -51, 36, 66, 60, 38, 17, 4, -1,
+    -1,
+};
+
+static const int16_t coeffs_ratio_10[81] = {
+    0, 0, 0, 0, 1, 4, 7, 11, 16, 21,
+    26, 29, 29, 26, 16, 0, -24, -55, -92, -135,
+    -178, -219, -251, -269, -265, -234, -169, -66, 76, 260,
+    480, 733, 1010, 1300, 1591, 1868, 2119, 2329, 2489, 2588,
+    2624, 2588, 2489, 2329, 2119, 1868, 1591, 1300, 1010, 733,
+    480, 260, 76, -66, -169, -234, -265, -269, -251, -219,
+    -178, -135, -92, -55, -24, 0, 16, 26, 29, 29,
+    26, 21, 16, 11, 7, 4, 1, 0, 0, 0,
+    0,
+};
+
+
+/*======================================================================
+ * DECIMATOR COEFFICIENTS
+ ======================================================================*/
+const int16_t * decimator_coefficients(uint8_t ratio, uint16_t *taps){
+    switch(ratio){
+        case 2:
+            *taps=sizeof(coeffs_ratio_2)/sizeof(coeffs_ratio_2[0]);
+            return coeffs_ratio_2;
+        case 5:
+            *taps=sizeof(coeffs_ratio_5)/sizeof(coeffs_ratio_5[0]);
+            return coeffs_ratio_5;
+        case 10:
+            *taps=sizeof(coeffs_ratio_10)/sizeof(coeffs_ratio_10[0]);
+            return coeffs_ratio_10;
+        default:
+            *taps=0;
+            return NULL;
+    }
+}
+
+
+/*======================================================================
+ * DECIMATOR INIT AND RESET
+ ======================================================================*/
+bool decimator_init(decimator_t *decimator, const int16_t *coeffs, uint16_t taps, uint8_t ratio, uint8_t channels, int32_t *history){
+    if (coeffs==NULL || history==NULL || taps==0 || ratio==0 || channels==0 || channels>DECIMATOR_MAX_CHANNELS){
+        return false;
+    }
+    decimator->coeffs=coeffs;
+    decimator->taps=taps;
+    decimator->ratio=ratio;
+    decimator->channels=channels;
+    decimator->history=history;
+
+    decimator_reset(decimator);
+    return true;
+}
+
+void decimator_reset(decimator_t *decimator){
+    memset(decimator->history,0,DECIMATOR_HISTORY_SIZE(decimator->channels,decimator->taps)*sizeof(int32_t));
+    decimator->position=0;
+    decimator->phase=0;
+    decimator->inputs=0;
+    decimator->outputs=0;
+}
+
+
+/*======================================================================
+ * DECIMATOR DOT PRODUCT
+ *
+ * No dependencies between iterations except the sum, keep it simple so
+ * the compiler can unroll/vectorize it (64 bit sum: 24 bit data * Q15
+ * coefficients can't overflow).
+ ======================================================================*/
+int64_t decimator_dot(const int16_t *coeffs, const int32_t *x, uint16_t taps){
+    int64_t sum=0;
+
+    for(uint16_t k=0;k<taps;k++){
+        sum+=(int64_t)coeffs[k]*x[k];
+    }
+    return sum;
+}
+
+
+/*======================================================================
+ * DECIMATOR PUSH
+ *
+ * The new sample is written in position and position+taps, after moving
+ * position forward history[position..position+taps-1] is the window from
+ * the oldest to the newest sample.
+ ======================================================================*/
+bool decimator_push(decimator_t *decimator, const int32_t *input, int32_t *output){
+    uint16_t taps=decimator->taps;
+    int32_t *history;
+    int64_t sum;
+
+    for(uint8_t channel=0;channel<decimator->channels;channel++){
+        history=&decimator->history[channel*2*taps];
+        history[decimator->position]=input[channel];
+        history[decimator->position+taps]=input[channel];
+    }
+    decimator->position++;
+    if (decimator->position==taps){
+        decimator->position=0;
+    }
+    decimator->inputs++;
+
+    decimator->phase++;
+    if (decimator->phase<decimator->ratio){
+        return false;
+    }
+    decimator->phase=0;
+
+    for(uint8_t channel=0;channel<decimator->channels;channel++){
+        history=&decimator->history[channel*2*taps];
+        sum=decimator_dot(decimator->coeffs,&history[decimator->position],taps);
+        //Q15 to integer, rounded
+        output[channel]=(int32_t)((sum+(1<<14))>>15);
+    }
+    decimator->outputs++;
+    return true;
+}
+
+
+/*======================================================================
+ * PACK AND UNPACK (big endian, same format as the packets)
+ ======================================================================*/
+int32_t decimator_unpack(const uint8_t *data, uint8_t bytes){
+    if (bytes==2){
+        return (int16_t)((data[0]<<8)|data[1]);
+    }
+    //24 bits, sign extension
+    int32_t value=(data[0]<<16)|(data[1]<<8)|data[2];
+    if (value & 0x800000){
+        value-=0x1000000;
+    }
+    return value;
+}
+
+void decimator_pack(int32_t value, uint8_t bytes, uint8_t *data){
+    if (bytes==2){
+        if (value>INT16_MAX) value=INT16_MAX;
+        if (value<INT16_MIN) value=INT16_MIN;
+        data[0]=(uint8_t)((value>>8)&0xFF);
+        data[1]=(uint8_t)(value&0xFF);
+        return;
+    }
+    if (value>0x7FFFFF) value=0x7FFFFF;
+    if (value<-0x800000) value=-0x800000;
+    data[0]=(uint8_t)((value>>16)&0xFF);
+    data[1]=(uint8_t)((value>>8)&0xFF);
+    data[2]=(uint8_t)(value&0xFF);
+}
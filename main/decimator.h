@@ -0,0 +1,71 @@
+#ifndef _DECIMATOR_H_
+#define _DECIMATOR_H_
+
+/*
+Fixed-point multi-channel FIR decimator (anti-alias filter + downsampling)
+
+The sensors are sampled "ratio" times faster than the packet sample rate, every
+input frame has one sample per channel (int32, 24 bit data or less). Only one
+output every "ratio" inputs is computed (polyphase decimation), so the cost is
+taps/ratio multiplications per input sample and channel:
+
+    output = (sum of coeffs[k]*x[n-taps+1+k], k = 0..taps-1 ) >> 15     (rounded)
+
+coeffs are Q15 (32768 = 1.0, sum of coeffs = DC gain) and x[n-taps+1] is the
+oldest sample of the window. The history of every channel is stored twice
+(history[i] = history[i+taps]), so the window is always contiguous in memory
+and the dot product (decimator_dot) is a plain loop that the compiler can
+vectorize or unroll.
+
+The coefficient sets of decimator_coefficients() are linear phase low pass
+filters (windowed sinc, Blackman window) with the cut off at 80% of the output
+Nyquist frequency, their delay is (taps-1)/2 input samples.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DECIMATOR_MAX_CHANNELS 12 //Maximum channels per decimator
+
+//int32 values of history needed by decimator_init
+#define DECIMATOR_HISTORY_SIZE(channels,taps) ((channels)*2*(taps))
+
+typedef struct {
+    const int16_t *coeffs; //Q15 coefficients, oldest sample first
+    uint16_t taps; //number of coefficients
+    uint8_t ratio; //inputs per output
+    uint8_t channels; //channels per frame
+
+    int32_t *history; //channels*2*taps samples (DECIMATOR_HISTORY_SIZE)
+    uint16_t position; //position of the oldest sample of the window
+    uint8_t phase; //inputs since the last output
+
+    uint32_t inputs; //input frames
+    uint32_t outputs; //output frames
+} decimator_t;
+
+
+/*Built-in coefficient set for ratio (2, 5 or 10), returns NULL if there isn't one*/
+const int16_t * decimator_coefficients(uint8_t ratio, uint16_t *taps);
+
+/*Prepares the decimator, history must have DECIMATOR_HISTORY_SIZE(channels,taps)
+values. Returns false if any parameter is invalid*/
+bool decimator_init(decimator_t *decimator, const int16_t *coeffs, uint16_t taps, uint8_t ratio, uint8_t channels, int32_t *history);
+
+/*Clears the history (for example after a sample rate change)*/
+void decimator_reset(decimator_t *decimator);
+
+/*Adds one input frame (one sample per channel). Returns true every "ratio" frames,
+then output has one filtered sample per channel*/
+bool decimator_push(decimator_t *decimator, const int32_t *input, int32_t *output);
+
+/*Dot product of the filter, sum of coeffs[k]*x[k] (k = 0..taps-1)*/
+int64_t decimator_dot(const int16_t *coeffs, const int32_t *x, uint16_t taps);
+
+/*Big endian signed value of "bytes" bytes (2 or 3) to int32 and back (saturated)*/
+int32_t decimator_unpack(const uint8_t *data, uint8_t bytes);
+void decimator_pack(int32_t value, uint8_t bytes, uint8_t *data);
+
+#endif
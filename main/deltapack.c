@@ -0,0 +1,189 @@
+#include "deltapack.h"
+#include "bitpack.h"
+
+
+/*======================================================================
+ * DELTAPACK ENCODE
+ ======================================================================*/
+uint32_t deltapack_encode(int32_t *samples, uint16_t count, uint8_t *encoded, uint32_t max_size){
+    uint32_t previous, difference, zigzag, all_bits;
+    uint32_t position=DELTAPACK_X0_BYTES;
+    uint16_t block_count;
+    uint8_t width;
+
+    if (count==0 || max_size<DELTAPACK_X0_BYTES){
+        return 0;
+    }
+    previous=(uint32_t)samples[0];
+    encoded[0]=(uint8_t)(previous>>24);
+    encoded[1]=(uint8_t)(previous>>16);
+    encoded[2]=(uint8_t)(previous>>8);
+    encoded[3]=(uint8_t)previous;
+
+    for(uint16_t first=0;first<count;first+=block_count){
+        block_count=(count-first<DELTAPACK_BLOCK)?(count-first):DELTAPACK_BLOCK;
+
+        //zigzag of the differences (modulo 2^32) in place and the bits of the biggest one
+        all_bits=0;
+        for(uint16_t each_sample=first;each_sample<first+block_count;each_sample++){
+            difference=(uint32_t)samples[each_sample]-previous;
+            previous=(uint32_t)samples[each_sample];
+            zigzag=(difference<<1)^(0u-(difference>>31));
+            samples[each_sample]=(int32_t)zigzag;
+            all_bits|=zigzag;
+        }
+        for(width=0;width<32 && (all_bits>>width)!=0;width++);
+
+        if (position+1+BITPACK_BYTES(block_count,width)>max_size){
+            return 0;
+        }
+        encoded[position++]=width;
+        if (width!=0){
+            position+=bitpack_pack(&samples[first],block_count,width,&encoded[position]);
+        }
+    }
+    return position;
+}
+
+
+/*======================================================================
+ * ZIGZAG AND PREFIX SUM
+ *
+ * values = zigzags of the differences, they become the samples (modulo
+ * 2^32). Returns the last sample (previous of the next block).
+ ======================================================================*/
+static uint32_t prefix_sum_scalar(uint32_t *values, uint16_t count, uint32_t previous){
+    uint32_t zigzag;
+
+    for(uint16_t each_sample=0;each_sample<count;each_sample++){
+        zigzag=values[each_sample];
+        previous+=(zigzag>>1)^(0u-(zigzag&1));
+        values[each_sample]=previous;
+    }
+    return previous;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define DELTAPACK_X86 1
+#include <immintrin.h>
+
+//4 samples: the differences added to the ones before them (2 shifts), plus the last sample
+static uint32_t prefix_sum_sse2(uint32_t *values, uint16_t count, uint32_t previous){
+    const __m128i one=_mm_set1_epi32(1);
+    __m128i carry=_mm_set1_epi32((int)previous), zigzag, sum;
+    uint16_t each_sample=0;
+
+    for(;each_sample+4<=count;each_sample+=4){
+        zigzag=_mm_loadu_si128((const __m128i *)&values[each_sample]);
+        sum=_mm_xor_si128(_mm_srli_epi32(zigzag,1),_mm_sub_epi32(_mm_setzero_si128(),_mm_and_si128(zigzag,one)));
+        sum=_mm_add_epi32(sum,_mm_slli_si128(sum,4));
+        sum=_mm_add_epi32(sum,_mm_slli_si128(sum,8));
+        sum=_mm_add_epi32(sum,carry);
+        _mm_storeu_si128((__m128i *)&values[each_sample],sum);
+        carry=_mm_shuffle_epi32(sum,0xFF);
+    }
+    return prefix_sum_scalar(&values[each_sample],count-each_sample,(uint32_t)_mm_cvtsi128_si32(carry));
+}
+
+//8 samples: the same in both 128 bit lanes, then the last sample of the low lane goes to the high one
+__attribute__((target("avx2")))
+static uint32_t prefix_sum_avx2(uint32_t *values, uint16_t count, uint32_t previous){
+    const __m256i one=_mm256_set1_epi32(1), last=_mm256_set1_epi32(7);
+    __m256i carry=_mm256_set1_epi32((int)previous), zigzag, sum, low;
+    uint16_t each_sample=0;
+
+    for(;each_sample+8<=count;each_sample+=8){
+        zigzag=_mm256_loadu_si256((const __m256i *)&values[each_sample]);
+        sum=_mm256_xor_si256(_mm256_srli_epi32(zigzag,1),_mm256_sub_epi32(_mm256_setzero_si256(),_mm256_and_si256(zigzag,one)));
+        sum=_mm256_add_epi32(sum,_mm256_slli_si256(sum,4));
+        sum=_mm256_add_epi32(sum,_mm256_slli_si256(sum,8));
+        low=_mm256_shuffle_epi32(sum,0xFF);
+        sum=_mm256_add_epi32(sum,_mm256_permute2x128_si256(low,low,0x08)); //0 in the low lane
+        sum=_mm256_add_epi32(sum,carry);
+        _mm256_storeu_si256((__m256i *)&values[each_sample],sum);
+        carry=_mm256_permutevar8x32_epi32(sum,last);
+    }
+    previous=(uint32_t)_mm256_cvtsi256_si32(carry);
+    _mm256_zeroupper(); //the code after it isn't AVX (no transition penalty)
+    return prefix_sum_scalar(&values[each_sample],count-each_sample,previous);
+}
+#endif
+
+typedef uint32_t (*prefix_sum_t)(uint32_t *values, uint16_t count, uint32_t previous);
+
+static const prefix_sum_t prefix_sums[]={
+    prefix_sum_scalar,
+#ifdef DELTAPACK_X86
+    prefix_sum_sse2,
+    prefix_sum_avx2,
+#endif
+};
+
+uint8_t deltapack_decoder(void){
+#ifdef DELTAPACK_X86
+    static int8_t best=-1; //checked once
+
+    if (best<0){
+        __builtin_cpu_init();
+        best=__builtin_cpu_supports("avx2")?DELTAPACK_DECODER_AVX2:DELTAPACK_DECODER_SSE2;
+    }
+    return (uint8_t)best;
+#else
+    return DELTAPACK_DECODER_SCALAR;
+#endif
+}
+
+const char *deltapack_decoder_name(uint8_t decoder){
+    static const char *names[]={"scalar","SSE2","AVX2"};
+
+    return (decoder<sizeof(names)/sizeof(names[0]))?names[decoder]:"?";
+}
+
+
+/*======================================================================
+ * DELTAPACK DECODE
+ ======================================================================*/
+static uint32_t decode(prefix_sum_t prefix_sum, const uint8_t *encoded, uint32_t size, uint16_t count, int32_t *samples){
+    uint32_t *values=(uint32_t *)samples; //zigzags first, samples after the prefix sum
+    uint32_t previous;
+    uint32_t position=DELTAPACK_X0_BYTES;
+    uint16_t block_count;
+    uint8_t width;
+
+    if (count==0 || size<DELTAPACK_X0_BYTES){
+        return 0;
+    }
+    previous=((uint32_t)encoded[0]<<24)|((uint32_t)encoded[1]<<16)|((uint32_t)encoded[2]<<8)|encoded[3];
+
+    for(uint16_t first=0;first<count;first+=block_count){
+        block_count=(count-first<DELTAPACK_BLOCK)?(count-first):DELTAPACK_BLOCK;
+        if (position+1>size){
+            return 0;
+        }
+        width=encoded[position++];
+        if (width>32 || position+BITPACK_BYTES(block_count,width)>size){
+            return 0;
+        }
+
+        if (width==0){
+            for(uint16_t each_sample=first;each_sample<first+block_count;each_sample++){
+                values[each_sample]=previous;
+            }
+            continue;
+        }
+        position+=bitpack_unpack_unsigned(&encoded[position],block_count,width,&values[first]);
+        previous=prefix_sum(&values[first],block_count,previous);
+    }
+    return position;
+}
+
+uint32_t deltapack_decode(const uint8_t *encoded, uint32_t size, uint16_t count, int32_t *samples){
+    return decode(prefix_sums[deltapack_decoder()],encoded,size,count,samples);
+}
+
+uint32_t deltapack_decode_with(uint8_t decoder, const uint8_t *encoded, uint32_t size, uint16_t count, int32_t *samples){
+    if (decoder>deltapack_decoder()){
+        return 0;
+    }
+    return decode(prefix_sums[decoder],encoded,size,count,samples);
+}
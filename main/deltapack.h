@@ -0,0 +1,64 @@
+#ifndef _DELTAPACK_H_
+#define _DELTAPACK_H_
+
+/*
+Delta + zigzag + bit width per block (frame of reference) codec
+
+For quiet channels the difference between consecutive samples is a few counts, so
+instead of 24 bits per sample every block of DELTAPACK_BLOCK samples uses only the bits
+of its biggest difference:
+
+    difference = sample - previous sample        (the previous of the first one is X0)
+    zigzag     = (difference << 1) ^ (difference >> 31)   0,-1,1,-2,2... -> 0,1,2,3,4...
+    width      = bits of the biggest zigzag of the block  (0 if all the differences are 0)
+
+               -----------------------------------------------------------------------
+    STREAM =   | X0 (4 bytes) | BLOCK 0 | BLOCK 1 | ... | BLOCK (count-1)/DELTAPACK_BLOCK |
+               -----------------------------------------------------------------------
+    BLOCK  =   | WIDTH (1 byte) | zigzags of the block, WIDTH bits each (bitpack.h) |
+
+X0 is the first sample (int32 big endian), so the first difference is 0. The last block
+has the samples that are left. Unlike Steim there are no options to test per word, the
+encoder is 2 passes over the samples and the decoder is bitpack_unpack_unsigned + a 
+prefix sum.
+
+The server side (x86-64 hosts) decodes many packets: there the zigzag and the prefix sum also
+have vector versions, 4 samples at once with SSE2 (every x86-64 CPU) and 8 with AVX2 (if
+the CPU has it, checked once at runtime). deltapack_decode uses the best one, the scalar
+one is the only one of the ESP32 and the reference of the others (same samples).
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+
+#define DELTAPACK_BLOCK 128 //samples per block (1 WIDTH byte every 128 samples)
+#define DELTAPACK_X0_BYTES 4
+
+/*Maximum bytes of "count" samples (every block with 32 bits)*/
+#define DELTAPACK_MAX_BYTES(count) (DELTAPACK_X0_BYTES+((count)+DELTAPACK_BLOCK-1)/DELTAPACK_BLOCK+4*(uint32_t)(count))
+
+/*Encodes "count" samples into "encoded" (max_size bytes). The samples are overwritten
+(zigzag values). Returns the bytes written or 0 if they don't fit*/
+uint32_t deltapack_encode(int32_t *samples, uint16_t count, uint8_t *encoded, uint32_t max_size);
+
+/*Decodes "count" samples of a stream of "size" bytes. Returns the bytes read or 0 if
+the stream is invalid or shorter*/
+uint32_t deltapack_decode(const uint8_t *encoded, uint32_t size, uint16_t count, int32_t *samples);
+
+//Decoders of deltapack_decode
+#define DELTAPACK_DECODER_SCALAR 0
+#define DELTAPACK_DECODER_SSE2 1 //x86-64 hosts
+#define DELTAPACK_DECODER_AVX2 2 //x86-64 hosts with AVX2
+
+/*Best decoder of this CPU, the one used by deltapack_decode*/
+uint8_t deltapack_decoder(void);
+
+/*Name of a decoder ("scalar", "SSE2", "AVX2")*/
+const char *deltapack_decoder_name(uint8_t decoder);
+
+/*Same as deltapack_decode with one decoder (tests and benchmarks), 0 if this CPU doesn't
+have it (decoder > deltapack_decoder())*/
+uint32_t deltapack_decode_with(uint8_t decoder, const uint8_t *encoded, uint32_t size, uint16_t count, int32_t *samples);
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdio.h>
+
+#include "epoch_time.h"
+
+
+//floor division (also for negative values)
+static int64_t floor_div(int64_t value, int64_t divisor, int64_t *remainder){
+    int64_t quotient=value/divisor;
+    int64_t rest=value%divisor;
+    if (rest<0){
+        rest+=divisor;
+        quotient--;
+    }
+    *remainder=rest;
+    return quotient;
+}
+
+//two BCD digits (the bits of mask), false if a digit is bigger than 9
+static bool bcd_decode(uint8_t value, uint8_t mask, uint8_t *decoded){
+    value&=mask;
+    if ((value&0x0F)>9 || (value>>4)>9){
+        return false;
+    }
+    *decoded=(uint8_t)((value>>4)*10+(value&0x0F));
+    return true;
+}
+
+static uint8_t bcd_encode(uint8_t value){
+    return (uint8_t)(((value/10)<<4)|(value%10));
+}
+
+
+/*======================================================================
+ * CALENDAR (proleptic Gregorian, days since 1970-01-01)
+ ======================================================================*/
+int32_t epoch_days_from_civil(int32_t year, uint8_t month, uint8_t day){
+    year-=(month<=2);
+    int32_t era=(year>=0?year:year-399)/400;
+    uint32_t year_of_era=(uint32_t)(year-era*400);
+    uint32_t day_of_year=(153*(month>2?month-3:month+9)+2)/5+day-1;
+    uint32_t day_of_era=year_of_era*365+year_of_era/4-year_of_era/100+day_of_year;
+    return era*146097+(int32_t)day_of_era-719468;
+}
+
+void epoch_civil_from_days(int32_t days, int32_t *year, uint8_t *month, uint8_t *day){
+    days+=719468;
+    int32_t era=(days>=0?days:days-146096)/146097;
+    uint32_t day_of_era=(uint32_t)(days-era*146097);
+    uint32_t year_of_era=(day_of_era-day_of_era/1460+day_of_era/36524-day_of_era/146096)/365;
+    uint32_t day_of_year=day_of_era-(365*year_of_era+year_of_era/4-year_of_era/100);
+    uint32_t mp=(5*day_of_year+2)/153;
+    *day=(uint8_t)(day_of_year-(153*mp+2)/5+1);
+    *month=(uint8_t)(mp<10?mp+3:mp-9);
+    *year=(int32_t)year_of_era+era*400+(*month<=2);
+}
+
+uint8_t epoch_days_in_month(int32_t year, uint8_t month){
+    static const uint8_t days[12]={31,28,31,30,31,30,31,31,30,31,30,31};
+    bool leap=(year%4==0 && year%100!=0) || year%400==0;
+
+    if (month<1 || month>12){
+        return 0;
+    }
+    return (month==2 && leap)?29:days[month-1];
+}
+
+bool epoch_datetime_valid(const epoch_datetime_t *datetime){
+    return datetime->month>=1 && datetime->month<=12
+        && datetime->day>=1 && datetime->day<=epoch_days_in_month(datetime->year,datetime->month)
+        && datetime->hour<24 && datetime->minute<60 && datetime->second<60
+        && datetime->microsecond<EPOCH_US_PER_SECOND;
+}
+
+
+/*======================================================================
+ * EPOCH <-> DATE AND TIME
+ ======================================================================*/
+int64_t epoch_from_datetime(const epoch_datetime_t *datetime){
+    int64_t seconds=(int64_t)epoch_days_from_civil(datetime->year,datetime->month,datetime->day)*EPOCH_SECONDS_PER_DAY
+        +datetime->hour*3600+datetime->minute*60+datetime->second;
+    return seconds*EPOCH_US_PER_SECOND+datetime->microsecond;
+}
+
+void epoch_to_datetime(int64_t epoch_us, epoch_datetime_t *datetime){
+    int64_t microsecond, second_of_day;
+    int64_t seconds=floor_div(epoch_us,EPOCH_US_PER_SECOND,&microsecond);
+    int32_t days=(int32_t)floor_div(seconds,EPOCH_SECONDS_PER_DAY,&second_of_day);
+
+    epoch_civil_from_days(days,&datetime->year,&datetime->month,&datetime->day);
+    datetime->hour=(uint8_t)(second_of_day/3600);
+    datetime->minute=(uint8_t)((second_of_day/60)%60);
+    datetime->second=(uint8_t)(second_of_day%60);
+    datetime->microsecond=(uint32_t)microsecond;
+}
+
+
+/*======================================================================
+ * DS3231 REGISTERS (BCD)
+ ======================================================================*/
+bool epoch_from_ds3231(const uint8_t *registers, int64_t *epoch_us){
+    epoch_datetime_t datetime={0};
+    uint8_t year, hour;
+
+    if (!bcd_decode(registers[0],0x7F,&datetime.second) || !bcd_decode(registers[1],0x7F,&datetime.minute)
+        || !bcd_decode(registers[4],0x3F,&datetime.day) || !bcd_decode(registers[5],0x1F,&datetime.month)
+        || !bcd_decode(registers[6],0xFF,&year)){
+        return false;
+    }
+
+    if (registers[2]&0x40){
+        //12 hour mode: 12 AM = 0 h, bit 5 = PM
+        if (!bcd_decode(registers[2],0x1F,&hour) || hour<1 || hour>12){
+            return false;
+        }
+        hour=(uint8_t)(hour%12+((registers[2]&0x20)?12:0));
+    }
+    else if (!bcd_decode(registers[2],0x3F,&hour)){
+        return false;
+    }
+    datetime.hour=hour;
+    datetime.year=EPOCH_DS3231_FIRST_YEAR+((registers[5]&0x80)?100:0)+year;
+
+    if (!epoch_datetime_valid(&datetime)){
+        return false;
+    }
+    *epoch_us=epoch_from_datetime(&datetime);
+    return true;
+}
+
+bool epoch_to_ds3231(int64_t epoch_us, uint8_t *registers){
+    epoch_datetime_t datetime;
+    int64_t remainder;
+    int64_t days=floor_div(epoch_us,EPOCH_US_PER_SECOND*EPOCH_SECONDS_PER_DAY,&remainder);
+
+    epoch_to_datetime(epoch_us,&datetime);
+    if (datetime.year<EPOCH_DS3231_FIRST_YEAR || datetime.year>EPOCH_DS3231_LAST_YEAR){
+        return false;
+    }
+    registers[0]=bcd_encode(datetime.second);
+    registers[1]=bcd_encode(datetime.minute);
+    registers[2]=bcd_encode(datetime.hour); //24 hour mode (bit 6 = 0)
+    registers[3]=(uint8_t)((days+3)%7+1); //1970-01-01 was a Thursday (4), days>0 after 2000
+    registers[4]=bcd_encode(datetime.day);
+    registers[5]=(uint8_t)(bcd_encode(datetime.month)|((datetime.year>=EPOCH_DS3231_FIRST_YEAR+100)?0x80:0));
+    registers[6]=bcd_encode((uint8_t)(datetime.year%100));
+    return true;
+}
+
+
+/*======================================================================
+ * TEXT (logs only)
+ ======================================================================*/
+void epoch_format(int64_t epoch_us, char *text){
+    epoch_datetime_t datetime;
+
+    epoch_to_datetime(epoch_us,&datetime);
+    //years out of 0-9999 aren't valid times of the datalogger, the ranges keep the text in EPOCH_FORMAT_BYTES
+    snprintf(text,EPOCH_FORMAT_BYTES,"%04u-%02u-%02uT%02u:%02u:%02u.%06uZ",(unsigned int)datetime.year%10000,datetime.month%100,
+        datetime.day%100,datetime.hour%100,datetime.minute%100,datetime.second%100,(unsigned int)datetime.microsecond%1000000);
+}
@@ -0,0 +1,77 @@
+#ifndef _EPOCH_TIME_H_
+#define _EPOCH_TIME_H_
+
+/*
+Time of the datalogger: int64 microseconds since 1970-01-01 00:00:00 UTC (epoch_us)
+
+Every time inside the firmware is an epoch_us (DS3231 read, START_US of the header, miniSEED
+start time, index of the SD logs), the text formats are only made at the edges (logs):
+
+    DS3231 registers 0x00-0x06 (BCD)  --epoch_from_ds3231-->  epoch_us  --epoch_format-->  text
+                                      <--epoch_to_ds3231---
+
+The calendar is the proleptic Gregorian one (days since 1970-01-01, negative before), the
+divisions are floor divisions so the times before 1970 are also right. There are no leap
+seconds (same as POSIX time and the DS3231).
+
+DS3231: the clock keeps UTC (set by sntp_config.c). The registers have 2 BCD digits per
+value, the hours can be in 12 hour mode (bit 6, bit 5 = PM) and the century bit (bit 7 of
+the month) toggles when the year goes from 99 to 00: year = 2000 + 100*century + YY, so
+the DS3231 covers 2000-2199.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EPOCH_US_PER_SECOND 1000000LL
+#define EPOCH_SECONDS_PER_DAY 86400
+
+#define EPOCH_DS3231_REGISTERS 7 //seconds, minutes, hours, day of week, date, month/century, year
+#define EPOCH_DS3231_FIRST_YEAR 2000
+#define EPOCH_DS3231_LAST_YEAR 2199
+
+#define EPOCH_FORMAT_BYTES 28 //"YYYY-MM-DDTHH:mm:SS.uuuuuuZ" + terminator
+
+typedef struct {
+    int32_t year;
+    uint8_t month;        //1-12
+    uint8_t day;          //1-31
+    uint8_t hour;         //0-23
+    uint8_t minute;       //0-59
+    uint8_t second;       //0-59
+    uint32_t microsecond; //0-999999
+} epoch_datetime_t;
+
+
+/*Days since 1970-01-01 of a date (negative before)*/
+int32_t epoch_days_from_civil(int32_t year, uint8_t month, uint8_t day);
+
+/*Date of the days since 1970-01-01*/
+void epoch_civil_from_days(int32_t days, int32_t *year, uint8_t *month, uint8_t *day);
+
+/*Days of the month (28-31), 0 if the month isn't 1-12*/
+uint8_t epoch_days_in_month(int32_t year, uint8_t month);
+
+/*True if every field is in its range (day of the month included)*/
+bool epoch_datetime_valid(const epoch_datetime_t *datetime);
+
+/*Date and time (UTC) to epoch_us, the fields aren't checked (epoch_datetime_valid)*/
+int64_t epoch_from_datetime(const epoch_datetime_t *datetime);
+
+/*epoch_us to date and time (UTC)*/
+void epoch_to_datetime(int64_t epoch_us, epoch_datetime_t *datetime);
+
+/*DS3231 registers 0x00-0x06 to epoch_us, false if a value isn't valid BCD or out of range
+(stopped oscillator, I2C noise)*/
+bool epoch_from_ds3231(const uint8_t *registers, int64_t *epoch_us);
+
+/*epoch_us to DS3231 registers 0x00-0x06 (24 hour mode, day of week 1 = Monday), the
+microseconds are truncated. False if the year is out of 2000-2199*/
+bool epoch_to_ds3231(int64_t epoch_us, uint8_t *registers);
+
+/*ISO 8601 text "YYYY-MM-DDTHH:mm:SS.uuuuuuZ" (EPOCH_FORMAT_BYTES with the terminator), for logs*/
+void epoch_format(int64_t epoch_us, char *text);
+
+#endif
@@ -72,56 +72,60 @@ void http_get_receive ( char *local_response_buffer, int HTTP_RESPONSE_SIZE, cha
 
 /*
  * HTTP Post request function (send buffer by HTTP POST)
+ *
+ * The client is kept between packets (HTTP keep-alive), the TLS handshake is done once 
+ * and not once per packet (short packets, PACKET_DURATION_MS in packet_duration.h). After an error
+ * the client is closed and the next POST connects again.
  */
+static esp_http_client_handle_t post_client=NULL;
+static char post_response_buffer[DEFAULT_BUFFER_SIZE_RESPONSE];
+
 esp_err_t http_post_send(char * data_buffer, int DATA_BUFFER_SIZE, char * HTTP_POST_SEND_URL)
 {
     printf("POST_BUFFER: current buffer:%p\n",data_buffer);
 
-    //ESP_LOGI(TAG,"Memory allocation");
-    char * local_response_buffer=NULL;
-    local_response_buffer = heap_caps_malloc(DEFAULT_BUFFER_SIZE_RESPONSE * sizeof *local_response_buffer, MALLOC_CAP_8BIT);  
-    
-    if (local_response_buffer==NULL){
-            ESP_LOGE(TAG,"Memory allocation failed");    
-        }else{
-            //ESP_LOGI(TAG,"Reseting array, filling it with zeros");
-            memset(local_response_buffer, 0, DEFAULT_BUFFER_SIZE_RESPONSE); // <---- reset array / fill array with zeros
-        }
+    memset(post_response_buffer, 0, DEFAULT_BUFFER_SIZE_RESPONSE); // <---- reset array / fill array with zeros
 
-    esp_http_client_config_t config = {
-        .url = HTTP_POST_SEND_URL,
-        .transport_type = HTTP_TRANSPORT_OVER_SSL,
-        .method=HTTP_METHOD_POST,
-        .event_handler = _http_event_handler,
-        .user_data = local_response_buffer,
-        .buffer_size = DEFAULT_BUFFER_SIZE_RESPONSE,
-        .timeout_ms=5000,
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (post_client==NULL){
+        esp_http_client_config_t config = {
+            .url = HTTP_POST_SEND_URL,
+            .transport_type = HTTP_TRANSPORT_OVER_SSL,
+            .method=HTTP_METHOD_POST,
+            .event_handler = _http_event_handler,
+            .user_data = post_response_buffer,
+            .buffer_size = DEFAULT_BUFFER_SIZE_RESPONSE,
+            .timeout_ms=5000,
+        };
+        post_client = esp_http_client_init(&config);
+        if (post_client==NULL){
+            ESP_LOGE(TAG,"HTTP client init failed");
+            return ESP_FAIL;
+        }
+        esp_http_client_set_header(post_client, "Content-Type", "application/x-www-form-urlencoded");
+    }
+    else{
+        esp_http_client_set_url(post_client, HTTP_POST_SEND_URL);
+    }
     esp_err_t error_handler=ESP_OK;
 
     // POST Request
-    esp_http_client_set_header(client, "Content-Type", "application/x-www-form-urlencoded");
-    esp_http_client_set_post_field(client, data_buffer, DATA_BUFFER_SIZE);
+    esp_http_client_set_post_field(post_client, data_buffer, DATA_BUFFER_SIZE);
     
-    esp_err_t err = esp_http_client_perform(client);
+    esp_err_t err = esp_http_client_perform(post_client);
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %d",
-                esp_http_client_get_status_code(client),
-                esp_http_client_get_content_length(client));
-        ESP_LOGI(TAG, "RESPONSE FROM SERVER (http_post_send): %s", local_response_buffer);
+                esp_http_client_get_status_code(post_client),
+                esp_http_client_get_content_length(post_client));
+        ESP_LOGI(TAG, "RESPONSE FROM SERVER (http_post_send): %.*s", DEFAULT_BUFFER_SIZE_RESPONSE, post_response_buffer);
 
     } else {
         ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
         error_handler=ESP_FAIL;
-    }
 
-    //cleanup
-    esp_http_client_cleanup(client);
-    
-    //ESP_LOGI(TAG,"Deleting buffer");
-    heap_caps_free(local_response_buffer);
-    local_response_buffer=NULL;
+        //cleanup, the connection is opened again with the next POST
+        esp_http_client_cleanup(post_client);
+        post_client=NULL;
+    }
     
     return error_handler;
 }
@@ -21,6 +21,6 @@ void http_get_receive ( char *local_response_buffer, int HTTP_RESPONSE_SIZE, cha
 
 
 /*
- * HTTP Post request function (send buffer by HTTP POST)
+ * HTTP Post request function (send buffer by HTTP POST), the connection stays open for the next one
  */
 esp_err_t http_post_send(char * data_buffer, int DATA_BUFFER_SIZE, char * HTTP_POST_SEND_URL);
@@ -1,5 +1,6 @@
 #include "driver/i2c.h" //Headers for I2C
 #include "i2c_ds3231.h"
+#include "epoch_time.h" //BCD registers <-> epoch_us
 
 
 
@@ -38,55 +39,46 @@ void ds3231_reg_config(void){
 }
 
 /*====================================================================================
-FUNCTION: DS3231_SET_DATETIME
+FUNCTION: DS3231_SET_TIME
 
-Set an specific date and time 
+Set an specific date and time (UTC)
 =====================================================================================*/
-void ds3231_set_datetime(char * local_datetime){
-    uint8_t raw_datetime[7]={0};
+bool ds3231_set_time(int64_t epoch_us){
+    uint8_t raw_datetime[EPOCH_DS3231_REGISTERS]={0};
+    esp_err_t error;
     
-    /*Parse local_datetime*/
-    //YY 
-    raw_datetime[6]=(local_datetime[0]<<4)|local_datetime[1];
-    //MM 
-    raw_datetime[5]=(local_datetime[2]<<4)|local_datetime[3];
-    //DD 
-    raw_datetime[4]=(local_datetime[4]<<4)|local_datetime[5];
-    //Day
-    raw_datetime[3]=1;
-    //HH 
-    raw_datetime[2]=(local_datetime[6]<<4)|local_datetime[7];
-    //mm 
-    raw_datetime[1]=(local_datetime[8]<<4)|local_datetime[9];
-    //SS
-    raw_datetime[0]=(local_datetime[10]<<4)|local_datetime[11];
+    /*Registers 0x00-0x06 in BCD: SS mm HH day DD MM YY*/
+    if (!epoch_to_ds3231(epoch_us,raw_datetime)){
+        return false;
+    }
 
     //se crea el link de la comunicacion 
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
 	
-    //-----------------------[ Modify Control Register (0x0E) ]-----------------------------------------------
+    //-----------------------[ Write date and time registers (0x00-0x06) ]-----------------------------------
 	/*Start I2C communication as MASTER*/
     i2c_master_start(cmd);
 
     i2c_master_write_byte(cmd, DS3231_ADDRESS | I2C_MASTER_WRITE, ACK_EN);
-    /*Select control register*/
+    /*Select seconds register, the next ones are written in order*/
     i2c_master_write_byte(cmd, REG_SECONDS, ACK_EN);
-    /*Turns on the internal oscillator to initialize the clock functions*/
     i2c_master_write(cmd, raw_datetime, sizeof(raw_datetime), ACK_EN);
      //----------------------------------------------------------------------------------------------------
 
     i2c_master_stop(cmd);
-    i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000/portTICK_PERIOD_MS);
+    error=i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000/portTICK_PERIOD_MS);
     i2c_cmd_link_delete(cmd);
+    return error==ESP_OK;
 }
 
 /*====================================================================================
-FUNCTION: DS3231_GET_DATETIME
+FUNCTION: DS3231_GET_TIME
 
-Get date and time of the RTC 
+Get date and time of the RTC (UTC)
 =====================================================================================*/
-void ds3231_get_datetime(char * data_received){
-    uint8_t raw_datetime[7]={0};
+bool ds3231_get_time(int64_t * epoch_us){
+    uint8_t raw_datetime[EPOCH_DS3231_REGISTERS]={0};
+    esp_err_t error;
 
     //se crea el link de la comunicacion 
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
@@ -101,35 +93,58 @@ void ds3231_get_datetime(char * data_received){
     i2c_master_start(cmd);
     //se lee a partir de la direccion anterior en el mismo dispositivo
     i2c_master_write_byte(cmd, DS3231_ADDRESS | I2C_MASTER_READ, ACK_EN);
-    i2c_master_read(cmd, raw_datetime, sizeof(raw_datetime),ACK_DIS); //read 3 axis of the accelerometer
+    i2c_master_read(cmd, raw_datetime, sizeof(raw_datetime),I2C_MASTER_LAST_NACK); //registers 0x00-0x06
     //--------------------------------------------------------------------------------------------
 
     i2c_master_stop(cmd);
-    i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000/portTICK_PERIOD_MS);
+    error=i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000/portTICK_PERIOD_MS);
     i2c_cmd_link_delete(cmd);
-    
-    //YY 
-    data_received[0]=raw_datetime[6]>>4;
-    data_received[1]=raw_datetime[6]&0B00001111;
-    //MM 
-    data_received[2]=(raw_datetime[5]&0B00010000)>>4;
-    data_received[3]= raw_datetime[5]&0B00001111;
-    //DD 
-    data_received[4]=raw_datetime[4]>>4;
-    data_received[5]=raw_datetime[4]&0B00001111;
-    //raw_datetime[3] deprecated, it's for indentify the day of week (1-7)
-    //HH 
-    data_received[6]=(raw_datetime[2]&0B00110000)>>4;
-    data_received[7]= raw_datetime[2]&0B00001111;
-    //mm 
-    data_received[8]=raw_datetime[1]>>4;
-    data_received[9]=raw_datetime[1]&0B00001111;
-    //SS 
-    data_received[10]=raw_datetime[0]>>4;
-    data_received[11]=raw_datetime[0]&0B00001111;
-
-    //parse to ascii format
-    for(uint8_t i=0;i<DATETIME_SIZE_FORMAT;i++){
-        data_received[i]+=48;
+    if (error!=ESP_OK){
+        return false;
     }
-}
\ No newline at end of file
+
+    //BCD registers to UTC microseconds (no ascii on the way)
+    return epoch_from_ds3231(raw_datetime,epoch_us);
+}
+
+/*====================================================================================
+FUNCTION: DS3231_GET_AGING / DS3231_SET_AGING
+
+Aging offset register, the frequency of the RTC is corrected with the drift measured
+by SNTP (sntp_config.c)
+=====================================================================================*/
+bool ds3231_get_aging(int8_t * aging){
+    uint8_t value=0;
+    esp_err_t error;
+
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, DS3231_ADDRESS | I2C_MASTER_WRITE, ACK_EN);
+    i2c_master_write_byte(cmd, REG_AGING_OFFSET, ACK_EN);
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, DS3231_ADDRESS | I2C_MASTER_READ, ACK_EN);
+    i2c_master_read_byte(cmd, &value, I2C_MASTER_NACK);
+    i2c_master_stop(cmd);
+
+    error=i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000/portTICK_PERIOD_MS);
+    i2c_cmd_link_delete(cmd);
+    *aging=(int8_t)value;
+    return error==ESP_OK;
+}
+
+bool ds3231_set_aging(int8_t aging){
+    esp_err_t error;
+
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, DS3231_ADDRESS | I2C_MASTER_WRITE, ACK_EN);
+    i2c_master_write_byte(cmd, REG_AGING_OFFSET, ACK_EN);
+    i2c_master_write_byte(cmd, (uint8_t)aging, ACK_EN);
+    i2c_master_stop(cmd);
+
+    error=i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000/portTICK_PERIOD_MS);
+    i2c_cmd_link_delete(cmd);
+    return error==ESP_OK;
+}
@@ -11,21 +11,36 @@ When high (Bit 6), the 12-hour mode is selected. In the 12-hour mode, bit 5 is t
 AM/PM bit with logic-high being PM. In the 24-hour mode, bit 5 is the second 
 10-hour bit (20–23 hours). The century bit (bit 7 of the month register) is 
 toggled when the years register overflows from 99 to 00.
+
+The clock keeps UTC, the BCD registers are converted to and from epoch_us by 
+epoch_from_ds3231() and epoch_to_ds3231() (epoch_time.h).
 */
 
+#include <stdint.h>
+#include <stdbool.h>
+
 
 /*Configurates the RTC, turns on the clock*/
 void ds3231_reg_config(void);
 
-/*Configurates date and time values of ds3231 rtc*/
-void ds3231_set_datetime(char * data_received);
+/*Configurates date and time values of ds3231 rtc, UTC microseconds since 1970-01-01 (epoch_time.h),
+returns false if the I2C write failed or the year is out of 2000-2199*/
+bool ds3231_set_time(int64_t epoch_us);
 
-/*Read date and time values of ds3231 rtc*/
-void ds3231_get_datetime(char * data_received);
+/*Read date and time values of ds3231 rtc (UTC, whole seconds), returns false if the I2C read 
+failed or the registers aren't a valid date*/
+bool ds3231_get_time(int64_t * epoch_us);
 
-#define DATETIME_SIZE_FORMAT 12 //12 bytes maximum format YYMMDDHHmmSS
+/*Aging offset register (REG_AGING_OFFSET), LSBs of ~0.1 ppm, + = slower oscillator. It is
+applied in the next temperature conversion (every 64 s). Returns false if the I2C failed*/
+bool ds3231_get_aging(int8_t * aging);
+bool ds3231_set_aging(int8_t aging);
 
 
+/*INT/SQW pin of the DS3231 (1 Hz square wave, falling edge = the seconds register changes), 
+open drain: needs an external pull-up, GPIO 39 is input only (clock_discipline.h)*/
+#define DS3231_PIN_SQW 39
+
 //device address (i2c address)
 #define DS3231_ADDRESS (0B1101000 << 1) // DS3231 I2C address is 0x1C(28)
 
@@ -131,4 +146,8 @@ void ds3231_get_datetime(char * data_received);
 /*Control status register*/
 #define REG_CONTROL_STATUS 0x0F
 
+/*Aging offset (two's complement), trims the capacitors of the crystal: +1 LSB = ~0.1 ppm slower 
+at 25 C (time_sync.h)*/
+#define REG_AGING_OFFSET 0x10
+
 
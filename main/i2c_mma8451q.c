@@ -66,4 +66,113 @@ void mma8451q_read_accl(uint8_t * data_received, uint8_t size_buffer){
     i2c_cmd_link_delete(cmd);
 
     //printf("MMA8451Q: DATA[0]:%d  DATA[1]: %d\n",data_received[0],data_received[1]);
-}
\ No newline at end of file
+}
+
+
+/*Changes the output data rate, CTRL_REG1 can only be modified in standby mode*/
+void mma8451q_set_rate(uint8_t data_rate){
+    
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+
+    //-----------------------[ Standby mode with the new data rate ]---------------------------------
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MMA8452Q_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, CTRL_REG1, true);
+    i2c_master_write_byte(cmd, data_rate, true);
+
+    //-----------------------[ Active mode ]----------------------------------------------------------
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MMA8452Q_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, CTRL_REG1, true);
+    i2c_master_write_byte(cmd, data_rate|MMA8451Q_ACTIVE, true);
+
+    i2c_master_stop(cmd);
+    i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000/portTICK_PERIOD_MS);
+    i2c_cmd_link_delete(cmd);
+
+    printf("MMA8451Q: CTRL_REG1 = 0x%02X\n",data_rate|MMA8451Q_ACTIVE);
+}
+
+
+/*Configurates the FIFO in circular mode with a watermark, the sensor ends in active mode*/
+void mma8451q_fifo_config(uint8_t data_rate, uint8_t watermark){
+    
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+
+    //-----------------------[ Standby mode (F_SETUP can only be written in standby) ]----------------
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MMA8452Q_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, CTRL_REG1, true);
+    i2c_master_write_byte(cmd, data_rate, true);
+
+    //-----------------------[ FIFO circular mode and watermark ]--------------------------------------
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MMA8452Q_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, F_SETUP, true);
+    i2c_master_write_byte(cmd, F_MODE_CIRCULAR|(watermark & F_STATUS_COUNT_MASK), true);
+
+    //-----------------------[  Set range to +/- 2g ]--------------------------------------------------
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MMA8452Q_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, XYZ_DATA_CFG, true);
+    i2c_master_write_byte(cmd, 0B00000000, true);
+
+    //-----------------------[ Active mode, the FIFO starts to fill ]----------------------------------
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MMA8452Q_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, CTRL_REG1, true);
+    i2c_master_write_byte(cmd, data_rate|MMA8451Q_ACTIVE, true);
+
+    i2c_master_stop(cmd);
+    i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000/portTICK_PERIOD_MS);
+    i2c_cmd_link_delete(cmd);
+
+    printf("MMA8451Q: FIFO configuration finish (watermark %d samples)\n",watermark);
+}
+
+
+/*Returns the F_STATUS register*/
+uint8_t mma8451q_fifo_status(void){
+    uint8_t fifo_status=0;
+
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+	
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MMA8452Q_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, F_STATUS, true);
+    
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MMA8452Q_ADDRESS << 1) | I2C_MASTER_READ, true);
+    i2c_master_read_byte(cmd, &fifo_status, I2C_MASTER_NACK);
+
+    i2c_master_stop(cmd);
+    i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000/portTICK_PERIOD_MS);
+    i2c_cmd_link_delete(cmd);
+
+    return fifo_status;
+}
+
+
+/*Burst read of FIFO samples. With the FIFO enabled the register address goes
+back from OUT_Z_LSB (0x06) to OUT_X_MSB (0x01), so all the samples are read
+in a single I2C transaction*/
+void mma8451q_read_fifo(uint8_t * data_received, uint8_t samples){
+    
+    if (samples==0){
+        return;
+    }
+
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+	
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MMA8452Q_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, MMA8452Q_ACCEL_XOUT_H, true);
+    
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MMA8452Q_ADDRESS << 1) | I2C_MASTER_READ, true);
+    i2c_master_read(cmd, data_received, samples*MMA8451Q_BYTES_PER_SAMPLE, I2C_MASTER_LAST_NACK);
+
+    i2c_master_stop(cmd);
+    i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000/portTICK_PERIOD_MS);
+    i2c_cmd_link_delete(cmd);
+}
@@ -4,9 +4,41 @@
 /*Configurates the accelerometer's sample rate, range, etc*/
 void mma8451q_reg_config(void);
 
+/*Changes the output data rate (data_rate = MMA8451Q_DR_xxx_HZ), the sensor ends in active mode*/
+void mma8451q_set_rate(uint8_t data_rate);
+
 /*Read acceleration values of mma8451q*/
 void mma8451q_read_accl(uint8_t * data_received, uint8_t size_buffer);
 
+/*Configurates the FIFO in circular mode with a watermark (in samples), data_rate = MMA8451Q_DR_xxx_HZ.
+The sensor ends in active mode (same range as mma8451q_reg_config)*/
+void mma8451q_fifo_config(uint8_t data_rate, uint8_t watermark);
+
+/*Returns the F_STATUS register (overflow flag, watermark flag and number of samples in the FIFO)*/
+uint8_t mma8451q_fifo_status(void);
+
+/*Burst read of "samples" FIFO samples (6 bytes each, same format as mma8451q_read_accl)*/
+void mma8451q_read_fifo(uint8_t * data_received, uint8_t samples);
+
+
+/*
+Acquisition modes
+
+MMA8451Q_MODE_TIMER: one I2C transaction (6 bytes) every timer tick (TIMER_ISR).
+MMA8451Q_MODE_FIFO:  the accelerometer samples with its own clock into the 32 sample
+                     FIFO, the task reads F_STATUS and drains the FIFO in one burst
+                     every MMA8451Q_FIFO_WATERMARK samples. The ODR of the sensor must
+                     be equal to the sample rate (50, 100 or 200 Hz in sample_rate.c).
+*/
+#define MMA8451Q_MODE_TIMER 0
+#define MMA8451Q_MODE_FIFO  1
+
+#define MMA8451Q_ACQUISITION_MODE MMA8451Q_MODE_TIMER
+
+#define MMA8451Q_FIFO_SIZE 32 //Maximum number of samples in the FIFO
+#define MMA8451Q_FIFO_WATERMARK 20 //Samples per burst read (200 ms at 100 Hz, 120 ms of margin before overflow)
+#define MMA8451Q_BYTES_PER_SAMPLE 6 //X, Y, Z (2 bytes each)
+
 
 #define MMA8452Q_ADDRESS 0x1C // MMA8452Q I2C address is 0x1C(28)
 #define MMA8452Q_ACCEL_XOUT_H 0x01  //Address of the first X acceleration data register
@@ -15,3 +47,23 @@ void mma8451q_read_accl(uint8_t * data_received, uint8_t size_buffer);
 
 #define XYZ_DATA_CFG 0x0E //Register for configurating sensivity range
 #define CTRL_REG1 0x2A //Control register for selecting the operation mode
+
+    #define MMA8451Q_ACTIVE (1<<0) //0 = standby (registers can be modified), 1 = active
+    //Output data rate (DR bits)
+    #define MMA8451Q_DR_800_HZ (0B000<<3)
+    #define MMA8451Q_DR_400_HZ (0B001<<3)
+    #define MMA8451Q_DR_200_HZ (0B010<<3)
+    #define MMA8451Q_DR_100_HZ (0B011<<3)
+    #define MMA8451Q_DR_50_HZ  (0B100<<3)
+
+#define F_STATUS 0x00 //FIFO status (same address as STATUS when FIFO is enabled)
+
+    #define F_STATUS_OVERFLOW (1<<7) //FIFO overflow, the oldest samples were lost
+    #define F_STATUS_WATERMARK (1<<6) //Watermark reached
+    #define F_STATUS_COUNT_MASK 0x3F //Number of samples in the FIFO (0 to 32)
+
+#define F_SETUP 0x09 //FIFO configuration (only writable in standby mode)
+
+    #define F_MODE_DISABLED (0B00<<6)
+    #define F_MODE_CIRCULAR (0B01<<6) //oldest sample is replaced when the FIFO is full
+    #define F_MODE_FILL     (0B10<<6) //FIFO stops when full
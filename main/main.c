@@ -12,13 +12,26 @@
 #include "spi_adxl355.h" //Header to control 20 bit accelerometer
 #include "i2c_mma8451q.h" //14 bit accelerometer header
 #include "i2c_ds3231.h" //real time clock header
+#include "epoch_time.h" //UTC microseconds (epoch_us), text only in logs
 
 #include "timer_conf.h" //Timer configuration 
 #include "sd_config.h" //SD functions and configurations
 
 #include "wifi_functions.h" //Wifi functions and configurations
 #include "http_functions.h" //Http functions 
-#include "sntp_config.h" //to update date and time by internet 
+#include "sntp_config.h" //time service: DS3231 on UTC with SNTP, station time and its uncertainty
+#include "sample_ring.h" //lock-free rings for sensor samples
+#include "adxl355_fifo.h" //ADXL355 FIFO decoder
+#include "mcp356x_drdy.h" //MCP356x data ready timestamps
+#include "mcp356x_scan.h" //MCP356x SCAN channels demultiplexer
+#include "sample_rate.h" //sample rate table (sensor settings per rate)
+#include "decimator.h" //anti-alias filter and downsampling (DECIMATION_RATIO)
+#include "packet_layout.h" //packet offsets (compile time)
+#include "packet_duration.h" //items and buffers of the short packets
+#include "packet_header.h" //CONTROL_BYTES (header version 4)
+#include "packet_codec.h" //Steim compressed packets and miniSEED records
+#include "buffer_pool.h" //packet buffers shared by WiFi and SD (reference count per sink)
+#include "clock_discipline.h" //sample timer phase locked to the DS3231 SQW pin
 
 
 /*-=-=-=-=-=-=-=-=-=-=- FreeRTOS headers -=-=-=-=-=-=-=-=-=-=*/
@@ -29,6 +42,8 @@
 #include "freertos/queue.h" //queues manager header
 #include "freertos/semphr.h" //semaphores manager header
 #include "nvs_flash.h"
+#include "nvs.h"
+#include "xtensa/core-macros.h" //CPU cycle counter
 
 
 
@@ -38,35 +53,213 @@
 
 char * TAG = "MAIN";
 
-//Semaphore handler to notify rtc task when has to look for date and time
-SemaphoreHandle_t semaphore_rtc_ds3231 = NULL;
+/*-=-=-=-=-=-=-=-=-=-=- Sample rings -=-=-=-=-=-=-=-=-=-=*/
+/*
+Sensor tasks push every sample into a lock-free ring (sample_ring.h) and 
+fill_buffer_with_sensor_task drains them in batches. No kernel call is done 
+per sample, the consumer only wakes every SAMPLE_RING_DRAIN_MS.
+*/
+#define SAMPLE_RING_CAPACITY 512  //Maximum number of samples per ring (power of 2), 5.12 seconds at 100 Hz
+#define SAMPLE_RING_BATCH 64  //Maximum number of samples taken from every ring at once
+#define SAMPLE_RING_DRAIN_MS 100  //Time that the consumer sleeps when the rings don't have samples 
 
-/*-=-=-=-=-=-=-=-=-=-=- Queues -=-=-=-=-=-=-=-=-=-=*/
-//2500
-#define MAX_NUM_MSG 700  //Maximum number of messages per queue 
 #define BYTES_PER_MSG_16_BIT 2  //To store 16 bits of information per message
 #define BYTES_PER_MSG_24_BIT 3  //To store 24 bits of information per message
 
+#define BYTES_SAMPLE_MMA8451Q (BYTES_PER_MSG_16_BIT*3) //16 bit per message (only 14 used) per channel considering 3 channels
+#define BYTES_SAMPLE_ADXL355 (BYTES_PER_MSG_24_BIT*3) //24 bit per message (only 20 used) per channel considering 3 channels
+#define BYTES_SAMPLE_MCP3561 (BYTES_PER_MSG_24_BIT*MCP356X_SCAN_CHANNELS) //24 bit per message (24 used) per SCAN channel, stored with its timestamp (mcp356x_sample_t)
+
+//position of every sensor sample in packet_item_t (the geophone channels start at 0)
+#define PACKET_ITEM_ADXL355 offsetof(packet_item_t,adxl355_x)
+#define PACKET_ITEM_MMA8451Q offsetof(packet_item_t,mma8451q_x)
+_Static_assert(PACKET_ITEM_ADXL355==BYTES_SAMPLE_MCP3561, "packet_item_t: geophone channels must be first");
+_Static_assert(PACKET_ITEM_MMA8451Q==BYTES_SAMPLE_MCP3561+BYTES_SAMPLE_ADXL355, "packet_item_t: ADXL355 axes must be before MMA8451Q axes");
+
+//Ring to save values of 14 BIT accelerometer
+sample_ring_t ring_mma8451q;
+uint8_t ring_mma8451q_storage[SAMPLE_RING_CAPACITY*BYTES_SAMPLE_MMA8451Q];
+
+//Ring to save values of 20 BIT accelerometer
+sample_ring_t ring_adxl355;
+uint8_t ring_adxl355_storage[SAMPLE_RING_CAPACITY*BYTES_SAMPLE_ADXL355];
+
+//Ring to save values of 24 BIT ADC mcp3561
+sample_ring_t ring_adc_mcp3561;
+mcp356x_sample_t ring_adc_mcp3561_storage[SAMPLE_RING_CAPACITY];
+
+/*
+The three rings are read together (sensor_rings_pop), one item of each one is one item of the
+packet. In TIMER mode every sensor is read at the same tick. A sensor in FIFO mode (or in TIMER
+mode with the MCP3561 in DRDY mode) has its own clock: its ring follows the MCP3561 ring (the
+timestamps of the packet) and some samples are dropped or repeated to keep them aligned
+(sample_ring_follow)
+*/
+#define RING_FOLLOWS_ADXL355 (ADXL355_ACQUISITION_MODE==ADXL355_MODE_FIFO || MCP356X_ACQUISITION_MODE==MCP356X_MODE_DRDY)
+#define RING_FOLLOWS_MMA8451Q (MMA8451Q_ACQUISITION_MODE==MMA8451Q_MODE_FIFO || MCP356X_ACQUISITION_MODE==MCP356X_MODE_DRDY)
+
+typedef struct {
+    sample_ring_t *mcp3561;   //reference ring
+    sample_ring_t *adxl355;
+    sample_ring_t *mma8451q;
+    uint8_t last_adxl355[BYTES_SAMPLE_ADXL355];   //last samples taken (repeated by a slip)
+    uint8_t last_mma8451q[BYTES_SAMPLE_MMA8451Q];
+} sensor_rings_t;
+
+/*
+With DECIMATION_RATIO > 1 decimation_task drains the sensor rings and pushes the filtered
+samples into the decimated rings, fill_buffer_with_sensor_task reads RING_TO_BUFFER_xxx
+*/
+#if DECIMATION_RATIO>1
+#define DECIMATED_RING_CAPACITY 128 //Maximum number of samples per decimated ring (power of 2)
+
+sample_ring_t ring_dec_mma8451q;
+uint8_t ring_dec_mma8451q_storage[DECIMATED_RING_CAPACITY*BYTES_SAMPLE_MMA8451Q];
+
+sample_ring_t ring_dec_adxl355;
+uint8_t ring_dec_adxl355_storage[DECIMATED_RING_CAPACITY*BYTES_SAMPLE_ADXL355];
+
+sample_ring_t ring_dec_adc_mcp3561;
+mcp356x_sample_t ring_dec_adc_mcp3561_storage[DECIMATED_RING_CAPACITY];
+
+#define RING_TO_BUFFER_MCP3561 ring_dec_adc_mcp3561
+#define RING_TO_BUFFER_ADXL355 ring_dec_adxl355
+#define RING_TO_BUFFER_MMA8451Q ring_dec_mma8451q
+#else
+#define RING_TO_BUFFER_MCP3561 ring_adc_mcp3561
+#define RING_TO_BUFFER_ADXL355 ring_adxl355
+#define RING_TO_BUFFER_MMA8451Q ring_mma8451q
+#endif
+
+
+/*-=-=-=-=-=-=-=-=-=-=- Acquisition time -=-=-=-=-=-=-=-=-=-=*/
+/*
+Time between the timer tick and the end of the sensor reads (microseconds), 
+printed and cleared by full_buffer_selection_go_to_task. With ACQUISITION_THREE_TASKS 
+every timer task has its own statistics, with ACQUISITION_SINGLE_TASK only 
+acquisition_task is measured.
+*/
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t count;
+} acquisition_time_t;
+
+#define ACQ_TIME_MCP356X 0
+#define ACQ_TIME_ADXL355 1
+#define ACQ_TIME_MMA8451Q 2
+#define ACQ_TIME_SINGLE_TASK 3
+#define ACQ_TIME_TOTAL 4
+
+const char * acq_time_names[ACQ_TIME_TOTAL] = {"mcp3561 task","adxl355 task","mma8451q task","acquisition task"};
+acquisition_time_t acq_time[ACQ_TIME_TOTAL];
+
+//Adds the time since the last tick to the statistics, only the owner task writes them
+void acq_time_add(acquisition_time_t *stats){
+    uint32_t elapsed=(uint32_t)(timer_get_timestamp()-timer_get_last_tick());
+
+    if (stats->count==0 || elapsed<stats->min) stats->min=elapsed;
+    if (elapsed>stats->max) stats->max=elapsed;
+    stats->sum+=elapsed;
+    stats->count++;
+}
+
+
+/*-=-=-=-=-=-=-=-=-=-=- Decimation cost -=-=-=-=-=-=-=-=-=-=*/
+/*
+CPU cycles spent in decimator_push by decimation_task (DECIMATION_RATIO > 1), printed 
+and cleared by full_buffer_selection_go_to_task as cycles per input sample and channel.
+*/
+#define DECIMATION_CHANNELS (NUMBER_OF_SENSORS) //every channel of the packet
+
+typedef struct {
+    uint64_t cycles;
+    uint32_t inputs;
+} decimation_cost_t;
+
+decimation_cost_t decimation_cost;
+
+
+/*-=-=-=-=-=-=-=-=-=-=- Sample rate -=-=-=-=-=-=-=-=-=-=*/
+/*
+The sample rate can be changed without a reflash with "sample_rate=" in STATION_CONFIG_FILE
+of the SD card (sd_config.h, read at every mount): sample_rate_request() checks the rate 
+against the table (sample_rate.h) and fill_buffer_with_sensor_task applies it before starting
+the next buffer (a packet never mixes two rates). The rate is stored in NVS and loaded in the
+next boot.
+
+Every change increments sample_rate_generation, the sensor tasks compare it with 
+their own copy after every wake up and reprogram their sensor with sample_rate_entry.
+
+The rate is the packet rate, the sensors and the timer use the row of the acquisition 
+rate (rate*DECIMATION_RATIO), SAMPLE_RATE_PACKET gives the packet rate back.
+*/
+#define NVS_NAMESPACE_CONFIG "config" //NVS namespace of the station configuration
+#define NVS_KEY_SAMPLE_RATE "sample_rate" //sample rate in Hz (uint16)
+
+#define SAMPLE_RATE_ADXL355_FIFO (ADXL355_ACQUISITION_MODE==ADXL355_MODE_FIFO)
+#define SAMPLE_RATE_MMA8451Q_FIFO (MMA8451Q_ACQUISITION_MODE==MMA8451Q_MODE_FIFO)
+
+const sample_rate_entry_t * volatile sample_rate_entry=NULL; //current rate and sensor settings
+volatile uint32_t sample_rate_generation=0; //incremented every time the rate changes
+volatile uint16_t sample_rate_pending=0; //rate to apply in the next buffer (0 = no change)
 
-//Queue to save values of 14 BIT accelerometer
-xQueueHandle queue_mma8451q;
+#define SAMPLE_RATE_PACKET(entry) ((entry)->rate/DECIMATION_RATIO) //packet rate of a table row
 
-//Queue to save values of 20 BIT accelerometer
-xQueueHandle queue_adxl355;
 
-//Queue to save values of 24 BIT ADC mcp3561
-xQueueHandle queue_adc_mcp3561;
+/*-=-=-=-=-=-=-=-=-=-=- Packet duration -=-=-=-=-=-=-=-=-=-=*/
+/*
+A packet leaves the station once it is full, with ITEMS_PER_SENSOR items at 100 Hz its first
+sample is 12 s old (too late for early warning). The duration of the packets can be changed
+without a reflash ("packet_duration_ms=" in STATION_CONFIG_FILE): packet_duration_request() checks
+it and fill_buffer_with_sensor_task applies it before starting the next buffer, like the sample
+rate (stored in NVS, loaded in the next boot).
+
+Items of a packet = rate*duration, between 1 and ITEMS_PER_SENSOR (packet_duration.h, also
+tested on the host). The buffers always have PACKET_BUFFER_SIZE bytes (ITEMS_PER_SENSOR items),
+whatever the duration: the backlog records written
+with a longer duration (or a higher rate) before a change still fit in the buffers of the SD 
+read path, so a new duration never makes the SD backlog unreadable. A new duration (or rate) is
+used with the next packet.
+
+The ITEMS of the header give the layout of every packet (packet_layout_init), the server and
+packet_codec.c read it from there. Overhead of every packet (CONTROL_BYTES, IDs, START_TIME and
+DATETIME_TIME, 57 bytes with 7 sensors) at 100 Hz: 0.2% at 12 s, 2.8% at 1 s, 5.4% at 0.5 s.
+http_post_send keeps the connection open between packets, so the TLS handshake isn't paid per packet.
+*/
+#define NVS_KEY_PACKET_DURATION "packet_ms" //duration of a packet in ms (uint16)
+
+volatile uint16_t packet_duration_ms=PACKET_DURATION_MS; //current duration
+volatile uint16_t packet_duration_pending=0; //duration to apply in the next buffer (0 = no change)
+packet_layout_t packet_layout; //layout of the packet being filled (fill_buffer_with_sensor_task)
+
+
+/*-=-=-=-=-=-=-=-=-=-=- Packet sequence -=-=-=-=-=-=-=-=-=-=*/
+/*
+SEQUENCE of the packet header (packet_header.h), +1 every packet of sensor data. To not 
+write the flash every packet, NVS stores the end of a block of PACKET_SEQUENCE_BLOCK 
+values; after a reboot the sequence continues at the end of the last block (a jump that
+the server sees as a reboot, never a repeated SEQUENCE).
+*/
+#define NVS_KEY_PACKET_SEQUENCE "packet_seq" //first SEQUENCE not reserved (uint32)
+#define PACKET_SEQUENCE_BLOCK 256 //SEQUENCE values reserved every NVS write (~50 minutes at 12 s per packet)
+
+uint32_t packet_sequence=0; //SEQUENCE of the next packet
+uint32_t packet_sequence_reserved=0; //first SEQUENCE not reserved in NVS
 
 
+/*-=-=-=-=-=-=-=-=-=-=- Queues -=-=-=-=-=-=-=-=-=-=*/
+
 //Queue to save EMPTY buffer pointers
 xQueueHandle queue_empty_buffers;
 
 //Queue to save FULL buffer pointers
 xQueueHandle queue_full_buffers;
 
-//Queue to save DATE and TIME in ascii format YY MM DD HH mm SS 
-xQueueHandle queue_date_time;
 
+//Queue to save the buffer that will be compressed (PAYLOAD_ENCODING)
+xQueueHandle queue_to_encode;
 
 //Queue to save the buffer that will be stored in SD card
 xQueueHandle queue_to_save_in_sd;
@@ -74,8 +267,12 @@ xQueueHandle queue_to_save_in_sd;
 //Queue to save the buffer that will be send over WiFi
 xQueueHandle queue_to_send_wifi;
 
-//Queue to store filename lists of files in SD card
-xQueueHandle queue_filename_list;
+//Queue of the SEQ of the backlog records uploaded (acked by fill_buffer_with_sd_task)
+xQueueHandle queue_backlog_ack;
+
+//Queues of cold buffers (PSRAM_POOL): free ones, and the ones with a packet (oldest first). NULL without cold buffers
+xQueueHandle queue_cold_empty;
+xQueueHandle queue_cold_full;
 
 
 /*-=-=-=-=-=-=-=-=-=-=- Buffers =-=-=-=-=-=-=-=-=-=-=*/
@@ -85,11 +282,12 @@ General structure
 Number of sensors = ADC + MMA8451Q (XYZ) + ADXL355 (XYZ) = 7 sensors 
 
 Maximum allowed buffer_size = 27025 bytes (higher the value causes an error using wifi communication).
-Note: this value is an stimate.
+The compiler checks it (PACKET_MAX_BYTES, packet_layout.h), TIMING_BYTES included: that's why
+ITEMS_PER_SENSOR is 1200 instead of the 1500 of the first format below.
 
-Maximum time allowed (assuming 100 Hz sampling rate, 1500 items per sensor and 7 sensors) 
+Maximum time allowed (assuming 100 Hz sampling rate, 1200 items per sensor and 7 sensors) 
                                        =  (ITEMS_PER_SENSOR)/(SAMPLE RATE)
-                                       =  (1500)/(100) = 15 seconds per buffer
+                                       =  (1200)/(100) = 12 seconds per buffer
 
                  =============================================================================================================================               
                  ||                                         EXAMPLE BUFFER                                                                  ||        
@@ -109,20 +307,56 @@ NOTE: Every sensor has an ID that helps the server to identify the sensor name a
 The last byte (STATUS BYTE) is just for internal microcontroller processes and is not sent. 
 If STATUS BYTE = 0 it means that the buffer was filled with current information of the sensors.
 If STATUS BYTE = 1 it means that the buffer was filled with SD information (not current information).
+After the STATUS BYTE (not sent either) the buffers filled with SD information keep the SEQ of
+their record in the backlog index (uint32, backlog_index.h), it is acked when the packet is uploaded.
 
 TOTAL BYTES that will be sent:   18 + 4501 + 4501 + 4501 + 4501 + 3001 + 3001 + 3001  
                                  = 27025 bytes
 
 TOTAL BYTES (considering STATUS byte)= 27026
                      
-                      -------------------------------------------------------------------------------------------------------------------------------------
-Where CONTROL_BYTES = | ITEMS_PER_SENSOR (2 bytes) |  NUMBER_OF_SENSORS (1 byte) | SAMPLE_RATE (2 bytes) | ID_STATION (1 byte) |  LOCAL_DATETIME(12 bytes) |                      
-                      -------------------------------------------------------------------------------------------------------------------------------------                
-      CONTROL_BYTES = 2 + 1 + 2 + 1 + 12 = 18 bytes
+(first format, 18 CONTROL_BYTES, 1500 items and no TIMING_BYTES)
+
+                      ----------------------------------------------------------------------------------------------------------------------------
+Where CONTROL_BYTES = | MAGIC "DL" (2 bytes) | VERSION (1 byte) | PAYLOAD ENCODING (1 byte) | ITEMS_PER_SENSOR (2 bytes) | NUMBER_OF_SENSORS (1 byte) |
+                      | ID_STATION (1 byte) | SAMPLE_RATE (2 bytes) | SEQUENCE (4 bytes) | START_US (8 bytes) | TIME_QUALITY (4 bytes) |
+                      | LENGTH (4 bytes) | CRC (4 bytes) |
+                      ----------------------------------------------------------------------------------------------------------------------------
+      CONTROL_BYTES = 2 + 1 + 1 + 2 + 1 + 1 + 2 + 4 + 8 + 4 + 4 + 4 = 34 bytes (header version 4, packet_header.h)
+
+Note: PAYLOAD ENCODING 0 = raw, this layout; 1 = Steim-1, 2 = Steim-2 compressed sensor blocks;
+3 = bit packed, 4 = delta packed sensor blocks, see packet_codec.h.
+With PAYLOAD_ENCODING = PACKET_ENCODING_MSEED3 the packet is replaced by miniSEED 3 records
+(one per sensor, mseed.h).
+
+Note: SEQUENCE is +1 every packet (stored in NVS, it continues after a reboot), START_US is the 
+UTC time of the first sample (microseconds since 1970, epoch_time.h; 0 if the DS3231 couldn't be
+read), TIME_QUALITY is its uncertainty in microseconds (SNTP, time_sync.h; 0xFFFFFFFF if the
+clock was never synced) and CRC (CRC-32C) covers the header and the LENGTH bytes after it. 
+The same packet sent twice (WiFi retries, SD copies) has the same SEQUENCE.
+
+After the last sensor there are TIMING_BYTES (before the STATUS BYTE), all values big endian:
 
-Note: LOCAL_DATETIME if not used 12 bytes are equal to 0 (size defined in i2c_ds3231.h file). 
-If used this date and time are sampled when the first sensor byte is sampled, the format is:
-YY MM DD HH mm SS 
+                      -------------------------------------------------------------------------------------
+Where TIMING_BYTES =  | START_TIME (8 bytes) | DATETIME_TIME (8 bytes) | INTERVAL_RESIDUALS (2*ITEMS_PER_SENSOR) |
+                      -------------------------------------------------------------------------------------
+      TIMING_BYTES = 8 + 8 + 2*1200 = 2416 bytes
+
+START_TIME:         sample timer value (microseconds since conf_timer) of the first sample. 
+DATETIME_TIME:      sample timer value of the last anchor of the station clock, the SQW edge of the 
+                    DS3231 second that was read (sntp_config.h). START_US is the station clock at 
+                    START_TIME: time at that edge + (START_TIME - DATETIME_TIME) without the drift 
+                    of the timer (soft_clock.h). Without SQW edges it is the time of the read 
+                    (TIME_QUALITY + 1 s).
+INTERVAL_RESIDUALS: int16 per sample, (time since the previous sample - 1/SAMPLE_RATE) in 
+                    microseconds, 0 for the first sample (+-32767 us maximum). 
+
+Sample time of item N = START_TIME + N/SAMPLE_RATE + (sum of INTERVAL_RESIDUALS 0..N), the
+timestamps come from the 24 bit ADC samples (timer tick latched in the TIMER_ISR or IRQ pin).
+
+With SAMPLE_CLOCK_DISCIPLINE the ticks are phase locked to the seconds of the DS3231 (SQW pin,
+clock_discipline.h): RATE ticks per RTC second and one of them on every second. The timer values
+are still APB microseconds, so the INTERVAL_RESIDUALS also show the trim of the period (a few us).
 
 
 
@@ -134,86 +368,331 @@ it means...
 
 #define STATUS_BYTE_SD_DATA 1     //The buffer was filled with SD information
 #define STATUS_BYTE_SENSOR_DATA 0 //The buffer was filled with sensor's information (current information)
+#define BUFFER_STATUS_BYTES 5     //STATUS BYTE + SEQ of the backlog record (after max_buffer_size)
 
 
 
-#define CONTROL_BYTES 18 //Number of control bytes
-#define ITEMS_PER_SENSOR 1500  //Maximum number of samples (1 item = 1 sample) per sensor   
-#define NUMBER_OF_SENSORS 7  //Number of sensors
+/*CONTROL_BYTES, ITEMS_PER_SENSOR, TIMING_BYTES, the sensor IDs and the bytes per item of 
+every sensor are defined in packet_layout.h (PACKET_CHANNELS)*/
+#define NUMBER_OF_SENSORS PACKET_CHANNEL_COUNT  //Number of sensors (7 with one geophone channel)
 //SAMPLE_RATE defined in timer_conf.h
 #define ID_STATION 'A'  //Station ID 
 
+/*Payload of the packets sent and stored (packet_codec.h): PACKET_ENCODING_RAW, PACKET_ENCODING_STEIM1,
+PACKET_ENCODING_STEIM2, PACKET_ENCODING_PACKED (20 bit ADXL355 and 14 bit MMA8451Q samples without
+the bits that are always 0), PACKET_ENCODING_DELTA (differences with the bits of the biggest one 
+every 128 samples, best for quiet sites) or PACKET_ENCODING_MSEED3 (miniSEED 3 records, Steim-2). Compressed packets 
+are smaller but have a variable size (the server must decode them), if a packet doesn't get smaller
+it is sent raw*/
+#define PAYLOAD_ENCODING PACKET_ENCODING_RAW
+
+#define MSEED_NETWORK "XX" //FDSN network code of the miniSEED records (XX = not registered)
+
 /*Maximum size of buffer
 
-In this example there are 4 sensors of 24 bit and 3 sensors of 16 bit. For this case,
-max_buffer_size = 27025 bytes.
+In this example there are 4 sensors of 24 bit and 3 sensors of 16 bit plus TIMING_BYTES (1200 items,
+header version 4). For this case, max_buffer_size = 24057 bytes.
 
-max_buffer_size calculated in buffer_general_calc function
+max_buffer_size = PACKET_BUFFER_SIZE (packet_duration.h) with every packet duration, a shorter
+packet only uses the first PACKET_SIZE_ITEMS(items) bytes
 */
-uint16_t max_buffer_size= 0;
-
-//How many bytes considering every sensor ex: 3 bytes sensor 1, 2 bytes sensor 2, this variable will be equal to 5 (calculated in general_calc function)
-uint16_t total_bytes_sensors= 0;
+uint16_t max_buffer_size= PACKET_BUFFER_SIZE;
 
 /*This program can switch between empty and full buffers. Empty buffers will be filled and Full buffers
   will be sent over WiFi. Once one buffer is sent it will be on the Empty Buffer list again.
+
+  The buffers come from a pool (buffer_pool.h): one full buffer can be uploaded and stored in SD 
+  at the same time, it is on the Empty Buffer list again when every sink (WiFi, SD) released it.
 */
-#define NUMBER_OF_BUFFERS 3 //Number of buffers that will be considered in the empty buffer list at the begining
+#define NUMBER_OF_BUFFERS 3 //Number of buffers that will be considered in the empty buffer list at the begining (packets of ITEMS_PER_SENSOR items)
 
+uint16_t number_of_buffers=NUMBER_OF_BUFFERS; //hot buffers
 
-/*
-ID of each sensor
-0 = SM-24 (ADC 24 BITS mcp3561)
-1 = ADXL355 X axis 
-2 = ADXL355 Y axis
-3 = ADXL355 Z axis
-4 = mma8451q X axis
-5 = mma8451q Y axis
-6 = mma8451q Z axis
-
-... define more if neccesary
-*/
+#if PAYLOAD_ENCODING!=PACKET_ENCODING_RAW
+#define BUFFER_POOL_BUFFERS (number_of_buffers+1) //+ spare buffer of encode_buffer_task
+#else
+#define BUFFER_POOL_BUFFERS number_of_buffers
+#endif
 
-//declare sensors in the same order that will be sent
-const uint8_t    id_sensor[] = {0,1,2,3,4,5,6}; 
+/*1 = cold buffers in PSRAM (needs CONFIG_ESP32_SPIRAM_SUPPORT): the free PSRAM (minus PSRAM_POOL_RESERVE)
+is split in buffers at boot, they keep the packets that can't be sent now (WiFi lost without SD card, 
+slow SD card) so the hot buffers in internal RAM are free for the sensors again.
+4 MB of PSRAM are ~160 packets, ~32 minutes at 12 s per packet (~3 minutes with 1 s packets, the
+buffers always have PACKET_SIZE bytes)*/
+#define PSRAM_POOL 1
+#define PSRAM_POOL_RESERVE (256*1024) //bytes of PSRAM left for the rest of the firmware
+#define SINK_BUSY_WAITING 1 //a sink (WiFi, SD) with this number of packets waiting is busy, hot packets go to cold buffers
 
-//declare resolution in bytes of each sensor in the same order that will be sent
-const uint8_t bytes_p_item[] = {3,3,3,3,2,2,2}; 
+/*1 = every packet uploaded is also stored in the log of ARCHIVE_FOLDER (written while it is uploaded)
+and the records of the log of FOLDER are copied to it once they are uploaded, so the SD card keeps
+every packet. 0 = only the packets that couldn't be uploaded are stored (FOLDER)*/
+#define SD_ARCHIVE_PACKETS 1
 
-//declare sensor offset in bytes (for buffer making)
-uint16_t offset_buffer_per_sensor[NUMBER_OF_SENSORS]; 
+/*Seconds without backlog records to take while some of the taken ones aren't acked, then the
+records taken and not uploaded (buffers lost, SD_LOG_ERROR) are taken again (backlog_index_rewind)*/
+#define SD_BACKLOG_RETRY_S 60
 
+buffer_pool_t buffer_pool; //packet buffers (max_buffer_size + STATUS BYTE and SEQ each)
+
+//Buffer pool metrics (modified by full_buffer_selection_go_to_task)
+typedef struct {
+    uint32_t spilled;   //hot packets copied to cold buffers
+    uint32_t recycled;  //cold packets replaced by newer ones (lost)
+    uint32_t dropped;   //packets without sink nor buffer (lost)
+    uint16_t cold_max;  //maximum cold buffers used at once
+} pool_metrics_t;
+
+pool_metrics_t pool_metrics;
 
 
 
 /*======================================================================
- * OFFSET BUFFER CALCULATION FUNCTION
+ * SAMPLE RATE FUNCTIONS
  * 
- * Prepare offset buffers per sensor and calculates the maximum number
- * of bytes of the buffer according the previous definitions and 
- * configurations
+ * sample_rate_init: loads the rate from NVS (SAMPLE_RATE the first time)
+ * sample_rate_request: validates a new rate, returns false if not supported
+ * sample_rate_apply: changes the timer period and notifies the sensor tasks
  ======================================================================*/
-void buffer_general_calc(void){
-    //calculates de maximum number of bytes in the buffer 
-    max_buffer_size= CONTROL_BYTES+NUMBER_OF_SENSORS;
+//row of the acquisition rate (rate*DECIMATION_RATIO) or NULL
+const sample_rate_entry_t * sample_rate_acquisition_entry(uint16_t rate){
+    if ((uint32_t)rate*DECIMATION_RATIO>UINT16_MAX){
+        return NULL;
+    }
+    return sample_rate_lookup(rate*DECIMATION_RATIO);
+}
 
-    offset_buffer_per_sensor[0]=CONTROL_BYTES+1; //Control buffers + ID (Sensor 1)
-    
-    for(int each_sensor=0;each_sensor<NUMBER_OF_SENSORS-1;each_sensor++){
-        //SENSOR N
-        offset_buffer_per_sensor[each_sensor+1]=offset_buffer_per_sensor[each_sensor]+ 1 + bytes_p_item[each_sensor]*ITEMS_PER_SENSOR;  
+bool sample_rate_valid(uint16_t rate){
+    const sample_rate_entry_t *entry=sample_rate_acquisition_entry(rate);
+
+    if (!sample_rate_supported(entry,SAMPLE_RATE_ADXL355_FIFO,SAMPLE_RATE_MMA8451Q_FIFO)){
+        return false;
+    }
+    //every SCAN channel has to be converted in one period
+    return sample_rate_mcp356x_osr(entry,MCP356X_DMCLK_HZ,MCP356X_SCAN_CHANNELS)!=0;
+}
+
+void sample_rate_init(void){
+    nvs_handle_t nvs;
+    uint16_t rate=SAMPLE_RATE;
+
+    if (nvs_open(NVS_NAMESPACE_CONFIG, NVS_READONLY, &nvs)==ESP_OK){
+        if (nvs_get_u16(nvs, NVS_KEY_SAMPLE_RATE, &rate)!=ESP_OK){
+            rate=SAMPLE_RATE;
+        }
+        nvs_close(nvs);
+    }
+
+    if (!sample_rate_valid(rate)){
+        ESP_LOGW(TAG,"Sample rate %d Hz not supported, using %d Hz",rate,SAMPLE_RATE);
+        rate=SAMPLE_RATE;
+    }
+    if (!sample_rate_valid(rate)){
+        //the default rate doesn't match the FIFO modes, first rate of the table that works
+        for(uint8_t i=0;i<sample_rate_table_size();i++){
+            rate=SAMPLE_RATE_PACKET(sample_rate_table_entry(i));
+            if (sample_rate_valid(rate)) break;
+        }
+        ESP_LOGE(TAG,"SAMPLE_RATE not supported by the acquisition modes, using %d Hz",rate);
+    }
+
+    sample_rate_entry=sample_rate_acquisition_entry(rate);
+    timer_set_period(sample_rate_timer_period(sample_rate_entry));
+    ESP_LOGI(TAG,"Sample rate %d Hz (acquisition %d Hz, timer period %d us)",rate,sample_rate_entry->rate,timer_get_period());
+}
+
+bool sample_rate_request(uint16_t rate){
+    if (!sample_rate_valid(rate)){
+        ESP_LOGW(TAG,"Sample rate %d Hz not supported",rate);
+        return false;
+    }
+    sample_rate_pending=rate;
+    return true;
+}
+
+void sample_rate_apply(uint16_t rate){
+    nvs_handle_t nvs;
     
-        //calculates de maximum number of bytes in the buffer
-        max_buffer_size = max_buffer_size + ITEMS_PER_SENSOR*bytes_p_item[each_sensor];
-        
-        //calculates total bytes considering 1 item and all sensors
-        total_bytes_sensors+=bytes_p_item[each_sensor];
-    } 
-    max_buffer_size = max_buffer_size + ITEMS_PER_SENSOR*bytes_p_item[NUMBER_OF_SENSORS-1];
-    total_bytes_sensors+=bytes_p_item[NUMBER_OF_SENSORS-1];
-
-    printf("Buffer calc function: max_buffer_size (without considering STATUS_BYTE) = %d\n",max_buffer_size);
-    printf("Buffer calc function: total_bytes_sensors = %d\n",total_bytes_sensors);
+    if (nvs_open(NVS_NAMESPACE_CONFIG, NVS_READWRITE, &nvs)==ESP_OK){
+        nvs_set_u16(nvs, NVS_KEY_SAMPLE_RATE, rate);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    else{
+        ESP_LOGW(TAG,"Sample rate: NVS not available, the rate will be lost after reboot");
+    }
+
+    sample_rate_entry=sample_rate_acquisition_entry(rate);
+    timer_set_period(sample_rate_timer_period(sample_rate_entry));
+    sample_rate_generation++;
+    ESP_LOGI(TAG,"Sample rate changed to %d Hz",rate);
+}
+
+
+
+/*======================================================================
+ * PACKET DURATION FUNCTIONS
+ * 
+ * packet_duration_init: loads the duration from NVS (PACKET_DURATION_MS the first time)
+ * packet_duration_request: validates a new duration, returns false if not supported
+ * packet_duration_apply: stores the duration (fill_buffer_with_sensor_task)
+ * packet_layout_update: layout of the next packet (current rate and duration)
+ * station_config_request: requests the settings of the SD card (STATION_CONFIG_FILE)
+ ======================================================================*/
+void packet_layout_update(void){
+    packet_layout_init(&packet_layout,packet_items(SAMPLE_RATE_PACKET(sample_rate_entry),packet_duration_ms));
+}
+
+void packet_duration_init(void){
+    nvs_handle_t nvs;
+    uint16_t duration_ms=PACKET_DURATION_MS;
+
+    if (nvs_open(NVS_NAMESPACE_CONFIG, NVS_READONLY, &nvs)==ESP_OK){
+        if (nvs_get_u16(nvs, NVS_KEY_PACKET_DURATION, &duration_ms)!=ESP_OK){
+            duration_ms=PACKET_DURATION_MS;
+        }
+        nvs_close(nvs);
+    }
+    if (!packet_duration_valid(duration_ms)){
+        ESP_LOGW(TAG,"Packet duration %d ms not supported, using %d ms",duration_ms,PACKET_DURATION_MS);
+        duration_ms=PACKET_DURATION_MS;
+    }
+    packet_duration_ms=duration_ms;
+
+    //layout at the current rate (after sample_rate_init)
+    packet_layout_update();
+    ESP_LOGI(TAG,"Packet duration %d ms (%d items per sensor, %d of the %d bytes of the buffers)",
+        duration_ms,packet_layout.items,packet_layout.size,max_buffer_size);
+}
+
+bool packet_duration_request(uint16_t duration_ms){
+    if (!packet_duration_valid(duration_ms)){
+        ESP_LOGW(TAG,"Packet duration %d ms not supported (%d..%d ms)",duration_ms,PACKET_DURATION_MIN_MS,PACKET_DURATION_MAX_MS);
+        return false;
+    }
+    packet_duration_pending=duration_ms;
+    return true;
+}
+
+void packet_duration_apply(uint16_t duration_ms){
+    nvs_handle_t nvs;
+
+    if (nvs_open(NVS_NAMESPACE_CONFIG, NVS_READWRITE, &nvs)==ESP_OK){
+        nvs_set_u16(nvs, NVS_KEY_PACKET_DURATION, duration_ms);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    else{
+        ESP_LOGW(TAG,"Packet duration: NVS not available, the duration will be lost after reboot");
+    }
+
+    packet_duration_ms=duration_ms;
+    if (packet_items_limited(SAMPLE_RATE_PACKET(sample_rate_entry),duration_ms)){
+        ESP_LOGW(TAG,"Packet duration changed to %d ms, limited to %d items per sensor",duration_ms,ITEMS_PER_SENSOR);
+    }
+    else{
+        ESP_LOGI(TAG,"Packet duration changed to %d ms",duration_ms);
+    }
+}
+
+/*Settings of the SD card (STATION_CONFIG_FILE), only the ones that change the current values
+are requested (the file is read again at every mount)*/
+void station_config_request(const sd_station_config_t *config){
+    if (config->sample_rate!=0 && config->sample_rate!=SAMPLE_RATE_PACKET(sample_rate_entry)){
+        sample_rate_request(config->sample_rate);
+    }
+    if (config->packet_duration_ms!=0 && config->packet_duration_ms!=packet_duration_ms){
+        packet_duration_request(config->packet_duration_ms);
+    }
+}
+
+
+
+/*======================================================================
+ * PACKET SEQUENCE FUNCTIONS
+ * 
+ * packet_sequence_init: continues after the last block reserved in NVS
+ * packet_sequence_next: SEQUENCE of a new packet (only fill_buffer_with_sensor_task)
+ ======================================================================*/
+static void packet_sequence_reserve(void){
+    nvs_handle_t nvs;
+
+    packet_sequence_reserved=packet_sequence+PACKET_SEQUENCE_BLOCK;
+    if (nvs_open(NVS_NAMESPACE_CONFIG, NVS_READWRITE, &nvs)==ESP_OK){
+        nvs_set_u32(nvs, NVS_KEY_PACKET_SEQUENCE, packet_sequence_reserved);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    else{
+        ESP_LOGW(TAG,"Packet sequence: NVS not available, the sequence restarts after reboot");
+    }
+}
+
+void packet_sequence_init(void){
+    nvs_handle_t nvs;
+
+    packet_sequence=0;
+    if (nvs_open(NVS_NAMESPACE_CONFIG, NVS_READONLY, &nvs)==ESP_OK){
+        if (nvs_get_u32(nvs, NVS_KEY_PACKET_SEQUENCE, &packet_sequence)!=ESP_OK){
+            packet_sequence=0;
+        }
+        nvs_close(nvs);
+    }
+    packet_sequence_reserve();
+    ESP_LOGI(TAG,"Packet sequence starts at %u",packet_sequence);
+}
+
+uint32_t packet_sequence_next(void){
+    if (packet_sequence>=packet_sequence_reserved){
+        packet_sequence_reserve();
+    }
+    return packet_sequence++;
+}
+
+
+/*======================================================================
+ * HEADER FUNCTIONS
+ ======================================================================*/
+//CONTROL_BYTES of a raw packet (header version 4), LENGTH and CRC are written by packet_header_seal
+void set_buffer_header(char * buffer, const packet_layout_t * layout, uint32_t sequence, int64_t start_us, uint32_t time_quality){
+    packet_header_t header;
+
+    header.encoding=PACKET_ENCODING_RAW;
+    header.items=layout->items;
+    header.sensors=NUMBER_OF_SENSORS;
+    header.station=ID_STATION;
+    header.rate=SAMPLE_RATE_PACKET(sample_rate_entry);
+    header.sequence=sequence;
+    header.start_us=start_us;
+    header.time_quality=time_quality;
+    packet_header_write(buffer,&header);
+}
+
+//Sensor IDs, a compressed or miniSEED packet (SD or encode_buffer_task) overwrites them
+void set_buffer_raw_layout(char * buffer, const packet_layout_t * layout){
+    for (int8_t i=0;i<NUMBER_OF_SENSORS;i++){
+        buffer[layout->channels[i].id_offset]=layout->channels[i].id;
+    }
+}
+
+
+/*======================================================================
+ * TIMING FUNCTIONS
+ * 
+ * Big endian values of TIMING_BYTES
+ ======================================================================*/
+void set_buffer_u64(char * buffer, uint64_t value){
+    for(int8_t i=7;i>=0;i--){
+        buffer[i]=(int8_t)(value & 0xFF);
+        value>>=8;
+    }
+}
+
+//residual of one sample interval (microseconds), saturated to int16
+void set_buffer_residual(char * buffer, int64_t residual){
+    if (residual>INT16_MAX) residual=INT16_MAX;
+    if (residual<INT16_MIN) residual=INT16_MIN;
+    buffer[0]=(int8_t)(((uint16_t)residual & 0xFF00)>>8); //MBS
+    buffer[1]=(int8_t)((uint16_t)residual & 0x00FF); //LBS
 }
 
 
@@ -225,66 +704,93 @@ void buffer_general_calc(void){
  * values that doesn't change during the program's execution.
  ======================================================================*/
 void reset_buffer(char * buffer){
-    printf("Reset_buffer: Pointer %p and ITEMS_PER_SENSOR: %d\n",buffer,ITEMS_PER_SENSOR);
-
-    //to add sensor's ID to the empty buffer
-    uint16_t each_id=0;
-
-    //ITEMS PER SENSOR (2 bytes)
-    //buffer[0] = MSB ITEMS_PER_SENSOR
-    buffer[0]=(int8_t)((ITEMS_PER_SENSOR & 0xFF00)>>8); //MBS
-    //buffer[0]='I'; //TEST
-    //buffer[1] = LSB ITEMS_PER_SENSOR
-    buffer[1]=(int8_t)(ITEMS_PER_SENSOR & 0x00FF); //LBS
-    //buffer[1]='I'; //TEST
-    printf("Reset_buffer: Done (ITEMS_PER_SENSOR=%d)\n",ITEMS_PER_SENSOR);
-
-    //NUMBER OF SENSORS (1 byte)
-    //buffer[2] = Number of sensors 
-    buffer[2]=(int8_t)(NUMBER_OF_SENSORS);
-    //buffer[2]+=48; //TEST 
-    printf("Reset_buffer: Done (number_of_sensors=%d)\n",NUMBER_OF_SENSORS);
-
-    //SAMPLE RATE (2 bytes)
-    //buffer[3] = MSB 
-    buffer[3]=(int8_t)((SAMPLE_RATE & 0xFF00)>>8); //MBS
-    //buffer[3]='h'; //TEST
-    //buffer[4] = LSB 
-    buffer[4]=(int8_t)(SAMPLE_RATE & 0x00FF); //LBS
-    //buffer[4]='z'; //TEST
-    printf("Reset_buffer: Done (SAMPLE_RATE=%d)\n",SAMPLE_RATE);
-
-    //ID STATION (1 byte)
-    //buffer[5] = ID_STATION 
-    buffer[5]=(int8_t)(ID_STATION); //8 bits
-    printf("Reset_buffer: Done (ID_STATION=%d)\n",ID_STATION);
-
-    //LOCAL_DATETIME (12 bytes), not used, so equal to 0
-    buffer[6]=0; //Y
-    buffer[7]=0; //Y
-    buffer[8]=0; //M
-    buffer[9]=0;  //M
-    buffer[10]=0; //D
-    buffer[11]=0; //D
-    buffer[12]=0; //H
-    buffer[13]=0; //H
-    buffer[14]=0; //m
-    buffer[15]=0; //m
-    buffer[16]=0; //S
-    buffer[17]=0; //S
-    printf("Reset_buffer: Done (local_date_time=0)\n");
-
-    //SENSOR  
+    printf("Reset_buffer: Pointer %p and items per sensor: %d\n",buffer,packet_layout.items);
+
+    //CONTROL_BYTES (header version 4): ITEMS PER SENSOR, NUMBER OF SENSORS, ID STATION, SAMPLE RATE...
+    //SEQUENCE, START_US and TIME_QUALITY are written by fill_buffer_with_sensor_task with every packet
+    set_buffer_header(buffer,&packet_layout,0,0,PACKET_HEADER_QUALITY_UNKNOWN);
+    printf("Reset_buffer: Done (items per sensor=%d, number_of_sensors=%d, SAMPLE_RATE=%d, ID_STATION=%d)\n",
+        packet_layout.items,NUMBER_OF_SENSORS,SAMPLE_RATE_PACKET(sample_rate_entry),ID_STATION);
+
+    //SENSOR IDs
+    set_buffer_raw_layout(buffer,&packet_layout);
+
     for (int8_t i=0;i<NUMBER_OF_SENSORS;i++){
-        each_id = offset_buffer_per_sensor[i]-1;
-        buffer[each_id]=id_sensor[i];
-        //buffer[each_id]+=48; //TEST
-        printf("Reset_buffer: Done (buffer[%d]=sensor id %d)\n",each_id,id_sensor[i]);
+        //buffer[packet_layout.channels[i].id_offset]+=48; //TEST
+        printf("Reset_buffer: Done (buffer[%d]=sensor id %d)\n",packet_layout.channels[i].id_offset,packet_layout.channels[i].id);
     }
 }
 
 
 
+/*======================================================================
+ * BUFFER POOL FUNCTIONS
+ * 
+ * buffer_release: the sink is done with the buffer (packet delivered)
+ * buffer_abandon: the sink couldn't deliver the packet
+ * 
+ * The last sink sends the buffer to queue_empty_buffers, or to 
+ * queue_full_buffers if some sink abandoned it (selected again).
+ * Cold buffers go back to queue_cold_empty or queue_cold_full.
+ ======================================================================*/
+//allocators of the pool buffers: internal RAM (hot) and PSRAM (cold)
+void * buffer_pool_alloc_dram(size_t size){
+    return heap_caps_malloc(size, MALLOC_CAP_8BIT);
+}
+
+void * buffer_pool_alloc_psram(size_t size){
+    return heap_caps_malloc(size, MALLOC_CAP_SPIRAM|MALLOC_CAP_8BIT);
+}
+
+void buffer_release_result(char * buffer, uint32_t sink, int8_t result){
+    bool cold=(buffer_pool_tier(&buffer_pool,buffer)==BUFFER_TIER_COLD);
+
+    if (result==BUFFER_POOL_FREE){
+        xQueueSendToBack(cold?queue_cold_empty:queue_empty_buffers, &buffer,portMAX_DELAY);
+    }
+    else if (result==BUFFER_POOL_REDELIVER){
+        if (cold){
+            xQueueSendToFront(queue_cold_full, &buffer,portMAX_DELAY); //oldest packet
+        }
+        else{
+            xQueueSendToBack(queue_full_buffers, &buffer,portMAX_DELAY);
+        }
+    }
+    else if (result==BUFFER_POOL_ERROR){
+        ESP_LOGE(TAG,"Buffer pool: buffer %p released by sink 0x%x that didn't hold it",buffer,sink);
+    }
+}
+
+void buffer_release(char * buffer, uint32_t sink){
+    buffer_release_result(buffer,sink,buffer_pool_release(&buffer_pool,buffer,sink));
+}
+
+void buffer_abandon(char * buffer, uint32_t sink){
+    buffer_release_result(buffer,sink,buffer_pool_abandon(&buffer_pool,buffer,sink));
+}
+
+/*SD sink of one queue_to_save_in_sd message: "sink" or the other SD sink if a message of the
+same buffer already released it (the selection task empties the queue when the SD is removed).
+An archive copy that isn't written is released, a backlog record that isn't written is abandoned*/
+void buffer_release_sd(char * buffer, uint32_t sink, bool written){
+    int8_t result=BUFFER_POOL_ERROR;
+
+    for (uint8_t i=0;i<2 && result==BUFFER_POOL_ERROR;i++){
+        if (i!=0){
+            sink^=BUFFER_SINK_SD_ARCHIVE|BUFFER_SINK_SD_BACKLOG;
+        }
+        if (written || sink==BUFFER_SINK_SD_ARCHIVE){
+            result=buffer_pool_release(&buffer_pool,buffer,sink);
+        }
+        else{
+            result=buffer_pool_abandon(&buffer_pool,buffer,sink);
+        }
+    }
+    buffer_release_result(buffer,sink,result);
+}
+
+
+
 /*======================================================================
  *0  SEND BUFFER TO WIFI TASK
  
@@ -297,6 +803,10 @@ void send_buffer_wifi_task(void *pvParameters){
     esp_err_t error_handler=ESP_OK; //to store the return error of post function if everything ok, return value from function will be equal to ESP_OK
     
     unsigned int retry_times=0;
+
+    //SEQ of a backlog record uploaded
+    uint32_t seq=0;
+
     while (1)
     {
         //Receive the buffer to store in SD card
@@ -309,12 +819,24 @@ void send_buffer_wifi_task(void *pvParameters){
         printf("Send buffer by wifi: sending buffer by wifi\n");
 
         //send buffer to server by HTTP POST method
-        error_handler = http_post_send(current_full_buffer,max_buffer_size, MONGODB_SERVER);
+        error_handler = http_post_send(current_full_buffer,packet_encoded_size(current_full_buffer), MONGODB_SERVER);
             
-        //if no error, empty the current buffer
+        //if no error, release the current buffer (it's empty when the SD archive is done too)
         if (error_handler==ESP_OK){ 
-            //Clear the current buffer
-            xQueueSendToBack(queue_empty_buffers, &current_full_buffer,portMAX_DELAY);
+            //a backlog record: its slot is acked (the segments before the oldest slot are removed)
+            if (current_full_buffer[max_buffer_size]==STATUS_BYTE_SD_DATA){
+                memcpy(&seq,&current_full_buffer[max_buffer_size+1],sizeof(seq));
+                xQueueSendToBack(queue_backlog_ack,&seq,0);
+#if SD_ARCHIVE_PACKETS
+                /*the archive copy of a backlog record is written once it's uploaded, not when it's
+                read (a record not acked is read again after a rewind)*/
+                if ((xEventGroupGetBits(flags_hardware_available)&FLAG_SD_MOUNTED)!=0 &&
+                    buffer_pool_hold(&buffer_pool,current_full_buffer,BUFFER_SINK_SD_ARCHIVE)){
+                    xQueueSendToBack(queue_to_save_in_sd, &current_full_buffer,portMAX_DELAY);
+                }
+#endif
+            }
+            buffer_release(current_full_buffer,BUFFER_SINK_WIFI);
             retry_times=0;
         }
         //if error message then try to send buffer again
@@ -323,10 +845,12 @@ void send_buffer_wifi_task(void *pvParameters){
             xQueueSendToFront(queue_to_send_wifi, &current_full_buffer,portMAX_DELAY);
             retry_times++;
         }
-        //if retry times exceded and SD connected then send the buffer to SD queue
-        else if ((xEventGroupGetBits(flags_hardware_available)&FLAG_SD_MOUNTED)!=0){
+        //if retry times exceded and SD connected then send the buffer to SD queue (backlog)
+        else if ((xEventGroupGetBits(flags_hardware_available)&FLAG_SD_MOUNTED)!=0 &&
+            buffer_pool_hold(&buffer_pool,current_full_buffer,BUFFER_SINK_SD_BACKLOG)){
             printf("SEND_WIFI: FAIL, sending to SD card...\n");
             xQueueSendToBack(queue_to_save_in_sd, &current_full_buffer,portMAX_DELAY);
+            buffer_release(current_full_buffer,BUFFER_SINK_WIFI);
             retry_times=0;
         }
         //if retry times exceded but NO SD CARD then try to send the buffer again
@@ -348,16 +872,19 @@ void send_buffer_wifi_task(void *pvParameters){
  =======================================================================*/
 void send_buffer_to_SD_task(void *pvParameters){
     
-    /*Filename depends of the local datetime, 12 chars: YY MM DD HH mm SS*/
-    char filename_datetime[SIZE_CHAR_FOLDER+DATETIME_SIZE_FORMAT] = FOLDER"/"; 
-
     char *current_full_buffer=NULL;
 
-    //maximum size of the route (number of characters)
-    uint8_t max_size_route= SIZE_CHAR_FOLDER;
-    
-    //file handler
-    FILE* file = NULL;
+    //sink of this queue message (one message per SD sink of the buffer)
+    uint32_t sink=0;
+
+    //log of the sink (sd_backlog or sd_archive, sd_config.h)
+    sd_log_t *packet_log=NULL;
+
+    //slot of the backlog record in the backlog index (sd_backlog_index)
+    sd_log_location_t location={0,0};
+    uint32_t seq=0;
+
+    bool written=false;
 
     while (1)
     {
@@ -366,36 +893,134 @@ void send_buffer_to_SD_task(void *pvParameters){
         
         //SD busy flag
         xEventGroupWaitBits(flags_hardware_available, FLAG_SD_AVAILABLE, true, true, portMAX_DELAY);
-        
-        //Get the filename
-        printf("Send buffer to SD task: creating filename\n");
-        for (uint8_t i=0;i<DATETIME_SIZE_FORMAT;i++){
-            filename_datetime[max_size_route+i]=current_full_buffer[6+i];    
+
+        /*Archive copy (the buffer is being uploaded) or backlog (to upload later), if the 
+        buffer has both then this message is one of them and the other message the other one*/
+        sink=(buffer_pool_pending(&buffer_pool,current_full_buffer)&BUFFER_SINK_SD_ARCHIVE)?BUFFER_SINK_SD_ARCHIVE:BUFFER_SINK_SD_BACKLOG;
+        packet_log=(sink==BUFFER_SINK_SD_ARCHIVE)?&sd_archive:&sd_backlog;
+
+        //a packet read from the backlog is still there (its slot isn't acked, it's taken again after a rewind)
+        if (sink==BUFFER_SINK_SD_BACKLOG && current_full_buffer[max_buffer_size]==STATUS_BYTE_SD_DATA){
+            xEventGroupSetBits(flags_hardware_available, FLAG_SD_AVAILABLE);
+            printf("GRABAR EN SD TASK: paquete del backlog, ya esta en la SD\n");
+            buffer_release_sd(current_full_buffer,sink,true);
+            continue;
         }
 
-        printf("GRABAR EN SD TASK: abriendo la ruta %s\n",filename_datetime);
-        /* Use POSIX and C standard library functions to work with files.
-        Open the file
-        */
-        file = fopen(filename_datetime,"wb");
-        if (file == NULL) {
-            ESP_LOGE(TAG, "Failed to open file for writing");
-            return;
+        /*One record at the end of the log (sd_log.h), START_US (or the first miniSEED record) is
+        kept in the index of the segment. The packet is in the card when it returns. A backlog
+        record gets its slot in the backlog index before it's written (backlog_index.h)*/
+        written=true;
+        if (sink==BUFFER_SINK_SD_BACKLOG){
+            location=sd_log_append_location(packet_log,packet_encoded_size(current_full_buffer));
+            written=backlog_index_add(&sd_backlog_index,location,&seq);
+        }
+        if (written){
+            written=sd_log_append(packet_log,current_full_buffer,packet_encoded_size(current_full_buffer),packet_start_us(current_full_buffer));
+            //the slot of a record not written is cancelled
+            if (!written && sink==BUFFER_SINK_SD_BACKLOG){
+                backlog_index_ack(&sd_backlog_index,seq);
+            }
         }
         
-        //parameters: buffer_write, size in bytes of each element, number of elements, file
-        printf("GRABAR EN SD TASK: grabando informacion en el archivo\n");
-        fwrite(current_full_buffer,max_buffer_size,1,file); // write the buffer in SD card
-        
-        printf("GRABAR EN SD TASK: cerrando archivo\n");
-        fclose(file);
-            
-        printf("GRABAR EN SD TASK: archivo grabado\n");
-        //SD free Flag
-        xEventGroupSetBits(flags_hardware_available, FLAG_SD_AVAILABLE|FLAG_FILES_AVAILABLE);
+        //SD free Flag (and pending records if it was a backlog packet)
+        xEventGroupSetBits(flags_hardware_available, FLAG_SD_AVAILABLE|((written && sink==BUFFER_SINK_SD_BACKLOG)?FLAG_FILES_AVAILABLE:0));
+
+        if (!written){
+            ESP_LOGE(TAG, "Failed to write the packet in the %s log (segment %d, %d backlog records pending)",
+                (sink==BUFFER_SINK_SD_ARCHIVE)?"archive":"backlog",packet_log->segment,backlog_index_pending(&sd_backlog_index));
+            buffer_release_sd(current_full_buffer,sink,false);
+            vTaskDelay(1000 / portTICK_PERIOD_MS);
+            continue;
+        }
+        printf("GRABAR EN SD TASK: paquete grabado en %s, segmento %d registro %d\n",
+            (sink==BUFFER_SINK_SD_ARCHIVE)?"archive":"backlog",packet_log->segment,packet_log->count-1);
         
-        //Clear the current buffer
-        xQueueSendToBack(queue_empty_buffers, &current_full_buffer,portMAX_DELAY);
+        //Release the current buffer (it's empty when the upload is done too)
+        buffer_release_sd(current_full_buffer,sink,true);
+    }
+}
+
+
+
+/*======================================================================
+ * ROUTE ONE FULL BUFFER (buffer_pool_route)
+ * 
+ * Returns false if it was a cold packet that stays in the cold backlog
+ ======================================================================*/
+bool full_buffer_route(char * buffer, EventBits_t hardware_available){
+    buffer_route_state_t state;
+    uint32_t sinks=0;
+    char *cold_buffer=NULL;
+    uint16_t cold_used=0;
+
+    state.wifi=((hardware_available & FLAG_WIFI_CONNECTED)!=0);
+    state.sd=((hardware_available & FLAG_SD_MOUNTED)!=0);
+    state.archive=SD_ARCHIVE_PACKETS;
+    state.sensor_data=(buffer[max_buffer_size]==STATUS_BYTE_SENSOR_DATA);
+    state.cold=(buffer_pool_tier(&buffer_pool,buffer)==BUFFER_TIER_COLD);
+    state.wifi_waiting=uxQueueMessagesWaiting(queue_to_send_wifi);
+    state.sd_waiting=uxQueueMessagesWaiting(queue_to_save_in_sd);
+    state.busy_waiting=SINK_BUSY_WAITING;
+    state.cold_free=(queue_cold_empty!=NULL)?uxQueueMessagesWaiting(queue_cold_empty):0;
+    state.cold_used=(queue_cold_full!=NULL)?uxQueueMessagesWaiting(queue_cold_full):0;
+
+    switch (buffer_pool_route(&state,&sinks)){
+        case BUFFER_ROUTE_SINKS:
+            //every sink is held before the first queue, so a fast sink can't empty the buffer
+            if (!buffer_pool_hold(&buffer_pool,buffer,sinks)){
+                ESP_LOGE(TAG,"Selection task: buffer %p already held by sinks 0x%x",buffer,buffer_pool_pending(&buffer_pool,buffer));
+                return true;
+            }
+            if (sinks & BUFFER_SINK_WIFI){
+                printf("Selection task: WiFi send buffer%s\n",state.cold?" (cold)":""); 
+                xQueueSendToBack(queue_to_send_wifi, &buffer,portMAX_DELAY);
+            }
+            if (sinks & (BUFFER_SINK_SD_ARCHIVE|BUFFER_SINK_SD_BACKLOG)){
+                printf("Selection task: SD store buffer (%s)\n",(sinks & BUFFER_SINK_SD_ARCHIVE)?"archive":"backlog"); 
+                xQueueSendToBack(queue_to_save_in_sd, &buffer,portMAX_DELAY);
+            }
+            return true;
+
+        case BUFFER_ROUTE_COLD:
+        case BUFFER_ROUTE_RECYCLE:
+            //the packet is copied to a free cold buffer or to the oldest one (its packet is lost)
+            if (state.cold_free!=0){
+                if (xQueueReceive(queue_cold_empty,&cold_buffer,0)==pdTRUE){
+                    pool_metrics.spilled++;
+                }
+            }
+            else if (xQueueReceive(queue_cold_full,&cold_buffer,0)==pdTRUE){
+                pool_metrics.recycled++;
+                ESP_LOGW(TAG,"Selection task: cold buffers full, oldest packet replaced");
+            }
+            if (cold_buffer==NULL){
+                //the cold buffer counted was taken meanwhile (the queues changed), the packet is lost
+                pool_metrics.dropped++;
+                ESP_LOGW(TAG,"Selection task: no cold buffer, packet lost");
+            }
+            else{
+                memcpy(cold_buffer,buffer,packet_encoded_size(buffer));
+                memcpy(&cold_buffer[max_buffer_size],&buffer[max_buffer_size],BUFFER_STATUS_BYTES); //STATUS BYTE and SEQ
+                xQueueSendToBack(queue_cold_full, &cold_buffer,portMAX_DELAY);
+                cold_used=uxQueueMessagesWaiting(queue_cold_full);
+                if (cold_used>pool_metrics.cold_max){
+                    pool_metrics.cold_max=cold_used;
+                }
+                printf("Selection task: buffer moved to PSRAM (%d cold packets)\n",cold_used);
+            }
+            xQueueSendToBack(queue_empty_buffers, &buffer,portMAX_DELAY);
+            return true;
+
+        case BUFFER_ROUTE_KEEP:
+            xQueueSendToFront(queue_cold_full, &buffer,portMAX_DELAY);
+            return false;
+
+        default:
+            printf("Selection task: WARNING NEITHER SD NOR WIFI CONNECTED!!!\n\n");     
+            pool_metrics.dropped++;
+            xQueueSendToBack(queue_empty_buffers, &buffer,portMAX_DELAY);
+            return true;
     }
 }
 
@@ -414,23 +1039,57 @@ void full_buffer_selection_go_to_task(void *pvParameters){
 
     //to save event flags
     EventBits_t hardware_available;
+
+    //a cold packet was sent in the last loop (the next one is sent without waiting)
+    bool cold_sent=false;
              
     while (1)
     {
         printf("=============================================================\n");
-        printf("Items in adc queue = %d/%d\n",uxQueueMessagesWaiting(queue_adc_mcp3561),MAX_NUM_MSG);
-        printf("Items in adxl355 queue = %d/%d\n",uxQueueMessagesWaiting(queue_adxl355),MAX_NUM_MSG);
-        printf("Items in mma8451q queue = %d/%d\n\n",uxQueueMessagesWaiting(queue_mma8451q),MAX_NUM_MSG);
+        printf("Items in adc ring = %d/%d (overruns %d)\n",sample_ring_count(&ring_adc_mcp3561),SAMPLE_RING_CAPACITY,ring_adc_mcp3561.overruns);
+        printf("Items in adxl355 ring = %d/%d (overruns %d, slips %d)\n",sample_ring_count(&ring_adxl355),SAMPLE_RING_CAPACITY,ring_adxl355.overruns,ring_adxl355.slips);
+        printf("Items in mma8451q ring = %d/%d (overruns %d, slips %d)\n\n",sample_ring_count(&ring_mma8451q),SAMPLE_RING_CAPACITY,ring_mma8451q.overruns,ring_mma8451q.slips);
+
+#if DECIMATION_RATIO>1
+        //cycles per input sample and channel, channels that one core could filter at the acquisition rate
+        if (decimation_cost.inputs!=0){
+            uint32_t cycles_per_channel=(uint32_t)(decimation_cost.cycles/((uint64_t)decimation_cost.inputs*DECIMATION_CHANNELS));
+            printf("Decimation: %d cycles per input sample per channel (%d inputs), one core sustains ~%d channels at %d Hz\n",
+                cycles_per_channel,decimation_cost.inputs,
+                cycles_per_channel?(CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ*1000000/(cycles_per_channel*sample_rate_entry->rate)):0,sample_rate_entry->rate);
+            decimation_cost.cycles=0;
+            decimation_cost.inputs=0;
+        }
+        printf("Decimated rings: adc %d, adxl355 %d, mma8451q %d (overruns %d)\n\n",sample_ring_count(&ring_dec_adc_mcp3561),
+            sample_ring_count(&ring_dec_adxl355),sample_ring_count(&ring_dec_mma8451q),ring_dec_adc_mcp3561.overruns);
+#endif
+
+        for (int i=0;i<ACQ_TIME_TOTAL;i++){
+            if (acq_time[i].count!=0){
+                printf("Acquisition time %s: min %d us, mean %d us, max %d us (%d ticks)\n",acq_time_names[i],
+                    acq_time[i].min,(uint32_t)(acq_time[i].sum/acq_time[i].count),acq_time[i].max,acq_time[i].count);
+                acq_time[i].count=0;
+                acq_time[i].max=0;
+                acq_time[i].sum=0;
+            }
+        }
+        printf("\n");
     
-        printf("fill_buffer_with_sensor_task: full buffers queue = %d/%d\n",uxQueueMessagesWaiting(queue_full_buffers),NUMBER_OF_BUFFERS);
-        printf("fill_buffer_with_sensor_task: empty buffers queue = %d/%d\n\n",uxQueueMessagesWaiting(queue_empty_buffers),NUMBER_OF_BUFFERS);
-        printf("fill_buffer_with_sensor_task: pending files queue = %d/%d\n\n",uxQueueMessagesWaiting(queue_filename_list),MAX_OPEN_FILES*2);
-        printf("fill_buffer_with_sensor_task: sd store queue = %d/%d\n",uxQueueMessagesWaiting(queue_to_save_in_sd),NUMBER_OF_BUFFERS);
-        printf("fill_buffer_with_sensor_task: wifi send queue = %d/%d\n",uxQueueMessagesWaiting(queue_to_send_wifi),NUMBER_OF_BUFFERS);
+        printf("fill_buffer_with_sensor_task: full buffers queue = %d/%d\n",uxQueueMessagesWaiting(queue_full_buffers),number_of_buffers);
+        printf("fill_buffer_with_sensor_task: empty buffers queue = %d/%d\n\n",uxQueueMessagesWaiting(queue_empty_buffers),number_of_buffers);
+        printf("SD logs: backlog segments %d-%d (%d records pending, %d taken, %d skipped), archive segment %d (%d records written)\n\n",
+            sd_backlog.first,sd_backlog.segment,backlog_index_pending(&sd_backlog_index),sd_backlog_index.next-sd_backlog_index.head,
+            sd_backlog.skipped,sd_archive.segment,sd_archive.appended);
+        printf("fill_buffer_with_sensor_task: sd store queue = %d/%d\n",uxQueueMessagesWaiting(queue_to_save_in_sd),2*number_of_buffers);
+        printf("fill_buffer_with_sensor_task: wifi send queue = %d/%d\n",uxQueueMessagesWaiting(queue_to_send_wifi),number_of_buffers);
+        printf("Buffer pool: hot %d, cold %d/%d used (max %d), spilled %d, recycled %d, dropped %d\n",
+            buffer_pool.tier_count[BUFFER_TIER_HOT],(queue_cold_full!=NULL)?uxQueueMessagesWaiting(queue_cold_full):0,
+            buffer_pool.tier_count[BUFFER_TIER_COLD],pool_metrics.cold_max,pool_metrics.spilled,pool_metrics.recycled,pool_metrics.dropped);
         printf("=============================================================\n");
 
         current_full_buffer=NULL;
-        xQueueReceive(queue_full_buffers,&current_full_buffer,500);
+        xQueueReceive(queue_full_buffers,&current_full_buffer,cold_sent?0:500);
+        cold_sent=false;
 
         /*Get SD and WiFi status (connected or disconnected)
 
@@ -442,6 +1101,11 @@ void full_buffer_selection_go_to_task(void *pvParameters){
                     )
         */
         hardware_available = xEventGroupWaitBits(flags_hardware_available,FLAG_WIFI_CONNECTED|FLAG_SD_MOUNTED, false, false, 0);
+
+        //settings of a card just mounted, used from the next packet
+        if ((xEventGroupClearBits(flags_hardware_available, FLAG_STATION_CONFIG)&FLAG_STATION_CONFIG)!=0){
+            station_config_request(&sd_station_config);
+        }
         
         if((hardware_available & FLAG_WIFI_CONNECTED)== 0){
             printf("Selector task: WiFi Disconnected\n");
@@ -466,35 +1130,16 @@ void full_buffer_selection_go_to_task(void *pvParameters){
                 printf("Selector task: BUFFER filled with SD\n");
             }
             
-            //If wifi connected then... send the buffer by WiFi
-            if ((hardware_available & FLAG_WIFI_CONNECTED)!= 0)
-            {    
-                printf("Selection task: WiFi send buffer\n"); 
-                xQueueSendToBack(queue_to_send_wifi, &current_full_buffer,portMAX_DELAY);
-            }
             /*
-            If SD connected and buffer was filled with SENSOR data
+            If wifi connected then... send the buffer by WiFi, and if SD connected and the
+            buffer was filled with SENSOR data store a copy in the SD archive at the same time 
+            (SD_ARCHIVE_PACKETS, buffers filled with SD data are archived when they are uploaded)
 
-            or  if SD connected and WiFi Disconnected then...
-            
-            store buffer data in SD card
-            */
-            else if(
-            (((hardware_available & FLAG_WIFI_CONNECTED)== 0) || 
-            (current_full_buffer[max_buffer_size]==STATUS_BYTE_SENSOR_DATA))
-            && ((hardware_available & FLAG_SD_MOUNTED)!= 0)
-            )
-            {
-                printf("Selection task: SD store buffer\n"); 
-                xQueueSendToBack(queue_to_save_in_sd, &current_full_buffer,portMAX_DELAY);
-            }
-            /*If WiFi connected but is busy and buffer was filled with SD information then
-            send to the back of the full buffer queue 
+            If SD connected and WiFi Disconnected then... store buffer data in SD card (backlog)
+
+            If the sink is busy or there is no sink the packet goes to a cold buffer (PSRAM_POOL)
             */
-            else{
-                printf("Selection task: WARNING NEITHER SD NOR WIFI CONNECTED!!!\n\n");     
-                xQueueSendToBack(queue_empty_buffers, &current_full_buffer,portMAX_DELAY);
-            }
+            full_buffer_route(current_full_buffer,hardware_available);
         }
         //-------------------- NO buffer available ---------------------
         else{
@@ -507,7 +1152,8 @@ void full_buffer_selection_go_to_task(void *pvParameters){
                     printf("Selector task: There stuck items in wifi queue, emptying the queuen\n");
                     xQueueReceive(queue_to_send_wifi,&current_full_buffer,100);
                     if (current_full_buffer!=NULL){
-                        xQueueSendToBack(queue_full_buffers, &current_full_buffer,portMAX_DELAY);    
+                        //it's selected again when the other sinks release it
+                        buffer_abandon(current_full_buffer,BUFFER_SINK_WIFI);
                     }
                 }
             }
@@ -518,60 +1164,18 @@ void full_buffer_selection_go_to_task(void *pvParameters){
                     printf("Selector task: There stuck items in SD queue, emptying the queuen\n");
                     xQueueReceive(queue_to_save_in_sd,&current_full_buffer,100);
                     if (current_full_buffer!=NULL){
-                        xQueueSendToBack(queue_full_buffers, &current_full_buffer,portMAX_DELAY);    
+                        //backlog packets are selected again, archive copies are dropped
+                        buffer_release_sd(current_full_buffer,BUFFER_SINK_SD_BACKLOG,false);
                     }
                 }
             }
-        }
-    }
-}
-
 
-/*=================================================================================
- *3 GET NAMES OF PENDING FILES
- * 
- * Check filename list of pending files
- =================================================================================*/
-void get_filename_list_task(void *pvParameter)
-{
-    
-    //matrix to store the list of files
-    char filename_list[MAX_OPEN_FILES][MAX_FILENAME_SIZE];
-
-    //total read files
-    uint8_t total_read_files=0;
-
-    //we assume there are files into SD card
-    xEventGroupSetBits(flags_hardware_available, FLAG_FILES_AVAILABLE);
-        
-    while (1){
-        //if SD busy then wait...
-        xEventGroupWaitBits(flags_hardware_available, FLAG_SD_AVAILABLE, true, true, portMAX_DELAY);
-        
-        //get 5 (MAX_OPEN_FILES) filenames
-        total_read_files = sd_list_files(filename_list,MAX_OPEN_FILES,uxQueueMessagesWaiting(queue_filename_list));
-       
-        //SD free flag
-        xEventGroupSetBits(flags_hardware_available, FLAG_SD_AVAILABLE);
-
-        //if less than 5 (MAX_OPEN_FILES) filenames, then there are no more files in SD card
-        if (total_read_files<MAX_OPEN_FILES){
-            printf("FILE LIST: There are no more files in SD, %d/%d read files\n",total_read_files,MAX_OPEN_FILES);
-            xEventGroupClearBits(flags_hardware_available, FLAG_FILES_AVAILABLE);
+            //cold backlog (oldest first) when there are no hot packets
+            current_full_buffer=NULL;
+            if (queue_cold_full!=NULL && xQueueReceive(queue_cold_full,&current_full_buffer,0)==pdTRUE){
+                cold_sent=full_buffer_route(current_full_buffer,hardware_available);
+            }
         }
-
-        printf("FILE LIST: List of files: \n");
-        //send every read filename to the queue
-        for (uint8_t i =0; i<total_read_files; i++){
-            printf("FILE LIST: Adding file %.12s to the queue...\n",&filename_list[i][0]);
-        
-            xQueueSendToBack(queue_filename_list, &filename_list[i][0],portMAX_DELAY); 
-        }        
-
-        /*if there are no more files into files wait for them...
-          also wait 
-        */
-        xEventGroupWaitBits(flags_hardware_available, FLAG_FILES_AVAILABLE|FLAG_WIFI_CONNECTED, false, true, portMAX_DELAY);
     }
 }
 
@@ -579,71 +1183,143 @@ void get_filename_list_task(void *pvParameter)
 /*======================================================================
  *4  FILL BUFFER WITH SD CARD TASK
  
- *  This task get data from sd and fills an empty buffer. One file is 
- *  equal to one full buffer.
+ *  This task get data from sd and fills an empty buffer. One record of
+ *  the backlog log is equal to one full buffer, the backlog index gives
+ *  the next record to upload (backlog_index.h).
  =======================================================================*/
 void fill_buffer_with_sd_task(void *pvParameters){
 
-    /*Filename depends of the local datetime, 12 chars: YY MM DD HH mm SS*/
-    char filename_datetime[SIZE_CHAR_FOLDER+DATETIME_SIZE_FORMAT] = FOLDER"/"; 
-
     char *current_empty_buffer=NULL;
 
-    //maximum size of the route (number of characters)
-    uint8_t max_size_route= SIZE_CHAR_FOLDER;
-    
-    //file handler
-    FILE* file = NULL;
+    //bytes of the packet or SD_LOG_xxx
+    int32_t result=0;
+
+    //record taken from the backlog index (segment and position) and its slot
+    sd_log_location_t location={0,0};
+    uint32_t seq=0, acked=0;
+    bool taken=false;
+
+    //seconds waiting for the acks of the records taken
+    uint16_t idle_s=0;
 
     while (1)
     {
-        //Check if WiFi is connected 
+        //Check if WiFi is connected and there are pending records
         printf("READ SD TASK: check if wifi connected\n");
-        xEventGroupWaitBits(flags_hardware_available, FLAG_WIFI_CONNECTED, false, true, portMAX_DELAY);
-        
-        //if there is a filename in the queue take it an read the file
-        xQueueReceive(queue_filename_list,&filename_datetime[max_size_route],portMAX_DELAY);   
-        printf("READ SD TASK: filename taked from the queue %s\n",&filename_datetime[max_size_route]);
+        xEventGroupWaitBits(flags_hardware_available, FLAG_WIFI_CONNECTED|FLAG_FILES_AVAILABLE, false, true, portMAX_DELAY);
         
         //SD busy flag
         printf("READ SD TASK: look if SD available\n");
         xEventGroupWaitBits(flags_hardware_available, FLAG_SD_AVAILABLE, true, true, portMAX_DELAY);
-        
-        //if there is some free buffer then fill it with sensor information
-        xQueueReceive(queue_empty_buffers,&current_empty_buffer,portMAX_DELAY);   
-        
-        printf("READ SD TASK: Current buffer %p    Openning the route %s\n",current_empty_buffer,filename_datetime);
-        /* Use POSIX and C standard library functions to work with files.
-        Open the file (rb = read binary)
-        */
-        file = fopen(filename_datetime,"rb");
-        if (file == NULL) {
-            ESP_LOGE(TAG, "Failed to open file for reading");
-            return;
+
+        //records uploaded (send_buffer_wifi_task), then the segments before the oldest pending record are removed
+        while (xQueueReceive(queue_backlog_ack,&acked,0)==pdTRUE){
+            if (!backlog_index_ack(&sd_backlog_index,acked)){
+                ESP_LOGW(TAG,"READ SD TASK: slot %d not acked, the record will be uploaded again",acked);
+            }
+        }
+        sd_log_trim(&sd_backlog,backlog_index_oldest(&sd_backlog_index,&location)?location.segment:sd_backlog.segment);
+
+        //next record of the backlog (oldest first)
+        taken=backlog_index_take(&sd_backlog_index,&location,&seq);
+        result=SD_LOG_EMPTY;
+        if (taken){
+            //if there is some free buffer then fill it with the record
+            xQueueReceive(queue_empty_buffers,&current_empty_buffer,portMAX_DELAY);   
+            result=sd_log_read_at(&sd_backlog,location,current_empty_buffer,max_buffer_size);
+            printf("READ SD TASK: Current buffer %p, slot %d (segment %d record %d): %d\n",current_empty_buffer,seq,location.segment,location.record,result);
+            idle_s=0;
         }
-        
-        //parameters: buffer_write, size in bytes of each element, number of elements, file
-        printf("READ SD TASK: Reading file content\n");
-        fread(current_empty_buffer,max_buffer_size,1,file); // write the buffer in SD card
-        
-        printf("READ SD TASK: closing file\n");
-        fclose(file);
 
-        printf("READ SD TASK: Deleting file: %s \n",filename_datetime);
-        remove(filename_datetime);   
+        /*a corrupted record is acked (nothing to upload). A record longer than PACKET_SIZE (other
+        firmware) isn't: it stays pending in the card, never removed by sd_log_trim*/
+        if (result==SD_LOG_CORRUPTED){
+            backlog_index_ack(&sd_backlog_index,seq);
+        }
 
-        //Buffer was filled with SD card information
-        current_empty_buffer[max_buffer_size]=STATUS_BYTE_SD_DATA; 
+        //no more records: wait for new ones (send_buffer_to_SD_task)
+        if (backlog_index_pending(&sd_backlog_index)==0){
+            xEventGroupClearBits(flags_hardware_available, FLAG_FILES_AVAILABLE);
+        }
 
         //SD free Flag
-        printf("READ SD TASK: Reading file done, SD available again\n");
+        printf("READ SD TASK: Reading record done, SD available again\n");
         xEventGroupSetBits(flags_hardware_available, FLAG_SD_AVAILABLE);
+
+        //every pending record was taken: wait for their acks, the ones not acked are taken again later
+        if (!taken){
+            if (backlog_index_pending(&sd_backlog_index)!=0){
+                idle_s++;
+                if (idle_s>=SD_BACKLOG_RETRY_S){
+                    printf("READ SD TASK: %d records taken and not uploaded, taking them again\n",backlog_index_pending(&sd_backlog_index));
+                    backlog_index_rewind(&sd_backlog_index);
+                    idle_s=0;
+                }
+                vTaskDelay(1000 / portTICK_PERIOD_MS);
+            }
+            continue;
+        }
+
+        if (result<=0){
+            if (result==SD_LOG_CORRUPTED){
+                ESP_LOGW(TAG,"READ SD TASK: record corrupted (CRC), discarded");
+            }
+            //a packet longer than the buffers (firmware with a bigger ITEMS_PER_SENSOR), it's kept
+            else if (result==SD_LOG_TOO_LONG){
+                ESP_LOGE(TAG,"READ SD TASK: segment %d record %d longer than the buffers (%d bytes), kept in the card",
+                    location.segment,location.record,max_buffer_size);
+            }
+            //the slot isn't acked, the record is taken again after a rewind
+            else if (result==SD_LOG_ERROR){
+                ESP_LOGE(TAG,"READ SD TASK: SD card couldn't be read");
+                vTaskDelay(1000 / portTICK_PERIOD_MS);
+            }
+            xQueueSendToBack(queue_empty_buffers, &current_empty_buffer,portMAX_DELAY);
+            continue;
+        }
+
+        //Buffer was filled with SD card information (and the slot of the record)
+        current_empty_buffer[max_buffer_size]=STATUS_BYTE_SD_DATA; 
+        memcpy(&current_empty_buffer[max_buffer_size+1],&seq,sizeof(seq));
+
+        //packets with a header are checked (version 4, LENGTH and CRC), a corrupted or old packet isn't sent
+        if (packet_header_present(current_empty_buffer) && !packet_header_check(current_empty_buffer,max_buffer_size)){
+            ESP_LOGW(TAG,"READ SD TASK: segment %d record %d corrupted (CRC) or old header version, discarded",location.segment,location.record);
+            xQueueSendToBack(queue_backlog_ack, &seq,0);
+            xQueueSendToBack(queue_empty_buffers, &current_empty_buffer,portMAX_DELAY);
+            continue;
+        }
         
         //Clear the current buffer
         xQueueSendToBack(queue_full_buffers, &current_empty_buffer,portMAX_DELAY);
     }
 }
 
+/*======================================================================
+ * POP ONE BATCH OF THE SENSOR RINGS
+ *
+ * The batch is the items that every ring can give, after the slip of
+ * the rings that follow the MCP3561 ring (sample_ring_slip). Returns
+ * the items of the batch, max_items at most.
+ ======================================================================*/
+uint32_t sensor_rings_pop(sensor_rings_t *rings, mcp356x_sample_t *batch_mcp3561, uint8_t *batch_adxl355, uint8_t *batch_mma8451q, uint32_t max_items){
+    uint32_t batch_size=max_items;
+    int32_t slip_adxl355=sample_ring_slip(rings->adxl355);
+    int32_t slip_mma8451q=sample_ring_slip(rings->mma8451q);
+
+    if (batch_size>sample_ring_count(rings->mcp3561)) batch_size=sample_ring_count(rings->mcp3561);
+    if (batch_size>sample_ring_count_slipped(rings->adxl355,slip_adxl355)) batch_size=sample_ring_count_slipped(rings->adxl355,slip_adxl355);
+    if (batch_size>sample_ring_count_slipped(rings->mma8451q,slip_mma8451q)) batch_size=sample_ring_count_slipped(rings->mma8451q,slip_mma8451q);
+    if (batch_size==0){
+        return 0;
+    }
+
+    sample_ring_pop_batch(rings->mcp3561,batch_mcp3561,batch_size);
+    sample_ring_pop_slipped(rings->adxl355,batch_adxl355,batch_size,slip_adxl355,rings->last_adxl355);
+    sample_ring_pop_slipped(rings->mma8451q,batch_mma8451q,batch_size,slip_mma8451q,rings->last_mma8451q);
+    return batch_size;
+}
+
 /*======================================================================
  *5  FILL BUFFER WITH SENSOR DATA TASK
  
@@ -654,22 +1330,36 @@ void fill_buffer_with_sd_task(void *pvParameters){
  =======================================================================*/
 void fill_buffer_with_sensor_task(void *pvParameters){
     //All data, 3 bytes adc (24 bits), 6 bytes accl (16 bits x 3 channels), 9 bytes accl (24 bits x 3 channels) 
-    uint8_t data_queue[total_bytes_sensors]; 
+
+    //samples taken from the rings at once (static to keep them out of the task stack)
+    static mcp356x_sample_t batch_adc_mcp3561[SAMPLE_RING_BATCH];
+    static uint8_t batch_adxl355[SAMPLE_RING_BATCH*BYTES_SAMPLE_ADXL355];
+    static uint8_t batch_mma8451q[SAMPLE_RING_BATCH*BYTES_SAMPLE_MMA8451Q];
+
+    //rings of the packet (the sensor rings or the decimated ones)
+    static sensor_rings_t rings={&RING_TO_BUFFER_MCP3561,&RING_TO_BUFFER_ADXL355,&RING_TO_BUFFER_MMA8451Q};
+
+    //samples available in all the rings and current sample of the batch
+    uint32_t batch_size=0;
+    uint32_t each_batch_item=0;
 
     //to recieve the current empty buffer and fill it
     char *current_empty_buffer=NULL;
     
     //to add items to the empty buffer
     uint16_t each_item=0;
-    //to add each byte per item
-    uint16_t each_byte_per_item=0;
-    //to configurate each sensor in buffer
-    uint8_t each_sensor=0;
+    //to pack each channel of the batch
+    uint8_t each_channel=0;
+
+    //timestamp of the previous sample and nominal period (timer counts) for the interval residuals
+    uint64_t previous_timestamp=0;
+    uint32_t nominal_period=0;
 
-    //to count positions in the current empty buffer
-    uint16_t empty_buff_pos=0;
-    //to count positions in the data_queue buffer
-    uint16_t data_buff_pos=0;
+    //timer value and UTC time of the first sample (START_TIME and START_US)
+    uint64_t start_timer=0;
+    int64_t start_us=0;
+    uint32_t time_quality; //uncertainty of START_US (TIME_QUALITY)
+    char start_text[EPOCH_FORMAT_BYTES];
 
     printf("fill_buffer_with_sensor_task : Prepared\n");    
 
@@ -682,56 +1372,271 @@ void fill_buffer_with_sensor_task(void *pvParameters){
         xQueueReceive(queue_empty_buffers,&current_empty_buffer,portMAX_DELAY);
         printf("Make_buffer: Current buffer = %p\n",current_empty_buffer);
 
-        //look for current date and time 
-        xSemaphoreGive(semaphore_rtc_ds3231);
+        //new sample rate, the samples of the old rate that are still in the rings are discarded (decimation_task empties its own rings)
+        if (sample_rate_pending!=0){
+            sample_rate_apply(sample_rate_pending);
+            sample_rate_pending=0;
+            vTaskDelay(SAMPLE_RING_DRAIN_MS / portTICK_PERIOD_MS);
+            while(sample_ring_pop_batch(&RING_TO_BUFFER_MCP3561,batch_adc_mcp3561,SAMPLE_RING_BATCH)!=0);
+            while(sample_ring_pop_batch(&RING_TO_BUFFER_ADXL355,batch_adxl355,SAMPLE_RING_BATCH)!=0);
+            while(sample_ring_pop_batch(&RING_TO_BUFFER_MMA8451Q,batch_mma8451q,SAMPLE_RING_BATCH)!=0);
+        }
+        //new packet duration, the samples in the rings are still valid
+        if (packet_duration_pending!=0){
+            packet_duration_apply(packet_duration_pending);
+            packet_duration_pending=0;
+        }
+        //items of this packet (rate and duration), a packet never changes its layout
+        packet_layout_update();
+
+        //the buffer may come from SD (or be compressed), the header is written when the buffer is full
+        set_buffer_raw_layout(current_empty_buffer,&packet_layout);
+        nominal_period=timer_get_period()*DECIMATION_RATIO;
 
         //Store each value in one general buffer
-        for(each_item=0;each_item<ITEMS_PER_SENSOR;each_item++){
-            /*    SM-24 GEOHPONE (24 BIT ADC MCP3561 )
-            BYTES:     |  0  |   1   |  2  |
-            adxl355:     MBS   middle  LSB  
-            */
-            xQueueReceive(queue_adc_mcp3561,&data_queue[0],portMAX_DELAY);
-            
-            /*    ADXL355
-            BYTES:     |  0  |   1   |  2  |  3  |   4   |  5  |  6  |   7   |  8  |
-            adxl355:    MBSX   middle LSBX   MSBY  middle LSBY  MBSZ   middle  LSBZ
+        each_item=0;
+        while(each_item<packet_layout.items){
+            //samples that every ring can give (aligned with the MCP3561 ring, sensor_rings_pop)
+            batch_size=packet_layout.items-each_item;
+            if (batch_size>SAMPLE_RING_BATCH) batch_size=SAMPLE_RING_BATCH;
+            batch_size=sensor_rings_pop(&rings,batch_adc_mcp3561,batch_adxl355,batch_mma8451q,batch_size);
+
+            //nothing to do, sleep until the sensor tasks push more samples 
+            if (batch_size==0){
+                vTaskDelay(SAMPLE_RING_DRAIN_MS / portTICK_PERIOD_MS);
+                continue;
+            }
+
+            /*Every channel of the batch to its items, one channel at a time (channel-major,
+            the same order of the packet). Samples in the batches:
+
+                SM-24 GEOHPONE (24 BIT ADC MCP3561 ), 3 bytes more per SCAN channel
+                BYTES:     |  0  |   1   |  2  |
+                mcp3561:     MBS   middle  LSB  
+
+                ADXL355
+                BYTES:     |  0  |   1   |  2  |  3  |   4   |  5  |  6  |   7   |  8  |
+                adxl355:    MBSX   middle LSBX   MSBY  middle LSBY  MBSZ   middle  LSBZ
+                
+                MMA8451Q
+                BYTES:     |  0  |  1  |  2  |  3  |  4  |  5  |
+                mma8451q:   MBSX  LSBX   MSBY  LSBY  MBSZ  LSBZ
             */
-            xQueueReceive(queue_adxl355,&data_queue[3],portMAX_DELAY);
-            
-            /*    MMA8451Q
-            BYTES:     |  0  |  1  |  2  |  3  |  4  |  5  |
-            mma8451q:   MBSX  LSBX   MSBY  LSBY  MBSZ  LSBZ
+            for(each_channel=0;each_channel<MCP356X_SCAN_CHANNELS;each_channel++){
+                packet_pack_channel(current_empty_buffer,&packet_layout.channels[each_channel],each_item,batch_size,
+                    &batch_adc_mcp3561[0].data[BYTES_PER_MSG_24_BIT*each_channel],sizeof(mcp356x_sample_t));
+            }
+            for(each_channel=0;each_channel<3;each_channel++){
+                packet_pack_channel(current_empty_buffer,&packet_layout.channels[PACKET_INDEX_adxl355_x+each_channel],each_item,batch_size,
+                    &batch_adxl355[BYTES_PER_MSG_24_BIT*each_channel],BYTES_SAMPLE_ADXL355);
+                packet_pack_channel(current_empty_buffer,&packet_layout.channels[PACKET_INDEX_mma8451q_x+each_channel],each_item,batch_size,
+                    &batch_mma8451q[BYTES_PER_MSG_16_BIT*each_channel],BYTES_SAMPLE_MMA8451Q);
+            }
+
+            /*    TIMING (timestamp of the 24 bit ADC sample)
+            first sample = START_TIME, the next ones = interval residual 
             */
-            xQueueReceive(queue_mma8451q,&data_queue[12],portMAX_DELAY);
-        
-            data_buff_pos=0;
-            for(each_sensor=0;each_sensor<NUMBER_OF_SENSORS;each_sensor++){
-                empty_buff_pos=offset_buffer_per_sensor[each_sensor]+each_item*bytes_p_item[each_sensor];
-                for(each_byte_per_item=0;each_byte_per_item<bytes_p_item[each_sensor];each_byte_per_item++){
-                    // TEST MODE
-                    //current_empty_buffer[empty_buff_pos+each_byte_per_item]='s';
-                    
-                    //NORMAL OPERATION
-                    current_empty_buffer[empty_buff_pos+each_byte_per_item]=data_queue[data_buff_pos];
-                    data_buff_pos++;
-                }   
+            for(each_batch_item=0;each_batch_item<batch_size;each_batch_item++,each_item++){
+                if (each_item==0){
+                    start_timer=batch_adc_mcp3561[each_batch_item].timestamp;
+                    set_buffer_u64(&current_empty_buffer[packet_layout.timing_offset],start_timer);
+                    set_buffer_residual(&current_empty_buffer[packet_layout.timing_offset+16],0);
+                }
+                else{
+                    set_buffer_residual(&current_empty_buffer[packet_layout.timing_offset+16+2*each_item],
+                        (int64_t)(batch_adc_mcp3561[each_batch_item].timestamp-previous_timestamp)-nominal_period);
+                }
+                previous_timestamp=batch_adc_mcp3561[each_batch_item].timestamp;
             }
         }
-        //Save date and time into the current empty buffer (from position 6 to 17, 12 bytes)
-        xQueueReceive(queue_date_time,&current_empty_buffer[6],portMAX_DELAY); 
-        printf("fill_buffer_with_sensor_task: date and time %.12s\n",&current_empty_buffer[6]);
+        //Save the timer value of the last anchor of the station clock (SQW edge of the DS3231 second) into the current empty buffer (DATETIME_TIME)
+        set_buffer_u64(&current_empty_buffer[packet_layout.timing_offset+8],time_service_anchor_timer());
+
+        /*header: UTC time of the first sample with the station clock, no I2C (0 if the DS3231 was 
+        never read) and its uncertainty (SNTP), then LENGTH and CRC*/
+        start_us=time_service_time(start_timer);
+        time_quality=(start_us==0)?PACKET_HEADER_QUALITY_UNKNOWN:time_service_uncertainty();
+        set_buffer_header(current_empty_buffer,&packet_layout,packet_sequence_next(),start_us,time_quality);
+        packet_header_seal(current_empty_buffer,packet_layout.size);
+        epoch_format(start_us,start_text);
+        printf("fill_buffer_with_sensor_task: start %s (+-%u us), sequence %u\n",start_text,time_quality,packet_sequence-1);
 
         //Buffer was filled with sensor information
         current_empty_buffer[max_buffer_size]=STATUS_BYTE_SENSOR_DATA;
 
-        //once buffer is full pass it to the full buffers queue
+        //once buffer is full pass it to the full buffers queue (or to the encoder)
         printf("fill_buffer_with_sensor_task: Full buffer\n");
         //printf("Buffer content: %s\n",current_empty_buffer);
 
+#if PAYLOAD_ENCODING!=PACKET_ENCODING_RAW
+        xQueueSendToBack(queue_to_encode,&current_empty_buffer,portMAX_DELAY);
+#else
         xQueueSendToBack(queue_full_buffers,&current_empty_buffer,portMAX_DELAY);
+#endif
+    }
+}
+
+
+/*======================================================================
+ *5.1  DECIMATION TASK (DECIMATION_RATIO > 1)
+
+ *  Takes the samples of the three sensor rings (aligned, one sample of
+ *  every sensor per tick), filters every channel with the FIR decimator
+ *  and pushes one sample every DECIMATION_RATIO ticks into the rings
+ *  read by fill_buffer_with_sensor_task.
+ =======================================================================*/
+#if DECIMATION_RATIO>1
+void decimation_task(void *pvParameters){
+    //samples taken from the sensor rings at once (static to keep them out of the task stack)
+    static mcp356x_sample_t batch_adc_mcp3561[SAMPLE_RING_BATCH];
+    static uint8_t batch_adxl355[SAMPLE_RING_BATCH*BYTES_SAMPLE_ADXL355];
+    static uint8_t batch_mma8451q[SAMPLE_RING_BATCH*BYTES_SAMPLE_MMA8451Q];
+
+    //one frame with all the channels (packet order) and the filtered frame
+    int32_t input[DECIMATION_CHANNELS];
+    int32_t output[DECIMATION_CHANNELS];
+    packet_item_t data_item;
+    uint8_t *data_queue=(uint8_t *)&data_item;
+
+    //filtered samples
+    mcp356x_sample_t out_mcp3561;
+    uint8_t out_adxl355[BYTES_SAMPLE_ADXL355];
+    uint8_t out_mma8451q[BYTES_SAMPLE_MMA8451Q];
+
+    //sensor rings (the ones with their own clock are aligned with the MCP3561 ring)
+    static sensor_rings_t rings={&ring_adc_mcp3561,&ring_adxl355,&ring_mma8451q};
+
+    uint32_t batch_size=0;
+    uint32_t start_cycles=0;
+    uint8_t each_channel=0;
+
+    //filter delay in timer counts ((taps-1)/2 input samples), subtracted from the timestamps
+    uint64_t filter_delay=0;
+
+    uint16_t taps=0;
+    const int16_t *coeffs=decimator_coefficients(DECIMATION_RATIO,&taps);
+    static int32_t history[DECIMATOR_HISTORY_SIZE(DECIMATION_CHANNELS,8*DECIMATION_RATIO+1)];
+    decimator_t decimator;
+
+    if (taps>8*DECIMATION_RATIO+1 || !decimator_init(&decimator,coeffs,taps,DECIMATION_RATIO,DECIMATION_CHANNELS,history)){
+        ESP_LOGE(TAG,"Decimation: DECIMATION_RATIO %d not supported",DECIMATION_RATIO);
+        vTaskDelete(NULL);
+    }
+    uint32_t rate_generation=sample_rate_generation;
+    filter_delay=(uint64_t)((taps-1)/2)*timer_get_period();
+
+    printf("decimation_task: ratio %d, %d taps, %d channels\n",DECIMATION_RATIO,taps,DECIMATION_CHANNELS);
+
+    while(1){
+        //new sample rate, the samples of the old rate are discarded and the filter starts again
+        if (rate_generation!=sample_rate_generation){
+            rate_generation=sample_rate_generation;
+            vTaskDelay(SAMPLE_RING_DRAIN_MS / portTICK_PERIOD_MS);
+            while(sample_ring_pop_batch(&ring_adc_mcp3561,batch_adc_mcp3561,SAMPLE_RING_BATCH)!=0);
+            while(sample_ring_pop_batch(&ring_adxl355,batch_adxl355,SAMPLE_RING_BATCH)!=0);
+            while(sample_ring_pop_batch(&ring_mma8451q,batch_mma8451q,SAMPLE_RING_BATCH)!=0);
+            decimator_reset(&decimator);
+            filter_delay=(uint64_t)((taps-1)/2)*timer_get_period();
+        }
+
+        batch_size=sensor_rings_pop(&rings,batch_adc_mcp3561,batch_adxl355,batch_mma8451q,SAMPLE_RING_BATCH);
+
+        //nothing to do, sleep until the sensor tasks push more samples 
+        if (batch_size==0){
+            vTaskDelay(SAMPLE_RING_DRAIN_MS / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        for(uint32_t each_batch_item=0;each_batch_item<batch_size;each_batch_item++){
+            //same byte order as fill_buffer_with_sensor_task
+            memcpy(&data_queue[0],batch_adc_mcp3561[each_batch_item].data,BYTES_SAMPLE_MCP3561);
+            memcpy(&data_queue[PACKET_ITEM_ADXL355],&batch_adxl355[each_batch_item*BYTES_SAMPLE_ADXL355],BYTES_SAMPLE_ADXL355);
+            memcpy(&data_queue[PACKET_ITEM_MMA8451Q],&batch_mma8451q[each_batch_item*BYTES_SAMPLE_MMA8451Q],BYTES_SAMPLE_MMA8451Q);
+
+            for(each_channel=0;each_channel<DECIMATION_CHANNELS;each_channel++){
+                input[each_channel]=decimator_unpack(&data_queue[packet_channels[each_channel].item_offset],packet_channels[each_channel].bytes);
+            }
+
+            start_cycles=xthal_get_ccount();
+            if (!decimator_push(&decimator,input,output)){
+                decimation_cost.cycles+=xthal_get_ccount()-start_cycles;
+                decimation_cost.inputs++;
+                continue;
+            }
+            decimation_cost.cycles+=xthal_get_ccount()-start_cycles;
+            decimation_cost.inputs++;
+
+            for(each_channel=0;each_channel<DECIMATION_CHANNELS;each_channel++){
+                decimator_pack(output[each_channel],packet_channels[each_channel].bytes,&data_queue[packet_channels[each_channel].item_offset]);
+            }
+            memcpy(out_mcp3561.data,&data_queue[0],BYTES_SAMPLE_MCP3561);
+            memcpy(out_adxl355,&data_queue[PACKET_ITEM_ADXL355],BYTES_SAMPLE_ADXL355);
+            memcpy(out_mma8451q,&data_queue[PACKET_ITEM_MMA8451Q],BYTES_SAMPLE_MMA8451Q);
+            //the filtered sample belongs to the middle of the window
+            out_mcp3561.timestamp=batch_adc_mcp3561[each_batch_item].timestamp-filter_delay;
+
+            //if a ring is full the sample is dropped
+            sample_ring_push(&ring_dec_adc_mcp3561,&out_mcp3561);
+            sample_ring_push(&ring_dec_adxl355,out_adxl355);
+            sample_ring_push(&ring_dec_mma8451q,out_mma8451q);
+        }
+    }
+}
+#endif
+
+
+/*======================================================================
+ *5.2  ENCODE BUFFER TASK (PAYLOAD_ENCODING != PACKET_ENCODING_RAW)
+
+ *  Compresses the full buffers of fill_buffer_with_sensor_task into a 
+ *  spare buffer, the compressed one goes to the full buffers queue and 
+ *  the raw one becomes the spare buffer (no copies back). If the packet 
+ *  doesn't get smaller the raw buffer is sent.
+ =======================================================================*/
+#if PAYLOAD_ENCODING!=PACKET_ENCODING_RAW
+void encode_buffer_task(void *pvParameters){
+    //buffer allocated in app_main, one more than number_of_buffers
+    char *spare_buffer=(char *)pvParameters;
+    char *current_full_buffer=NULL;
+    char *swap=NULL;
+
+    //samples of one channel (static to keep them out of the task stack)
+    static int32_t work[PACKET_CODEC_WORK_SAMPLES];
+
+    uint16_t encoded_size=0;
+    uint16_t raw_size=0;
+    uint64_t start_time=0;
+
+    while(1){
+        xQueueReceive(queue_to_encode,&current_full_buffer,portMAX_DELAY);
+
+        start_time=timer_get_timestamp();
+        encoded_size=0;
+        raw_size=packet_encoded_size(current_full_buffer); //packets shorter than the buffers (packet duration)
+        if (spare_buffer!=NULL){
+#if PAYLOAD_ENCODING==PACKET_ENCODING_MSEED3
+            //the records start at START_US of the header
+            encoded_size=packet_encode_mseed(current_full_buffer,spare_buffer,raw_size,MSEED_NETWORK,work);
+#else
+            encoded_size=packet_encode(current_full_buffer,spare_buffer,PAYLOAD_ENCODING,raw_size,work);
+#endif
+        }
+
+        if (encoded_size!=0 && encoded_size<raw_size){
+            printf("encode_buffer_task: %d -> %d bytes (%d%%) in %d us\n",raw_size,encoded_size,
+                (100*encoded_size)/raw_size,(uint32_t)(timer_get_timestamp()-start_time));
+            memcpy(&spare_buffer[max_buffer_size],&current_full_buffer[max_buffer_size],BUFFER_STATUS_BYTES); //STATUS BYTE and SEQ
+            swap=spare_buffer;
+            spare_buffer=current_full_buffer;
+            current_full_buffer=swap;
+        }
+        else{
+            printf("encode_buffer_task: packet doesn't get smaller, sent raw\n");
+        }
+        xQueueSendToBack(queue_full_buffers,&current_full_buffer,portMAX_DELAY);
     }
 }
+#endif
 
 
 /*======================================================================
@@ -741,28 +1646,88 @@ void fill_buffer_with_sensor_task(void *pvParameters){
  *  Get data of the MMA8451Q accelerometer. This task only excecutes when
  *  receives a notification from the TIMER_ISR
  =======================================================================*/
+#if MMA8451Q_ACQUISITION_MODE==MMA8451Q_MODE_TIMER
 void get_data_mma8451q_task(void *pvParameter)
 {
     //Configurates the mma8451q sensor
     mma8451q_reg_config();
+    uint32_t rate_generation=sample_rate_generation;
+    mma8451q_set_rate(sample_rate_entry->mma8451q_dr);
     
     //se declara el buffer de recepcion de datos
     uint8_t data_received[6]; // 8 bit data to save 14 bits per channel of the accelerometer (total 8*6 bits)
 
     //delay for task and resource initialization...
     vTaskDelay(DELAY_FOR_INIT / portTICK_PERIOD_MS);
+    uint32_t tick=timer_get_tick_count(); //the ticks of the initialization are skipped
 
     while(1){        
-        // Sleep until the ISR gives us something to do, if nothing is recieved then waits forever
-        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+        // Sleep until the ISR gives us something to do (one tick at a time)
+        timer_wait_tick(&tick);
 
-        mma8451q_read_accl(data_received,sizeof(data_received));
+        if (rate_generation!=sample_rate_generation){
+            rate_generation=sample_rate_generation;
+            mma8451q_set_rate(sample_rate_entry->mma8451q_dr);
+        }
 
+        mma8451q_read_accl(data_received,sizeof(data_received));
+        acq_time_add(&acq_time[ACQ_TIME_MMA8451Q]);
         
-        //We send the acceleration values of all axis (x,y,z)
-        xQueueSendToBack(queue_mma8451q, data_received,portMAX_DELAY);     
+        //We send the acceleration values of all axis (x,y,z), if the ring is full the sample is dropped
+        sample_ring_push(&ring_mma8451q, data_received);     
+	}
+}
+
+#else /*MMA8451Q_MODE_FIFO*/
+
+//In FIFO mode the sensor's ODR is the sample rate of the packet (sample_rate_valid checks it)
+
+//Time to fill the FIFO up to the watermark
+#define MMA8451Q_FIFO_POLL_MS(rate) ((1000*MMA8451Q_FIFO_WATERMARK)/(rate))
+
+void get_data_mma8451q_task(void *pvParameter)
+{
+    //samples read from the FIFO
+    static uint8_t fifo_samples[MMA8451Q_FIFO_SIZE*MMA8451Q_BYTES_PER_SAMPLE];
+
+    uint8_t fifo_status=0;
+    uint8_t total_samples=0;
+
+    TickType_t last_wake_time;
+
+    //delay for task and resource initialization...
+    vTaskDelay(DELAY_FOR_INIT / portTICK_PERIOD_MS);
+
+    //Configurates the mma8451q sensor, the FIFO starts to fill from here
+    uint32_t rate_generation=sample_rate_generation;
+    mma8451q_fifo_config(sample_rate_entry->mma8451q_dr, MMA8451Q_FIFO_WATERMARK);
+    last_wake_time=xTaskGetTickCount();
+
+    while(1){        
+        // Sleep until the FIFO reaches the watermark
+        vTaskDelayUntil(&last_wake_time, MMA8451Q_FIFO_POLL_MS(sample_rate_entry->rate) / portTICK_PERIOD_MS);
+
+        if (rate_generation!=sample_rate_generation){
+            rate_generation=sample_rate_generation;
+            mma8451q_set_rate(sample_rate_entry->mma8451q_dr);
+        }
+
+        fifo_status=mma8451q_fifo_status();
+        if (fifo_status & F_STATUS_OVERFLOW){
+            ESP_LOGW(TAG,"MMA8451Q FIFO: overflow, samples lost");
+        }
+
+        //read all the stored samples in one I2C transaction
+        total_samples=fifo_status & F_STATUS_COUNT_MASK;
+        mma8451q_read_fifo(fifo_samples,total_samples);
+
+        //We send the acceleration values of all axis (x,y,z), if the ring is full the sample is dropped
+        for(uint8_t i=0;i<total_samples;i++){
+            sample_ring_push(&ring_mma8451q, &fifo_samples[i*MMA8451Q_BYTES_PER_SAMPLE]);
+        }
 	}
 }
+#endif
 
 
 /*======================================================================
@@ -772,6 +1737,7 @@ void get_data_mma8451q_task(void *pvParameter)
  *  Get data of the ADXL355 accelerometer. This task only excecutes when
  *  receives a notification from the TIMER_ISR
  =======================================================================*/
+#if ADXL355_ACQUISITION_MODE==ADXL355_MODE_TIMER
 void get_data_adxl355_task(void *pvParameter)
 {
     /*Configurates SPI clock and SPI PINS*/
@@ -779,7 +1745,8 @@ void get_data_adxl355_task(void *pvParameter)
     vTaskDelay(100 / portTICK_PERIOD_MS);
 
     /*Configurates the accelerometer's sample rate*/
-    adxl355_100hz_rate(); 
+    uint32_t rate_generation=sample_rate_generation;
+    adxl355_set_rate(sample_rate_entry->adxl355_filter); 
     /*Configurates and turns on the accelerometer (+-2G range)*/
     adxl355_range_conf();
     
@@ -788,17 +1755,107 @@ void get_data_adxl355_task(void *pvParameter)
 
     //delay for task and resource initialization...
     vTaskDelay(DELAY_FOR_INIT / portTICK_PERIOD_MS);
+    uint32_t tick=timer_get_tick_count(); //the ticks of the initialization are skipped
 
     while(1){        
-        // Sleep until the ISR gives us something to do, if nothing is recieved then waits forever
-        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+        // Sleep until the ISR gives us something to do (one tick at a time)
+        timer_wait_tick(&tick);
+
+        if (rate_generation!=sample_rate_generation){
+            rate_generation=sample_rate_generation;
+            adxl355_change_rate(sample_rate_entry->adxl355_filter);
+        }
 
         adxl355_read_accl(data_received,sizeof(data_received));
+        acq_time_add(&acq_time[ACQ_TIME_ADXL355]);
+
+        //We send the acceleration values of all axis (x,y,z), if the ring is full the sample is dropped
+        sample_ring_push(&ring_adxl355, data_received);     
+	}
+}
+
+#else /*ADXL355_MODE_FIFO*/
+
+//In FIFO mode the sensor's ODR is the sample rate of the packet (sample_rate_valid checks it)
+
+//Maximum time without watermark interrupt before reading the FIFO anyway (missed edge)
+#define ADXL355_FIFO_TIMEOUT_MS(rate) ((2*1000*ADXL355_FIFO_WATERMARK)/(3*(rate))+10)
+
+/*INT1 interrupt (watermark reached), wakes up get_data_adxl355_task*/
+void IRAM_ATTR adxl355_int1_isr_handler(void* arg)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(get_data_adxl355_taskID, &xHigherPriorityTaskWoken);
+    if (xHigherPriorityTaskWoken) {
+      portYIELD_FROM_ISR();
+    }
+}
+
+void get_data_adxl355_task(void *pvParameter)
+{
+    //raw FIFO entries (DMA capable buffer) and decoded samples
+    static DMA_ATTR uint8_t fifo_raw[ADXL355_FIFO_ENTRIES*ADXL355_FIFO_BYTES_PER_ENTRY];
+    static uint8_t fifo_samples[(ADXL355_FIFO_ENTRIES/3)*ADXL355_FIFO_BYTES_PER_SAMPLE];
+    
+    adxl355_fifo_decoder_t decoder;
+    adxl355_fifo_decoder_reset(&decoder);
+
+    uint8_t entries=0;
+    uint16_t total_samples=0;
+
+    /*Configurates SPI clock and SPI PINS*/
+    adxl355_config_spi(); 
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+
+    /*Configurates the accelerometer's sample rate (equal to the packet sample rate)*/
+    uint32_t rate_generation=sample_rate_generation;
+    adxl355_set_rate(sample_rate_entry->adxl355_filter);
+    /*FIFO watermark and INT1 interrupt*/
+    adxl355_fifo_config(ADXL355_FIFO_WATERMARK);
+
+    //INT1 is active low (INT_POL=0 in the RANGE register)
+    gpio_config_t int1_config= {
+        .intr_type=GPIO_INTR_NEGEDGE,
+        .pin_bit_mask=(1ULL<<ADXL355_PIN_INT1),
+        .mode=GPIO_MODE_INPUT,
+    };
+    gpio_config(&int1_config);
+    //the gpio isr service is installed in sd_config_card
+    gpio_isr_handler_add(ADXL355_PIN_INT1, adxl355_int1_isr_handler, NULL);
+
+    //delay for task and resource initialization...
+    vTaskDelay(DELAY_FOR_INIT / portTICK_PERIOD_MS);
+
+    /*Configurates and turns on the accelerometer (+-2G range), the FIFO starts to fill from here*/
+    adxl355_range_conf();
+
+    while(1){        
+        // Sleep until the watermark interrupt (or the timeout)
+        ulTaskNotifyTake(pdTRUE, ADXL355_FIFO_TIMEOUT_MS(sample_rate_entry->rate) / portTICK_PERIOD_MS);
+
+        if (rate_generation!=sample_rate_generation){
+            rate_generation=sample_rate_generation;
+            adxl355_change_rate(sample_rate_entry->adxl355_filter);
+        }
+
+        //read all the entries in one burst, INT1 goes high again when the FIFO is under the watermark
+        entries=adxl355_fifo_entries();
+        adxl355_read_fifo(fifo_raw,entries);
+
+        total_samples=adxl355_fifo_decode(&decoder,fifo_raw,entries,fifo_samples,sizeof(fifo_samples)/ADXL355_FIFO_BYTES_PER_SAMPLE);
+
+        //We send the acceleration values of all axis (x,y,z), if the ring is full the sample is dropped
+        for(uint16_t i=0;i<total_samples;i++){
+            sample_ring_push(&ring_adxl355, &fifo_samples[i*ADXL355_FIFO_BYTES_PER_SAMPLE]);
+        }
 
-        //We send the acceleration values of all axis (x,y,z)
-        xQueueSendToBack(queue_adxl355, data_received,portMAX_DELAY);     
+        if (decoder.dropped_entries!=0){
+            ESP_LOGW(TAG,"ADXL355 FIFO: %d entries dropped to keep X,Y,Z alignment",decoder.dropped_entries);
+            decoder.dropped_entries=0;
+        }
 	}
 }
+#endif
 
 
 /*======================================================================
@@ -806,67 +1863,380 @@ void get_data_adxl355_task(void *pvParameter)
 
  *      1ro en muestrearse
  *  Get data of the MCP3561 ADC. This task only excecutes when
- *  receives a notification from the TIMER_ISR
+ *  receives a notification from the TIMER_ISR (MCP356X_MODE_TIMER) or
+ *  from the IRQ pin of the ADC (MCP356X_MODE_DRDY)
  =======================================================================*/
+#if MCP356X_ACQUISITION_MODE==MCP356X_MODE_TIMER
 void get_data_adc_mcp3561_task(void *pvParameter)
 {
     mcp356x_config_spi();   
     vTaskDelay(100 / portTICK_PERIOD_MS);      
     mcp356x_reg_config();
+    uint32_t rate_generation=sample_rate_generation;
+    mcp356x_set_rate(sample_rate_entry->mcp356x_config1);
     
-    //se declara el buffer de recepcion de datos
-    uint8_t data_received[3]; //24 bits to store 24 bit adc resolution
+    //se declara el buffer de recepcion de datos (24 bits to store 24 bit adc resolution and the timestamp)
+    mcp356x_sample_t data_received; 
     
 
     //delay for task and resource initialization...
     vTaskDelay(DELAY_FOR_INIT / portTICK_PERIOD_MS);
+    uint32_t tick=timer_get_tick_count(); //the ticks of the initialization are skipped
 
     while(1){        
-        // Sleep until the ISR gives us something to do, if nothing is recieved then waits forever
-        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+        // Sleep until the ISR gives us something to do (one tick at a time, with its own stamp)
+        uint64_t tick_stamp=timer_wait_tick(&tick);
 
-        mcp356x_read_adc(data_received,sizeof(data_received));    
+        if (rate_generation!=sample_rate_generation){
+            rate_generation=sample_rate_generation;
+            mcp356x_set_rate(sample_rate_entry->mcp356x_config1);
+        }
+
+        data_received.timestamp=tick_stamp;
+        mcp356x_read_adc(data_received.data,sizeof(data_received.data));    
+        acq_time_add(&acq_time[ACQ_TIME_MCP356X]);
         
-        //We send the acceleration values of 24 bit ADC (SM-24 geophone)
-        xQueueSendToBack(queue_adc_mcp3561, data_received,portMAX_DELAY);      
+        //We send the acceleration values of 24 bit ADC (SM-24 geophone), if the ring is full the sample is dropped
+        sample_ring_push(&ring_adc_mcp3561, &data_received);      
+    }
+}
+
+#else /*MCP356X_MODE_DRDY*/
+
+#define MCP356X_STAMP_RING_CAPACITY 16 //IRQ stamps waiting for the ADC task (power of 2)
+
+//IRQ stamps, producer = mcp356x_irq_isr_handler, consumer = get_data_adc_mcp3561_task
+sample_ring_t ring_mcp356x_stamps;
+uint64_t ring_mcp356x_stamps_storage[MCP356X_STAMP_RING_CAPACITY];
+
+/*IRQ pin interrupt (conversion ready), latches the sample timer and wakes up the ADC task*/
+void IRAM_ATTR mcp356x_irq_isr_handler(void* arg)
+{
+    uint64_t stamp=timer_get_timestamp_from_isr();
+    sample_ring_push(&ring_mcp356x_stamps, &stamp);
+
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(get_data_adc_mcp3561_taskID, &xHigherPriorityTaskWoken);
+    if (xHigherPriorityTaskWoken) {
+      portYIELD_FROM_ISR();
+    }
+}
+
+void get_data_adc_mcp3561_task(void *pvParameter)
+{
+    //stamps received since the last read (oldest first)
+    uint64_t pending_stamps[MCP356X_STAMP_RING_CAPACITY];
+    uint32_t total_stamps=0;
+
+    mcp356x_sample_t data_received;
+
+    mcp356x_drdy_tracker_t tracker;
+    uint32_t rate_generation=sample_rate_generation;
+    mcp356x_drdy_init(&tracker, timer_get_period());
+
+#if MCP356X_SCAN_CHANNELS>1
+    //one read per channel (32 bit + channel ID), joined into one sample per SCAN cycle
+    uint8_t raw_read[MCP356X_BYTES_PER_READ];
+    const uint8_t scan_channel_ids[MCP356X_SCAN_CHANNELS]={MCP356X_CHID_DIF_CH0_CH1,MCP356X_CHID_DIF_CH2_CH3,MCP356X_CHID_DIF_CH4_CH5};
+    mcp356x_scan_demux_t demux;
+    mcp356x_scan_demux_init(&demux, scan_channel_ids, MCP356X_SCAN_CHANNELS);
+#endif
+
+    sample_ring_init(&ring_mcp356x_stamps, ring_mcp356x_stamps_storage, sizeof(uint64_t), MCP356X_STAMP_RING_CAPACITY);
+
+    mcp356x_config_spi();   
+    vTaskDelay(100 / portTICK_PERIOD_MS);      
+    mcp356x_reg_config();
+    //OSR and delay between SCAN cycles to get ~rate cycles per second
+    mcp356x_set_rate(sample_rate_mcp356x_config1(sample_rate_entry,MCP356X_DMCLK_HZ,MCP356X_SCAN_CHANNELS));
+    mcp356x_set_scan_timer(sample_rate_mcp356x_scan_timer(sample_rate_entry,MCP356X_DMCLK_HZ,MCP356X_SCAN_CHANNELS));
+
+    //IRQ pin goes low when a conversion is ready
+    gpio_config_t irq_config= {
+        .intr_type=GPIO_INTR_NEGEDGE,
+        .pin_bit_mask=(1ULL<<MCP356X_PIN_IRQ),
+        .mode=GPIO_MODE_INPUT,
+    };
+    gpio_config(&irq_config);
+
+    //delay for task and resource initialization...
+    vTaskDelay(DELAY_FOR_INIT / portTICK_PERIOD_MS);
+
+    //the gpio isr service is installed in sd_config_card
+    gpio_isr_handler_add(MCP356X_PIN_IRQ, mcp356x_irq_isr_handler, NULL);
+
+    while(1){        
+        // Sleep until the IRQ pin says that there is a new conversion
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        //new rate, the tracker starts again with the new nominal period
+        if (rate_generation!=sample_rate_generation){
+            rate_generation=sample_rate_generation;
+            mcp356x_set_rate(sample_rate_mcp356x_config1(sample_rate_entry,MCP356X_DMCLK_HZ,MCP356X_SCAN_CHANNELS));
+            mcp356x_set_scan_timer(sample_rate_mcp356x_scan_timer(sample_rate_entry,MCP356X_DMCLK_HZ,MCP356X_SCAN_CHANNELS));
+            mcp356x_drdy_init(&tracker, timer_get_period());
+#if MCP356X_SCAN_CHANNELS>1
+            mcp356x_scan_demux_init(&demux, scan_channel_ids, MCP356X_SCAN_CHANNELS);
+#endif
+            while(sample_ring_pop_batch(&ring_mcp356x_stamps, pending_stamps, MCP356X_STAMP_RING_CAPACITY)!=0);
+            continue;
+        }
+
+        //stamps first, so the read data is never older than the newest stamp
+        total_stamps=sample_ring_pop_batch(&ring_mcp356x_stamps, pending_stamps, MCP356X_STAMP_RING_CAPACITY);
+        if (total_stamps==0){
+            continue;
+        }
+
+#if MCP356X_SCAN_CHANNELS==1
+        mcp356x_read_adc(data_received.data,sizeof(data_received.data));    
+
+        if (mcp356x_drdy_associate(&tracker, pending_stamps, total_stamps, &data_received.timestamp)){
+            //We send the values of 24 bit ADC (SM-24 geophone), if the ring is full the sample is dropped
+            sample_ring_push(&ring_adc_mcp3561, &data_received);      
+
+            //only after an accepted read, a rejected one doesn't advance the samples
+            if ((tracker.samples % (10*sample_rate_entry->rate))==0){
+                ESP_LOGI(TAG,"MCP356X DRDY: period %d us, missed %d, samples %d",tracker.period,tracker.missed,tracker.samples);
+            }
+        }
+#else
+        /*the IRQ stamps of one cycle aren't equally spaced (one per channel), so the tracker
+        isn't used: the read belongs to the newest stamp and the channel ID tells if 
+        conversions were lost*/
+        mcp356x_read_adc(raw_read,sizeof(raw_read));    
+
+        if (mcp356x_scan_demux_push(&demux, raw_read, pending_stamps[total_stamps-1], data_received.data, &data_received.timestamp)){
+            //We send the values of the three geophone channels, if the ring is full the sample is dropped
+            sample_ring_push(&ring_adc_mcp3561, &data_received);      
+
+            if ((demux.frames % (10*sample_rate_entry->rate))==0){
+                ESP_LOGI(TAG,"MCP356X SCAN: frames %d, dropped reads %d, duplicated %d, unknown %d",demux.frames,demux.dropped_reads,demux.duplicated_reads,demux.unknown_reads);
+            }
+        }
+#endif
+    }
+}
+#endif
+
+
+/*======================================================================
+ *8.1  SINGLE ACQUISITION TASK (ACQUISITION_SINGLE_TASK)
+
+ *  Reads every sensor in TIMER mode in the same tick: MCP3561, ADXL355 
+ *  (SPI polling transactions, the CPU doesn't sleep between the two reads)
+ *  and then MMA8451Q (I2C). Only one notification from the TIMER_ISR and 
+ *  one context switch per tick instead of three.
+ =======================================================================*/
+#if ACQ_TASK_READS_ANY
+void acquisition_task(void *pvParameter)
+{
+    uint32_t rate_generation=sample_rate_generation;
+
+#if ACQ_TASK_READS_MCP356X
+    mcp356x_sample_t data_mcp3561; //24 bit ADC value and its timestamp
+    mcp356x_config_spi();   
+    vTaskDelay(100 / portTICK_PERIOD_MS);      
+    mcp356x_reg_config();
+    mcp356x_set_rate(sample_rate_entry->mcp356x_config1);
+#endif
+
+#if ACQ_TASK_READS_ADXL355
+    uint8_t data_adxl355[BYTES_SAMPLE_ADXL355];
+    adxl355_config_spi(); 
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+    adxl355_set_rate(sample_rate_entry->adxl355_filter); 
+    adxl355_range_conf();
+#endif
+
+#if ACQ_TASK_READS_MMA8451Q
+    uint8_t data_mma8451q[BYTES_SAMPLE_MMA8451Q];
+    mma8451q_reg_config();
+    mma8451q_set_rate(sample_rate_entry->mma8451q_dr);
+#endif
+
+    //delay for task and resource initialization...
+    vTaskDelay(DELAY_FOR_INIT / portTICK_PERIOD_MS);
+    uint32_t tick=timer_get_tick_count(); //the ticks of the initialization are skipped
+
+    while(1){        
+        // Sleep until the ISR gives us something to do (one tick at a time, with its own stamp)
+#if ACQ_TASK_READS_MCP356X
+        data_mcp3561.timestamp=timer_wait_tick(&tick);
+#else
+        timer_wait_tick(&tick);
+#endif
+
+        //new rate, every sensor of this task is reprogrammed before the next read
+        if (rate_generation!=sample_rate_generation){
+            rate_generation=sample_rate_generation;
+#if ACQ_TASK_READS_MCP356X
+            mcp356x_set_rate(sample_rate_entry->mcp356x_config1);
+#endif
+#if ACQ_TASK_READS_ADXL355
+            adxl355_change_rate(sample_rate_entry->adxl355_filter);
+#endif
+#if ACQ_TASK_READS_MMA8451Q
+            mma8451q_set_rate(sample_rate_entry->mma8451q_dr);
+#endif
+        }
+
+#if ACQ_TASK_READS_MCP356X
+        mcp356x_read_adc_polling(data_mcp3561.data,sizeof(data_mcp3561.data));
+#endif
+#if ACQ_TASK_READS_ADXL355
+        adxl355_read_accl_polling(data_adxl355,sizeof(data_adxl355));
+#endif
+#if ACQ_TASK_READS_MMA8451Q
+        mma8451q_read_accl(data_mma8451q,sizeof(data_mma8451q));
+#endif
+        acq_time_add(&acq_time[ACQ_TIME_SINGLE_TASK]);
+
+        //if a ring is full the sample is dropped
+#if ACQ_TASK_READS_MCP356X
+        sample_ring_push(&ring_adc_mcp3561, &data_mcp3561);
+#endif
+#if ACQ_TASK_READS_ADXL355
+        sample_ring_push(&ring_adxl355, data_adxl355);
+#endif
+#if ACQ_TASK_READS_MMA8451Q
+        sample_ring_push(&ring_mma8451q, data_mma8451q);
+#endif
     }
 }
+#endif
 
 
 /*=================================================================================
  *9 GET DATA REAL TIME CLOCK DS3231 by I2C TASK 
  * 
- * Check date and time by the i2c bus
+ * Anchors the station clock to the DS3231 every TIME_SERVICE_ANCHOR_S (i2c), 
+ * the falling edge of the SQW pin (start of every RTC second) gives the 
+ * sample timer value of the second that was read
  =================================================================================*/
-void get_data_rtc_ds3231_task(void *pvParameter)
+#if SAMPLE_CLOCK_DISCIPLINE
+#define SQW_STAMP_RING_CAPACITY 4 //SQW edges waiting for the clock discipline task (power of 2)
+#define SQW_LOST_MS 3000 //without edges for this time: holdover (the last trim is kept)
+
+//Timer values of one SQW edge
+typedef struct {
+    uint64_t edge;      //counter at the edge
+    uint64_t last_tick; //alarm value of the last sample tick
+} sqw_stamp_t;
+
+//SQW edges, producer = sqw_isr_handler, consumer = clock_discipline_task
+sample_ring_t ring_sqw_stamps;
+sqw_stamp_t ring_sqw_stamps_storage[SQW_STAMP_RING_CAPACITY];
+
+//Servo of the sample clock, OFFSET (residual, timer counts) and its mean tell the timing quality
+clock_discipline_t sample_clock;
+#endif
+
+/*SQW pin interrupt (falling edge), latches the sample timer for the time service (anchor of 
+the DS3231 second) and wakes up the clock discipline task*/
+void IRAM_ATTR sqw_isr_handler(void* arg)
 {
-    /*Array to store 12 bytes date and time 
-    */
-    char local_datetime[DATETIME_SIZE_FORMAT] = {0}; 
+    uint64_t edge=timer_get_timestamp_from_isr();
+
+    time_service_edge_from_isr(edge);
+
+#if SAMPLE_CLOCK_DISCIPLINE
+    sqw_stamp_t stamp;
 
+    stamp.edge=edge;
+    stamp.last_tick=timer_get_last_tick();
+    sample_ring_push(&ring_sqw_stamps, &stamp);
+
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(clock_discipline_taskID, &xHigherPriorityTaskWoken);
+    if (xHigherPriorityTaskWoken) {
+      portYIELD_FROM_ISR();
+    }
+#endif
+}
+
+#define SQW_FIRST_EDGE_MS 1100 //one SQW period and the latency of the ISR
+
+void get_data_rtc_ds3231_task(void *pvParameter)
+{
     printf("RTC-TASK: setting intial register configuration\n");
     ds3231_reg_config();
 
-    //delay for task and resource initialization...
+    //1 Hz square wave (enabled by ds3231_reg_config), open drain with external pull-up
+    gpio_config_t sqw_config= {
+        .intr_type=GPIO_INTR_NEGEDGE,
+        .pin_bit_mask=(1ULL<<DS3231_PIN_SQW),
+        .mode=GPIO_MODE_INPUT,
+    };
+    gpio_config(&sqw_config);
+
+    //delay for task and resource initialization (the sample timer too)...
     vTaskDelay(DELAY_FOR_INIT / portTICK_PERIOD_MS);
 
-    /*Initial date and time are set i sntp_config.c file*/
+    //the gpio isr service is installed in sd_config_card, the first anchor waits for one edge
+    gpio_isr_handler_add(DS3231_PIN_SQW, sqw_isr_handler, NULL);
+    vTaskDelay(SQW_FIRST_EDGE_MS / portTICK_PERIOD_MS);
+
+    /*Initial date and time are set by the time service (sntp_config.c), the packets read the
+    station clock, the DS3231 is only read to anchor it again (drift of the sample timer)*/
     while (1)
     {
-        /* Sleep until the fill_buffer_with_sensor_task gives something to do, 
-        if nothing is recieved then waits forever*/
-        xSemaphoreTake(semaphore_rtc_ds3231,portMAX_DELAY);
-        
-        ds3231_get_datetime(local_datetime);
-        
-        //We send the date and time values to the queue
-        xQueueSendToBack(queue_date_time, local_datetime,portMAX_DELAY);   
+        if (!time_service_anchor()){
+            ESP_LOGW(TAG,"RTC-TASK: DS3231 couldn't be read, the station clock runs with the sample timer (START_US = 0 if it was never read)");
+        }
+        vTaskDelay(TIME_SERVICE_ANCHOR_S*1000 / portTICK_PERIOD_MS);
     }
     
 }
 
 
 
+/*=================================================================================
+ *9.1 SAMPLE CLOCK DISCIPLINE TASK (SAMPLE_CLOCK_DISCIPLINE)
+ * 
+ * The SQW edges latched by sqw_isr_handler, the servo trims the timer 
+ * period (clock_discipline.h)
+ =================================================================================*/
+#if SAMPLE_CLOCK_DISCIPLINE
+void clock_discipline_task(void *pvParameter)
+{
+    sqw_stamp_t stamp;
+    uint32_t rate_generation=sample_rate_generation;
+
+    clock_discipline_init(&sample_clock, timer_get_period(), sample_rate_entry->rate, TIMER_SCALE);
+
+    while(1){
+        // Sleep until the next RTC second
+        if (ulTaskNotifyTake(pdTRUE, SQW_LOST_MS / portTICK_PERIOD_MS)==0){
+            if (sample_clock.started){
+                ESP_LOGW(TAG,"CLOCK DISCIPLINE: no SQW edges, holdover (trim %d ppb)",clock_discipline_ppb(&sample_clock));
+                clock_discipline_lost(&sample_clock);
+            }
+            continue;
+        }
+
+        //new rate, new nominal period: the servo starts again without trim
+        if (rate_generation!=sample_rate_generation){
+            rate_generation=sample_rate_generation;
+            timer_set_trim(0);
+            clock_discipline_init(&sample_clock, timer_get_period(), sample_rate_entry->rate, TIMER_SCALE);
+            while(sample_ring_pop(&ring_sqw_stamps, &stamp));
+            continue;
+        }
+
+        while(sample_ring_pop(&ring_sqw_stamps, &stamp)){
+            timer_set_trim(clock_discipline_edge(&sample_clock, stamp.edge, stamp.last_tick));
+        }
+
+        if (sample_clock.edges!=0 && (sample_clock.edges % 60)==0){
+            ESP_LOGI(TAG,"CLOCK DISCIPLINE: offset %d us (mean %d), trim %d ppb, %s, rejected edges %d",sample_clock.offset,
+                sample_clock.offset_mean>>4,clock_discipline_ppb(&sample_clock),sample_clock.locked?"locked":"not locked",sample_clock.rejected);
+        }
+    }
+}
+#endif
+
+
 /*=================================================================================
  *10 CHECK FREE RAM TASK 
  * 
@@ -877,6 +2247,12 @@ void check_free_ram_task(void *pvParameter)
     //Check free ram size in bytes
     while(1){
 		ESP_LOGI(TAG, "free RAM: %d bytes",esp_get_free_heap_size());
+
+        //minimum free stack of the SD tasks since the boot (SD_TASK_STACK_BYTES)
+        if (send_buffer_to_SD_taskID!=NULL && fill_buffer_with_sd_taskID!=NULL){
+            ESP_LOGI(TAG, "SD tasks free stack: write %d bytes, read %d bytes of %d",
+                uxTaskGetStackHighWaterMark(send_buffer_to_SD_taskID),uxTaskGetStackHighWaterMark(fill_buffer_with_sd_taskID),SD_TASK_STACK_BYTES);
+        }
 		vTaskDelay(pdMS_TO_TICKS(1000));
 	}
 }
@@ -892,76 +2268,106 @@ void app_main()
     ESP_LOGI(TAG,"APP MAIN: Allow other core to finish initialization...");
 	//Allow other core to finish initialization
     vTaskDelay(200 / portTICK_PERIOD_MS);
+
+    // initialize NVS (non volatil storage, required for wifi and the sample rate)
+	ESP_ERROR_CHECK(nvs_flash_init());
+
+    //sample rate stored in NVS (SAMPLE_RATE the first time), before reset_buffer and the timer
+    sample_rate_init();
+
+    //SEQUENCE of the packets, continues after the last one of the previous boot
+    packet_sequence_init();
+
+    //packet duration stored in NVS (PACKET_DURATION_MS the first time), items of the first packet
+    packet_duration_init();
     
     /*
     ----------------------------------------------------------------------
     -------------------- { MEMORY ALLOCATION } --------------------
     ----------------------------------------------------------------------
     */
-    //buffer offset and maximum number of bytes
-    buffer_general_calc();
-    vTaskDelay(100 / portTICK_PERIOD_MS);
+    //buffer offsets are calculated by the compiler (packet_layout.h), the packet length by packet_duration_init
+    printf("Buffer: max_buffer_size (without considering STATUS_BYTE and SEQ) = %d, %d hot buffers\n",max_buffer_size,number_of_buffers);
+    printf("Buffer: bytes per item (all sensors) = %d\n",(int)PACKET_BYTES_PER_ITEM);
    
     printf("Memory allocation\n");
-    //Prepare semaphore
-    semaphore_rtc_ds3231 = xSemaphoreCreateBinary();
-    
-    //Prepare queues    
-    queue_mma8451q = xQueueCreate(MAX_NUM_MSG, BYTES_PER_MSG_16_BIT*3); //16 bit per message (only 14 used) per channel (in total 16*3 bits) considering 3 channels
-    queue_adxl355  = xQueueCreate(MAX_NUM_MSG, BYTES_PER_MSG_24_BIT*3); //24 bit per message (only 20 used) per channel (in total 24*3 bits) considering 3 channels
-    queue_adc_mcp3561 = xQueueCreate(MAX_NUM_MSG, BYTES_PER_MSG_24_BIT); //24 bit per message (24 used) 
-    ESP_LOGI(TAG, "Queues for data sensing have been created");
-	vTaskDelay(100 / portTICK_PERIOD_MS);
-
-    //Queue to store date and time of each buffers
-    queue_date_time = xQueueCreate(NUMBER_OF_BUFFERS, DATETIME_SIZE_FORMAT);
-    ESP_LOGI(TAG, "Queue for date and time created");
+    //Prepare sample rings    
+    sample_ring_init(&ring_mma8451q, ring_mma8451q_storage, BYTES_SAMPLE_MMA8451Q, SAMPLE_RING_CAPACITY);
+    sample_ring_init(&ring_adxl355, ring_adxl355_storage, BYTES_SAMPLE_ADXL355, SAMPLE_RING_CAPACITY);
+    sample_ring_init(&ring_adc_mcp3561, ring_adc_mcp3561_storage, sizeof(mcp356x_sample_t), SAMPLE_RING_CAPACITY);
+#if RING_FOLLOWS_ADXL355
+    sample_ring_follow(&ring_adxl355, &ring_adc_mcp3561);
+#endif
+#if RING_FOLLOWS_MMA8451Q
+    sample_ring_follow(&ring_mma8451q, &ring_adc_mcp3561);
+#endif
+#if SAMPLE_CLOCK_DISCIPLINE
+    sample_ring_init(&ring_sqw_stamps, ring_sqw_stamps_storage, sizeof(sqw_stamp_t), SQW_STAMP_RING_CAPACITY);
+#endif
+#if DECIMATION_RATIO>1
+    sample_ring_init(&ring_dec_mma8451q, ring_dec_mma8451q_storage, BYTES_SAMPLE_MMA8451Q, DECIMATED_RING_CAPACITY);
+    sample_ring_init(&ring_dec_adxl355, ring_dec_adxl355_storage, BYTES_SAMPLE_ADXL355, DECIMATED_RING_CAPACITY);
+    sample_ring_init(&ring_dec_adc_mcp3561, ring_dec_adc_mcp3561_storage, sizeof(mcp356x_sample_t), DECIMATED_RING_CAPACITY);
+#endif
+    ESP_LOGI(TAG, "Rings for data sensing have been created");
 	vTaskDelay(100 / portTICK_PERIOD_MS);
 
     //Queues to storage full and empty buffers (queues storage only pointers)
-    queue_full_buffers= xQueueCreate(NUMBER_OF_BUFFERS, sizeof(uint32_t)); //Number of messages = NUMBER_OF_BUFFERS, size of messages in bytes = 32 bits (4 bytes)
-	queue_empty_buffers= xQueueCreate(NUMBER_OF_BUFFERS, sizeof(uint32_t));
+    queue_full_buffers= xQueueCreate(number_of_buffers, sizeof(uint32_t)); //Number of messages = number_of_buffers, size of messages in bytes = 32 bits (4 bytes)
+	queue_empty_buffers= xQueueCreate(number_of_buffers, sizeof(uint32_t));
     ESP_LOGI(TAG, "Queues for buffer pointers have been created");
 	vTaskDelay(100 / portTICK_PERIOD_MS);
 
     //Queues to save in SD card or send over WIFI
-    queue_to_save_in_sd= xQueueCreate(NUMBER_OF_BUFFERS, sizeof(uint32_t)); //Number of messages = NUMBER_OF_BUFFERS, size of messages in bytes = 32 bits (4 bytes)
-	queue_to_send_wifi= xQueueCreate(NUMBER_OF_BUFFERS, sizeof(uint32_t));
+    queue_to_save_in_sd= xQueueCreate(2*number_of_buffers, sizeof(uint32_t)); //Number of messages = 2*number_of_buffers (archive + backlog of the same buffer), size of messages in bytes = 32 bits (4 bytes)
+	queue_to_send_wifi= xQueueCreate(number_of_buffers, sizeof(uint32_t));
+    queue_backlog_ack= xQueueCreate(number_of_buffers, sizeof(uint32_t)); //an ack that doesn't fit is lost (the record is uploaded again)
     ESP_LOGI(TAG, "Queues to save in SD card or send over WIFI have been created");
 	vTaskDelay(100 / portTICK_PERIOD_MS);
-    
-    //Queue to save filenames of pending files in SD card (MAX_OPEN_FILES defined in sd_config.h)
-    queue_filename_list = xQueueCreate(MAX_OPEN_FILES*2, MAX_FILENAME_SIZE);
-    ESP_LOGI(TAG, "Queue to read buffers from SD card");
-	vTaskDelay(100 / portTICK_PERIOD_MS);
 
-    //asing memory to the buffers
-    char *buffer_list[NUMBER_OF_BUFFERS];  /* declare the array that will store the buffer list */
+#if PAYLOAD_ENCODING!=PACKET_ENCODING_RAW
+    //Queue of the buffers that will be compressed
+    queue_to_encode= xQueueCreate(number_of_buffers, sizeof(uint32_t));
+#endif
     
-    for (int8_t i=0;i<NUMBER_OF_BUFFERS;i++){
-        /*heap_caps_malloc(bytes_to_allocate, type_of_information)
-        max_buffer_size + status byte (more information at the begining)
-        */
-        buffer_list[i] = heap_caps_malloc(max_buffer_size+1, MALLOC_CAP_8BIT);  
-        /* allocate N bytes buffer (BUFFER_SIZE defined at the begining) in a block of internal RAM memory*/
+    /*asing memory to the buffers (buffer pool, buffer_pool.h)
+    max_buffer_size + status byte and SEQ (more information at the begining), allocated with
+    buffer_pool_alloc_dram in a block of internal RAM memory
+    */
+    buffer_pool_init(&buffer_pool, max_buffer_size+BUFFER_STATUS_BYTES);
+    uint16_t allocated_buffers = buffer_pool_add(&buffer_pool, BUFFER_POOL_BUFFERS, BUFFER_TIER_HOT, buffer_pool_alloc_dram);
+    if (allocated_buffers<BUFFER_POOL_BUFFERS){
+        ESP_LOGE("DRAM (Data RAM)","Failed to allocate buffer in DRAM, %d/%d buffers",allocated_buffers,BUFFER_POOL_BUFFERS);
+    }
+    
+    for (uint16_t i=0;i<allocated_buffers && i<number_of_buffers;i++){
+        char *buffer = buffer_pool_get(&buffer_pool,i);
+
+        //prints the id (pointer) of the memory allocation
+        ESP_LOGI("DRAM (Data RAM)","Success in DRAM memory allocation, buffer_id[%d] = %p",i,buffer);
+        //send the id pointer to the free (not busy) buffer queue
+        ESP_LOGI("DRAM (Data RAM)","Sending buffer id to the empty buffer queue...");
+        xQueueSendToBack(queue_empty_buffers, &buffer,portMAX_DELAY);
+        ESP_LOGI("DRAM (Data RAM)","Preparing buffer (adding labels)");
+        reset_buffer(buffer);    
+        vTaskDelay((500/number_of_buffers) / portTICK_PERIOD_MS);
+    }
 
-        /*if memory allocated succesfully (malloc succesfully) will store the direction of memory
-        of the allocation, other case buffers_pinters[i] = NULL
-        */
-        if (buffer_list[i]==NULL){
-            ESP_LOGE("DRAM (Data RAM)","Failed to allocate buffer in DRAM");
-        }
-        else{
-            //prints the id (pointer) of the memory allocation
-            ESP_LOGI("DRAM (Data RAM)","Success in DRAM memory allocation, buffer_id[%d] = %p",i,buffer_list[i]);
-            //if memory allocation ok then send the id pointer to the free (not busy) buffer queue
-            ESP_LOGI("DRAM (Data RAM)","Sending buffer id to the empty buffer queue...");
-            xQueueSendToBack(queue_empty_buffers, &buffer_list[i],portMAX_DELAY);
-            ESP_LOGI("DRAM (Data RAM)","Preparing buffer (adding labels)");
-            reset_buffer(buffer_list[i]);    
-            vTaskDelay(500 / portTICK_PERIOD_MS);
+#if PSRAM_POOL && CONFIG_ESP32_SPIRAM_SUPPORT
+    //cold buffers: the free PSRAM at boot (after the hot ones, indexes allocated_buffers...)
+    uint16_t cold_buffers = buffer_pool_cold_count(heap_caps_get_free_size(MALLOC_CAP_SPIRAM), 
+        heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM), PSRAM_POOL_RESERVE, max_buffer_size+BUFFER_STATUS_BYTES, BUFFER_POOL_MAX-buffer_pool.count);
+    cold_buffers = buffer_pool_add(&buffer_pool, cold_buffers, BUFFER_TIER_COLD, buffer_pool_alloc_psram);
+    ESP_LOGI("PSRAM","%d cold buffers (%d bytes) in PSRAM",cold_buffers,cold_buffers*(max_buffer_size+BUFFER_STATUS_BYTES));
+    if (cold_buffers!=0){
+        queue_cold_empty = xQueueCreate(cold_buffers, sizeof(uint32_t));
+        queue_cold_full = xQueueCreate(cold_buffers, sizeof(uint32_t));
+        for (uint16_t i=0;i<cold_buffers;i++){
+            char *buffer = buffer_pool_get(&buffer_pool,allocated_buffers+i);
+            xQueueSendToBack(queue_cold_empty, &buffer,portMAX_DELAY);
         }
     }
+#endif
     
     /*
     ----------------------------------------------------------------------
@@ -1014,20 +2420,51 @@ void app_main()
 	xTaskCreate(full_buffer_selection_go_to_task,"full_buffer_selection_go_to_task", 8*1024, NULL, 6, NULL);
     vTaskDelay(100 / portTICK_PERIOD_MS);
 
+#if DECIMATION_RATIO>1
+    //2.1  create task: anti-alias filter and downsampling between the sensors and the buffers
+    ESP_LOGI(TAG,"\nCreating decimation task..."); 
+	xTaskCreate(decimation_task, "decimation_task", 4*1024, NULL, 6, NULL);
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+#endif
+
+#if PAYLOAD_ENCODING!=PACKET_ENCODING_RAW
+    //2.2  create task: compress the full buffers (the spare buffer is swapped with the compressed one)
+    ESP_LOGI(TAG,"\nCreating encode buffer task..."); 
+    char *spare_buffer = (buffer_pool.tier_count[BUFFER_TIER_HOT]>number_of_buffers)?buffer_pool_get(&buffer_pool, number_of_buffers):NULL; //last hot buffer
+    if (spare_buffer==NULL){
+        ESP_LOGE("DRAM (Data RAM)","Failed to allocate the spare buffer of the encoder in DRAM, packets will be sent raw");
+    }
+	xTaskCreate(encode_buffer_task, "encode_buffer_task", 3*1024, spare_buffer, 6, NULL);
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+#endif
+
+#if ACQ_TASK_READS_ANY
+    //3  create task: get data from every sensor in TIMER mode (single acquisition task)
+    ESP_LOGI(TAG,"\nCreating single acquisition task..."); 
+	xTaskCreate(acquisition_task, "acquisition_task", 3*1024, NULL, 6, &acquisition_taskID);
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+#endif
+
+#if !ACQ_TASK_READS_MCP356X
     //3  create task: get data from SPI 24 Bit ADC mcp3561
     ESP_LOGI(TAG,"\nCreating task to take data from SPI 24 bit ADC mcp3561 ..."); 
 	xTaskCreate(get_data_adc_mcp3561_task, "get_data_adc_mcp3561_task", 2*1024, NULL, 6, &get_data_adc_mcp3561_taskID);
     vTaskDelay(100 / portTICK_PERIOD_MS);
+#endif
 
+#if !ACQ_TASK_READS_ADXL355
     //4  create task: get data from SPI 20 bit accelerometer adxl355
     ESP_LOGI(TAG,"\nCreating task to take data from adxl355 SPI 20 bit accelerometer..."); 
 	xTaskCreate(get_data_adxl355_task, "get_data_adxl355_task", 2*1024, NULL, 6, &get_data_adxl355_taskID);
     vTaskDelay(100 / portTICK_PERIOD_MS);
+#endif
 
+#if !ACQ_TASK_READS_MMA8451Q
     //5  create task: get data from i2c 14 bit accelerometer mma8451q
     ESP_LOGI(TAG,"\nCreating task to take data from mma8451q i2c 14 bit accelerometer..."); 
 	xTaskCreate(get_data_mma8451q_task, "get_data_mma8451q_task", 2*1024, NULL, 6, &get_data_mma8451q_taskID);
     vTaskDelay(100 / portTICK_PERIOD_MS);
+#endif
 
     //6  create task: Check free ram memory available
     ESP_LOGI(TAG,"\nCreating task to check how much free RAM memory available..."); 
@@ -1039,19 +2476,21 @@ void app_main()
 	xTaskCreate(get_data_rtc_ds3231_task, "get_data_rtc_ds3231_task", 2*1024, NULL, 6, NULL);
     vTaskDelay(100 / portTICK_PERIOD_MS);
 
-    //8  create task: Send buffer to SD card task
-    ESP_LOGI(TAG,"\nCreating send buffer to SD task..."); 
-	xTaskCreate(send_buffer_to_SD_task, "send_buffer_to_SD_task", 2*1024, NULL, 7, NULL);
+#if SAMPLE_CLOCK_DISCIPLINE
+    //7.1  create task: Sample clock discipline (DS3231 SQW pin)
+    ESP_LOGI(TAG,"\nCreating sample clock discipline task..."); 
+	xTaskCreate(clock_discipline_task, "clock_discipline_task", 2*1024, NULL, 6, &clock_discipline_taskID);
     vTaskDelay(100 / portTICK_PERIOD_MS);
+#endif
 
-    //9  create task: Get filename list task
-    ESP_LOGI(TAG,"\nCreating filename list SD task..."); 
-	xTaskCreate(get_filename_list_task, "get_filename_list_task", 2*1024, NULL, 3, NULL);
+    //8  create task: Send buffer to SD card task
+    ESP_LOGI(TAG,"\nCreating send buffer to SD task..."); 
+	xTaskCreate(send_buffer_to_SD_task, "send_buffer_to_SD_task", SD_TASK_STACK_BYTES, NULL, 7, &send_buffer_to_SD_taskID);
     vTaskDelay(100 / portTICK_PERIOD_MS);
 
     //10  create task: Fill buffer with SD data task
     ESP_LOGI(TAG,"\nFill buffer with SD data..."); 
-	xTaskCreate(fill_buffer_with_sd_task, "fill_buffer_with_sd_task", 2*1024, NULL, 3, NULL);
+	xTaskCreate(fill_buffer_with_sd_task, "fill_buffer_with_sd_task", SD_TASK_STACK_BYTES, NULL, 3, &fill_buffer_with_sd_taskID);
     vTaskDelay(100 / portTICK_PERIOD_MS);
 
     //0  create task: To send full buffers to the server by wifi
@@ -1099,17 +2538,16 @@ void app_main()
     ----------------------------------------------------------------------
     */
     printf("Online configurations\n");
-    // initialize NVS (non volatil storage, required for wifi)
-	ESP_ERROR_CHECK(nvs_flash_init());
     
     ESP_LOGI(TAG,"Wifi configurations..."); 
     wifi_init_sta();    
     vTaskDelay(200 / portTICK_PERIOD_MS);
 
     printf ("Timer configurations...\n");
-    conf_timer(); //configurate the timer 100 HZ sample rate
+    conf_timer(); //configurate the timer (sample rate loaded by sample_rate_init)
     printf ("All configurations done, initializing system...\n");
 
-    printf ("SNTP clock configurations...\n");
-    sntp_config();
+    //11  create task: Time service (SNTP, drift and uncertainty of the DS3231)
+    ESP_LOGI(TAG,"\nCreating time service task..."); 
+    xTaskCreate(time_service_task, "time_service_task", 4*1024, NULL, 4, NULL);
 }
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include "mcp356x_drdy.h"
+
+//weight of every new period measurement (1/16)
+#define PERIOD_FILTER_SHIFT 4
+
+
+/*======================================================================
+ * MCP356X DRDY TRACKER INIT
+ ======================================================================*/
+void mcp356x_drdy_init(mcp356x_drdy_tracker_t *tracker, uint32_t nominal_period){
+    tracker->last_stamp=0;
+    tracker->nominal_period=nominal_period;
+    tracker->period=nominal_period;
+    tracker->started=false;
+
+    tracker->samples=0;
+    tracker->missed=0;
+    tracker->duplicated=0;
+}
+
+
+/*======================================================================
+ * MCP356X DRDY ASSOCIATE
+ *
+ * Only the newest stamp has data (ADCDATA holds the last conversion),
+ * older stamps are counted as missed samples. The delta between two
+ * consecutive stamps tells if IRQ edges were lost (more than 1.5 periods)
+ * or updates the period estimation (one period +-50%).
+ ======================================================================*/
+bool mcp356x_drdy_associate(mcp356x_drdy_tracker_t *tracker, const uint64_t *stamps, uint32_t total_stamps, uint64_t *sample_stamp){
+    uint64_t previous_stamp=tracker->last_stamp;
+    uint64_t delta=0;
+
+    if (total_stamps==0){
+        tracker->duplicated++;
+        return false;
+    }
+
+    for(uint32_t each_stamp=0;each_stamp<total_stamps;each_stamp++){
+        if (tracker->started || each_stamp>0){
+            delta=stamps[each_stamp]-previous_stamp;
+
+            //more than 1.5 periods without stamps, IRQ edges were lost
+            if (delta>(uint64_t)tracker->period+(tracker->period>>1)){
+                tracker->missed+=(uint32_t)((delta+(tracker->period>>1))/tracker->period)-1;
+            }
+            //deltas of one period (+-50%) update the period estimation
+            else if (delta>(uint64_t)(tracker->period>>1)){
+                tracker->period=tracker->period-(tracker->period>>PERIOD_FILTER_SHIFT)+(uint32_t)(delta>>PERIOD_FILTER_SHIFT);
+            }
+        }
+        previous_stamp=stamps[each_stamp];
+    }
+
+    //conversions overwritten before the read
+    tracker->missed+=total_stamps-1;
+
+    tracker->last_stamp=stamps[total_stamps-1];
+    tracker->started=true;
+    tracker->samples++;
+
+    *sample_stamp=tracker->last_stamp;
+    return true;
+}
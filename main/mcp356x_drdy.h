@@ -0,0 +1,47 @@
+#ifndef _MCP356X_DRDY_H_
+#define _MCP356X_DRDY_H_
+
+/*
+Timestamp to sample association for the MCP356x data ready (IRQ) mode.
+
+The IRQ pin of the ADC goes low every time a conversion is ready. The GPIO ISR
+latches the sample timer counter (timer_conf.h) in that moment and wakes up the
+ADC task, then the task reads ADCDATA. The task may be late, so between two
+reads it can receive:
+
+    0 stamps -> no new conversion (spurious wake up), the read is a duplicate.
+    1 stamp  -> normal case, the data belongs to that stamp.
+    N stamps -> N-1 conversions were overwritten before being read (missed),
+                the data belongs to the LAST stamp.
+
+It also detects lost IRQ edges (a gap bigger than 1.5 periods between stamps)
+and keeps an estimation of the real conversion period, the ADC runs with its
+own internal clock so the period is not exactly 1/SAMPLE_RATE.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint64_t last_stamp; //stamp of the last associated sample (timer counts)
+    uint32_t nominal_period; //expected conversion period (timer counts)
+    uint32_t period; //measured conversion period (timer counts)
+    bool started; //false until the first sample
+
+    uint32_t samples; //samples associated to a stamp
+    uint32_t missed; //conversions that were never read (overwritten or IRQ edge lost)
+    uint32_t duplicated; //reads without a new conversion (discarded)
+} mcp356x_drdy_tracker_t;
+
+
+/*Prepares the tracker, nominal_period in timer counts*/
+void mcp356x_drdy_init(mcp356x_drdy_tracker_t *tracker, uint32_t nominal_period);
+
+/*Associates one ADCDATA read with the IRQ stamps received since the last read
+(stamps sorted from oldest to newest). Returns false if the read has no new
+conversion (must be discarded), else sample_stamp = stamp of the read data*/
+bool mcp356x_drdy_associate(mcp356x_drdy_tracker_t *tracker, const uint64_t *stamps, uint32_t total_stamps, uint64_t *sample_stamp);
+
+#endif
@@ -0,0 +1,75 @@
+#include <string.h>
+
+#include "mcp356x_scan.h"
+
+
+/*======================================================================
+ * MCP356X SCAN DEMUX INIT
+ ======================================================================*/
+void mcp356x_scan_demux_init(mcp356x_scan_demux_t *demux, const uint8_t *channel_ids, uint8_t channels){
+    memset(demux,0,sizeof(mcp356x_scan_demux_t));
+
+    if (channels>MCP356X_SCAN_MAX_CHANNELS){
+        channels=MCP356X_SCAN_MAX_CHANNELS;
+    }
+    memcpy(demux->channel_ids,channel_ids,channels);
+    demux->channels=channels;
+}
+
+
+/*======================================================================
+ * MCP356X SCAN DEMUX PUSH
+ *
+ *   - A CHID that isn't in the list is discarded.
+ *   - The last read again (same channel and data): no new conversion,
+ *     discarded. The same channel with other data is a conversion of a
+ *     later cycle (a whole cycle of reads was lost), it isn't joined
+ *     to the frame.
+ *   - The first channel starts a new frame, an incomplete frame is dropped.
+ *   - Any other channel out of order: some conversions were lost, the
+ *     frame is dropped and the demultiplexer waits for the first channel.
+ ======================================================================*/
+bool mcp356x_scan_demux_push(mcp356x_scan_demux_t *demux, const uint8_t *raw, uint64_t stamp, uint8_t *frame, uint64_t *frame_stamp){
+    uint8_t chid=raw[0]>>4;
+    uint8_t index=0;
+
+    while(index<demux->channels && demux->channel_ids[index]!=chid){
+        index++;
+    }
+    if (index==demux->channels){
+        demux->unknown_reads++;
+        return false;
+    }
+
+    if (demux->partial_channels!=0 && index==demux->partial_channels-1 &&
+        memcmp(&demux->partial[index*MCP356X_SCAN_BYTES_PER_CHANNEL],&raw[1],MCP356X_SCAN_BYTES_PER_CHANNEL)==0){
+        demux->duplicated_reads++;
+        return false;
+    }
+    else if (index==0){
+        //first channel before finishing the last frame, the last one is lost
+        demux->dropped_reads+=demux->partial_channels;
+        demux->partial_channels=0;
+        demux->partial_stamp=stamp;
+    }
+    else if (index!=demux->partial_channels){
+        demux->dropped_reads+=demux->partial_channels+1;
+        demux->partial_channels=0;
+        return false;
+    }
+
+    //24 bit data without CHID and sign extension (same as FORMAT_24_BIT)
+    memcpy(&demux->partial[index*MCP356X_SCAN_BYTES_PER_CHANNEL],&raw[1],MCP356X_SCAN_BYTES_PER_CHANNEL);
+    demux->partial_channels++;
+
+    if (demux->partial_channels<demux->channels){
+        return false;
+    }
+
+    //all channels complete
+    demux->partial_channels=0;
+    demux->frames++;
+    memcpy(frame,demux->partial,demux->channels*MCP356X_SCAN_BYTES_PER_CHANNEL);
+    *frame_stamp=demux->partial_stamp;
+    return true;
+}
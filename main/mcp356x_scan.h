@@ -0,0 +1,70 @@
+#ifndef _MCP356X_SCAN_H_
+#define _MCP356X_SCAN_H_
+
+/*
+MCP356x SCAN mode demultiplexer (several channels)
+
+In SCAN mode the ADC converts the selected channels one after the other, ADCDATA
+only holds the last conversion. With DATA_FORMAT = 32 bit + channel ID every read
+says which channel it belongs to:
+
+BYTES:     |       0        |   1   |   2    |  3  |
+            CHID[3:0] | SGN   MSB     middle   LSB
+
+    CHID (4 bits): channel of the conversion (MCP356X_CHID_xxx)
+    SGN (4 bits):  sign extension of the 24 bit data (overrange)
+
+The demultiplexer joins one read of every channel (in SCAN order) into one frame,
+a frame has the 24 bit data of every channel (MSB, middle, LSB) in the order of
+channel_ids, the same layout as the 24 bit format of a single channel:
+
+BYTES:     |  0  |   1   |  2  |  3  |   4   |  5  | ...
+frame:      MSB0  middle  LSB0  MSB1  middle  LSB1  ...
+
+The first channel always starts a new frame, an incomplete frame is dropped
+(alignment recovery, same idea as the X marker of adxl355_fifo.h). The timestamp
+of the frame is the timestamp of its first channel.
+
+A read of the same channel with the same data is the same conversion read again,
+with other data it is a conversion of a later cycle. Losing exactly a whole cycle of
+reads in a row can't be seen with the channel IDs.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MCP356X_SCAN_MAX_CHANNELS 4 //Differential pairs of the MCP3564 (CH0-CH1 to CH6-CH7)
+#define MCP356X_SCAN_BYTES_PER_READ 4 //32 bit format with channel ID
+#define MCP356X_SCAN_BYTES_PER_CHANNEL 3 //24 bit data of one channel in the frame
+
+/*Channel ID (CHID) of the differential channels*/
+#define MCP356X_CHID_DIF_CH0_CH1 0x8
+#define MCP356X_CHID_DIF_CH2_CH3 0x9
+#define MCP356X_CHID_DIF_CH4_CH5 0xA
+#define MCP356X_CHID_DIF_CH6_CH7 0xB
+
+typedef struct {
+    uint8_t channel_ids[MCP356X_SCAN_MAX_CHANNELS]; //CHID of every channel in SCAN order
+    uint8_t channels; //number of channels per frame
+
+    uint8_t partial[MCP356X_SCAN_MAX_CHANNELS*MCP356X_SCAN_BYTES_PER_CHANNEL]; //channels already received
+    uint8_t partial_channels; //number of channels in partial
+    uint64_t partial_stamp; //timestamp of the first channel of partial
+
+    uint32_t frames; //complete frames
+    uint32_t dropped_reads; //reads discarded to recover the SCAN order
+    uint32_t duplicated_reads; //same read twice, channel and data (no new conversion)
+    uint32_t unknown_reads; //reads with a CHID that isn't in channel_ids
+} mcp356x_scan_demux_t;
+
+
+/*Prepares the demultiplexer, channel_ids in SCAN order (maximum MCP356X_SCAN_MAX_CHANNELS)*/
+void mcp356x_scan_demux_init(mcp356x_scan_demux_t *demux, const uint8_t *channel_ids, uint8_t channels);
+
+/*Adds one ADCDATA read (4 bytes) and its timestamp. Returns true when a frame is
+complete, then frame (3 bytes per channel) and frame_stamp are written*/
+bool mcp356x_scan_demux_push(mcp356x_scan_demux_t *demux, const uint8_t *raw, uint64_t stamp, uint8_t *frame, uint64_t *frame_stamp);
+
+#endif
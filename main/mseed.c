@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "mseed.h"
+#include "steim.h"
+#include "crc32c.h"
+#include "epoch_time.h"
+
+
+static void put_le16(uint8_t *buffer, uint16_t value){
+    buffer[0]=(uint8_t)value;
+    buffer[1]=(uint8_t)(value>>8);
+}
+
+static void put_le32(uint8_t *buffer, uint32_t value){
+    for(uint8_t i=0;i<4;i++){
+        buffer[i]=(uint8_t)(value>>(8*i));
+    }
+}
+
+static uint16_t get_le16(const uint8_t *buffer){
+    return (uint16_t)(buffer[0]|(buffer[1]<<8));
+}
+
+static uint32_t get_le32(const uint8_t *buffer){
+    return (uint32_t)buffer[0]|((uint32_t)buffer[1]<<8)|((uint32_t)buffer[2]<<16)|((uint32_t)buffer[3]<<24);
+}
+
+
+/*======================================================================
+ * SOURCE IDENTIFIER
+ ======================================================================*/
+char mseed_band_code(uint16_t rate){
+    //short period sensors (corner period < 10 s)
+    if (rate>=1000) return 'G';
+    if (rate>=250) return 'D';
+    if (rate>=80) return 'E';
+    if (rate>=10) return 'S';
+    return '?';
+}
+
+uint8_t mseed_sid(char *sid, const char *network, const char *station, const char *location, char band, char source, char subsource){
+    uint32_t length=strlen("FDSN:")+strlen(network)+1+strlen(station)+1+strlen(location)+1+1+1+1+1+1;
+
+    if (length>MSEED_SID_MAX){
+        return 0;
+    }
+    length=0;
+    memcpy(&sid[length],"FDSN:",5); length+=5;
+    memcpy(&sid[length],network,strlen(network)); length+=strlen(network);
+    sid[length++]='_';
+    memcpy(&sid[length],station,strlen(station)); length+=strlen(station);
+    sid[length++]='_';
+    memcpy(&sid[length],location,strlen(location)); length+=strlen(location);
+    sid[length++]='_';
+    sid[length++]=band;
+    sid[length++]='_';
+    sid[length++]=source;
+    sid[length++]='_';
+    sid[length++]=subsource;
+    return (uint8_t)length;
+}
+
+
+/*======================================================================
+ * MSEED WRITE RECORD
+ ======================================================================*/
+uint32_t mseed_write_record(uint8_t *record, uint32_t max_size, const char *sid, uint8_t sid_length,
+    int64_t start_us, uint16_t rate, uint8_t steim_level, const int32_t *samples, uint16_t count){
+    uint32_t header_length=MSEED_FIXED_HEADER+sid_length;
+    uint16_t frames;
+    epoch_datetime_t start;
+    double rate_double=rate;
+    uint64_t rate_bits;
+
+    if (max_size<header_length+STEIM_FRAME_BYTES){
+        return 0;
+    }
+    frames=steim_encode(steim_level,samples,count,samples[0],&record[header_length],(max_size-header_length)/STEIM_FRAME_BYTES);
+    if (frames==0){
+        return 0;
+    }
+
+    //start time (also before 1970)
+    epoch_to_datetime(start_us,&start);
+
+    memset(record,0,MSEED_FIXED_HEADER);
+    record[0]='M';
+    record[1]='S';
+    record[2]=3;
+    record[3]=0;
+    put_le32(&record[4],start.microsecond*1000);
+    put_le16(&record[8],(uint16_t)start.year);
+    put_le16(&record[10],(uint16_t)(epoch_days_from_civil(start.year,start.month,start.day)-epoch_days_from_civil(start.year,1,1)+1));
+    record[12]=start.hour;
+    record[13]=start.minute;
+    record[14]=start.second;
+    record[15]=(steim_level==STEIM_1)?MSEED_ENCODING_STEIM1:MSEED_ENCODING_STEIM2;
+    memcpy(&rate_bits,&rate_double,sizeof(rate_bits));
+    put_le32(&record[16],(uint32_t)rate_bits);
+    put_le32(&record[20],(uint32_t)(rate_bits>>32));
+    put_le32(&record[24],count);
+    record[32]=MSEED_PUBLICATION_VERSION;
+    record[33]=sid_length;
+    put_le16(&record[34],0);
+    put_le32(&record[36],(uint32_t)frames*STEIM_FRAME_BYTES);
+    memcpy(&record[MSEED_FIXED_HEADER],sid,sid_length);
+
+    put_le32(&record[28],crc32c(0,record,header_length+(uint32_t)frames*STEIM_FRAME_BYTES));
+    return header_length+(uint32_t)frames*STEIM_FRAME_BYTES;
+}
+
+
+/*======================================================================
+ * MSEED RECORD LENGTH AND START TIME
+ ======================================================================*/
+uint32_t mseed_record_length(const uint8_t *record){
+    if (record[0]!='M' || record[1]!='S' || record[2]!=3){
+        return 0;
+    }
+    return MSEED_FIXED_HEADER+record[33]+get_le16(&record[34])+get_le32(&record[36]);
+}
+
+int64_t mseed_record_start_us(const uint8_t *record){
+    int32_t days=epoch_days_from_civil(get_le16(&record[8]),1,1)+get_le16(&record[10])-1;
+    int64_t seconds=(int64_t)days*EPOCH_SECONDS_PER_DAY+record[12]*3600+record[13]*60+record[14];
+
+    return seconds*EPOCH_US_PER_SECOND+get_le32(&record[4])/1000;
+}
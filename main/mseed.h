@@ -0,0 +1,62 @@
+#ifndef _MSEED_H_
+#define _MSEED_H_
+
+/*
+miniSEED 3 records (FDSN miniSEED 3.0)
+
+Every record has a fixed header of 40 bytes (little endian), the source identifier
+(SID), the extra headers (not used) and the data payload (Steim frames, big endian):
+
+ offset | bytes | field
+ 0      | 2     | "MS"
+ 2      | 1     | format version (3)
+ 3      | 1     | flags (0)
+ 4      | 4     | nanosecond of the start time
+ 8      | 2     | year
+ 10     | 2     | day of year (1-366)
+ 12     | 1     | hour
+ 13     | 1     | minute
+ 14     | 1     | second
+ 15     | 1     | payload encoding (10 = Steim-1, 11 = Steim-2)
+ 16     | 8     | sample rate in Hz (float64)
+ 24     | 4     | number of samples
+ 28     | 4     | CRC-32C of the record (computed with this field = 0, crc32c.h)
+ 32     | 1     | data publication version (1)
+ 33     | 1     | SID length
+ 34     | 2     | extra headers length (0)
+ 36     | 4     | payload length
+ 40     | ...   | SID, payload
+
+SID = "FDSN:NET_STA_LOC_B_S_s" (network, station, location, band, source, subsource).
+The start time is UTC (microseconds since 1970-01-01).
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+
+#define MSEED_FIXED_HEADER 40
+#define MSEED_SID_MAX 48 //SID maximum length in this firmware
+#define MSEED_ENCODING_STEIM1 10
+#define MSEED_ENCODING_STEIM2 11
+#define MSEED_PUBLICATION_VERSION 1
+
+
+/*Band code of a short period sensor at "rate" Hz (G, D, E, S or '?')*/
+char mseed_band_code(uint16_t rate);
+
+/*Writes the SID (no terminator), returns its length (0 if bigger than MSEED_SID_MAX)*/
+uint8_t mseed_sid(char *sid, const char *network, const char *station, const char *location, char band, char source, char subsource);
+
+/*Writes one record with "count" samples (Steim-1 or Steim-2, steim.h). Returns the
+length of the record or 0 if it doesn't fit in max_size*/
+uint32_t mseed_write_record(uint8_t *record, uint32_t max_size, const char *sid, uint8_t sid_length,
+    int64_t start_us, uint16_t rate, uint8_t steim_level, const int32_t *samples, uint16_t count);
+
+/*Length of the record (0 if it isn't a miniSEED 3 record)*/
+uint32_t mseed_record_length(const uint8_t *record);
+
+/*Start time of the record, microseconds since 1970-01-01 UTC (epoch_time.h)*/
+int64_t mseed_record_start_us(const uint8_t *record);
+
+#endif
@@ -0,0 +1,317 @@
+#include <string.h>
+
+#include "packet_codec.h"
+#include "steim.h"
+#include "mseed.h"
+#include "bitpack.h"
+#include "deltapack.h"
+#include "decimator.h" //decimator_unpack/decimator_pack (big endian values of the packets)
+
+
+static uint16_t get_u16(const char *buffer){
+    return (uint16_t)(((uint8_t)buffer[0]<<8)|(uint8_t)buffer[1]);
+}
+
+static uint64_t get_u64(const char *buffer){
+    uint64_t value=0;
+    for(uint8_t i=0;i<8;i++){
+        value=(value<<8)|(uint8_t)buffer[i];
+    }
+    return value;
+}
+
+
+/*======================================================================
+ * PACKET ENCODING AND SIZE
+ ======================================================================*/
+uint8_t packet_encoding(const char *buffer){
+    if (mseed_record_length((const uint8_t *)buffer)!=0){
+        return PACKET_ENCODING_MSEED3;
+    }
+    return (uint8_t)buffer[PACKET_HEADER_ENCODING];
+}
+
+uint16_t packet_encoded_size(const char *buffer){
+    uint32_t position=0;
+    uint32_t record_length;
+
+    if (packet_encoding(buffer)==PACKET_ENCODING_MSEED3){
+        for(uint8_t each_sensor=0;each_sensor<PACKET_CHANNEL_COUNT;each_sensor++){
+            record_length=mseed_record_length((const uint8_t *)&buffer[position]);
+            if (record_length==0 || position+record_length>PACKET_SIZE){
+                return PACKET_SIZE; //corrupted, as raw
+            }
+            position+=record_length;
+        }
+        return (uint16_t)position;
+    }
+    //LENGTH of the header (version 1 or corrupted packets as raw)
+    position=packet_header_packet_size(buffer);
+    if (position<CONTROL_BYTES+PACKET_TIMING_BYTES(1) || position>PACKET_SIZE){
+        return PACKET_SIZE;
+    }
+    return (uint16_t)position;
+}
+
+
+/*Layout of the packet from the ITEMS of its header, false if the header is invalid or the
+packet is longer than the buffers of this firmware (ITEMS_PER_SENSOR)*/
+static bool packet_layout_of(const char *buffer, packet_layout_t *layout){
+    packet_header_t header;
+
+    if (!packet_header_read(buffer,&header) || header.sensors!=PACKET_CHANNEL_COUNT){
+        return false;
+    }
+    return packet_layout_init(layout,header.items);
+}
+
+
+/*======================================================================
+ * PACKET ENCODE
+ ======================================================================*/
+/*Samples of one channel shifted to its real resolution (bits below are 0), returns the
+bits to pack: channel->bits, or all the bits of the item if the bits below aren't 0 
+(decimated or filtered samples)*/
+static uint8_t packed_channel_samples(const char *raw, const packet_channel_t *channel, uint16_t items, int32_t *work){
+    uint8_t shift=8*channel->bytes-channel->bits;
+    uint32_t low_bits=0;
+
+    for(uint16_t each_item=0;each_item<items;each_item++){
+        work[each_item]=decimator_unpack((const uint8_t *)&raw[channel->data_offset+each_item*channel->bytes],channel->bytes);
+        low_bits|=(uint32_t)work[each_item];
+    }
+    if (shift==0 || (low_bits&((1u<<shift)-1))!=0){
+        return 8*channel->bytes;
+    }
+    for(uint16_t each_item=0;each_item<items;each_item++){
+        work[each_item]>>=shift; //arithmetic shift, exact (bits below are 0)
+    }
+    return channel->bits;
+}
+
+uint16_t packet_encode(const char *raw, char *encoded, uint8_t encoding, uint16_t max_size, int32_t *work){
+    uint8_t level=(encoding==PACKET_ENCODING_STEIM1)?STEIM_1:STEIM_2;
+    const packet_channel_t *channel;
+    uint32_t position=CONTROL_BYTES;
+    uint16_t frames;
+    uint8_t bits;
+    uint32_t length;
+    packet_layout_t layout;
+
+    if (encoding!=PACKET_ENCODING_STEIM1 && encoding!=PACKET_ENCODING_STEIM2
+        && encoding!=PACKET_ENCODING_PACKED && encoding!=PACKET_ENCODING_DELTA){
+        return 0;
+    }
+    if (!packet_layout_of(raw,&layout)){
+        return 0;
+    }
+    const uint16_t items=layout.items;
+    const uint16_t timing_bytes=layout.timing_bytes;
+
+    memcpy(encoded,raw,CONTROL_BYTES);
+    encoded[PACKET_HEADER_ENCODING]=(char)encoding;
+
+    for(uint8_t each_sensor=0;each_sensor<PACKET_CHANNEL_COUNT;each_sensor++){
+        channel=&layout.channels[each_sensor];
+
+        if (encoding==PACKET_ENCODING_PACKED){
+            bits=packed_channel_samples(raw,channel,items,work);
+            if (position+PACKET_PACKED_BLOCK_HEADER+BITPACK_BYTES(items,bits)+timing_bytes>max_size){
+                return 0;
+            }
+            encoded[position]=(char)channel->id;
+            encoded[position+1]=(char)bits;
+            position+=PACKET_PACKED_BLOCK_HEADER;
+            position+=bitpack_pack(work,items,bits,(uint8_t *)&encoded[position]);
+            continue;
+        }
+
+        if (encoding==PACKET_ENCODING_DELTA){
+            bits=packed_channel_samples(raw,channel,items,work);
+            if (position+PACKET_DELTA_BLOCK_HEADER+timing_bytes>=max_size){
+                return 0;
+            }
+            length=deltapack_encode(work,items,(uint8_t *)&encoded[position+PACKET_DELTA_BLOCK_HEADER],
+                max_size-position-PACKET_DELTA_BLOCK_HEADER-timing_bytes);
+            if (length==0 || length>0xFFFF){
+                return 0;
+            }
+            encoded[position]=(char)channel->id;
+            encoded[position+1]=(char)bits;
+            encoded[position+2]=(char)(length>>8);
+            encoded[position+3]=(char)(length&0xFF);
+            position+=PACKET_DELTA_BLOCK_HEADER+length;
+            continue;
+        }
+
+        if (position+PACKET_STEIM_BLOCK_HEADER+STEIM_FRAME_BYTES+timing_bytes>max_size){
+            return 0;
+        }
+        for(uint16_t each_item=0;each_item<items;each_item++){
+            work[each_item]=decimator_unpack((const uint8_t *)&raw[channel->data_offset+each_item*channel->bytes],channel->bytes);
+        }
+        frames=steim_encode(level,work,items,work[0],(uint8_t *)&encoded[position+PACKET_STEIM_BLOCK_HEADER],
+            (max_size-position-PACKET_STEIM_BLOCK_HEADER-timing_bytes)/STEIM_FRAME_BYTES);
+        if (frames==0){
+            return 0;
+        }
+        encoded[position]=(char)channel->id;
+        encoded[position+1]=(char)(frames>>8);
+        encoded[position+2]=(char)(frames&0xFF);
+        position+=PACKET_STEIM_BLOCK_HEADER+(uint32_t)frames*STEIM_FRAME_BYTES;
+    }
+
+    memcpy(&encoded[position],&raw[layout.timing_offset],timing_bytes);
+    packet_header_seal(encoded,position+timing_bytes);
+    return (uint16_t)(position+timing_bytes);
+}
+
+
+/*======================================================================
+ * PACKET ENCODE MSEED (one record per sensor)
+ ======================================================================*/
+uint16_t packet_encode_mseed(const char *raw, char *encoded, uint16_t max_size, const char *network, int32_t *work){
+    const packet_channel_t *channel;
+    packet_header_t header;
+    uint16_t rate;
+    char station[2]={0,0}; //ID_STATION
+    char sid[MSEED_SID_MAX];
+    uint8_t sid_length;
+    uint32_t position=0;
+    uint32_t record_length;
+    packet_layout_t layout;
+
+    if (!packet_header_read(raw,&header) || !packet_layout_of(raw,&layout)){
+        return 0;
+    }
+    rate=header.rate;
+    station[0]=header.station;
+
+    for(uint8_t each_sensor=0;each_sensor<PACKET_CHANNEL_COUNT;each_sensor++){
+        channel=&layout.channels[each_sensor];
+        sid_length=mseed_sid(sid,network,station,channel->location,mseed_band_code(rate),channel->source,channel->subsource);
+        if (sid_length==0){
+            return 0;
+        }
+        for(uint16_t each_item=0;each_item<layout.items;each_item++){
+            work[each_item]=decimator_unpack((const uint8_t *)&raw[channel->data_offset+each_item*channel->bytes],channel->bytes);
+        }
+        record_length=mseed_write_record((uint8_t *)&encoded[position],max_size-position,sid,sid_length,
+            header.start_us,rate,STEIM_2,work,layout.items);
+        if (record_length==0){
+            return 0;
+        }
+        position+=record_length;
+    }
+    return (uint16_t)position;
+}
+
+int64_t packet_start_from_datetime(const char *raw, const packet_layout_t *layout){
+    return (int64_t)(get_u64(&raw[layout->timing_offset])-get_u64(&raw[layout->timing_offset+8]));
+}
+
+int64_t packet_start_us(const char *buffer){
+    packet_header_t header;
+
+    if (packet_encoding(buffer)==PACKET_ENCODING_MSEED3){
+        return mseed_record_start_us((const uint8_t *)buffer);
+    }
+    return packet_header_read(buffer,&header)?header.start_us:0;
+}
+
+
+/*======================================================================
+ * PACKET DECODE
+ ======================================================================*/
+bool packet_decode(const char *encoded, char *raw, int32_t *work){
+    uint8_t encoding=packet_encoding(encoded);
+    uint8_t level=(encoding==PACKET_ENCODING_STEIM1)?STEIM_1:STEIM_2;
+    const packet_channel_t *channel;
+    uint32_t position=CONTROL_BYTES;
+    uint16_t frames, length;
+    uint8_t bits, shift;
+    packet_header_t header;
+    packet_layout_t layout;
+
+    if (encoding==PACKET_ENCODING_MSEED3 || !packet_header_check(encoded,PACKET_SIZE)){
+        return false;
+    }
+    packet_header_read(encoded,&header);
+    if (!packet_layout_of(encoded,&layout)){
+        return false;
+    }
+    const uint16_t items=layout.items;
+    const uint16_t timing_bytes=layout.timing_bytes;
+    const uint16_t size=layout.size; //raw packet, limit of the encoded one
+
+    if (encoding==PACKET_ENCODING_RAW){
+        if (header.length!=(uint32_t)(size-CONTROL_BYTES)){
+            return false;
+        }
+        memcpy(raw,encoded,size);
+        return true;
+    }
+    if (encoding!=PACKET_ENCODING_STEIM1 && encoding!=PACKET_ENCODING_STEIM2
+        && encoding!=PACKET_ENCODING_PACKED && encoding!=PACKET_ENCODING_DELTA){
+        return false;
+    }
+
+    memcpy(raw,encoded,CONTROL_BYTES);
+    raw[PACKET_HEADER_ENCODING]=PACKET_ENCODING_RAW;
+
+    for(uint8_t each_sensor=0;each_sensor<PACKET_CHANNEL_COUNT;each_sensor++){
+        channel=&layout.channels[each_sensor];
+        if ((uint8_t)encoded[position]!=channel->id){
+            return false;
+        }
+
+        if (encoding==PACKET_ENCODING_PACKED){
+            //bits = the resolution of the sensor or all the bits of the item
+            bits=(uint8_t)encoded[position+1];
+            if ((bits!=channel->bits && bits!=8*channel->bytes)
+                || position+PACKET_PACKED_BLOCK_HEADER+BITPACK_BYTES(items,bits)+timing_bytes>size){
+                return false;
+            }
+            position+=PACKET_PACKED_BLOCK_HEADER;
+            position+=bitpack_unpack((const uint8_t *)&encoded[position],items,bits,work);
+            shift=8*channel->bytes-bits;
+            raw[channel->id_offset]=(char)channel->id;
+            for(uint16_t each_item=0;each_item<items;each_item++){
+                decimator_pack((int32_t)((uint32_t)work[each_item]<<shift),channel->bytes,(uint8_t *)&raw[channel->data_offset+each_item*channel->bytes]);
+            }
+            continue;
+        }
+
+        if (encoding==PACKET_ENCODING_DELTA){
+            //same BITS as PACKET_ENCODING_PACKED
+            bits=(uint8_t)encoded[position+1];
+            length=get_u16(&encoded[position+2]);
+            if ((bits!=channel->bits && bits!=8*channel->bytes)
+                || position+PACKET_DELTA_BLOCK_HEADER+length+timing_bytes>size
+                || deltapack_decode((const uint8_t *)&encoded[position+PACKET_DELTA_BLOCK_HEADER],length,items,work)!=length){
+                return false;
+            }
+            shift=8*channel->bytes-bits;
+            for(uint16_t each_item=0;each_item<items;each_item++){
+                work[each_item]=(int32_t)((uint32_t)work[each_item]<<shift);
+            }
+            position+=PACKET_DELTA_BLOCK_HEADER+length;
+        }
+        else{
+            frames=get_u16(&encoded[position+1]);
+            if (position+PACKET_STEIM_BLOCK_HEADER+(uint32_t)frames*STEIM_FRAME_BYTES+timing_bytes>size
+                || steim_decode(level,(const uint8_t *)&encoded[position+PACKET_STEIM_BLOCK_HEADER],frames,items,work)!=items){
+                return false;
+            }
+            position+=PACKET_STEIM_BLOCK_HEADER+(uint32_t)frames*STEIM_FRAME_BYTES;
+        }
+        raw[channel->id_offset]=(char)channel->id;
+        for(uint16_t each_item=0;each_item<items;each_item++){
+            decimator_pack(work[each_item],channel->bytes,(uint8_t *)&raw[channel->data_offset+each_item*channel->bytes]);
+        }
+    }
+
+    memcpy(&raw[layout.timing_offset],&encoded[position],timing_bytes);
+    packet_header_seal(raw,size);
+    return true;
+}
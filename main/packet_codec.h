@@ -0,0 +1,111 @@
+#ifndef _PACKET_CODEC_H_
+#define _PACKET_CODEC_H_
+
+/*
+Packet payload encoding (raw, Steim compressed, bit packed, delta packed or miniSEED 3)
+
+The encoding is stored in the PAYLOAD ENCODING byte of the header (packet_header.h):
+
+    0 = RAW:     the layout of packet_layout.h (PACKET_SIZE_ITEMS(ITEMS of the header))
+    1 = STEIM-1
+    2 = STEIM-2
+    3 = PACKED:  every sample with the real bits of the sensor (bitpack.h)
+    4 = DELTA:   differences, zigzag and bit width per block (deltapack.h)
+
+A compressed packet has the same CONTROL_BYTES and TIMING_BYTES, every sensor block is:
+
+                 ----------------------------------------------------------
+    SENSOR N =   | ID (1 byte) | FRAMES (2 bytes) | FRAMES*64 bytes (steim.h) |
+                 ----------------------------------------------------------
+
+with ITEMS samples (the first difference is 0, X0 is the first sample). The
+size of a compressed packet changes from packet to packet, packet_encoded_size() gives
+the bytes to send or store reading the packet itself.
+
+A bit packed packet has the same CONTROL_BYTES and TIMING_BYTES, every sensor block is:
+
+                 ---------------------------------------------------------------------
+    SENSOR N =   | ID (1 byte) | BITS (1 byte) | (ITEMS*BITS+7)/8 bytes                  |
+                 ---------------------------------------------------------------------
+
+BITS is the resolution of the sensor (packet_layout.h: 24 SM-24, 20 ADXL355, 14 MMA8451Q),
+the samples are shifted right so the bits that are always 0 aren't sent. If any sample of
+the channel has those bits set (decimated samples) BITS = 8 * bytes per item, so the
+encoding is always lossless. With 1 geophone channel (header version 4) it is 21364 bytes
+instead of the 24057 of PACKET_SIZE.
+
+A delta packed packet has the same CONTROL_BYTES and TIMING_BYTES, every sensor block is:
+
+                 --------------------------------------------------------------------------
+    SENSOR N =   | ID (1 byte) | BITS (1 byte) | LENGTH (2 bytes) | LENGTH bytes (deltapack.h) |
+                 --------------------------------------------------------------------------
+
+BITS is the same as in a bit packed packet (the samples are shifted before the differences).
+It is smaller than Steim when the differences are small (quiet sites) and faster to
+encode and decode (no options to test per word). One big difference makes the whole
+block of DELTAPACK_BLOCK samples wider, Steim only the word of that difference.
+
+A miniSEED 3 packet (PACKET_ENCODING_MSEED3) doesn't have CONTROL_BYTES, it is one
+Steim-2 record per sensor (mseed.h) in the order of the packet, it is recognized by the
+"MS" + version 3 of the first record (the other packets start with "DL"). The records 
+start at START_US of the header, the INTERVAL_RESIDUALS aren't sent.
+
+Every packet (except miniSEED) ends with packet_header_seal(), so its LENGTH and CRC
+are the ones of the encoded packet.
+
+ITEMS (items per sensor) is read from the header of every packet, from 1 to ITEMS_PER_SENSOR
+(short packets, PACKET_DURATION_MS of packet_duration.h), packet_layout_init() gives the offsets.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet_layout.h"
+
+#define PACKET_ENCODING_RAW 0
+#define PACKET_ENCODING_STEIM1 1
+#define PACKET_ENCODING_STEIM2 2
+#define PACKET_ENCODING_PACKED 3
+#define PACKET_ENCODING_DELTA 4
+#define PACKET_ENCODING_MSEED3 5 //not stored in the header (miniSEED packets don't have it)
+
+#define PACKET_STEIM_BLOCK_HEADER 3 //ID + FRAMES
+#define PACKET_PACKED_BLOCK_HEADER 2 //ID + BITS
+#define PACKET_DELTA_BLOCK_HEADER 4 //ID + BITS + LENGTH
+
+//int32 values of work needed by packet_encode and packet_decode
+#define PACKET_CODEC_WORK_SAMPLES ITEMS_PER_SENSOR
+
+
+/*Encoding of the packet (PACKET_ENCODING_xxx)*/
+uint8_t packet_encoding(const char *buffer);
+
+/*Bytes to send or store, CONTROL_BYTES + LENGTH of the header (PACKET_SIZE if LENGTH is
+invalid or the packet has a version 1 header)*/
+uint16_t packet_encoded_size(const char *buffer);
+
+/*Compresses a raw packet into "encoded" (max_size bytes), encoding = PACKET_ENCODING_STEIM1,
+PACKET_ENCODING_STEIM2, PACKET_ENCODING_PACKED or PACKET_ENCODING_DELTA. Returns the size of the
+encoded packet or 0 if it doesn't fit (then the raw packet should be used)*/
+uint16_t packet_encode(const char *raw, char *encoded, uint8_t encoding, uint16_t max_size, int32_t *work);
+
+/*Raw packet to miniSEED 3 records (one per sensor) in "encoded" (max_size bytes), they
+start at START_US of the header. Returns the size of all the records or 0 if they don't fit*/
+uint16_t packet_encode_mseed(const char *raw, char *encoded, uint16_t max_size, const char *network, int32_t *work);
+
+/*Sample timer microseconds from the last anchor of the station clock (DATETIME_TIME) to the
+first sample (START_TIME) of a raw packet with that layout*/
+int64_t packet_start_from_datetime(const char *raw, const packet_layout_t *layout);
+
+/*UTC time of the first sample (epoch_us): START_US of the header or the start time of the
+first record of a miniSEED packet, 0 if the packet doesn't have a version 4 header*/
+int64_t packet_start_us(const char *buffer);
+
+/*Compressed packet to raw packet (PACKET_SIZE_ITEMS(ITEMS) bytes, sealed again). Returns false
+if the CRC is wrong, the packet is invalid, miniSEED or doesn't have the layout of this firmware
+(sensors, more than ITEMS_PER_SENSOR items)*/
+bool packet_decode(const char *encoded, char *raw, int32_t *work);
+
+#endif
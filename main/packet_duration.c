@@ -0,0 +1,22 @@
+#include "packet_duration.h"
+
+
+/*======================================================================
+ * PACKET DURATION
+ ======================================================================*/
+bool packet_duration_valid(uint16_t duration_ms){
+    return duration_ms>=PACKET_DURATION_MIN_MS && duration_ms<=PACKET_DURATION_MAX_MS;
+}
+
+//items per channel of a packet (at least 1, at most the ITEMS_PER_SENSOR of the buffers)
+uint16_t packet_items(uint16_t rate, uint16_t duration_ms){
+    uint32_t items=((uint32_t)rate*duration_ms+500)/1000;
+
+    if (items<1) items=1;
+    if (items>ITEMS_PER_SENSOR) items=ITEMS_PER_SENSOR;
+    return (uint16_t)items;
+}
+
+bool packet_items_limited(uint16_t rate, uint16_t duration_ms){
+    return ((uint32_t)rate*duration_ms+500)/1000>ITEMS_PER_SENSOR;
+}
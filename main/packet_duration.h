@@ -0,0 +1,34 @@
+#ifndef _PACKET_DURATION_H_
+#define _PACKET_DURATION_H_
+
+/*
+Packet duration: items and buffers of the short packets (main.c, "Packet duration")
+
+    packet_duration_valid()   durations accepted by packet_duration_request (NVS, STATION_CONFIG_FILE)
+    packet_items()            items per channel of a packet at a rate and duration
+    packet_items_limited()    true if the duration gives more items than the buffers hold
+    PACKET_BUFFER_SIZE        bytes of every packet buffer (max_buffer_size of main.c)
+
+Items of a packet = rate*duration (rounded), between 1 and ITEMS_PER_SENSOR. The buffers
+always have PACKET_SIZE bytes (ITEMS_PER_SENSOR items) whatever the duration, so the backlog
+records of any duration and rate fit in the buffers of the SD read path.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet_layout.h"
+
+#define PACKET_DURATION_MS (ITEMS_PER_SENSOR*10) //default duration (ITEMS_PER_SENSOR at 100 Hz, 12 s)
+#define PACKET_DURATION_MIN_MS 500 //shorter packets waste the link in headers
+#define PACKET_DURATION_MAX_MS 60000
+
+#define PACKET_BUFFER_SIZE PACKET_SIZE //longest packet (ITEMS_PER_SENSOR items), every duration
+
+bool packet_duration_valid(uint16_t duration_ms);
+uint16_t packet_items(uint16_t rate, uint16_t duration_ms);
+bool packet_items_limited(uint16_t rate, uint16_t duration_ms);
+
+#endif
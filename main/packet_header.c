@@ -0,0 +1,99 @@
+#include <string.h>
+
+#include "packet_header.h"
+#include "crc32c.h"
+
+
+static void put_be(char *buffer, uint64_t value, uint8_t bytes){
+    for(int8_t i=bytes-1;i>=0;i--){
+        buffer[i]=(char)(value&0xFF);
+        value>>=8;
+    }
+}
+
+static uint64_t get_be(const char *buffer, uint8_t bytes){
+    uint64_t value=0;
+    for(uint8_t i=0;i<bytes;i++){
+        value=(value<<8)|(uint8_t)buffer[i];
+    }
+    return value;
+}
+
+//CRC of the header (without the CRC field) and the payload
+static uint32_t packet_crc(const char *buffer, uint32_t length){
+    uint32_t crc=crc32c(0,(const uint8_t *)buffer,PACKET_HEADER_CRC);
+    return crc32c(crc,(const uint8_t *)&buffer[PACKET_HEADER_BYTES],length);
+}
+
+
+/*======================================================================
+ * PACKET HEADER WRITE AND READ
+ ======================================================================*/
+void packet_header_write(char *buffer, const packet_header_t *header){
+    memcpy(&buffer[PACKET_HEADER_MAGIC_OFFSET],PACKET_HEADER_MAGIC,2);
+    buffer[PACKET_HEADER_VERSION_OFFSET]=PACKET_HEADER_VERSION;
+    buffer[PACKET_HEADER_ENCODING]=(char)header->encoding;
+    put_be(&buffer[PACKET_HEADER_ITEMS],header->items,2);
+    buffer[PACKET_HEADER_SENSORS]=(char)header->sensors;
+    buffer[PACKET_HEADER_STATION]=header->station;
+    put_be(&buffer[PACKET_HEADER_RATE],header->rate,2);
+    put_be(&buffer[PACKET_HEADER_SEQUENCE],header->sequence,4);
+    put_be(&buffer[PACKET_HEADER_START],(uint64_t)header->start_us,8);
+    put_be(&buffer[PACKET_HEADER_TIME_QUALITY],header->time_quality,4);
+}
+
+bool packet_header_present(const char *buffer){
+    return memcmp(&buffer[PACKET_HEADER_MAGIC_OFFSET],PACKET_HEADER_MAGIC,2)==0;
+}
+
+bool packet_header_current(const char *buffer){
+    return packet_header_present(buffer) && buffer[PACKET_HEADER_VERSION_OFFSET]==PACKET_HEADER_VERSION;
+}
+
+bool packet_header_read(const char *buffer, packet_header_t *header){
+    if (!packet_header_current(buffer)){
+        return false;
+    }
+    header->encoding=(uint8_t)buffer[PACKET_HEADER_ENCODING];
+    header->items=(uint16_t)get_be(&buffer[PACKET_HEADER_ITEMS],2);
+    header->sensors=(uint8_t)buffer[PACKET_HEADER_SENSORS];
+    header->station=buffer[PACKET_HEADER_STATION];
+    header->rate=(uint16_t)get_be(&buffer[PACKET_HEADER_RATE],2);
+    header->sequence=(uint32_t)get_be(&buffer[PACKET_HEADER_SEQUENCE],4);
+    header->start_us=(int64_t)get_be(&buffer[PACKET_HEADER_START],8);
+    header->time_quality=(uint32_t)get_be(&buffer[PACKET_HEADER_TIME_QUALITY],4);
+    header->length=(uint32_t)get_be(&buffer[PACKET_HEADER_LENGTH],4);
+    header->crc=(uint32_t)get_be(&buffer[PACKET_HEADER_CRC],4);
+    return true;
+}
+
+
+/*======================================================================
+ * PACKET HEADER SEAL AND CHECK
+ ======================================================================*/
+void packet_header_seal(char *buffer, uint32_t packet_size){
+    uint32_t length=packet_size-PACKET_HEADER_BYTES;
+
+    put_be(&buffer[PACKET_HEADER_LENGTH],length,4);
+    put_be(&buffer[PACKET_HEADER_CRC],packet_crc(buffer,length),4);
+}
+
+uint32_t packet_header_packet_size(const char *buffer){
+    if (!packet_header_current(buffer)){
+        return 0;
+    }
+    return PACKET_HEADER_BYTES+(uint32_t)get_be(&buffer[PACKET_HEADER_LENGTH],4);
+}
+
+bool packet_header_check(const char *buffer, uint32_t max_size){
+    uint32_t length;
+
+    if (max_size<PACKET_HEADER_BYTES || !packet_header_current(buffer)){
+        return false;
+    }
+    length=(uint32_t)get_be(&buffer[PACKET_HEADER_LENGTH],4);
+    if (length>max_size-PACKET_HEADER_BYTES){
+        return false;
+    }
+    return packet_crc(buffer,length)==(uint32_t)get_be(&buffer[PACKET_HEADER_CRC],4);
+}
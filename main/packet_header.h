@@ -0,0 +1,98 @@
+#ifndef _PACKET_HEADER_H_
+#define _PACKET_HEADER_H_
+
+/*
+Packet header (version 4), the CONTROL_BYTES of every packet, all values big endian:
+
+ offset | bytes | field
+ 0      | 2     | MAGIC "DL"
+ 2      | 1     | VERSION (4)
+ 3      | 1     | PAYLOAD ENCODING (PACKET_ENCODING_xxx, packet_codec.h)
+ 4      | 2     | ITEMS_PER_SENSOR
+ 6      | 1     | NUMBER_OF_SENSORS
+ 7      | 1     | ID_STATION
+ 8      | 2     | SAMPLE_RATE (Hz)
+ 10     | 4     | SEQUENCE, +1 every packet of the station (also after a reboot)
+ 14     | 8     | START_US, UTC time of the first sample (microseconds since 1970-01-01,
+        |       | epoch_time.h), 0 if the DS3231 couldn't be read
+ 22     | 4     | TIME_QUALITY, uncertainty of START_US in microseconds (time_sync.h, SNTP),
+        |       | 0xFFFFFFFF if the clock was never synced
+ 26     | 4     | LENGTH, bytes after the header (sensors + TIMING_BYTES, raw or encoded)
+ 30     | 4     | CRC, CRC-32C (crc32c.h) of bytes 0-29 and the LENGTH bytes after the header
+ 34     |       | first sensor
+
+The first packets (version 1) started with ITEMS_PER_SENSOR (never "DL") and had 18
+bytes: ITEMS_PER_SENSOR, NUMBER_OF_SENSORS, SAMPLE_RATE, ID_STATION, LOCAL_DATETIME.
+Version 2 had 42 bytes, the same fields plus LOCAL_DATETIME (12 ascii digits YYMMDDHHmmSS
+of the DS3231 in local time) before LENGTH. START_US is the same time in binary (sortable,
+no time zone), the text is made by the server or epoch_format() when it's needed. Version 3
+had 30 bytes, the same fields without TIME_QUALITY. Version 2 and 3 packets are seen as a
+header (packet_header_present) but they're not valid for this firmware.
+
+SEQUENCE and START_US let the server drop the packets that were sent twice (retries,
+SD copies) and find the missing ones; the CRC finds the packets corrupted in the SD.
+LENGTH and CRC are written by packet_header_seal() once the payload is complete, the
+packet must not change after that.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PACKET_HEADER_MAGIC "DL"
+#define PACKET_HEADER_VERSION 4
+
+//offsets of the fields
+#define PACKET_HEADER_MAGIC_OFFSET 0
+#define PACKET_HEADER_VERSION_OFFSET 2
+#define PACKET_HEADER_ENCODING 3
+#define PACKET_HEADER_ITEMS 4
+#define PACKET_HEADER_SENSORS 6
+#define PACKET_HEADER_STATION 7
+#define PACKET_HEADER_RATE 8
+#define PACKET_HEADER_SEQUENCE 10
+#define PACKET_HEADER_START 14
+#define PACKET_HEADER_TIME_QUALITY 22
+#define PACKET_HEADER_LENGTH 26
+#define PACKET_HEADER_CRC 30
+#define PACKET_HEADER_BYTES 34
+
+#define PACKET_HEADER_QUALITY_UNKNOWN 0xFFFFFFFFu //TIME_QUALITY of a clock never synced
+
+typedef struct {
+    uint8_t encoding; //PACKET_ENCODING_xxx
+    uint16_t items; //ITEMS_PER_SENSOR
+    uint8_t sensors; //NUMBER_OF_SENSORS
+    char station; //ID_STATION
+    uint16_t rate; //SAMPLE_RATE (Hz)
+    uint32_t sequence;
+    int64_t start_us; //UTC time of the first sample (epoch_us)
+    uint32_t time_quality; //uncertainty of start_us (microseconds)
+    uint32_t length; //written by packet_header_seal
+    uint32_t crc; //written by packet_header_seal
+} packet_header_t;
+
+
+/*Writes every field except LENGTH and CRC (MAGIC and VERSION included)*/
+void packet_header_write(char *buffer, const packet_header_t *header);
+
+/*Reads the header, false if it isn't a version 4 header (MAGIC or VERSION)*/
+bool packet_header_read(const char *buffer, packet_header_t *header);
+
+/*True if the buffer starts with a header (MAGIC "DL"), of any version after 1*/
+bool packet_header_present(const char *buffer);
+
+/*True if the buffer starts with a version 4 header (the one of this firmware)*/
+bool packet_header_current(const char *buffer);
+
+/*Writes LENGTH (packet_size - PACKET_HEADER_BYTES) and the CRC of the packet*/
+void packet_header_seal(char *buffer, uint32_t packet_size);
+
+/*Bytes of the packet (header + LENGTH) or 0 if it isn't a version 4 header*/
+uint32_t packet_header_packet_size(const char *buffer);
+
+/*True if it is a version 4 header, the packet fits in max_size bytes and the CRC is right*/
+bool packet_header_check(const char *buffer, uint32_t max_size);
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef _PACKET_LAYOUT_H_
+#define _PACKET_LAYOUT_H_
+
+/*
+Packet layout (compile time)
+
+Every channel of the packet is declared ONCE in PACKET_CHANNELS, in the order that
+will be sent: X(name, id, bytes per item, bits of the sensor, FDSN location, source and
+subsource codes).
+Everything else is generated from that list by the compiler (no runtime calculation):
+
+    packet_item_t             one sample of every channel (packet order, no padding),
+                              same layout as the data_queue of the sensor tasks
+    PACKET_INDEX_name         position of the channel in the packet
+    PACKET_ID_OFFSET(name)    offset of the channel ID byte
+    PACKET_DATA_OFFSET(name)  offset of the first item of the channel
+    PACKET_TIMING_OFFSET      offset of TIMING_BYTES (after the last channel)
+    PACKET_SIZE               bytes sent (without the STATUS BYTE)
+    packet_channels[]         the same values as a table (for loops)
+    packet_pack_channel()     copies a block of samples of one channel to its items
+
+Those are the values of the longest packet (ITEMS_PER_SENSOR items). A packet can be shorter
+(ITEMS field of the header, PACKET_DURATION_MS of packet_duration.h): the same macros with _ITEMS(items)
+give its layout and packet_layout_init() builds it at runtime (packet_layout_t).
+
+The packet format is described in main.c (CONTROL_BYTES, sensors, TIMING_BYTES), the
+CONTROL_BYTES in packet_header.h.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "spi_mcp356x.h" //MCP356X_SCAN_CHANNELS
+#include "packet_header.h"
+
+#define CONTROL_BYTES PACKET_HEADER_BYTES //Number of control bytes (header version 4)
+#if MCP356X_SCAN_CHANNELS==1
+#define ITEMS_PER_SENSOR 1200  //Maximum number of samples (1 item = 1 sample) per sensor (24057 bytes)
+#else
+#define ITEMS_PER_SENSOR 1000  //9 channels, 1200 items don't fit in PACKET_MAX_BYTES (26059 bytes)
+#endif
+#define PACKET_TIMING_BYTES(items) (8+8+2*(uint32_t)(items)) //Start time, datetime time and interval residuals
+#define TIMING_BYTES PACKET_TIMING_BYTES(ITEMS_PER_SENSOR)
+
+/*Biggest packet allowed (STATUS BYTE not included): the upload of bigger packets fails with
+WiFi (main.c, 27025 bytes = first format with 1500 items), ITEMS_PER_SENSOR must keep the
+packets (TIMING_BYTES included) under it*/
+#define PACKET_MAX_BYTES 27025
+
+/*
+Channels in the order that will be sent: X(name, id, bytes per item, bits, location, source, subsource)
+
+bits is the real resolution of the sensor, the data is left justified in the bytes of the
+item (the bits below are 0 unless the samples were filtered by the decimator), it is used
+by PACKET_ENCODING_PACKED (packet_codec.h).
+
+location, source and subsource build the FDSN source identifier of the miniSEED records
+(mseed.h), H = high gain seismometer, N = accelerometer. The band code depends on the
+sample rate.
+
+ID of each sensor
+0 = SM-24 (ADC 24 BITS mcp3561), Z component with MCP356X_SCAN_CHANNELS = 3
+1 = ADXL355 X axis
+2 = ADXL355 Y axis
+3 = ADXL355 Z axis
+4 = mma8451q X axis
+5 = mma8451q Y axis
+6 = mma8451q Z axis
+7 = SM-24 N component (ADC 24 BITS mcp3564, CH2-CH3)
+8 = SM-24 E component (ADC 24 BITS mcp3564, CH4-CH5)
+
+... define more if neccesary
+*/
+#if MCP356X_SCAN_CHANNELS==1
+#define PACKET_GEOPHONE_CHANNELS(X) \
+    X(sm24_z,      0, 3, 24, "00", 'H', 'Z')
+#else
+#define PACKET_GEOPHONE_CHANNELS(X) \
+    X(sm24_z,      0, 3, 24, "00", 'H', 'Z') \
+    X(sm24_n,      7, 3, 24, "00", 'H', 'N') \
+    X(sm24_e,      8, 3, 24, "00", 'H', 'E')
+#endif
+
+#define PACKET_CHANNELS(X) \
+    PACKET_GEOPHONE_CHANNELS(X) \
+    X(adxl355_x,   1, 3, 20, "10", 'N', 'X') \
+    X(adxl355_y,   2, 3, 20, "10", 'N', 'Y') \
+    X(adxl355_z,   3, 3, 20, "10", 'N', 'Z') \
+    X(mma8451q_x,  4, 2, 14, "20", 'N', 'X') \
+    X(mma8451q_y,  5, 2, 14, "20", 'N', 'Y') \
+    X(mma8451q_z,  6, 2, 14, "20", 'N', 'Z')
+
+
+/*One item of every channel (big endian values, packet order)*/
+typedef struct {
+#define PACKET_X_FIELD(name, id, bytes, bits, location, source, subsource) uint8_t name[bytes];
+    PACKET_CHANNELS(PACKET_X_FIELD)
+#undef PACKET_X_FIELD
+} packet_item_t;
+
+/*Position of every channel*/
+enum {
+#define PACKET_X_INDEX(name, id, bytes, bits, location, source, subsource) PACKET_INDEX_##name,
+    PACKET_CHANNELS(PACKET_X_INDEX)
+#undef PACKET_X_INDEX
+    PACKET_CHANNEL_COUNT
+};
+
+#define PACKET_BYTES_PER_ITEM (sizeof(packet_item_t)) //bytes of one item of every channel
+
+/*Every channel = ID byte + "items" items, the channels before it use
+offsetof(packet_item_t,name) bytes per item*/
+#define PACKET_ID_OFFSET_ITEMS(name, items) (CONTROL_BYTES+PACKET_INDEX_##name+(uint32_t)(items)*offsetof(packet_item_t,name))
+#define PACKET_TIMING_OFFSET_ITEMS(items) (CONTROL_BYTES+PACKET_CHANNEL_COUNT+(uint32_t)(items)*PACKET_BYTES_PER_ITEM)
+#define PACKET_SIZE_ITEMS(items) (PACKET_TIMING_OFFSET_ITEMS(items)+PACKET_TIMING_BYTES(items))
+
+//longest packet
+#define PACKET_ID_OFFSET(name) PACKET_ID_OFFSET_ITEMS(name,ITEMS_PER_SENSOR)
+#define PACKET_DATA_OFFSET(name) (PACKET_ID_OFFSET(name)+1)
+#define PACKET_TIMING_OFFSET PACKET_TIMING_OFFSET_ITEMS(ITEMS_PER_SENSOR)
+#define PACKET_SIZE PACKET_SIZE_ITEMS(ITEMS_PER_SENSOR)
+
+_Static_assert(PACKET_SIZE<=PACKET_MAX_BYTES, "packet bigger than PACKET_MAX_BYTES, reduce ITEMS_PER_SENSOR");
+_Static_assert(PACKET_BYTES_PER_ITEM==(3*MCP356X_SCAN_CHANNELS+3*3+3*2), "packet_item_t must not have padding");
+
+
+/*Channel description for loops*/
+typedef struct {
+    uint8_t id; //sensor ID
+    uint8_t bytes; //bytes per item
+    uint8_t bits; //resolution of the sensor (left justified in the bytes)
+    uint16_t id_offset; //offset of the ID byte in the packet
+    uint16_t data_offset; //offset of the first item in the packet
+    uint16_t item_offset; //offset in packet_item_t
+    const char *location; //FDSN location code
+    char source; //FDSN source code
+    char subsource; //FDSN subsource code
+} packet_channel_t;
+
+static const packet_channel_t packet_channels[PACKET_CHANNEL_COUNT] = {
+#define PACKET_X_CHANNEL(name, id, bytes, bits, location, source, subsource) \
+    {id, bytes, bits, PACKET_ID_OFFSET(name), PACKET_DATA_OFFSET(name), offsetof(packet_item_t,name), location, source, subsource},
+    PACKET_CHANNELS(PACKET_X_CHANNEL)
+#undef PACKET_X_CHANNEL
+};
+
+
+/*Layout of a packet of "items" items per channel*/
+typedef struct {
+    uint16_t items; //items per channel (ITEMS of the header)
+    uint16_t timing_offset; //offset of TIMING_BYTES
+    uint16_t timing_bytes; //TIMING_BYTES of this packet
+    uint16_t size; //bytes sent (without the STATUS BYTE)
+    packet_channel_t channels[PACKET_CHANNEL_COUNT]; //packet_channels[] with the offsets of this packet
+} packet_layout_t;
+
+/*Builds the layout of a packet of "items" items, returns false if items is 0 or bigger 
+than ITEMS_PER_SENSOR (the buffers can't keep it)*/
+static inline bool packet_layout_init(packet_layout_t *layout, uint16_t items){
+    if (items==0 || items>ITEMS_PER_SENSOR){
+        return false;
+    }
+    layout->items=items;
+    layout->timing_offset=(uint16_t)PACKET_TIMING_OFFSET_ITEMS(items);
+    layout->timing_bytes=(uint16_t)PACKET_TIMING_BYTES(items);
+    layout->size=(uint16_t)PACKET_SIZE_ITEMS(items);
+    for(uint8_t each_sensor=0;each_sensor<PACKET_CHANNEL_COUNT;each_sensor++){
+        layout->channels[each_sensor]=packet_channels[each_sensor];
+        layout->channels[each_sensor].id_offset=(uint16_t)(CONTROL_BYTES+each_sensor+(uint32_t)items*packet_channels[each_sensor].item_offset);
+        layout->channels[each_sensor].data_offset=layout->channels[each_sensor].id_offset+1;
+    }
+    return true;
+}
+
+
+/*Copies "count" items of one channel into the packet, starting at item "first_item".
+source points to the first sample of the channel, the next samples are every "stride"
+bytes (for example the X axis of a batch of ADXL355 samples: stride = 9 bytes).
+The items of a channel are contiguous in the packet, so only the source has a stride*/
+static inline void packet_pack_channel(char *buffer, const packet_channel_t *channel, uint16_t first_item, uint16_t count, const uint8_t *source, size_t stride){
+    uint8_t *destination=(uint8_t *)&buffer[channel->data_offset+(uint32_t)first_item*channel->bytes];
+
+    //constant size copies (2 or 3 bytes per item), the compiler turns them into loads/stores
+    if (channel->bytes==2){
+        for(uint16_t each_item=0;each_item<count;each_item++,destination+=2,source+=stride){
+            memcpy(destination,source,2);
+        }
+    }
+    else{
+        for(uint16_t each_item=0;each_item<count;each_item++,destination+=3,source+=stride){
+            memcpy(destination,source,3);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include <stddef.h>
+
+#include "sample_rate.h"
+
+#include "spi_adxl355.h" //ODR_xxx_HZ
+#include "i2c_mma8451q.h" //MMA8451Q_DR_xxx_HZ
+#include "spi_mcp356x.h" //PRESCALER_xxx_MCLK, OSR_xxx
+
+//sinc3 filter settling of the MCP356x in DMCLK periods (added to every conversion in SCAN mode)
+#define MCP356X_SETTLING_DMCLK 64
+//smallest OSR of the MCP356x (OSR_32)
+#define MCP356X_MIN_OSR 32
+
+
+/*
+Sample rate table (MCP3561 with the internal clock, 4.56 MHz, PRESCALER_8 -> DMCLK = 142.5 KHz)
+
+ rate  | ADXL355 ODR | MMA8451Q ODR | MCP3561 OSR (conversion rate)
+ 50    | 62.5        | 50           | 2048 (67.5 Hz)
+ 100   | 125         | 100          | 1024 (131.0 Hz)
+ 200   | 250         | 200          | 512  (247.4 Hz)
+ 250   | 250         | 400          | 256  (445.3 Hz)
+ 500   | 500         | 800          | 128  (742.2 Hz)
+ 1000  | 1000        | 800 (*)      | 64   (1113.3 Hz)
+
+ The conversion rate is DMCLK/(OSR + 64): every conversion takes OSR DMCLK periods plus 64
+ of sinc3 settling. The OSR is the biggest one whose conversion fits in one sample period,
+ so in DRDY mode the SCAN TIMER can stretch it to the exact rate.
+
+ (*) 800 Hz is the maximum ODR of the MMA8451Q, at 1000 Hz some samples are repeated
+*/
+static const sample_rate_entry_t sample_rate_table[] = {
+    {50,   ODR_62_5_HZ, 62500,   MMA8451Q_DR_50_HZ,  50000,  PRESCALER_8_MCLK|OSR_2048, 2048},
+    {100,  ODR_125_HZ,  125000,  MMA8451Q_DR_100_HZ, 100000, PRESCALER_8_MCLK|OSR_1024, 1024},
+    {200,  ODR_250_HZ,  250000,  MMA8451Q_DR_200_HZ, 200000, PRESCALER_8_MCLK|OSR_512,  512},
+    {250,  ODR_250_HZ,  250000,  MMA8451Q_DR_400_HZ, 400000, PRESCALER_8_MCLK|OSR_256,  256},
+    {500,  ODR_500_HZ,  500000,  MMA8451Q_DR_800_HZ, 800000, PRESCALER_8_MCLK|OSR_128,  128},
+    {1000, ODR_1000_HZ, 1000000, MMA8451Q_DR_800_HZ, 800000, PRESCALER_8_MCLK|OSR_64,   64},
+};
+
+#define SAMPLE_RATE_TABLE_SIZE (sizeof(sample_rate_table)/sizeof(sample_rate_table[0]))
+
+
+/*======================================================================
+ * SAMPLE RATE LOOKUP
+ ======================================================================*/
+const sample_rate_entry_t * sample_rate_lookup(uint16_t rate){
+    for(uint8_t i=0;i<SAMPLE_RATE_TABLE_SIZE;i++){
+        if (sample_rate_table[i].rate==rate){
+            return &sample_rate_table[i];
+        }
+    }
+    return NULL;
+}
+
+uint8_t sample_rate_table_size(void){
+    return SAMPLE_RATE_TABLE_SIZE;
+}
+
+const sample_rate_entry_t * sample_rate_table_entry(uint8_t index){
+    if (index>=SAMPLE_RATE_TABLE_SIZE){
+        return NULL;
+    }
+    return &sample_rate_table[index];
+}
+
+
+/*======================================================================
+ * SAMPLE RATE SUPPORTED
+ *
+ * In FIFO mode the samples come at the ODR of the sensor, the packet
+ * header would be wrong if the ODR is different to the tick rate.
+ ======================================================================*/
+bool sample_rate_supported(const sample_rate_entry_t *entry, bool adxl355_fifo, bool mma8451q_fifo){
+    if (entry==NULL){
+        return false;
+    }
+    if (adxl355_fifo && entry->adxl355_odr_mhz!=(uint32_t)entry->rate*1000){
+        return false;
+    }
+    if (mma8451q_fifo && entry->mma8451q_odr_mhz!=(uint32_t)entry->rate*1000){
+        return false;
+    }
+    return true;
+}
+
+
+/*======================================================================
+ * TIMER PERIOD AND MCP356X SCAN TIMER
+ ======================================================================*/
+uint32_t sample_rate_timer_period(const sample_rate_entry_t *entry){
+    return SAMPLE_RATE_TIMER_SCALE/entry->rate;
+}
+
+uint16_t sample_rate_mcp356x_osr(const sample_rate_entry_t *entry, uint32_t dmclk_hz, uint8_t channels){
+    uint32_t period_dmclk=dmclk_hz/entry->rate;
+    uint16_t osr=entry->mcp356x_osr;
+
+    //the OSR of the table is for one channel, halve it until the whole SCAN cycle fits
+    while(osr>MCP356X_MIN_OSR && (uint32_t)channels*(osr+MCP356X_SETTLING_DMCLK)>period_dmclk){
+        osr>>=1;
+    }
+    if ((uint32_t)channels*(osr+MCP356X_SETTLING_DMCLK)>period_dmclk && channels>1){
+        return 0;
+    }
+    return osr;
+}
+
+uint8_t sample_rate_mcp356x_config1(const sample_rate_entry_t *entry, uint32_t dmclk_hz, uint8_t channels){
+    uint16_t osr=sample_rate_mcp356x_osr(entry,dmclk_hz,channels);
+    uint8_t osr_bits=0;
+
+    if (osr==entry->mcp356x_osr){
+        return entry->mcp356x_config1;
+    }
+    //OSR_32 = 0, OSR_64 = 1 ... OSR_8192 = 8 (powers of 2)
+    while(osr>MCP356X_MIN_OSR){
+        osr>>=1;
+        osr_bits++;
+    }
+    return PRESCALER_8_MCLK|(osr_bits<<OSR);
+}
+
+uint32_t sample_rate_mcp356x_scan_timer(const sample_rate_entry_t *entry, uint32_t dmclk_hz, uint8_t channels){
+    uint32_t period_dmclk=dmclk_hz/entry->rate;
+    uint32_t cycle_dmclk=(uint32_t)channels*(sample_rate_mcp356x_osr(entry,dmclk_hz,channels)+MCP356X_SETTLING_DMCLK);
+
+    //the SCAN cycle is longer than the period, no delay (maximum rate)
+    if (period_dmclk<=cycle_dmclk){
+        return 0;
+    }
+    return period_dmclk-cycle_dmclk;
+}
@@ -0,0 +1,64 @@
+#ifndef _SAMPLE_RATE_H_
+#define _SAMPLE_RATE_H_
+
+/*
+Sample rate table
+
+Every supported packet sample rate (the rate of the timer tick, written in the
+SAMPLE_RATE field of the packet header) has a row with the settings of each sensor:
+
+    ADXL355:  FILTER register (ODR and low pass filter), ODR >= rate
+    MMA8451Q: DR bits of CTRL_REG1, ODR >= rate (800 Hz maximum)
+    MCP3561:  CONFIG1 register (prescaler and OSR), conversion rate >= rate
+
+In TIMER mode a sensor running faster than the tick is fine (the last value is
+read). In FIFO mode the ODR of the sensor IS the sample rate, so the rate is only
+valid if the ODR is exactly the same (sample_rate_supported).
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SAMPLE_RATE_TIMER_SCALE 1000000 //sample timer counts per second (1 count = 1 microsecond)
+
+typedef struct {
+    uint16_t rate; //packet sample rate in Hz
+
+    uint8_t adxl355_filter; //ODR_xxx_HZ
+    uint32_t adxl355_odr_mhz; //ODR in mHz
+
+    uint8_t mma8451q_dr; //MMA8451Q_DR_xxx_HZ
+    uint32_t mma8451q_odr_mhz; //ODR in mHz
+
+    uint8_t mcp356x_config1; //PRESCALER_xxx_MCLK|OSR_xxx
+    uint16_t mcp356x_osr; //OSR value (DMCLK periods per conversion)
+} sample_rate_entry_t;
+
+
+/*Returns the row of the rate or NULL if the rate isn't in the table*/
+const sample_rate_entry_t * sample_rate_lookup(uint16_t rate);
+
+/*Returns the number of rows and the row number "index" (to list the supported rates)*/
+uint8_t sample_rate_table_size(void);
+const sample_rate_entry_t * sample_rate_table_entry(uint8_t index);
+
+/*Checks the rate against the acquisition modes: a sensor in FIFO mode needs ODR == rate*/
+bool sample_rate_supported(const sample_rate_entry_t *entry, bool adxl355_fifo, bool mma8451q_fifo);
+
+/*Timer counts between two ticks*/
+uint32_t sample_rate_timer_period(const sample_rate_entry_t *entry);
+
+/*OSR of the MCP356x when "channels" are converted in every SCAN cycle: the OSR of the
+table or a smaller one so all the channels fit in one period, 0 if even OSR 32 doesn't fit*/
+uint16_t sample_rate_mcp356x_osr(const sample_rate_entry_t *entry, uint32_t dmclk_hz, uint8_t channels);
+
+/*CONFIG1 register (PRESCALER_8_MCLK and sample_rate_mcp356x_osr), channels = 1 gives mcp356x_config1*/
+uint8_t sample_rate_mcp356x_config1(const sample_rate_entry_t *entry, uint32_t dmclk_hz, uint8_t channels);
+
+/*Value of the MCP356x SCAN TIMER register (DMCLK periods between SCAN cycles) to get
+~rate cycles per second in DRDY mode, dmclk_hz = DMCLK frequency*/
+uint32_t sample_rate_mcp356x_scan_timer(const sample_rate_entry_t *entry, uint32_t dmclk_hz, uint8_t channels);
+
+#endif
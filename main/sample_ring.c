@@ -0,0 +1,174 @@
+#include <string.h>
+
+#include "sample_ring.h"
+
+
+/*======================================================================
+ * SAMPLE RING INIT
+ *
+ * capacity has to be a power of 2, it lets us use (counter & mask)
+ * instead of a modulo and lets head/tail overflow freely.
+ ======================================================================*/
+bool sample_ring_init(sample_ring_t *ring, void *storage, uint32_t item_size, uint32_t capacity){
+    if (ring==NULL || storage==NULL || item_size==0 || capacity==0 || (capacity & (capacity-1))!=0){
+        return false;
+    }
+
+    ring->storage=(uint8_t *)storage;
+    ring->item_size=item_size;
+    ring->capacity=capacity;
+    ring->mask=capacity-1;
+    ring->overruns=0;
+    ring->reference=NULL;
+    ring->slips=0;
+
+    atomic_init(&ring->head,0);
+    atomic_init(&ring->tail,0);
+    atomic_init(&ring->lead,0);
+    return true;
+}
+
+
+/*======================================================================
+ * SAMPLE RING PUSH (producer side)
+ *
+ * The item is copied first and then head is published with release
+ * order, so the consumer never sees a slot before its bytes are written.
+ ======================================================================*/
+bool sample_ring_push(sample_ring_t *ring, const void *item){
+    uint32_t head=atomic_load_explicit(&ring->head,memory_order_relaxed);
+    uint32_t tail=atomic_load_explicit(&ring->tail,memory_order_acquire);
+
+    //ring full, the sample is dropped (the consumer is late)
+    if ((uint32_t)(head-tail)>=ring->capacity){
+        ring->overruns++;
+        return false;
+    }
+
+    memcpy(&ring->storage[(head & ring->mask)*ring->item_size],item,ring->item_size);
+    atomic_store_explicit(&ring->head,head+1,memory_order_release);
+
+    //items ahead of the reference (the sample of the reference at this time is its last one)
+    if (ring->reference!=NULL){
+        atomic_store_explicit(&ring->lead,(int32_t)(head+1-atomic_load_explicit(&ring->reference->head,memory_order_relaxed)),memory_order_relaxed);
+    }
+    return true;
+}
+
+
+/*======================================================================
+ * SAMPLE RING POP (consumer side)
+ ======================================================================*/
+bool sample_ring_pop(sample_ring_t *ring, void *item){
+    return sample_ring_pop_batch(ring,item,1)==1;
+}
+
+
+/*======================================================================
+ * SAMPLE RING POP BATCH (consumer side)
+ *
+ * Copies the available items with at most two memcpy calls (before and
+ * after the end of the storage) and releases all the slots at once.
+ ======================================================================*/
+uint32_t sample_ring_pop_batch(sample_ring_t *ring, void *items, uint32_t max_items){
+    uint32_t tail=atomic_load_explicit(&ring->tail,memory_order_relaxed);
+    uint32_t head=atomic_load_explicit(&ring->head,memory_order_acquire);
+
+    uint32_t available=head-tail;
+    if (available>max_items){
+        available=max_items;
+    }
+    if (available==0){
+        return 0;
+    }
+
+    //first part: from tail to the end of the storage
+    uint32_t first_slot=tail & ring->mask;
+    uint32_t first_part=ring->capacity-first_slot;
+    if (first_part>available){
+        first_part=available;
+    }
+    memcpy(items,&ring->storage[first_slot*ring->item_size],first_part*ring->item_size);
+
+    //second part: wrapped items at the begining of the storage
+    if (available>first_part){
+        memcpy((uint8_t *)items+first_part*ring->item_size,ring->storage,(available-first_part)*ring->item_size);
+    }
+
+    atomic_store_explicit(&ring->tail,tail+available,memory_order_release);
+    return available;
+}
+
+
+/*======================================================================
+ * SAMPLE RING COUNT
+ ======================================================================*/
+uint32_t sample_ring_count(sample_ring_t *ring){
+    uint32_t tail=atomic_load_explicit(&ring->tail,memory_order_acquire);
+    uint32_t head=atomic_load_explicit(&ring->head,memory_order_acquire);
+    return head-tail;
+}
+
+
+/*======================================================================
+ * SAMPLE RING SLIP (consumer side)
+ *
+ * The items already taken from the two rings are the same time when the
+ * difference of their tails is the lead of the ring (the difference of
+ * the heads at the same time, the last push). The consumer is the only
+ * one that moves both tails, so they don't change while it compares.
+ ======================================================================*/
+void sample_ring_follow(sample_ring_t *ring, sample_ring_t *reference){
+    ring->reference=reference;
+}
+
+int32_t sample_ring_slip(sample_ring_t *ring){
+    int32_t slip;
+
+    if (ring->reference==NULL){
+        return 0;
+    }
+    slip=atomic_load_explicit(&ring->lead,memory_order_relaxed)-(int32_t)(atomic_load_explicit(&ring->tail,memory_order_relaxed)-
+        atomic_load_explicit(&ring->reference->tail,memory_order_relaxed));
+    return (slip>SAMPLE_RING_SLIP_ITEMS || slip<-SAMPLE_RING_SLIP_ITEMS)?slip:0;
+}
+
+uint32_t sample_ring_count_slipped(sample_ring_t *ring, int32_t slip){
+    uint32_t count=sample_ring_count(ring);
+
+    if (slip>0){
+        return (count>(uint32_t)slip)?count-(uint32_t)slip:0;
+    }
+    return count+(uint32_t)(-slip);
+}
+
+uint32_t sample_ring_pop_slipped(sample_ring_t *ring, void *items, uint32_t max_items, int32_t slip, void *last){
+    uint8_t *bytes=(uint8_t *)items;
+    uint32_t repeated=0, taken;
+    uint32_t tail, count;
+
+    if (max_items==0){
+        return 0;
+    }
+    //faster clock: the oldest items are dropped (never more than the ring has)
+    if (slip>0){
+        tail=atomic_load_explicit(&ring->tail,memory_order_relaxed);
+        count=sample_ring_count(ring);
+        if ((uint32_t)slip>count){
+            slip=(int32_t)count;
+        }
+        atomic_store_explicit(&ring->tail,tail+(uint32_t)slip,memory_order_release);
+        ring->slips+=(uint32_t)slip;
+    }
+    //slower clock: the last item is repeated (the rest of the repetitions in the next batch)
+    for (;slip<0 && repeated<max_items;slip++,repeated++){
+        memcpy(&bytes[repeated*ring->item_size],last,ring->item_size);
+        ring->slips++;
+    }
+
+    taken=repeated+sample_ring_pop_batch(ring,&bytes[repeated*ring->item_size],max_items-repeated);
+    if (taken!=0){
+        memcpy(last,&bytes[(taken-1)*ring->item_size],ring->item_size);
+    }
+    return taken;
+}
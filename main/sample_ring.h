@@ -0,0 +1,85 @@
+#ifndef _SAMPLE_RING_H_
+#define _SAMPLE_RING_H_
+
+/*
+Single producer / single consumer lock-free ring buffer for sensor samples.
+
+Every sensor task (producer) pushes one fixed size item per sample and
+fill_buffer_with_sensor_task (consumer) drains them in batches. Push and pop
+never block and never call the kernel: the producer only writes "head" and
+the consumer only writes "tail", both are free running 32 bit counters, so
+the number of stored items is always (head - tail).
+
+Rings read together (one item of each ring = one item of the packet) stay aligned only if
+their producers share one clock. A ring whose sensor has its own clock (FIFO or DRDY mode)
+follows a reference ring (sample_ring_follow): every push records how many items it's ahead
+of the reference, and the consumer drops or repeats items (sample_ring_slip) so the items
+taken together were sampled at the same time, within SAMPLE_RING_SLIP_ITEMS.
+
+Rules:
+    - Only ONE task may push and only ONE task may pop on the same ring.
+    - A ring and its reference are popped by the same task.
+    - capacity must be a power of 2 (the slot index is counter & mask).
+    - storage must have at least capacity*item_size bytes.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define SAMPLE_RING_SLIP_ITEMS 2 //difference with the reference that isn't slipped (jitter of the two clocks)
+
+typedef struct sample_ring {
+    uint8_t *storage;     //item storage (capacity*item_size bytes)
+    uint32_t item_size;   //bytes per item
+    uint32_t capacity;    //number of items (power of 2)
+    uint32_t mask;        //capacity-1
+
+    atomic_uint head;     //next slot to write (only modified by producer)
+    atomic_uint tail;     //next slot to read (only modified by consumer)
+
+    uint32_t overruns;    //items dropped because the ring was full (only modified by producer)
+
+    //ring with the clock that this one follows (sample_ring_follow), NULL = same clock
+    struct sample_ring *reference;
+    atomic_int lead;      //head - head of the reference after the last push (only modified by producer)
+    uint32_t slips;       //items dropped or repeated by sample_ring_pop_slipped (only modified by consumer)
+} sample_ring_t;
+
+
+/*Prepares the ring, returns false if capacity is not a power of 2 or any parameter is invalid*/
+bool sample_ring_init(sample_ring_t *ring, void *storage, uint32_t item_size, uint32_t capacity);
+
+/*PRODUCER: copies one item into the ring, returns false (and counts an overrun) if the ring is full*/
+bool sample_ring_push(sample_ring_t *ring, const void *item);
+
+/*CONSUMER: copies the oldest item out of the ring, returns false if the ring is empty*/
+bool sample_ring_pop(sample_ring_t *ring, void *item);
+
+/*CONSUMER: copies up to max_items of the oldest items (contiguous in items), returns number of items copied*/
+uint32_t sample_ring_pop_batch(sample_ring_t *ring, void *items, uint32_t max_items);
+
+/*Number of items waiting in the ring (safe from both sides)*/
+uint32_t sample_ring_count(sample_ring_t *ring);
+
+/*The producer of "ring" has its own clock, its items are aligned with the ones of "reference"
+(before the first push, both rings empty)*/
+void sample_ring_follow(sample_ring_t *ring, sample_ring_t *reference);
+
+/*CONSUMER of the ring and its reference, between two batches: items to drop (> 0) or to repeat
+(< 0) so the next item of the ring is aligned with the next one of the reference. The lead of the
+last push is exact for a producer that empties the FIFO of its sensor in bursts. 0 for a ring
+that doesn't follow another one*/
+int32_t sample_ring_slip(sample_ring_t *ring);
+
+/*CONSUMER: items that sample_ring_pop_slipped can give with this slip*/
+uint32_t sample_ring_count_slipped(sample_ring_t *ring, int32_t slip);
+
+/*CONSUMER: sample_ring_pop_batch after the slip: slip > 0 drops the oldest items, slip < 0 copies
+"last" (the last item taken, it's updated) -slip times at the start of the batch. Returns the 
+items copied (repeated ones too)*/
+uint32_t sample_ring_pop_slipped(sample_ring_t *ring, void *items, uint32_t max_items, int32_t slip, void *last);
+
+#endif
@@ -6,10 +6,10 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
-//to read directories
-#include <dirent.h> 
+#include <sys/stat.h> //mkdir
 
 #include "esp_vfs_fat.h"
+#include "esp_system.h" //esp_random
 #include "sdmmc_cmd.h"
 #include "driver/sdmmc_host.h"
 #include "task_list.h"
@@ -25,6 +25,37 @@ xQueueHandle gpio_evt_queue = NULL;
 //Maximum size of buffer
 uint16_t max_allocation=0;
 
+//Packet logs of the card (sd_log.h)
+sd_log_t sd_backlog;
+sd_log_t sd_archive;
+backlog_index_t sd_backlog_index;
+
+//Settings of STATION_CONFIG_FILE
+sd_station_config_t sd_station_config;
+
+
+/*Reads STATION_CONFIG_FILE, false if there is no file or no setting in it*/
+static bool station_config_read(sd_station_config_t *config){
+    FILE *file=fopen(STATION_CONFIG_FILE,"r");
+    char line[64];
+    unsigned int value;
+
+    config->sample_rate=0;
+    config->packet_duration_ms=0;
+    if (file==NULL){
+        return false;
+    }
+    while (fgets(line,sizeof(line),file)!=NULL){
+        if (sscanf(line,"sample_rate=%u",&value)==1 && value<=UINT16_MAX){
+            config->sample_rate=(uint16_t)value;
+        }
+        else if (sscanf(line,"packet_duration_ms=%u",&value)==1 && value<=UINT16_MAX){
+            config->packet_duration_ms=(uint16_t)value;
+        }
+    }
+    fclose(file);
+    return config->sample_rate!=0 || config->packet_duration_ms!=0;
+}
 
 /* ==============================================================================
 FUNCTION: SD MOUNT CARD
@@ -41,7 +72,7 @@ void sd_mount_card(void)
     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
         .format_if_mount_failed = false,
         //.format_if_mount_failed = true,
-        .max_files = 1,
+        .max_files = MAX_OPEN_FILES,
         .allocation_unit_size = max_allocation  
     };
     //more informations : https://docs.espressif.com/projects/esp-idf/en/release-v4.2/esp32/api-reference/storage/fatfs.html
@@ -77,6 +108,35 @@ void sd_mount_card(void)
         }
         return;
     }else{
+        //data and archive folders (error if they already exist)
+        mkdir(FOLDER, 0775);
+        mkdir(ARCHIVE_FOLDER, 0775);
+
+        //logs: end of the newest segment of each one (LOG_ID of a new log: random)
+        if (!sd_log_open(&sd_backlog, FOLDER, esp_random())){
+            ESP_LOGE(TAG, "Backlog log %s couldn't be opened", FOLDER);
+        }
+        if (!sd_log_open(&sd_archive, ARCHIVE_FOLDER, esp_random())){
+            ESP_LOGE(TAG, "Archive log %s couldn't be opened", ARCHIVE_FOLDER);
+        }
+        //records to upload: checkpoint of the index + the slots written after it (made again from the log if it's lost)
+        if (!backlog_index_open(&sd_backlog_index, &sd_backlog, esp_random())){
+            ESP_LOGE(TAG, "Backlog index of %s couldn't be opened", FOLDER);
+        }
+        printf("SD_CONFIG: backlog segments %d-%d, %d records pending (%s, %d slots after the checkpoint), archive segment %d\n",
+            sd_backlog.first,sd_backlog.segment,backlog_index_pending(&sd_backlog_index),sd_backlog_index.rebuilt?"index made again":"index found",
+            sd_backlog_index.recovered,sd_archive.segment);
+        if (backlog_index_pending(&sd_backlog_index)!=0){
+            xEventGroupSetBits(flags_hardware_available, FLAG_FILES_AVAILABLE);
+        }
+
+        //station settings of the card (checked and applied by the selection task, main.c)
+        if (station_config_read(&sd_station_config)){
+            printf("SD_CONFIG: %s, sample rate %d Hz, packet duration %d ms (0 = not set)\n",
+                STATION_CONFIG_FILE,sd_station_config.sample_rate,sd_station_config.packet_duration_ms);
+            xEventGroupSetBits(flags_hardware_available, FLAG_STATION_CONFIG);
+        }
+
         //sd card mounted successfully
         xEventGroupSetBits(flags_hardware_available, FLAG_SD_MOUNTED); 
         //sd card is not busy    
@@ -92,11 +152,20 @@ void sd_mount_card(void)
 /* ==============================================================================
 FUNCTION: SD UNMOUNT 
 
-This function make a list of filenames in the FOLDER directory (FOLDER route defined
-in sd_config.h)
+This function closes the logs and unmounts the SD card (the segment being written is 
+found again by sd_log_open, the backlog index gets a checkpoint)
 ============================================================================== */
 void sd_unmount_card(void)
 {
+    /*the task using the card ends its record first (it fails if the card was removed): the logs
+    are closed only with the flag, never while a FILE* is being written*/
+    while ((xEventGroupWaitBits(flags_hardware_available, FLAG_SD_AVAILABLE, true, true, 1000 / portTICK_PERIOD_MS)&FLAG_SD_AVAILABLE)==0){
+        ESP_LOGW(TAG, "SD UNMOUNT: waiting for the task using the card");
+    }
+    backlog_index_close(&sd_backlog_index);
+    sd_log_close(&sd_backlog);
+    sd_log_close(&sd_archive);
+
     // All done, unmount partition and disable SDMMC or SPI peripheral
     esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
     ESP_LOGI(TAG, "Card unmounted");
@@ -168,42 +237,6 @@ void sd_cd_monitor_task(void* arg)
 
 
 
-/* ==============================================================================
-FUNCTION: SD LIST FILES
-
-This function make a list of filenames in the FOLDER directory (FOLDER route defined
-in sd_config.h)
-============================================================================== */
-int sd_list_files (char (*filename_list)[MAX_FILENAME_SIZE],int max_number_files, int offset_files){
-    //to save directory
-    DIR *directory;
-    //to read each filename
-    struct dirent *file;
-    //file counter
-    int each_file=0;
-
-    directory = opendir(FOLDER);
-    //if the directory exist then...
-    if (directory) {
-        printf("SD_FUNCTION: LISTA COMPLETA DE ARCHIVOS\n");
-        while (((file = readdir(directory)) != NULL) && (each_file<max_number_files+offset_files)) 
-        {
-            printf("SD_FUNCTION: %s\n",file->d_name);
-            if (each_file>=offset_files){
-                for (uint8_t each_char=0; each_char<MAX_FILENAME_SIZE; each_char++){
-                    //save each file into list file matrix
-                    filename_list[each_file-offset_files][each_char] = file->d_name[each_char];
-                }
-            }
-            each_file++;
-        }
-        closedir(directory);
-    }
-    return each_file-offset_files;
-}
-
-
-
 /* ==============================================================================
 FUNCTION: SD CONFIG CARD
 
@@ -1,29 +1,34 @@
 
 /*
 Maximum filename size WITHOUT FILENAME EXTENSION
-In this case for datalogger: YYMMDDHHmmSS
-filenames in this example don't have extension (example: .txt, .bin, etc). 
+In this case for datalogger: the packets are records of an append-only log (sd_log.h), one 
+folder of segment files of 4 MB: segment number (8 hex digits) + ".LOG", example 0000002A.LOG
 
-YY = year
-MM = month
-DD = day
-HH = hours
-mm = minutes 
-SS = seconds
+The log in "data" (FOLDER) keeps the packets to upload (backlog), BACKLOG.IDX in the same folder
+keeps the records not uploaded yet (backlog_index.h) and the segments before the oldest one are
+removed. The log in "archive" (ARCHIVE_FOLDER) keeps every packet uploaded
+(SD_ARCHIVE_PACKETS, main.c), it's never removed by the datalogger.
 
-TOTAL: 12 bytes or chars without file extension
+TOTAL: 12 bytes or chars (SD_LOG_NAME_BYTES)
 
-Note: to prevent reading of trash files, the data files will be into a folder named "data"
+Note: the files of one packet each of the firmware before the log (12 hex digits, milliseconds)
+aren't segments, they stay in the folders but they aren't uploaded
 */
+#include "sd_log.h"
+#include "backlog_index.h"
+
 #define MAX_FILENAME_SIZE 12
 
-/*Maximum number of open files*/
-#define MAX_OPEN_FILES 5
+/*Maximum number of open files (segment written and read of every log, backlog index)*/
+#define MAX_OPEN_FILES 6
 
 
 #define MOUNT_POINT "/sd"
 #define FOLDER MOUNT_POINT"/data"
 #define SIZE_CHAR_FOLDER sizeof(FOLDER) //length of /sd/data = 8 char
+#define ARCHIVE_FOLDER MOUNT_POINT"/archive" //copy of every packet (packets already uploaded)
+#define SIZE_CHAR_ARCHIVE_FOLDER sizeof(ARCHIVE_FOLDER) //length of /sd/archive = 11 char
+#define STATION_CONFIG_FILE MOUNT_POINT"/CONFIG.TXT" //station settings, read at every mount (sd_station_config_t)
 
 
 //      SD pin  | ESP32 gpio numbers
@@ -75,6 +80,11 @@ Note: to prevent reading of trash files, the data files will be into a folder na
 //Maximum number of messages for sd interrupt queue 
 #define SD_QUEUE_MAX_MSSG 5
 
+/*Stack of the SD tasks (send_buffer_to_SD_task, fill_buffer_with_sd_task) in bytes: sd_log and
+the backlog index go down through stdio, the VFS, FATFS and the SDMMC driver plus ESP_LOGx, 2 KB
+isn't enough. check_free_ram_task logs the free stack (uxTaskGetStackHighWaterMark)*/
+#define SD_TASK_STACK_BYTES (4*1024)
+
 
 
 //Unmount SD card
@@ -83,8 +93,25 @@ void sd_unmount_card(void);
 //Mount the SD card, set maximum number of open files, etc
 void sd_mount_card(void);
 
-//Look for the list of all files, returns the read files (value could be lower than max_number_files)
-int sd_list_files (char (*filename_list)[MAX_FILENAME_SIZE],int max_number_files, int offset_files);
+//Logs of the mounted card (sd_log.h), used while FLAG_SD_AVAILABLE is taken
+extern sd_log_t sd_backlog; //FOLDER, packets to upload
+extern sd_log_t sd_archive; //ARCHIVE_FOLDER, packets uploaded
+extern backlog_index_t sd_backlog_index; //records of sd_backlog not uploaded yet
+
+/*Settings of STATION_CONFIG_FILE, one "key=value" per line (other lines are ignored):
+
+sample_rate=200
+packet_duration_ms=1000
+
+0 = not in the file. sd_mount_card reads them and sets FLAG_STATION_CONFIG, the selection task
+of main.c checks them (sample_rate_request, packet_duration_request), they are applied from the
+next packet and stored in NVS, so the file can be removed afterwards*/
+typedef struct {
+    uint16_t sample_rate;        //packet sample rate in Hz
+    uint16_t packet_duration_ms; //duration of a packet
+} sd_station_config_t;
+
+extern sd_station_config_t sd_station_config; //settings of the mounted card
 
 /*This funcion must be called form main file. Starts the SD main process: it indentifies when 
 SD card is inserted or not inserted, if inserted then mounts the unit*/
@@ -0,0 +1,641 @@
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h> //fsync
+
+#include "sd_log.h"
+#include "crc32c.h"
+
+#define SEGMENT_MAGIC "DLSG"
+#define SEGMENT_VERSION 1
+#define RECORD_MAGIC "DR"
+#define INDEX_MAGIC "DLIX"
+#define PATH_BYTES (SD_LOG_FOLDER_BYTES+1+SD_LOG_NAME_BYTES)
+#define CHUNK_BYTES 256 //CRC of the records found by sd_log_open
+
+
+static void put_be(uint8_t *buffer, uint64_t value, uint8_t bytes){
+    for(int8_t i=bytes-1;i>=0;i--){
+        buffer[i]=(uint8_t)(value&0xFF);
+        value>>=8;
+    }
+}
+
+static uint64_t get_be(const uint8_t *buffer, uint8_t bytes){
+    uint64_t value=0;
+    for(uint8_t i=0;i<bytes;i++){
+        value=(value<<8)|buffer[i];
+    }
+    return value;
+}
+
+static void segment_path(const sd_log_t *log, uint32_t segment, char *path){
+    snprintf(path,PATH_BYTES,"%s/%08X.LOG",log->folder,(unsigned int)segment);
+}
+
+//segment number of a file name, false if it isn't a segment
+static bool segment_number(const char *name, uint32_t *segment){
+    uint32_t value=0;
+    char c;
+
+    if (strlen(name)!=SD_LOG_NAME_BYTES || name[8]!='.' || (name[9]|0x20)!='l' || (name[10]|0x20)!='o' || (name[11]|0x20)!='g'){
+        return false;
+    }
+    for (uint8_t i=0;i<8;i++){
+        c=name[i];
+        if (c>='0' && c<='9') value=(value<<4)|(uint32_t)(c-'0');
+        else if ((c|0x20)>='a' && (c|0x20)<='f') value=(value<<4)|(uint32_t)((c|0x20)-'a'+10);
+        else return false;
+    }
+    *segment=value;
+    return value!=0;
+}
+
+//the data reaches the card (fclose does the same with every packet file)
+static bool flush(FILE *file){
+    return fflush(file)==0 && fsync(fileno(file))==0;
+}
+
+static bool read_at(FILE *file, uint32_t offset, void *data, uint32_t bytes){
+    return fseek(file,(long)offset,SEEK_SET)==0 && fread(data,bytes,1,file)==1;
+}
+
+//a read after the end of the file (a segment cut by a reset while it was created) isn't a card error
+static bool card_error(FILE *file){
+    return !feof(file);
+}
+
+
+/*======================================================================
+ * SEGMENT HEADER AND INDEX
+ *
+ * Both return 1 if they're valid, 0 if they aren't (other data, a
+ * segment not sealed) and -1 if the card couldn't be read.
+ ======================================================================*/
+static int8_t header_read(FILE *file, uint32_t segment, uint32_t *log_id, uint32_t *salt){
+    uint8_t header[SD_LOG_HEADER_BYTES];
+
+    if (!read_at(file,0,header,SD_LOG_HEADER_BYTES)){
+        return card_error(file)?-1:0;
+    }
+    if (memcmp(header,SEGMENT_MAGIC,4)!=0 || header[4]!=SEGMENT_VERSION || get_be(&header[8],4)!=segment ||
+        get_be(&header[16],4)!=crc32c(0,header,16)){
+        return 0;
+    }
+    if (log_id!=NULL){
+        *log_id=(uint32_t)get_be(&header[12],4);
+    }
+    *salt=crc32c(0,header,16);
+    return 1;
+}
+
+//checks the index (COUNT and CRC)
+static int8_t index_read(FILE *file, uint32_t salt, uint16_t *count){
+    uint8_t index[12], entry[SD_LOG_ENTRY_BYTES];
+    uint32_t records, crc;
+
+    if (!read_at(file,SD_LOG_DATA_END,index,12)){
+        return card_error(file)?-1:0;
+    }
+    records=(uint32_t)get_be(&index[4],4);
+    if (memcmp(index,INDEX_MAGIC,4)!=0 || records>SD_LOG_SEGMENT_RECORDS){
+        return 0;
+    }
+    crc=crc32c(salt,index,8);
+    for (uint32_t i=0;i<records;i++){
+        if (fread(entry,SD_LOG_ENTRY_BYTES,1,file)!=1){
+            return card_error(file)?-1:0;
+        }
+        crc=crc32c(crc,entry,SD_LOG_ENTRY_BYTES);
+    }
+    if (crc!=get_be(&index[8],4)){
+        return 0;
+    }
+    *count=(uint16_t)records;
+    return 1;
+}
+
+//entry "record" of the index (also before the segment is sealed)
+static bool entry_read(FILE *file, uint16_t record, sd_log_entry_t *entry){
+    uint8_t data[SD_LOG_ENTRY_BYTES];
+
+    if (!read_at(file,SD_LOG_DATA_END+12+(uint32_t)record*SD_LOG_ENTRY_BYTES,data,SD_LOG_ENTRY_BYTES)){
+        return false;
+    }
+    entry->offset=(uint32_t)get_be(data,4);
+    entry->start_us=(int64_t)get_be(&data[4],8);
+    return true;
+}
+
+static bool entry_write(FILE *file, uint16_t record, uint32_t offset, int64_t start_us){
+    uint8_t data[SD_LOG_ENTRY_BYTES];
+
+    put_be(data,offset,4);
+    put_be(&data[4],(uint64_t)start_us,8);
+    return fseek(file,(long)(SD_LOG_DATA_END+12+(uint32_t)record*SD_LOG_ENTRY_BYTES),SEEK_SET)==0 &&
+        fwrite(data,SD_LOG_ENTRY_BYTES,1,file)==1;
+}
+
+/*Record at "offset": returns the LENGTH of the packet (copied to buffer if it isn't NULL),
+SD_LOG_CORRUPTED, SD_LOG_TOO_LONG (max_size) or SD_LOG_ERROR*/
+static int32_t record_read(FILE *file, uint32_t salt, uint32_t offset, int64_t *start_us, char *buffer, uint32_t max_size){
+    uint8_t header[SD_LOG_RECORD_BYTES], chunk[CHUNK_BYTES];
+    uint32_t length, crc, bytes;
+
+    if (offset+SD_LOG_RECORD_BYTES>SD_LOG_DATA_END){
+        return SD_LOG_CORRUPTED;
+    }
+    if (!read_at(file,offset,header,SD_LOG_RECORD_BYTES)){
+        return card_error(file)?SD_LOG_ERROR:SD_LOG_CORRUPTED;
+    }
+    length=(uint32_t)get_be(&header[4],4);
+    if (memcmp(header,RECORD_MAGIC,2)!=0 || length==0 || length>SD_LOG_DATA_END-offset-SD_LOG_RECORD_BYTES){
+        return SD_LOG_CORRUPTED;
+    }
+    if (buffer!=NULL && length>max_size){
+        return SD_LOG_TOO_LONG;
+    }
+    crc=crc32c(salt,header,16);
+    if (buffer!=NULL){
+        if (fread(buffer,length,1,file)!=1){
+            return card_error(file)?SD_LOG_ERROR:SD_LOG_CORRUPTED;
+        }
+        crc=crc32c(crc,(const uint8_t *)buffer,length);
+    }
+    else{
+        for (uint32_t done=0;done<length;done+=bytes){
+            bytes=(length-done<CHUNK_BYTES)?length-done:CHUNK_BYTES;
+            if (fread(chunk,bytes,1,file)!=1){
+                return card_error(file)?SD_LOG_ERROR:SD_LOG_CORRUPTED;
+            }
+            crc=crc32c(crc,chunk,bytes);
+        }
+    }
+    if (crc!=get_be(&header[16],4)){
+        return SD_LOG_CORRUPTED;
+    }
+    *start_us=(int64_t)get_be(&header[8],8);
+    return (int32_t)length;
+}
+
+
+/*======================================================================
+ * SEGMENT CREATE AND SEAL
+ ======================================================================*/
+static bool segment_create(sd_log_t *log){
+    uint8_t header[SD_LOG_HEADER_BYTES]={0};
+    char path[PATH_BYTES];
+    uint32_t segment=log->segment+1;
+    FILE *file;
+
+    segment_path(log,segment,path);
+    file=fopen(path,"w+b");
+    if (file==NULL){
+        return false;
+    }
+    memcpy(header,SEGMENT_MAGIC,4);
+    header[4]=SEGMENT_VERSION;
+    put_be(&header[8],segment,4);
+    put_be(&header[12],log->log_id,4);
+    put_be(&header[16],crc32c(0,header,16),4);
+
+    //the last byte allocates every cluster of the segment (it isn't filled)
+    if (fwrite(header,SD_LOG_HEADER_BYTES,1,file)!=1 || fseek(file,(long)SD_LOG_SEGMENT_BYTES-1,SEEK_SET)!=0 ||
+        fputc(0,file)==EOF || !flush(file)){
+        fclose(file);
+        remove(path);
+        return false;
+    }
+    log->file=file;
+    log->segment=segment;
+    log->salt=crc32c(0,header,16);
+    log->tail=SD_LOG_HEADER_BYTES;
+    log->count=0;
+    return true;
+}
+
+//the entries are already in the card (sd_log_append), only the COUNT and the CRC are written
+static bool segment_seal(sd_log_t *log){
+    uint8_t index[12], chunk[CHUNK_BYTES-CHUNK_BYTES%SD_LOG_ENTRY_BYTES];
+    uint32_t crc, bytes;
+
+    memcpy(index,INDEX_MAGIC,4);
+    put_be(&index[4],log->count,4);
+    crc=crc32c(log->salt,index,8);
+    if (fseek(log->file,SD_LOG_DATA_END+12,SEEK_SET)!=0){
+        return false;
+    }
+    for (uint32_t done=0;done<(uint32_t)log->count*SD_LOG_ENTRY_BYTES;done+=bytes){
+        bytes=((uint32_t)log->count*SD_LOG_ENTRY_BYTES-done<sizeof(chunk))?(uint32_t)log->count*SD_LOG_ENTRY_BYTES-done:sizeof(chunk);
+        if (fread(chunk,bytes,1,log->file)!=1){
+            return false;
+        }
+        crc=crc32c(crc,chunk,bytes);
+    }
+    put_be(&index[8],crc,4);
+
+    if (fseek(log->file,SD_LOG_DATA_END,SEEK_SET)!=0 || fwrite(index,12,1,log->file)!=1 || !flush(log->file)){
+        return false;
+    }
+    fclose(log->file);
+    log->file=NULL;
+    return true;
+}
+
+/*Records of the newest segment without index (written until a reset or sd_log_close), their
+entries are written again (a reset can cut the entry of the last record). False if the card
+couldn't be read or written*/
+static bool segment_scan(sd_log_t *log){
+    uint32_t offset=SD_LOG_HEADER_BYTES;
+    int32_t length;
+    int64_t start_us;
+
+    log->count=0;
+    while (log->count<SD_LOG_SEGMENT_RECORDS){
+        length=record_read(log->file,log->salt,offset,&start_us,NULL,0);
+        if (length==SD_LOG_ERROR){
+            return false;
+        }
+        if (length<=0){
+            break;
+        }
+        if (!entry_write(log->file,log->count,offset,start_us)){
+            return false;
+        }
+        log->count++;
+        offset+=SD_LOG_RECORD_BYTES+(uint32_t)length;
+    }
+    log->tail=offset;
+    return log->count==0 || flush(log->file);
+}
+
+
+/*======================================================================
+ * SEGMENT ENTRY (reading)
+ *
+ * Entry "record" of a segment (index of the segment being written in
+ * "file", else the index of the segment file in read_file), count = 
+ * records of the segment. Returns 1, 0 (no such segment, not valid) or
+ * -1 (card error)
+ ======================================================================*/
+static int8_t read_open(sd_log_t *log, uint32_t segment){
+    char path[PATH_BYTES];
+    int8_t result;
+
+    if (log->read_file!=NULL && log->read_segment==segment){
+        return 1;
+    }
+    if (log->read_file!=NULL){
+        fclose(log->read_file);
+    }
+    segment_path(log,segment,path);
+    log->read_file=fopen(path,"rb");
+    if (log->read_file==NULL){
+        return (errno==ENOENT)?0:-1;
+    }
+    result=header_read(log->read_file,segment,NULL,&log->read_salt);
+    if (result==1){
+        result=index_read(log->read_file,log->read_salt,&log->read_count);
+    }
+    if (result!=1){
+        fclose(log->read_file);
+        log->read_file=NULL;
+        return result;
+    }
+    log->read_segment=segment;
+    return 1;
+}
+
+static int8_t segment_entry(sd_log_t *log, uint32_t segment, uint16_t record, sd_log_entry_t *entry, uint16_t *count,
+    FILE **file, uint32_t *salt){
+    int8_t result;
+
+    if (segment==log->segment && log->file!=NULL){
+        *count=log->count;
+        *file=log->file;
+        *salt=log->salt;
+        if (record<log->count && !entry_read(log->file,record,entry)){
+            return -1;
+        }
+        return 1;
+    }
+    result=read_open(log,segment);
+    if (result!=1){
+        return result;
+    }
+    *count=log->read_count;
+    *file=log->read_file;
+    *salt=log->read_salt;
+    if (record<log->read_count && !entry_read(log->read_file,record,entry)){
+        return -1;
+    }
+    return 1;
+}
+
+//first record at location or after it: 1, 0 (no more records) or -1 (card error)
+static int8_t locate(sd_log_t *log, sd_log_location_t *location){
+    sd_log_entry_t entry;
+    uint16_t count;
+    FILE *file;
+    uint32_t salt;
+    int8_t found;
+
+    while (1){
+        if (log->segment==0 || location->segment>log->segment){
+            return 0;
+        }
+        found=segment_entry(log,location->segment,location->record,&entry,&count,&file,&salt);
+        if (found<0){
+            return -1;
+        }
+        if (found==1 && location->record<count){
+            return 1;
+        }
+        if (location->segment==log->segment){
+            return 0;
+        }
+        if (found==0 && location->segment>=log->first){
+            log->skipped++; //segment without header or index
+        }
+        location->segment++;
+        location->record=0;
+    }
+}
+
+
+/*======================================================================
+ * SD LOG OPEN AND CLOSE
+ ======================================================================*/
+bool sd_log_open(sd_log_t *log, const char *folder, uint32_t log_id){
+    DIR *directory;
+    struct dirent *file;
+    char path[PATH_BYTES];
+    uint32_t segment, oldest=UINT32_MAX, newest=0;
+    int8_t result=0;
+
+    memset(log,0,sizeof(sd_log_t));
+    if (strlen(folder)>=SD_LOG_FOLDER_BYTES){
+        return false;
+    }
+    strcpy(log->folder,folder);
+    log->log_id=log_id;
+
+    directory=opendir(folder);
+    if (directory==NULL){
+        return false;
+    }
+    while ((file=readdir(directory))!=NULL){
+        if (segment_number(file->d_name,&segment)){
+            oldest=(segment<oldest)?segment:oldest;
+            newest=(segment>newest)?segment:newest;
+        }
+    }
+    closedir(directory);
+
+    //newest segment with a header (a reset while it was created leaves it without one)
+    while (newest!=0 && newest>=oldest){
+        segment_path(log,newest,path);
+        log->file=fopen(path,"r+b");
+        if (log->file==NULL){
+            return false;
+        }
+        result=header_read(log->file,newest,&log->log_id,&log->salt);
+        if (result==1){
+            break;
+        }
+        fclose(log->file);
+        log->file=NULL;
+        if (result<0){
+            return false;
+        }
+        remove(path);
+        newest--;
+    }
+
+    log->first=1;
+    if (log->file!=NULL){
+        log->segment=newest;
+        log->first=oldest;
+        result=index_read(log->file,log->salt,&log->count);
+        if (result==1){
+            //sealed: the next append creates a new segment
+            fclose(log->file);
+            log->file=NULL;
+            log->tail=SD_LOG_DATA_END;
+        }
+        else if (result<0 || !segment_scan(log)){
+            fclose(log->file);
+            log->file=NULL;
+            return false;
+        }
+    }
+    log->next.segment=log->first;
+    log->next.record=0;
+    log->open=true;
+    return true;
+}
+
+void sd_log_close(sd_log_t *log){
+    if (log->file!=NULL){
+        fclose(log->file);
+        log->file=NULL;
+    }
+    if (log->read_file!=NULL){
+        fclose(log->read_file);
+        log->read_file=NULL;
+    }
+    log->open=false;
+}
+
+
+/*======================================================================
+ * SD LOG APPEND
+ ======================================================================*/
+sd_log_location_t sd_log_append_location(const sd_log_t *log, uint32_t size){
+    sd_log_location_t location={log->segment,log->count};
+
+    if (log->file==NULL || log->count==SD_LOG_SEGMENT_RECORDS || log->tail+SD_LOG_RECORD_BYTES+size>SD_LOG_DATA_END){
+        location.segment=log->segment+1;
+        location.record=0;
+    }
+    return location;
+}
+
+bool sd_log_append(sd_log_t *log, const char *packet, uint32_t size, int64_t start_us){
+    uint8_t header[SD_LOG_RECORD_BYTES];
+    uint32_t crc;
+
+    if (!log->open || size==0 || size>SD_LOG_MAX_PACKET){
+        return false;
+    }
+    if (log->file!=NULL && (log->count==SD_LOG_SEGMENT_RECORDS || log->tail+SD_LOG_RECORD_BYTES+size>SD_LOG_DATA_END) &&
+        !segment_seal(log)){
+        return false;
+    }
+    if (log->file==NULL && !segment_create(log)){
+        return false;
+    }
+
+    memcpy(header,RECORD_MAGIC,2);
+    header[2]=0;
+    header[3]=0;
+    put_be(&header[4],size,4);
+    put_be(&header[8],(uint64_t)start_us,8);
+    crc=crc32c(log->salt,header,16);
+    put_be(&header[16],crc32c(crc,(const uint8_t *)packet,size),4);
+
+    //the entry first: the record is the last write, the entry of a record cut by a reset isn't used
+    if (!entry_write(log->file,log->count,log->tail,start_us) || fseek(log->file,(long)log->tail,SEEK_SET)!=0 ||
+        fwrite(header,SD_LOG_RECORD_BYTES,1,log->file)!=1 || fwrite(packet,size,1,log->file)!=1 || !flush(log->file)){
+        return false;
+    }
+    log->count++;
+    log->tail+=SD_LOG_RECORD_BYTES+size;
+    log->appended++;
+    return true;
+}
+
+
+/*======================================================================
+ * SD LOG READ
+ ======================================================================*/
+int32_t sd_log_read_at(sd_log_t *log, sd_log_location_t location, char *buffer, uint32_t max_size){
+    sd_log_entry_t entry;
+    uint16_t count;
+    FILE *file;
+    uint32_t salt;
+    int64_t start_us;
+    int32_t result;
+    int8_t found;
+
+    if (!log->open){
+        return SD_LOG_ERROR;
+    }
+    found=segment_entry(log,location.segment,location.record,&entry,&count,&file,&salt);
+    if (found<0){
+        return SD_LOG_ERROR;
+    }
+    if (found==0 || location.record>=count){
+        return SD_LOG_CORRUPTED;
+    }
+    result=record_read(file,salt,entry.offset,&start_us,buffer,max_size);
+    if (result==SD_LOG_CORRUPTED){
+        log->skipped++;
+    }
+    return result;
+}
+
+int32_t sd_log_read(sd_log_t *log, char *buffer, uint32_t max_size, sd_log_location_t *location){
+    int32_t result;
+    int8_t found;
+
+    if (!log->open){
+        return SD_LOG_ERROR;
+    }
+    found=locate(log,&log->next);
+    if (found<=0){
+        return (found<0)?SD_LOG_ERROR:SD_LOG_EMPTY;
+    }
+    result=sd_log_read_at(log,log->next,buffer,max_size);
+    if (result==SD_LOG_ERROR){
+        return result;
+    }
+    if (location!=NULL){
+        *location=log->next;
+    }
+    log->next.record++;
+    return result;
+}
+
+bool sd_log_locate(sd_log_t *log, sd_log_location_t *location){
+    return log->open && locate(log,location)==1;
+}
+
+void sd_log_trim(sd_log_t *log, uint32_t segment){
+    char path[PATH_BYTES];
+
+    if (!log->open){
+        return;
+    }
+    segment=(segment<log->segment)?segment:log->segment;
+    for (;log->first<segment;log->first++){
+        if (log->read_file!=NULL && log->read_segment==log->first){
+            fclose(log->read_file);
+            log->read_file=NULL;
+        }
+        segment_path(log,log->first,path);
+        remove(path);
+    }
+    if (log->next.segment<log->first){
+        log->next.segment=log->first;
+        log->next.record=0;
+    }
+}
+
+bool sd_log_pending(const sd_log_t *log){
+    return log->open && log->segment!=0 && (log->next.segment<log->segment ||
+        (log->next.segment==log->segment && log->next.record<log->count));
+}
+
+
+/*======================================================================
+ * SD LOG SEEK
+ *
+ * Binary search of the segments (first entry of every index) and then
+ * of the entries of the segment found.
+ ======================================================================*/
+bool sd_log_seek(sd_log_t *log, int64_t start_us){
+    sd_log_entry_t entry;
+    uint16_t count, low_record, high_record, middle_record;
+    FILE *file;
+    uint32_t salt, low, high, middle, segment;
+    int8_t found;
+
+    if (!log->open || log->segment==0){
+        return false;
+    }
+    //last segment that starts at start_us or before
+    segment=log->first;
+    low=log->first;
+    high=log->segment;
+    while (low<=high){
+        middle=low+(high-low)/2;
+        found=segment_entry(log,middle,0,&entry,&count,&file,&salt);
+        if (found<0){
+            return false;
+        }
+        if (found==1 && count!=0 && entry.start_us<=start_us){
+            segment=middle;
+            low=middle+1;
+        }
+        else{
+            high=middle-1;
+        }
+    }
+
+    //first record of that segment at start_us or after (or the next segment)
+    if (segment_entry(log,segment,0,&entry,&count,&file,&salt)!=1){
+        count=0;
+    }
+    low_record=0;
+    high_record=count;
+    while (low_record<high_record){
+        middle_record=(uint16_t)((low_record+high_record)/2);
+        if (segment_entry(log,segment,middle_record,&entry,&count,&file,&salt)!=1){
+            return false;
+        }
+        if (entry.start_us<start_us){
+            low_record=middle_record+1;
+        }
+        else{
+            high_record=middle_record;
+        }
+    }
+    log->next.segment=segment;
+    log->next.record=low_record;
+    if (low_record==count && segment<log->segment){
+        log->next.segment=segment+1;
+        log->next.record=0;
+    }
+    return sd_log_pending(log);
+}
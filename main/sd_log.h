@@ -0,0 +1,151 @@
+#ifndef _SD_LOG_H_
+#define _SD_LOG_H_
+
+/*
+Append-only packet log in the SD card: one folder of big preallocated segment files
+
+Every segment is created with its final size (SD_LOG_SEGMENT_BYTES), so writing one packet
+is a seek and a write inside a file that already exists: no new directory entry and no new
+clusters in the FAT for every packet. The packets are records appended one after the other,
+the folder gets one file every SD_LOG_SEGMENT_RECORDS packets or SD_LOG_SEGMENT_BYTES.
+Segment names are the segment number (8 hex digits) + ".LOG", 1 is the first one. All
+values big endian:
+
+Segment header (offset 0)
+ 0      | 4     | MAGIC "DLSG"
+ 4      | 1     | VERSION (1)
+ 5      | 3     | 0
+ 8      | 4     | SEGMENT number
+ 12     | 4     | LOG_ID, random number of the log (sd_log_open)
+ 16     | 4     | CRC, CRC-32C (crc32c.h) of bytes 0-15 = SALT of the segment
+
+Record (from offset SD_LOG_HEADER_BYTES, one after the other)
+ 0      | 2     | MAGIC "DR"
+ 2      | 2     | 0
+ 4      | 4     | LENGTH of the packet
+ 8      | 8     | START_US of the packet (epoch_us, packet_start_us)
+ 16     | 4     | CRC, CRC-32C of bytes 0-15 and the packet starting with SALT
+ 20     |       | packet (header and payload, as it was uploaded)
+
+Index (offset SD_LOG_DATA_END)
+ 0      | 4     | MAGIC "DLIX"
+ 4      | 4     | COUNT of records
+ 8      | 4     | CRC, CRC-32C of bytes 0-7 and the entries starting with SALT
+ 12     | 12*n  | entries: OFFSET of the record (4), START_US (8)
+
+The entry of every record is written with the record, bytes 0-11 of the index when the 
+segment is full (the segment is SEALED, the CRC is made from the entries on the card). The
+index stays in the card, so SD_LOG_SEGMENT_RECORDS doesn't take RAM: it is sized for the 
+smallest packets (500 ms at 50 Hz, 557 bytes raw: ~7300 records in 4 MB), the records of 
+short packets fill the segment instead of the record cap.
+
+The clusters of a new segment keep old data of the card, SALT (LOG_ID + SEGMENT) makes the
+records and indexes of other segments or logs invalid there. The end of the records of a
+segment that isn't sealed is the first record that isn't valid (a record cut by a reset is
+written again by the next append), sd_log_open writes the entries of its records again.
+
+sd_log_open finds the segments (one readdir) and reads the index of the newest one, or its
+records if it isn't sealed (only that segment is read to resume). A record is read by its
+location (sd_log_read_at, the backlog keeps the locations to upload in backlog_index.h) or in
+order from the oldest one (sd_log_read, sd_log_seek finds a time with a binary search of the
+indexes). The log never removes records by itself, sd_log_trim removes the oldest segments.
+
+The log only needs stdio and dirent (FATFS VFS of ESP-IDF or any POSIX file system).
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SD_LOG_SEGMENT_BYTES (4UL*1024*1024)  //size of every segment file
+#define SD_LOG_SEGMENT_RECORDS 8192           //maximum records of a segment (index of 96 KB in the card)
+#define SD_LOG_HEADER_BYTES 20                //segment header
+#define SD_LOG_RECORD_BYTES 20                //header of every record
+#define SD_LOG_ENTRY_BYTES 12                 //entry of the index
+#define SD_LOG_INDEX_BYTES (12+SD_LOG_SEGMENT_RECORDS*SD_LOG_ENTRY_BYTES)
+#define SD_LOG_DATA_END (SD_LOG_SEGMENT_BYTES-SD_LOG_INDEX_BYTES) //records end before the index
+#define SD_LOG_MAX_PACKET (SD_LOG_DATA_END-SD_LOG_HEADER_BYTES-SD_LOG_RECORD_BYTES)
+#define SD_LOG_NAME_BYTES 12                  //"0000002A.LOG" (MAX_FILENAME_SIZE)
+#define SD_LOG_FOLDER_BYTES 20                //maximum folder name with the terminator
+
+//Results of sd_log_read and sd_log_read_at (bigger than 0: bytes of the packet)
+#define SD_LOG_EMPTY 0      //every record was read
+#define SD_LOG_CORRUPTED -1 //the record isn't valid (CRC), sd_log_read skips it
+#define SD_LOG_TOO_LONG -2  //the packet doesn't fit in the buffer, sd_log_read skips it
+#define SD_LOG_ERROR -3     //the card couldn't be read, sd_log_read reads the same record next time
+
+typedef struct {
+    uint32_t offset;  //offset of the record in the segment
+    int64_t start_us; //START_US of the packet
+} sd_log_entry_t;
+
+typedef struct {
+    uint32_t segment;
+    uint16_t record;  //position in the index of the segment
+} sd_log_location_t;
+
+typedef struct {
+    char folder[SD_LOG_FOLDER_BYTES];
+    uint32_t log_id;
+    bool open;
+
+    //newest segment, the one being written if "file" isn't NULL (else it's sealed or there are no segments)
+    FILE *file;
+    uint32_t segment; //0 = no segments
+    uint32_t salt;
+    uint32_t tail;    //offset of the next record
+    uint16_t count;   //records (their entries are in the index of the segment)
+
+    //reading (records before "next" were read)
+    uint32_t first;   //oldest segment
+    sd_log_location_t next;
+    FILE *read_file;  //segment of the last read (not the one being written)
+    uint32_t read_segment;
+    uint32_t read_salt;
+    uint16_t read_count;
+
+    uint32_t appended; //records written since sd_log_open
+    uint32_t skipped;  //records (or segments) not valid found by the reads
+} sd_log_t;
+
+
+/*Opens the log of "folder" (it must exist) and finds the end of the newest segment, log_id is
+the LOG_ID of the first segment if the folder has no segments. The next record to read is the
+first one of the oldest segment. False if the newest segment can't be read*/
+bool sd_log_open(sd_log_t *log, const char *folder, uint32_t log_id);
+
+/*Closes the files (the segment being written stays without index, sd_log_open finds its end)*/
+void sd_log_close(sd_log_t *log);
+
+/*Location that sd_log_append gives to the next packet of "size" bytes*/
+sd_log_location_t sd_log_append_location(const sd_log_t *log, uint32_t size);
+
+/*Appends one packet (flushed to the card before it returns), a full segment is sealed and a
+new one is created. False if it couldn't be written (the log stays as it was)*/
+bool sd_log_append(sd_log_t *log, const char *packet, uint32_t size, int64_t start_us);
+
+/*Reads the record at "location" to "buffer" (max_size bytes, NULL only checks the record),
+returns the bytes of the packet or SD_LOG_CORRUPTED (also if there is no such record),
+SD_LOG_TOO_LONG, SD_LOG_ERROR*/
+int32_t sd_log_read_at(sd_log_t *log, sd_log_location_t location, char *buffer, uint32_t max_size);
+
+/*Reads the next record (in order), returns the same as sd_log_read_at or SD_LOG_EMPTY after
+the last one. location = the record read*/
+int32_t sd_log_read(sd_log_t *log, char *buffer, uint32_t max_size, sd_log_location_t *location);
+
+/*True if there are records that sd_log_read didn't read yet*/
+bool sd_log_pending(const sd_log_t *log);
+
+/*The next sd_log_read reads the first record with START_US >= start_us (START_US grows with
+the records, steps of the clock back aren't found). False if there is no such record*/
+bool sd_log_seek(sd_log_t *log, int64_t start_us);
+
+/*Moves location to the first record at location or after it (the next segment if the record
+isn't in its segment), false if there is no such record or the card couldn't be read*/
+bool sd_log_locate(sd_log_t *log, sd_log_location_t *location);
+
+/*Removes the segments before "segment" (never the newest one)*/
+void sd_log_trim(sd_log_t *log, uint32_t segment);
+
+#endif
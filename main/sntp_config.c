@@ -1,14 +1,20 @@
+#include <stdlib.h> //setenv
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
 #include "esp_log.h"
 
-#include "esp_sntp.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
 #include "task_list.h"
 
 //custom headers
 #include "sntp_config.h"
 #include "i2c_ds3231.h" //real time clock header
+#include "timer_conf.h" //sample timer (microseconds since conf_timer)
+#include "epoch_time.h"
+#include "time_sync.h" //SNTP filter, slew and drift (pure C)
+#include "soft_clock.h" //station clock extended with the sample timer (pure C)
 
 /* Variable holding number of times ESP32 restarted since first boot.
  * It is placed into RTC memory using RTC_DATA_ATTR and
@@ -16,126 +22,302 @@
  */
 //RTC_DATA_ATTR static int boot_count = 0;
 
+#define EDGE_MAX_AGE_US 1050000 //an older SQW edge isn't the one of the second that was read (edges lost)
+#define READ_ATTEMPTS 3         //DS3231 reads if the second changes during the read
 
 static const char *TAG = "sntp";
 
+/*Software clock (raw clock) and CORRECTION, written by the time service and the anchors 
+(RTC task), read by every task that needs the station time*/
+static portMUX_TYPE time_service_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint64_t sqw_edge=0;           //sample timer value of the last SQW edge (0 = no edges)
+static soft_clock_t station_clock;    //zero = not anchored (soft_clock_init)
+static int64_t correction_us=0;       //station time = raw clock + correction_us
+static uint32_t uncertainty_us=TIME_SYNC_UNKNOWN;
 
-void initialize_sntp(void)
-{
-    ESP_LOGI(TAG, "Initializing SNTP...");
-    sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    sntp_setservername(0, "pool.ntp.org");
- 
-    sntp_init();
+//Filter of the SNTP samples, only used by time_service_task
+static time_sync_t sntp_filter;
+
+
+//raw clock of a sample timer value (time_sync.h), 0 if it was never anchored
+static int64_t raw_time(uint64_t timer_us){
+    int64_t raw_us;
+
+    portENTER_CRITICAL(&time_service_mux);
+    raw_us=soft_clock_time(&station_clock,timer_us);
+    portEXIT_CRITICAL(&time_service_mux);
+    return raw_us;
 }
 
+static void publish(int64_t correction, uint32_t uncertainty){
+    portENTER_CRITICAL(&time_service_mux);
+    correction_us=correction;
+    uncertainty_us=uncertainty;
+    portEXIT_CRITICAL(&time_service_mux);
+}
 
-void obtain_time(void)
-{
-    initialize_sntp();
-
-    // wait for time to be set
-    time_t now = 0;
-    struct tm timeinfo = { 0 };
-    int retry = 0;
-    const int retry_count = 10;
-    while (sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET && ++retry < retry_count) {
-        ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
+
+/*======================================================================
+ * TIME SERVICE: ANCHOR AND STATION TIME
+ ======================================================================*/
+void IRAM_ATTR time_service_edge_from_isr(uint64_t timer){
+    portENTER_CRITICAL_ISR(&time_service_mux);
+    sqw_edge=timer;
+    portEXIT_CRITICAL_ISR(&time_service_mux);
+}
+
+bool time_service_anchor(void){
+    uint64_t edge_before, edge_after, read_timer;
+    int64_t rtc_us;
+    bool at_edge;
+    uint8_t result;
+
+    //the seconds register changes at the SQW edge, the read must not cross an edge
+    for(uint8_t attempt=0;;attempt++){
+        portENTER_CRITICAL(&time_service_mux);
+        edge_before=sqw_edge;
+        portEXIT_CRITICAL(&time_service_mux);
+
+        if (!ds3231_get_time(&rtc_us)){
+            return false;
+        }
+        read_timer=timer_get_timestamp();
+
+        portENTER_CRITICAL(&time_service_mux);
+        edge_after=sqw_edge;
+        portEXIT_CRITICAL(&time_service_mux);
+        if (edge_before==edge_after || attempt+1>=READ_ATTEMPTS){
+            break;
+        }
+    }
+
+    at_edge=(edge_after!=0 && read_timer-edge_after<EDGE_MAX_AGE_US);
+    portENTER_CRITICAL(&time_service_mux);
+    result=soft_clock_anchor(&station_clock,at_edge?edge_after:read_timer,rtc_us,at_edge);
+    portEXIT_CRITICAL(&time_service_mux);
+
+    if (result==SOFT_CLOCK_STEPPED){
+        ESP_LOGW(TAG,"TIME: station clock stepped to the DS3231 (%s)",at_edge?"SQW edge":"no SQW edges");
     }
-    time(&now);
-    localtime_r(&now, &timeinfo);
+    return true;
 }
 
+int64_t time_service_time(uint64_t timer_us){
+    int64_t station_us;
 
-void sntp_parse_string (char * date, char * time, char * parsered_datetime){
-    /*Date initial format = MM/DD/YY   final format = YY MM DD
-      Time initial format = HH:mm:SS   final format = HH mm SS 
-    */
-    //YY
-    parsered_datetime[0]=date[6]-48;
-    parsered_datetime[1]=date[7]-48;
-    
-    //MM
-    parsered_datetime[2]=date[0]-48;
-    parsered_datetime[3]=date[1]-48;
-
-    //DD
-    parsered_datetime[4]=date[3]-48;
-    parsered_datetime[5]=date[4]-48;
-
-    //HH
-    parsered_datetime[6]=time[0]-48;
-    parsered_datetime[7]=time[1]-48;
-    
-    //mm
-    parsered_datetime[8]=time[3]-48;
-    parsered_datetime[9]=time[4]-48;
-
-    //SS
-    parsered_datetime[10]=time[6]-48;
-    parsered_datetime[11]=time[7]-48;
-    /*
-    for (int i=0; i<12; i++){
-        printf("Parsered[%d] = %d\n",i,parsered_datetime[i]);
-    }*/
+    portENTER_CRITICAL(&time_service_mux);
+    station_us=soft_clock_time(&station_clock,timer_us);
+    station_us+=(station_us==0)?0:correction_us;
+    portEXIT_CRITICAL(&time_service_mux);
+    return station_us;
 }
 
+uint64_t time_service_anchor_timer(void){
+    uint64_t timer_us;
 
-void sntp_config(void)
-{
-    char local_datetime[DATETIME_SIZE_FORMAT] = {0}; 
-    
-    //Wait until wifi is connected
-    xEventGroupWaitBits(flags_hardware_available, FLAG_WIFI_CONNECTED, false, true, portMAX_DELAY);
+    portENTER_CRITICAL(&time_service_mux);
+    timer_us=station_clock.base_timer;
+    portEXIT_CRITICAL(&time_service_mux);
+    return timer_us;
+}
 
-    //Wait until wifi available
-    xEventGroupWaitBits(flags_hardware_available, FLAG_WIFI_AVAILABLE, true, true, portMAX_DELAY);
-    
-    //++boot_count;
-    //ESP_LOGI(TAG, "Boot count: %d", boot_count);
+uint32_t time_service_uncertainty(void){
+    uint64_t uncertainty;
 
-    time_t now;
+    portENTER_CRITICAL(&time_service_mux);
+    uncertainty=uncertainty_us;
+    if (uncertainty!=TIME_SYNC_UNKNOWN){
+        //error of the last anchor of the software clock (timer against DS3231)
+        uncertainty+=(uint32_t)((station_clock.error_us<0)?-station_clock.error_us:station_clock.error_us);
+        //without SQW edges the second of the DS3231 started up to 1 s before the read
+        uncertainty+=station_clock.at_edge?0:EPOCH_US_PER_SECOND;
+    }
+    portEXIT_CRITICAL(&time_service_mux);
+    return (uncertainty>=TIME_SYNC_UNKNOWN)?TIME_SYNC_UNKNOWN:(uint32_t)uncertainty;
+}
+
+
+/*======================================================================
+ * SNTP EXCHANGE
+ *
+ * One request and one reply (RFC 4330) with T1 and T4 of the raw
+ * clock. The SNTP client of lwIP only sets the system time, it doesn't
+ * give the times of every exchange the filter needs.
+ ======================================================================*/
+static bool sntp_exchange(time_sync_sample_t *sample){
+    struct addrinfo hints={ .ai_family=AF_INET, .ai_socktype=SOCK_DGRAM };
+    struct addrinfo *server=NULL;
+    struct timeval timeout={ .tv_sec=0, .tv_usec=TIME_SERVICE_TIMEOUT_MS*1000 };
+    uint8_t packet[TIME_SYNC_NTP_BYTES];
+    int64_t t1_us, t4_us;
+    bool valid=false;
+    int sock;
+
+    //the pool gives other servers from time to time, it is resolved every poll
+    if (getaddrinfo(TIME_SERVICE_SERVER,TIME_SERVICE_PORT,&hints,&server)!=0 || server==NULL){
+        ESP_LOGW(TAG,"TIME: %s couldn't be resolved",TIME_SERVICE_SERVER);
+        return false;
+    }
+    sock=socket(AF_INET,SOCK_DGRAM,IPPROTO_UDP);
+    if (sock>=0){
+        setsockopt(sock,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+
+        t1_us=raw_time(timer_get_timestamp());
+        time_sync_ntp_request(packet,t1_us);
+        if (sendto(sock,packet,sizeof(packet),0,server->ai_addr,server->ai_addrlen)==sizeof(packet)
+            && recv(sock,packet,sizeof(packet),0)==sizeof(packet)){
+            t4_us=raw_time(timer_get_timestamp());
+            valid=time_sync_ntp_sample(packet,t1_us,t4_us,sample);
+        }
+        close(sock);
+    }
+    freeaddrinfo(server);
+    return valid;
+}
+
+
+/*======================================================================
+ * TIME SERVICE STEP
+ *
+ * Writing the seconds register restarts the second of the DS3231, so
+ * it is written at the start of a second of the server (within one
+ * FreeRTOS tick, the rest is slewed later).
+ ======================================================================*/
+static void time_service_step(time_sync_t *sync){
+    int64_t server_us, second_us;
+    uint64_t timer;
+    struct timeval utc_now;
     struct tm timeinfo;
-    time(&now);
-    localtime_r(&now, &timeinfo);
-    // Is time set? If not, tm_year will be (1970 - 1900).
-    if (timeinfo.tm_year < (2016 - 1900)) {
-        ESP_LOGI(TAG, "Time is not set yet. Connecting to WiFi and getting time over NTP.");
-        obtain_time();
-        // update 'now' variable with current time
-        time(&now);
+    char text[EPOCH_FORMAT_BYTES];
+    time_t now;
+
+    server_us=raw_time(timer_get_timestamp())+sync->correction_us+time_sync_step_us(sync);
+    vTaskDelay((EPOCH_US_PER_SECOND-server_us%EPOCH_US_PER_SECOND)/1000/portTICK_PERIOD_MS+1);
+
+    timer=timer_get_timestamp();
+    server_us=raw_time(timer)+sync->correction_us+time_sync_step_us(sync);
+    second_us=server_us-server_us%EPOCH_US_PER_SECOND;
+    if (!ds3231_set_time(second_us)){
+        ESP_LOGW(TAG,"TIME: the DS3231 couldn't be set");
+        return;
     }
+    portENTER_CRITICAL(&time_service_mux);
+    soft_clock_step(&station_clock,timer,second_us);
+    portEXIT_CRITICAL(&time_service_mux);
+    ESP_LOGW(TAG,"TIME: DS3231 set, error %lld us",time_sync_step_us(sync));
+    time_sync_stepped(sync);
+    publish(sync->correction_us,TIME_SYNC_UNKNOWN);
 
-    //for some reason it doesnt work if we put 8 characters 
-    char date[9];
-    char time[9];
+    //system time for the logs, in local time (the DS3231 keeps UTC)
+    utc_now.tv_sec=(time_t)(second_us/EPOCH_US_PER_SECOND);
+    utc_now.tv_usec=0;
+    settimeofday(&utc_now,NULL);
+    now=utc_now.tv_sec;
+    localtime_r(&now,&timeinfo);
+    strftime(text,sizeof(text),"%x %X",&timeinfo);
+    ESP_LOGI(TAG, "The current date/time in Mexico City is: %s",text);
+}
 
-    /* Set timezone to Central time (Mexico) and print local time
-    https://sites.google.com/a/usapiens.com/opnode/time-zones
-    */
-    setenv("TZ", "CST6CDT,M3.2.0,M11.1.0", 1);
-    tzset();
-    localtime_r(&now, &timeinfo);
-    
-    /* Convert date and time to string 
-    https://www.tutorialspoint.com/c_standard_library/c_function_strftime.htm 
-    
-    %x = Date representation, example	08/19/12
-    %X = Time representation, example	02:50:06
-    */
-    strftime(date, sizeof(date), "%x", &timeinfo);
-    strftime(time, sizeof(time), "%X", &timeinfo);
-    
-    //set wifi available again...
-    xEventGroupSetBits(flags_hardware_available, FLAG_WIFI_AVAILABLE);    
 
-    ESP_LOGI(TAG, "The current date/time in Mexico City is: %s %s", date,time);
-    sntp_parse_string(date,time,local_datetime);
+/*======================================================================
+ * TIME SERVICE AGING
+ ======================================================================*/
+static void time_service_aging(time_sync_t *sync){
+    int8_t delta=time_sync_aging_delta(sync);
+    int8_t aging;
+    int16_t target;
 
-    //Set initial date and time to the real time clock
-    ds3231_set_datetime(local_datetime);
+    if (delta==0 || !ds3231_get_aging(&aging)){
+        return;
+    }
+    target=(int16_t)aging+delta;
+    if (target>INT8_MAX) target=INT8_MAX;
+    if (target<INT8_MIN) target=INT8_MIN;
+    if (target==aging){
+        return; //the register is at its limit
+    }
+    if (ds3231_set_aging((int8_t)target)){
+        ESP_LOGI(TAG,"TIME: drift %d ppb, DS3231 aging offset %d -> %d",sync->frequency_ppb,aging,target);
+        time_sync_aging_applied(sync,(int8_t)(target-aging));
+    }
 }
 
 
+/*======================================================================
+ * TIME SERVICE POLL
+ ======================================================================*/
+static bool time_service_poll(time_sync_t *sync){
+    time_sync_sample_t sample;
+    bool valid;
+
+    //the raw clock needs the first anchor (RTC task), the software clock follows the DS3231 since then
+    if ((xEventGroupGetBits(flags_hardware_available)&FLAG_WIFI_CONNECTED)==0 || raw_time(timer_get_timestamp())==0){
+        return false;
+    }
 
+    //Wait until wifi available
+    if ((xEventGroupWaitBits(flags_hardware_available, FLAG_WIFI_AVAILABLE, true, true,
+        TIME_SERVICE_TIMEOUT_MS / portTICK_PERIOD_MS)&FLAG_WIFI_AVAILABLE)==0){
+        return false;
+    }
+    valid=sntp_exchange(&sample);
+    //set wifi available again...
+    xEventGroupSetBits(flags_hardware_available, FLAG_WIFI_AVAILABLE);
+    if (!valid){
+        return false;
+    }
+
+    switch(time_sync_add(sync,&sample)){
+        case TIME_SYNC_STEP:
+            time_service_step(sync);
+            break;
+        case TIME_SYNC_SLEW:
+            time_service_aging(sync);
+            break;
+        default:
+            break;
+    }
+    ESP_LOGI(TAG,"TIME: offset %lld us, delay %lld us, correction %lld us, drift %d ppb, jitter %u us",
+        sample.offset_us,sample.delay_us,sync->correction_us,sync->frequency_ppb,sync->jitter_us);
+    return true;
+}
+
+
+/*======================================================================
+ * TIME SERVICE TASK
+ ======================================================================*/
+void time_service_task(void *pvParameter)
+{
+    int64_t raw_us;
+    int32_t seconds_to_poll=0;
+    uint8_t burst=TIME_SERVICE_BURST;
+
+    time_sync_init(&sntp_filter);
+
+    //Time zone of the logs
+    setenv("TZ", LOCAL_TIMEZONE, 1);
+    tzset();
+
+    while (1)
+    {
+        if (seconds_to_poll<=0){
+            if (!time_service_poll(&sntp_filter)){
+                seconds_to_poll=TIME_SERVICE_RETRY_S;
+            }
+            else if (burst>0){
+                burst--;
+                seconds_to_poll=TIME_SERVICE_BURST_S;
+            }
+            else{
+                seconds_to_poll=TIME_SERVICE_POLL_S;
+            }
+        }
+
+        //CORRECTION moves every second (at most TIME_SYNC_SLEW_PPM)
+        raw_us=raw_time(timer_get_timestamp());
+        publish(time_sync_slew(&sntp_filter,raw_us),time_sync_uncertainty(&sntp_filter,raw_us));
+
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        seconds_to_poll--;
+    }
+}
@@ -1,2 +1,51 @@
 
-void sntp_config(void);
\ No newline at end of file
+/*Time zone of the logs, Central time (Mexico). The DS3231 and the packets keep UTC (epoch_time.h)
+https://sites.google.com/a/usapiens.com/opnode/time-zones
+*/
+#define LOCAL_TIMEZONE "CST6CDT,M3.2.0,M11.1.0"
+
+/*
+Time service: the DS3231 is kept on UTC with SNTP while the station runs (time_sync.h)
+
+    raw clock     = software clock (soft_clock.h): DS3231 time at the SQW edge of the last 
+                    anchor + sample timer since then, without the drift of the timer
+    station time  = raw clock + CORRECTION (slewed every second, never jumps)
+
+The station time of a packet doesn't use the I2C bus: the RTC task anchors the software
+clock every TIME_SERVICE_ANCHOR_S (time_service_anchor) and the packets read it.
+
+time_service_task polls TIME_SERVICE_SERVER every TIME_SERVICE_POLL_S (a burst of
+TIME_SERVICE_BURST polls after boot fills the minimum delay filter), sets the DS3231 when
+the error is bigger than TIME_SYNC_STEP_US (first sync) and corrects its drift with the aging
+offset register. The packets get the station time (START_US) and its uncertainty (TIME_QUALITY).
+*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIME_SERVICE_SERVER "pool.ntp.org"
+#define TIME_SERVICE_PORT "123"         //TIME_SYNC_NTP_PORT
+#define TIME_SERVICE_POLL_S 64          //seconds between polls (NTP minpoll)
+#define TIME_SERVICE_BURST 8            //polls after boot, TIME_SERVICE_BURST_S apart (TIME_SYNC_WINDOW)
+#define TIME_SERVICE_BURST_S 2
+#define TIME_SERVICE_RETRY_S 8          //next try after a failed poll (no WiFi, no reply)
+#define TIME_SERVICE_TIMEOUT_MS 1000    //wait for the reply of the server
+#define TIME_SERVICE_ANCHOR_S 60        //seconds between DS3231 reads (anchors of the software clock)
+
+/*SQW pin interrupt (falling edge = new second of the DS3231), timer = sample timer value of the edge*/
+void time_service_edge_from_isr(uint64_t timer);
+
+/*Reads the DS3231 and anchors the software clock at the SQW edge of that second (the time of 
+the read if there are no edges). Returns false if the DS3231 couldn't be read*/
+bool time_service_anchor(void);
+
+/*Station time of a sample timer value (no I2C), 0 if the DS3231 was never read*/
+int64_t time_service_time(uint64_t timer_us);
+
+/*Sample timer value of the last anchor of the software clock*/
+uint64_t time_service_anchor_timer(void);
+
+/*Uncertainty of the station time in microseconds, TIME_SYNC_UNKNOWN before the first sync*/
+uint32_t time_service_uncertainty(void);
+
+/*SNTP polls, slew of CORRECTION (every second), steps and aging of the DS3231*/
+void time_service_task(void *pvParameter);
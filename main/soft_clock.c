@@ -0,0 +1,111 @@
+#include <string.h>
+
+#include "soft_clock.h"
+
+#define US_PER_SECOND 1000000LL
+
+
+static int64_t clamp(int64_t value, int64_t limit){
+    if (value>limit) return limit;
+    if (value<-limit) return -limit;
+    return value;
+}
+
+
+/*======================================================================
+ * SOFT CLOCK INIT
+ ======================================================================*/
+void soft_clock_init(soft_clock_t *clock){
+    memset(clock,0,sizeof(soft_clock_t));
+}
+
+
+/*======================================================================
+ * SOFT CLOCK TIME
+ ======================================================================*/
+int64_t soft_clock_time(const soft_clock_t *clock, uint64_t timer_us){
+    int64_t elapsed, slewed;
+
+    if (!clock->anchored){
+        return 0;
+    }
+    elapsed=(int64_t)(timer_us-clock->base_timer);
+    slewed=(elapsed<0)?0:((elapsed>SOFT_CLOCK_SLEW_SPAN_US)?SOFT_CLOCK_SLEW_SPAN_US:elapsed);
+    return clock->base_us+elapsed+elapsed*clock->rate_ppb/1000000000+slewed*clock->slew_ppb/1000000000;
+}
+
+
+/*======================================================================
+ * SOFT CLOCK STEP
+ ======================================================================*/
+void soft_clock_step(soft_clock_t *clock, uint64_t timer_us, int64_t epoch_us){
+    clock->base_timer=timer_us;
+    clock->base_us=epoch_us;
+    clock->slew_ppb=0;
+    clock->anchored=true;
+    clock->rate_started=false; //the DS3231 times before and after aren't comparable
+    clock->error_us=0;
+    clock->steps++;
+}
+
+
+/*======================================================================
+ * SOFT CLOCK ANCHOR
+ *
+ * RATE comes only from anchors at SQW edges (microseconds of jitter),
+ * the error of every anchor is slewed from the time the clock gives.
+ ======================================================================*/
+uint8_t soft_clock_anchor(soft_clock_t *clock, uint64_t timer_us, int64_t rtc_us, bool at_edge){
+    int64_t predicted=soft_clock_time(clock,timer_us);
+    int64_t error=rtc_us-predicted;
+    int64_t span, measured;
+    uint8_t result=SOFT_CLOCK_STEPPED;
+
+    clock->at_edge=at_edge;
+    if (!clock->anchored){
+        soft_clock_step(clock,timer_us,rtc_us);
+    }
+    else if (!at_edge){
+        //the DS3231 second rtc_us started up to 1 s before the read
+        if (predicted>=rtc_us && predicted<rtc_us+US_PER_SECOND){
+            clock->anchors++;
+            return SOFT_CLOCK_KEPT;
+        }
+        soft_clock_step(clock,timer_us,rtc_us);
+    }
+    else if (error>SOFT_CLOCK_STEP_US || error<-SOFT_CLOCK_STEP_US){
+        soft_clock_step(clock,timer_us,rtc_us);
+    }
+    else{
+        //new segment from the time of the clock (continuous), the error is slewed
+        clock->base_timer=timer_us;
+        clock->base_us=predicted;
+        clock->slew_ppb=(int32_t)clamp(error*1000000000/SOFT_CLOCK_SLEW_SPAN_US,SOFT_CLOCK_SLEW_PPB);
+        clock->error_us=(int32_t)error;
+        result=SOFT_CLOCK_SLEWED;
+    }
+    clock->anchors++;
+
+    //RATE: microseconds of the DS3231 against microseconds of the timer between two edges
+    if (!at_edge){
+        return result;
+    }
+    if (!clock->rate_started){
+        clock->rate_timer=timer_us;
+        clock->rate_us=rtc_us;
+        clock->rate_started=true;
+    }
+    else{
+        span=(int64_t)(timer_us-clock->rate_timer);
+        if (span>=SOFT_CLOCK_RATE_SPAN_US){
+            measured=((rtc_us-clock->rate_us)-span)*1000000000/span;
+            if (measured<=SOFT_CLOCK_MAX_RATE_PPB && measured>=-SOFT_CLOCK_MAX_RATE_PPB){
+                clock->rate_ppb=clock->rate_known?(int32_t)(clock->rate_ppb+(measured-clock->rate_ppb)/SOFT_CLOCK_RATE_FILTER):(int32_t)measured;
+                clock->rate_known=true;
+            }
+            clock->rate_timer=timer_us;
+            clock->rate_us=rtc_us;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,77 @@
+#ifndef _SOFT_CLOCK_H_
+#define _SOFT_CLOCK_H_
+
+/*
+Software clock of the station: UTC (epoch_us) of any sample timer value without I2C
+
+The DS3231 is only read to anchor the clock (sntp_config.c, every TIME_SERVICE_ANCHOR_S):
+the time of the second read (RTC) and the sample timer value of its SQW edge (TIMER). Between
+anchors the clock is extended with the sample timer, a 64 bit counter of APB microseconds
+(timer_conf.h) with the drift of its crystal against the DS3231 (RATE) removed:
+
+    D     = TIMER - BASE_TIMER                        (unsigned difference, it wraps)
+    time  = BASE_US + D + D*RATE/10^9 + min(D, SOFT_CLOCK_SLEW_SPAN_US)*SLEW/10^9
+
+RATE is measured between two anchors at SQW edges at least SOFT_CLOCK_RATE_SPAN_US apart.
+A new anchor starts a new segment at the time the clock gives there (BASE_US = time(TIMER),
+so the clock never jumps) and its error (RTC - time) is removed with SLEW during the next
+SOFT_CLOCK_SLEW_SPAN_US (at most SOFT_CLOCK_SLEW_PPB). Errors bigger than SOFT_CLOCK_STEP_US
+(first anchor, the DS3231 was set by SNTP or by hand) are a step: the clock jumps to RTC.
+
+Without SQW edges the anchor is the time of the read (the second started up to 1 s before):
+the clock only moves if it isn't inside that second.
+
+Timer values before BASE_TIMER (the first sample of a packet that started before the last
+anchor) only use RATE. The clock is monotonic between steps (time grows with TIMER).
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SOFT_CLOCK_STEP_US 10000            //bigger anchor errors are a step
+#define SOFT_CLOCK_SLEW_SPAN_US 30000000LL  //an anchor error is removed in this time
+#define SOFT_CLOCK_SLEW_PPB 500000          //maximum SLEW (500 ppm, 15 ms in SLEW_SPAN)
+#define SOFT_CLOCK_RATE_SPAN_US 16000000LL  //minimum time between the anchors of a RATE measurement
+#define SOFT_CLOCK_RATE_FILTER 4            //weight of every new RATE measurement (1/4)
+#define SOFT_CLOCK_MAX_RATE_PPB 1000000     //RATE limit (1000 ppm), a bigger one is a wrong anchor
+
+//Results of soft_clock_anchor
+#define SOFT_CLOCK_KEPT 0    //the clock agrees with a read without SQW edge
+#define SOFT_CLOCK_SLEWED 1  //new segment, the error is slewed
+#define SOFT_CLOCK_STEPPED 2 //the clock jumped to the DS3231
+
+typedef struct {
+    uint64_t base_timer;     //sample timer at the start of the segment
+    int64_t base_us;         //time at base_timer (epoch_us)
+    int32_t rate_ppb;        //drift of the timer, + = the timer is slow (it counts less than 1 us per us)
+    int32_t slew_ppb;        //SLEW of the segment
+    bool anchored;           //false until the first anchor
+
+    uint64_t rate_timer;     //last anchor at an SQW edge (start of the next RATE measurement)
+    int64_t rate_us;
+    bool rate_started;
+    bool rate_known;         //RATE was measured
+
+    bool at_edge;            //the last anchor was at an SQW edge
+    int32_t error_us;        //RTC - time of the last anchor (0 after a step)
+    uint32_t anchors;        //anchors used
+    uint32_t steps;          //steps (anchors included)
+} soft_clock_t;
+
+
+/*Clock without anchor, RATE = 0*/
+void soft_clock_init(soft_clock_t *clock);
+
+/*Time of a sample timer value (epoch_us), 0 if the clock was never anchored*/
+int64_t soft_clock_time(const soft_clock_t *clock, uint64_t timer_us);
+
+/*The DS3231 second rtc_us started at timer_us (at_edge = timer_us is its SQW edge, else it is
+the time of the read). Returns SOFT_CLOCK_KEPT, SOFT_CLOCK_SLEWED or SOFT_CLOCK_STEPPED*/
+uint8_t soft_clock_anchor(soft_clock_t *clock, uint64_t timer_us, int64_t rtc_us, bool at_edge);
+
+/*The time at timer_us is epoch_us (the DS3231 was set): the clock jumps, RATE is kept*/
+void soft_clock_step(soft_clock_t *clock, uint64_t timer_us, int64_t epoch_us);
+
+#endif
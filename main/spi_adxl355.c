@@ -57,6 +57,12 @@ void adxl355_config_spi(void){
 
 /*Configurates the accelerometer's sample rate*/
 void adxl355_100hz_rate(void){
+    adxl355_set_rate(ODR_125_HZ); //Frecuencia de muestreo de 100 Hz (125 Hz en el sensor)
+    printf("ADXL355: Frecuencia de muestreo 100 Hz \n");
+}
+
+/*Configurates the accelerometer's sample rate and low pass filter*/
+void adxl355_set_rate(uint8_t odr_lpf){
     //error variable
     esp_err_t ret;
     
@@ -94,17 +100,15 @@ void adxl355_100hz_rate(void){
     */
 
     memset(&transaccion, 0, sizeof(transaccion));       //Se limpia con 0 la variable para evitar errores
-    datos_enviar=0x05; //Frecuencia de muestreo de 100 Hz
+    datos_enviar=odr_lpf; //Frecuencia de muestreo (ODR_xxx_HZ)
 
-    //se escribe el dato 1 en la direccion 0x28, el registro de filtros
+    //se escribe el dato en la direccion 0x28, el registro de filtros
     transaccion.length=8;      //total de datos 8 bits.
     transaccion.tx_buffer=&datos_enviar;   //Puntero de datos a enviar
-    transaccion.addr=(0x28<<1)|WRITE_FLAG_ADXL355; //Registro para activar el modo medicion
+    transaccion.addr=ADXL355_REG_FILTER|WRITE_FLAG_ADXL355; //Registro de filtros
 
     ret=spi_device_transmit(adxl355_handler, &transaccion);  //Transmite los datos
     assert(ret==ESP_OK);            //Should have had no issues.
-    printf("ADXL355: Frecuencia de muestreo 100 Hz \n");
-
 }
 
 
@@ -148,6 +152,28 @@ void adxl355_range_conf(void){
     printf("ADXL355: Rango +- 2G y sensor en modo medicion \n");
 }
 
+/*Changes the sample rate, the FILTER register must be written in standby mode*/
+void adxl355_change_rate(uint8_t odr_lpf){
+    esp_err_t ret;
+    spi_transaction_t transaccion;
+    uint8_t datos_enviar=POWER_CTL_STANDBY|POWER_CTL_TEMP_OFF;
+
+    //se pasa a modo standby
+    memset(&transaccion, 0, sizeof(transaccion));
+    transaccion.length=8;
+    transaccion.tx_buffer=&datos_enviar;
+    transaccion.addr=ADXL355_REG_POWER_CTL|WRITE_FLAG_ADXL355;
+
+    ret=spi_device_transmit(adxl355_handler, &transaccion);
+    assert(ret==ESP_OK);
+
+    adxl355_set_rate(odr_lpf);
+
+    //rango +-2G y modo medicion otra vez
+    adxl355_range_conf();
+}
+
+
 /*Read acceleration values, parameters: pointer of buffer where data will be saved*/
 void adxl355_read_accl(uint8_t * data_received, uint8_t size_buffer){
     esp_err_t ret;
@@ -170,3 +196,82 @@ void adxl355_read_accl(uint8_t * data_received, uint8_t size_buffer){
     ret=spi_device_transmit(adxl355_handler, &transaccion);  //Transmitir
     assert(ret==ESP_OK);     //Should have had no issues.
 }
+
+
+/*Same as adxl355_read_accl but the CPU waits for the end of the transaction (polling),
+it avoids the interrupt and the context switch of spi_device_transmit*/
+void adxl355_read_accl_polling(uint8_t * data_received, uint8_t size_buffer){
+    esp_err_t ret;
+    spi_transaction_t transaccion;
+
+    memset(&transaccion, 0, sizeof(transaccion));
+    transaccion.length=8*size_buffer;
+    transaccion.rx_buffer= data_received;
+    transaccion.addr=XDATA3|READ_FLAG_ADXL355;
+
+    ret=spi_device_polling_transmit(adxl355_handler, &transaccion);
+    assert(ret==ESP_OK);
+}
+
+
+/*Configurates the FIFO watermark and maps the watermark interrupt to INT1*/
+void adxl355_fifo_config(uint8_t watermark_entries){
+    esp_err_t ret;
+
+    //se declara la variable de transaccion
+    spi_transaction_t transaccion;
+
+    /*Registers 0x29 (FIFO_SAMPLES) and 0x2A (INT_MAP) are consecutive, so both
+    are written in the same transaction*/
+    uint8_t datos_enviar[2];
+    datos_enviar[0]=watermark_entries; //1 entry = 1 axis, maximum 96 entries
+    datos_enviar[1]=INT_MAP_FIFO_FULL_EN1; //INT1 goes low when the watermark is reached
+
+    memset(&transaccion, 0, sizeof(transaccion));
+    transaccion.length=8*sizeof(datos_enviar);
+    transaccion.tx_buffer=&datos_enviar;
+    transaccion.addr=ADXL355_REG_FIFO_SAMPLES|WRITE_FLAG_ADXL355;
+
+    ret=spi_device_transmit(adxl355_handler, &transaccion);
+    assert(ret==ESP_OK);
+
+    printf("ADXL355: FIFO watermark %d entries \n",watermark_entries);
+}
+
+
+/*Returns the number of entries (axis values) stored in the FIFO*/
+uint8_t adxl355_fifo_entries(void){
+    esp_err_t ret;
+    spi_transaction_t transaccion;
+    uint8_t entries=0;
+
+    memset(&transaccion, 0, sizeof(transaccion));
+    transaccion.length=8;
+    transaccion.rx_buffer=&entries;
+    transaccion.addr=ADXL355_REG_FIFO_ENTRIES|READ_FLAG_ADXL355;
+
+    ret=spi_device_transmit(adxl355_handler, &transaccion);
+    assert(ret==ESP_OK);
+
+    return entries & 0x7F;
+}
+
+
+/*Burst read of FIFO entries, FIFO_DATA address doesn't increment so all the
+entries are read in the same transaction (SPI bus uses DMA, see spi_config.c)*/
+void adxl355_read_fifo(uint8_t * raw_entries, uint16_t entries){
+    esp_err_t ret;
+    spi_transaction_t transaccion;
+
+    if (entries==0){
+        return;
+    }
+
+    memset(&transaccion, 0, sizeof(transaccion));
+    transaccion.length=8*3*entries;  //3 bytes per entry
+    transaccion.rx_buffer=raw_entries;
+    transaccion.addr=ADXL355_REG_FIFO_DATA|READ_FLAG_ADXL355;
+
+    ret=spi_device_transmit(adxl355_handler, &transaccion);
+    assert(ret==ESP_OK);
+}
@@ -7,9 +7,49 @@ void adxl355_100hz_rate(void);
 /*Configurates and turns on the accelerometer (+-2G range)*/
 void adxl355_range_conf(void);
 
+/*Configurates the accelerometer's sample rate and low pass filter (value of the FILTER register, ODR_xxx_HZ)*/
+void adxl355_set_rate(uint8_t odr_lpf);
+
+/*Changes the sample rate while the accelerometer is measuring (standby, FILTER register, measurement mode)*/
+void adxl355_change_rate(uint8_t odr_lpf);
+
 /*Read acceleration values*/
 void adxl355_read_accl(uint8_t * data_received, uint8_t size_buffer);
 
+/*Read acceleration values with a polling transaction (no interrupts, for acquisition_task)*/
+void adxl355_read_accl_polling(uint8_t * data_received, uint8_t size_buffer);
+
+/*Configurates the FIFO watermark (in entries, 1 entry = 1 axis) and maps the watermark interrupt to INT1*/
+void adxl355_fifo_config(uint8_t watermark_entries);
+
+/*Returns the number of entries (axis values) stored in the FIFO*/
+uint8_t adxl355_fifo_entries(void);
+
+/*Burst read of "entries" FIFO entries (3 bytes each) in one SPI transaction*/
+void adxl355_read_fifo(uint8_t * raw_entries, uint16_t entries);
+
+
+/*
+Acquisition modes
+
+ADXL355_MODE_TIMER: one 9 byte SPI transaction every timer tick (TIMER_ISR).
+ADXL355_MODE_FIFO:  the accelerometer samples with its own clock and stores the
+                    samples in the internal FIFO, when ADXL355_FIFO_WATERMARK entries
+                    are stored INT1 goes low and the whole FIFO is read in one burst.
+                    The ODR of the sensor must be equal to the sample rate (250, 500 or
+                    1000 Hz in sample_rate.c).
+*/
+#define ADXL355_MODE_TIMER 0
+#define ADXL355_MODE_FIFO  1
+
+#define ADXL355_ACQUISITION_MODE ADXL355_MODE_TIMER
+
+//Watermark in entries (multiple of 3), 60 entries = 20 samples = 80, 40 or 20 ms at 250, 500 or 1000 Hz (FIFO rates)
+#define ADXL355_FIFO_WATERMARK 60
+
+//INT1 pin of the accelerometer (watermark interrupt, active low)
+#define ADXL355_PIN_INT1 34
+
 
 #define READ_FLAG_ADXL355 0x01
 #define WRITE_FLAG_ADXL355 0x00
@@ -24,6 +64,27 @@ void adxl355_read_accl(uint8_t * data_received, uint8_t size_buffer);
 #define YDATA3  (0x0B << 1)
 #define XDATA3  (0x08 << 1)
 
+#define ADXL355_REG_FIFO_ENTRIES (0x05 << 1) //Number of valid entries in the FIFO (7 bits)
+#define ADXL355_REG_FIFO_DATA    (0x11 << 1) //FIFO output, the address doesn't increment during burst reads
+#define ADXL355_REG_FILTER       (0x28 << 1) //ODR and low pass filter
+#define ADXL355_REG_FIFO_SAMPLES (0x29 << 1) //FIFO watermark in entries (1 to 96)
+#define ADXL355_REG_INT_MAP      (0x2A << 1) //Interrupt pins configuration
+#define ADXL355_REG_POWER_CTL    (0x2D << 1) //Standby and temperature sensor
+
+    #define POWER_CTL_STANDBY (1<<0) //1 = standby (FILTER can be written), 0 = measurement
+    #define POWER_CTL_TEMP_OFF (1<<1) //temperature sensor disabled
+
+    #define INT_MAP_FIFO_FULL_EN1 (1<<1) //Watermark (FIFO_FULL) interrupt on INT1
+
+//ODR values (FILTER register), low pass filter corner = ODR/4
+#define ODR_4000_HZ   0x00
+#define ODR_2000_HZ   0x01
+#define ODR_1000_HZ   0x02
+#define ODR_500_HZ    0x03
+#define ODR_250_HZ    0x04
+#define ODR_125_HZ    0x05
+#define ODR_62_5_HZ   0x06
+
 /*
  This code tries to read ADXL355 accelerometer 
  */
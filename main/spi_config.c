@@ -17,17 +17,17 @@ void spi_bus_set_config(void){
         .sclk_io_num = PIN_NUM_CLK,
         .quadwp_io_num = -1,  //-1 means not used
         .quadhd_io_num = -1,  // not used
-        .max_transfer_sz = 32, //maximum 4094 minimum 0 in bytes
+        .max_transfer_sz = SPI_MAX_TRANSFER_SIZE, //maximum 4094 minimum 0 in bytes
     };
 
     /*
       Initialize the SPI bus
       se selecciona el bus SPI a utilizar, 
       se caga la configuracion del bus SPI, 
-      dma_chan es un tipo de comunicacion derivada del SPI, en caso de necesitarse
-      este valor es igual a 0 
+      dma_chan es un tipo de comunicacion derivada del SPI, en caso de no necesitarse
+      este valor es igual a 0 (se usa para leer la FIFO del ADXL355)
     */ 
-    ret = spi_bus_initialize(SPI3_HOST, &buscfg, 0);
+    ret = spi_bus_initialize(SPI3_HOST, &buscfg, SPI_DMA_CHANNEL);
     ESP_ERROR_CHECK(ret);
     printf("SPI_BUS_CONFIG: Se inicializo correctamente el bus\n");
 
@@ -22,5 +22,18 @@ Si el pin CS esta en 0 se activa el dispositivo esclavo
 #define PIN_NUM_MOSI 23
 #define PIN_NUM_CLK  18
 
+/*DMA lets us read the whole ADXL355 FIFO (96 entries * 3 bytes) in one transaction,
+without DMA the maximum transaction size is 64 bytes. DMA is only used in FIFO mode,
+small reads with DMA need an aligned (or temporary) buffer per transaction*/
+#include "spi_adxl355.h"
+
+#if ADXL355_ACQUISITION_MODE==ADXL355_MODE_FIFO
+    #define SPI_DMA_CHANNEL 1
+    #define SPI_MAX_TRANSFER_SIZE 512 //in bytes
+#else
+    #define SPI_DMA_CHANNEL 0
+    #define SPI_MAX_TRANSFER_SIZE 64 //in bytes
+#endif
+
 /*set SPI bus general configurations*/
 void spi_bus_set_config(void);
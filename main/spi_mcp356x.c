@@ -102,7 +102,7 @@ void mcp356x_reg_config(void){
 
     //-=-=-=-=-=-=-=-=-=[ Cambia al modo conversion continuo (CONFIG3=0x4)]-=-=-=-=-=-=-=-=-=-=-=-=    
     printf("CONFIG3: Modo conversion continuo\n");
-    data_to_send[3]=CONV_MODE_CONTINUOUS|FORMAT_24_BIT|CRC_DISABLED|OFFCAL_DISABLED|GAINCAL_DISABLED;
+    data_to_send[3]=CONV_MODE_CONTINUOUS|MCP356X_DATA_FORMAT|CRC_DISABLED|OFFCAL_DISABLED|GAINCAL_DISABLED;
 
     //-=-=-=-=-=-=-=-=-=[ Modificacion de las interrupciones (IRQ REGISTER0x5)]-=-=-=-=-=-=-=-=-=-=-=-=    
     printf("IRQ Register: Modificacion de las interrupciones\n");
@@ -113,10 +113,10 @@ void mcp356x_reg_config(void){
     data_to_send[5]=0B00000001;
 
     //-=-=-=-=-=-=-=-=-=[ Configuracion del modo SCAN o continuo (SCAN) 24 bits]-=-=-=-=-=-=-=-=-=-=-=-=    
-    printf("SCAN: Modo continuo, diferente entre canal 1 y 0\n");
+    printf("SCAN: Modo continuo, %d canales diferenciales\n",MCP356X_SCAN_CHANNELS);
     data_to_send[6]=SCAN_DLY_0_DMCLK; //MSB
     
-    data_to_send[7]=SCAN_DIF_CH0_CH1; //middle 
+    data_to_send[7]=MCP356X_SCAN_SELECTION; //middle (differential channels)
     
     data_to_send[8]=0; //for single channel scan mode (LSB)
     
@@ -162,4 +162,66 @@ void mcp356x_read_adc(uint8_t * data_received, uint8_t size_buffer){
 
     ret=spi_device_transmit(mcp356x_handler, &transaccion);  //Transmitir
     assert(ret==ESP_OK);            //Should have had no issues.
-}
\ No newline at end of file
+}
+
+
+/*Same as mcp356x_read_adc but the CPU waits for the end of the transaction (polling),
+it avoids the interrupt and the context switch of spi_device_transmit*/
+void mcp356x_read_adc_polling(uint8_t * data_received, uint8_t size_buffer){
+    esp_err_t ret;
+    spi_transaction_t transaccion;
+
+    memset(&transaccion, 0, sizeof(transaccion));
+    transaccion.length=8*size_buffer;
+    transaccion.rx_buffer= data_received;
+    transaccion.addr=DEVICE_ADDRESS|ADCDATA|FLAG_INCREMENTAL_READ;
+
+    ret=spi_device_polling_transmit(mcp356x_handler, &transaccion);
+    assert(ret==ESP_OK);
+}
+
+
+/*Writes the TIMER register (0x8): delay between two SCAN cycles in DMCLK periods (24 bits)*/
+void mcp356x_set_scan_timer(uint32_t dmclk_periods){
+    esp_err_t ret;
+
+    //se declara la variable de transaccion
+    spi_transaction_t transaccion;
+
+    //TIMER register, 24 bits (MSB first)
+    uint8_t data_to_send[3];
+    data_to_send[0]=(dmclk_periods>>16)&0xFF;
+    data_to_send[1]=(dmclk_periods>>8)&0xFF;
+    data_to_send[2]=dmclk_periods&0xFF;
+
+    memset(&transaccion, 0, sizeof(transaccion)); 
+    transaccion.length=8*sizeof(data_to_send);
+    transaccion.tx_buffer=&data_to_send;
+    transaccion.addr=DEVICE_ADDRESS|TIMER|FLAG_INCREMENTAL_WRITE; 
+
+    ret=spi_device_transmit(mcp356x_handler, &transaccion); 
+    assert(ret==ESP_OK);
+
+    printf("MCP356X: SCAN TIMER = %d DMCLK periods\n",dmclk_periods);
+}
+
+
+/*Writes the CONFIG1 register (prescaler and OSR), the ADC restarts the conversion*/
+void mcp356x_set_rate(uint8_t config1){
+    esp_err_t ret;
+
+    //se declara la variable de transaccion
+    spi_transaction_t transaccion;
+
+    uint8_t data_to_send=config1;
+
+    memset(&transaccion, 0, sizeof(transaccion)); 
+    transaccion.length=8;
+    transaccion.tx_buffer=&data_to_send;
+    transaccion.addr=DEVICE_ADDRESS|CONFIG1|FLAG_INCREMENTAL_WRITE; 
+
+    ret=spi_device_transmit(mcp356x_handler, &transaccion); 
+    assert(ret==ESP_OK);
+
+    printf("MCP356X: CONFIG1 = 0x%02X\n",config1);
+}
@@ -1,5 +1,72 @@
+#ifndef _SPI_MCP356X_H_
+#define _SPI_MCP356X_H_
+
+#include <stdint.h>
+
 #define CS_ADC_MCP356X   5
 
+//IRQ pin of the ADC (data ready, inactive state high, see IRQ register)
+#define MCP356X_PIN_IRQ  35
+
+/*
+Acquisition modes
+
+MCP356X_MODE_TIMER: ADCDATA is read every timer tick (TIMER_ISR), the ADC converts 
+                    with its own clock (~139 Hz) so samples are duplicated or skipped.
+MCP356X_MODE_DRDY:  the IRQ pin (data ready) wakes up the task, every conversion
+                    is read once. The GPIO ISR latches the sample timer, so each sample
+                    carries its timestamp (mcp356x_drdy.h). The SCAN TIMER register 
+                    adds a delay between conversions to get ~sample rate (sample_rate.c).
+*/
+#define MCP356X_MODE_TIMER 0
+#define MCP356X_MODE_DRDY  1
+
+#define MCP356X_ACQUISITION_MODE MCP356X_MODE_TIMER
+
+/*
+Channels converted in SCAN mode
+
+1: SM-24 geophone in CH0-CH1 (MCP3561), 24 bit data format.
+3: three-component SM-24 set in CH0-CH1 (Z), CH2-CH3 (N) and CH4-CH5 (E) (MCP3564),
+   32 bit data format with channel ID, every read is demultiplexed by its channel ID
+   (mcp356x_scan.h). Only with MCP356X_MODE_DRDY, in TIMER mode ADCDATA would only 
+   give the last converted channel every tick.
+*/
+#define MCP356X_SCAN_CHANNELS 1
+
+#if MCP356X_SCAN_CHANNELS==1
+    #define MCP356X_SCAN_SELECTION SCAN_DIF_CH0_CH1
+    #define MCP356X_DATA_FORMAT FORMAT_24_BIT
+    #define MCP356X_BYTES_PER_READ 3
+#elif MCP356X_SCAN_CHANNELS==3
+    #if MCP356X_ACQUISITION_MODE!=MCP356X_MODE_DRDY
+        #error "MCP356X: 3 SCAN channels need MCP356X_MODE_DRDY"
+    #endif
+    #define MCP356X_SCAN_SELECTION (SCAN_DIF_CH0_CH1|SCAN_DIF_CH2_CH3|SCAN_DIF_CH4_CH5)
+    #define MCP356X_DATA_FORMAT FORMAT_32_RIGHT_PLUS_ID
+    #define MCP356X_BYTES_PER_READ 4
+#else
+    #error "MCP356X_SCAN_CHANNELS must be 1 or 3"
+#endif
+
+/*Conversion rate in SCAN mode (approximated, internal clock)
+
+    DMCLK = MCLK/(4*PRESCALER) = 4.56 MHz/(4*8) = 142.5 KHz
+
+    One conversion (OSR + sinc3 settling) = OSR + 64 DMCLK periods (7.6 ms with OSR_1024)
+    One SCAN cycle = (MCP356X_SCAN_CHANNELS*conversion + TIMER) DMCLK periods 
+
+    The OSR of every sample rate and the TIMER value are in sample_rate.c
+*/
+#define MCP356X_MCLK_HZ 4560000 //internal clock measured
+#define MCP356X_DMCLK_HZ (MCP356X_MCLK_HZ/(4*8)) //PRESCALER_8
+
+/*Sample stored in the ADC ring (24 bit data of every channel and timestamp of the conversion)*/
+typedef struct {
+    uint64_t timestamp; //sample timer value in microseconds (timer_conf.h)
+    uint8_t data[3*MCP356X_SCAN_CHANNELS]; //MSB, middle, LSB of every channel
+} mcp356x_sample_t;
+
 
 //SPI configuration for the 24 bit ADC 
 void mcp356x_reg_config(void);
@@ -10,6 +77,15 @@ void mcp356x_config_spi(void);
 //Read ADC value of the mcp3561
 void mcp356x_read_adc(uint8_t * data_received, uint8_t size_buffer);
 
+//Read ADC value of the mcp3561 with a polling transaction (no interrupts, for acquisition_task)
+void mcp356x_read_adc_polling(uint8_t * data_received, uint8_t size_buffer);
+
+//Writes the CONFIG1 register (PRESCALER_xxx_MCLK|OSR_xxx), changes the conversion rate
+void mcp356x_set_rate(uint8_t config1);
+
+//Writes the TIMER register: delay between SCAN cycles in DMCLK periods (24 bits)
+void mcp356x_set_scan_timer(uint32_t dmclk_periods);
+
 
 //=========== [ COMMANDS DESCRIPTION ] =============
 /*
@@ -591,3 +667,4 @@ register is fully read, the CRCCFG_STATUS bit is reset to ‘1’.
     /*Disable conversion start interrupt output*/
     #define STP_DISABLE (0B0<<EN_STP)
 
+#endif
@@ -0,0 +1,221 @@
+#include <string.h>
+
+#include "steim.h"
+
+
+/*Ways to pack differences in one data word, densest first*/
+typedef struct {
+    uint8_t count; //differences per word
+    uint8_t bits; //bits per difference
+    uint8_t code; //nibble code
+    uint8_t dnib; //Steim-2 dnib (0xFF = no dnib)
+} steim_option_t;
+
+static const steim_option_t steim1_options[] = {
+    {4, 8, 1, 0xFF},
+    {2, 16, 2, 0xFF},
+    {1, 32, 3, 0xFF},
+};
+
+static const steim_option_t steim2_options[] = {
+    {7, 4, 3, 2},
+    {6, 5, 3, 1},
+    {5, 6, 3, 0},
+    {4, 8, 1, 0xFF},
+    {3, 10, 2, 3},
+    {2, 15, 2, 2},
+    {1, 30, 2, 1},
+};
+
+
+static void set_word(uint8_t *frames, uint32_t word, uint32_t value){
+    frames[4*word]=(uint8_t)(value>>24);
+    frames[4*word+1]=(uint8_t)(value>>16);
+    frames[4*word+2]=(uint8_t)(value>>8);
+    frames[4*word+3]=(uint8_t)value;
+}
+
+static uint32_t get_word(const uint8_t *frames, uint32_t word){
+    return ((uint32_t)frames[4*word]<<24)|((uint32_t)frames[4*word+1]<<16)|((uint32_t)frames[4*word+2]<<8)|frames[4*word+3];
+}
+
+static int fits(int64_t value, uint8_t bits){
+    if (bits==32){
+        return 1; //Steim-1, the decoder adds modulo 2^32
+    }
+    return value>=-((int64_t)1<<(bits-1)) && value<((int64_t)1<<(bits-1));
+}
+
+
+/*======================================================================
+ * STEIM ENCODE
+ *
+ * Greedy: every data word takes the option with more differences that
+ * fits the next differences (or the ones that are left).
+ ======================================================================*/
+uint16_t steim_encode(uint8_t level, const int32_t *samples, uint16_t count, int32_t previous, uint8_t *frames, uint16_t max_frames){
+    const steim_option_t *options;
+    uint8_t total_options;
+    int64_t differences[7];
+    uint16_t frame=0;
+    uint8_t word=3; //words 1 and 2 of frame 0 are X0 and XN
+    uint32_t nibbles=0;
+    uint32_t value;
+    uint16_t each_sample=0;
+    uint8_t available, option, k;
+
+    if (level==STEIM_1){
+        options=steim1_options;
+        total_options=sizeof(steim1_options)/sizeof(steim1_options[0]);
+    }
+    else if (level==STEIM_2){
+        options=steim2_options;
+        total_options=sizeof(steim2_options)/sizeof(steim2_options[0]);
+    }
+    else{
+        return 0;
+    }
+    if (max_frames==0 || count==0){
+        return 0;
+    }
+
+    memset(frames,0,STEIM_FRAME_BYTES);
+    set_word(frames,1,(uint32_t)samples[0]);
+    set_word(frames,2,(uint32_t)samples[count-1]);
+
+    while(each_sample<count){
+        if (word==STEIM_FRAME_WORDS){
+            set_word(&frames[frame*STEIM_FRAME_BYTES],0,nibbles);
+            frame++;
+            if (frame==max_frames){
+                return 0;
+            }
+            memset(&frames[frame*STEIM_FRAME_BYTES],0,STEIM_FRAME_BYTES);
+            word=1;
+            nibbles=0;
+        }
+
+        //next differences (up to 7)
+        available=(count-each_sample<7)?(count-each_sample):7;
+        for(k=0;k<available;k++){
+            differences[k]=(int64_t)samples[each_sample+k]-(each_sample+k==0?previous:samples[each_sample+k-1]);
+        }
+
+        for(option=0;option<total_options;option++){
+            if (options[option].count>available){
+                continue;
+            }
+            for(k=0;k<options[option].count && fits(differences[k],options[option].bits);k++);
+            if (k==options[option].count){
+                break;
+            }
+        }
+        if (option==total_options){
+            return 0; //Steim-2: difference bigger than 30 bits
+        }
+
+        value=0;
+        for(k=0;k<options[option].count;k++){
+            if (options[option].bits==32){
+                value=(uint32_t)differences[k];
+            }
+            else{
+                value=(value<<options[option].bits)|((uint32_t)differences[k]&(0xFFFFFFFFu>>(32-options[option].bits)));
+            }
+        }
+        if (options[option].dnib!=0xFF){
+            value|=(uint32_t)options[option].dnib<<30;
+        }
+        set_word(&frames[frame*STEIM_FRAME_BYTES],word,value);
+        nibbles|=(uint32_t)options[option].code<<(30-2*word);
+
+        word++;
+        each_sample+=options[option].count;
+    }
+    set_word(&frames[frame*STEIM_FRAME_BYTES],0,nibbles);
+    return frame+1;
+}
+
+
+/*======================================================================
+ * STEIM DECODE
+ ======================================================================*/
+static int32_t sign_extend(uint32_t value, uint8_t bits){
+    if (bits==32){
+        return (int32_t)value;
+    }
+    value&=0xFFFFFFFFu>>(32-bits);
+    if (value & (1u<<(bits-1))){
+        return (int32_t)(value|(0xFFFFFFFFu<<bits));
+    }
+    return (int32_t)value;
+}
+
+int32_t steim_decode(uint8_t level, const uint8_t *frames, uint16_t frame_count, uint16_t count, int32_t *samples){
+    const uint8_t *frame_data;
+    uint32_t nibbles, value;
+    uint8_t code, dnib, number, bits, first_word;
+    int32_t x0, xn;
+    uint32_t each_sample=0;
+
+    if (level!=STEIM_1 && level!=STEIM_2){
+        return STEIM_ERROR_LEVEL;
+    }
+    if (frame_count==0 || count==0){
+        return STEIM_ERROR_SHORT;
+    }
+    x0=(int32_t)get_word(frames,1);
+    xn=(int32_t)get_word(frames,2);
+
+    for(uint16_t frame=0;frame<frame_count && each_sample<count;frame++){
+        frame_data=&frames[frame*STEIM_FRAME_BYTES];
+        nibbles=get_word(frame_data,0);
+        first_word=(frame==0)?3:1;
+
+        for(uint8_t word=first_word;word<STEIM_FRAME_WORDS && each_sample<count;word++){
+            code=(nibbles>>(30-2*word))&0x3;
+            value=get_word(frame_data,word);
+            dnib=value>>30;
+
+            if (code==0){
+                continue;
+            }
+            else if (code==1){
+                number=4; bits=8;
+            }
+            else if (level==STEIM_1){
+                number=(code==2)?2:1;
+                bits=(code==2)?16:32;
+            }
+            else if (code==2){
+                if (dnib==0) return STEIM_ERROR_CODE;
+                number=dnib; //1 x 30, 2 x 15, 3 x 10
+                bits=30/dnib;
+            }
+            else{
+                if (dnib==3) return STEIM_ERROR_CODE;
+                number=5+dnib; //5 x 6, 6 x 5, 7 x 4
+                bits=(dnib==0)?6:(dnib==1)?5:4;
+            }
+
+            for(uint8_t k=0;k<number && each_sample<count;k++){
+                int32_t difference=sign_extend(value>>(bits*(number-1-k)),bits);
+                if (each_sample==0){
+                    samples[0]=x0;
+                }
+                else{
+                    samples[each_sample]=(int32_t)((uint32_t)samples[each_sample-1]+(uint32_t)difference);
+                }
+                each_sample++;
+            }
+        }
+    }
+
+    if (each_sample<count){
+        return STEIM_ERROR_SHORT;
+    }
+    if (samples[count-1]!=xn){
+        return STEIM_ERROR_XN;
+    }
+    return count;
+}
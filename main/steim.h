@@ -0,0 +1,58 @@
+#ifndef _STEIM_H_
+#define _STEIM_H_
+
+/*
+Steim-1 and Steim-2 compression (SEED difference encoding)
+
+The samples are stored as differences (sample - previous sample) packed in 32 bit
+words, as many differences per word as their size allows. Words are grouped in frames
+of 64 bytes (16 words), all values big endian:
+
+FRAME:     |  word 0  |  word 1  |  word 2  |  word 3  | ... |  word 15  |
+frame 0:     nibbles       X0         XN        data     ...     data
+frame 1..:   nibbles      data       data       data     ...     data
+
+    nibbles: 2 bit code per word (word 0 in bits 31-30), 00 = no data
+    X0:      first sample (forward integration constant)
+    XN:      last sample (reverse integration constant, checked by the decoder)
+
+Codes of the data words:
+
+ code | Steim-1          | Steim-2 (dnib = bits 31-30 of the word)
+ 01   | 4 x 8 bit        | 4 x 8 bit
+ 10   | 2 x 16 bit       | dnib 01: 1 x 30 bit, 10: 2 x 15 bit, 11: 3 x 10 bit
+ 11   | 1 x 32 bit       | dnib 00: 5 x 6 bit,  01: 6 x 5 bit,  10: 7 x 4 bit (bits 27-0)
+
+The first difference is (first sample - "previous"), the sample before the block (the
+last sample of the previous record in a continuous stream). The decoder doesn't use it,
+the first sample is X0.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+
+#define STEIM_1 1
+#define STEIM_2 2
+
+#define STEIM_FRAME_BYTES 64
+#define STEIM_FRAME_WORDS 16
+
+//Frames needed in the worst case (one difference per word)
+#define STEIM_MAX_FRAMES(samples) (((samples)+2+STEIM_FRAME_WORDS-2)/(STEIM_FRAME_WORDS-1))
+
+/*Decoder errors*/
+#define STEIM_ERROR_LEVEL -1 //level isn't STEIM_1 or STEIM_2
+#define STEIM_ERROR_CODE -2 //invalid Steim-2 dnib
+#define STEIM_ERROR_SHORT -3 //less differences than samples
+#define STEIM_ERROR_XN -4 //the last sample isn't XN (corrupted data)
+
+
+/*Encodes "count" samples in frames (zero padded). Returns the number of frames or 0 if
+they don't fit in max_frames or a difference doesn't fit in 30 bits (Steim-2)*/
+uint16_t steim_encode(uint8_t level, const int32_t *samples, uint16_t count, int32_t previous, uint8_t *frames, uint16_t max_frames);
+
+/*Decodes "count" samples from frame_count frames. Returns count or a STEIM_ERROR_xxx*/
+int32_t steim_decode(uint8_t level, const uint8_t *frames, uint16_t frame_count, uint16_t count, int32_t *samples);
+
+#endif
@@ -9,7 +9,7 @@
 //Define event flags
 #define FLAG_SD_MOUNTED         (1 << 0) // true when sd is mounted, false unmounted
 #define FLAG_SD_AVAILABLE       (1 << 1) // true when sd is not busy, false if it is busy
-#define FLAG_FILES_AVAILABLE    (1 << 2) // true there are pending files in SD card, false there are not files
+#define FLAG_FILES_AVAILABLE    (1 << 2) // true there are records not acked in the SD backlog index (backlog_index.h), false there are not records
 
 #define FLAG_WIFI_CONNECTED     (1 << 3) // true when connected, false disconnected
 #define FLAG_WIFI_AVAILABLE     (1 << 4) // true when sd is not busy, false if it is busy
@@ -18,7 +18,9 @@
 #define FLAG_ITEMS_IN_WIFI_QUEUE  (1 << 6) // true when there're elements in wifi queue, false no items 
 #define FLAG_ITEMS_IN_SD_QUEUE    (1 << 7) // true when there're elements in SD queue, false no items
 
-#define ALL_FLAGS_HARDWARE   FLAG_SD_MOUNTED|FLAG_SD_AVAILABLE|FLAG_FILES_AVAILABLE|FLAG_WIFI_CONNECTED|FLAG_WIFI_AVAILABLE|FLAG_WIFI_FAIL|FLAG_ITEMS_IN_WIFI_QUEUE|FLAG_ITEMS_IN_SD_QUEUE
+#define FLAG_STATION_CONFIG       (1 << 8) // true when the mounted card has settings to apply (sd_station_config), false none or applied
+
+#define ALL_FLAGS_HARDWARE   FLAG_SD_MOUNTED|FLAG_SD_AVAILABLE|FLAG_FILES_AVAILABLE|FLAG_WIFI_CONNECTED|FLAG_WIFI_AVAILABLE|FLAG_WIFI_FAIL|FLAG_ITEMS_IN_WIFI_QUEUE|FLAG_ITEMS_IN_SD_QUEUE|FLAG_STATION_CONFIG
 
 // Declare a variable to hold the created event group
 EventGroupHandle_t flags_hardware_available;
@@ -34,6 +36,14 @@ TaskHandle_t get_data_mma8451q_taskID; //Task handler mma8451q 14 bit accelerome
 
 TaskHandle_t get_data_adxl355_taskID; //Task handler adxl355 20 bit accelerometer 
 
+TaskHandle_t acquisition_taskID; //Task handler of the single acquisition task (ACQUISITION_SINGLE_TASK)
+
+TaskHandle_t clock_discipline_taskID; //Task handler of the sample clock discipline (DS3231 SQW pin)
+
+TaskHandle_t send_buffer_to_SD_taskID; //Task handler of the SD write task (stack high water mark)
+
+TaskHandle_t fill_buffer_with_sd_taskID; //Task handler of the SD read task (stack high water mark)
+
 
 
 
@@ -0,0 +1,259 @@
+#include <string.h>
+
+#include "time_sync.h"
+
+#define NTP_UNIX_OFFSET 2208988800LL //seconds from 1900-01-01 (NTP) to 1970-01-01 (epoch)
+#define NTP_MODE_CLIENT 3
+#define NTP_MODE_SERVER 4
+#define NTP_VERSION 4
+#define NTP_LEAP_UNSYNCHRONIZED 3
+
+//positions in the SNTP message
+#define NTP_ORIGINATE 24
+#define NTP_RECEIVE 32
+#define NTP_TRANSMIT 40
+
+#define STEP_CONFIRM 3 //samples in a row over TIME_SYNC_STEP_US to step a synced clock
+#define JITTER_FILTER 4 //weight of every new prediction error in the jitter (1/4)
+#define FREQUENCY_MAX_SPAN_US (86400LL*1000000) //a longer FREQUENCY measurement starts again (temperature, aging)
+
+
+static int64_t absolute(int64_t value){
+    return (value<0)?-value:value;
+}
+
+//epoch_us to NTP timestamp (seconds since 1900 and 1/2^32 fractions, era of the 32 bit seconds)
+static void ntp_put(uint8_t *buffer, int64_t epoch_us){
+    int64_t seconds=epoch_us/1000000;
+    int64_t microseconds=epoch_us%1000000;
+    uint32_t fraction;
+
+    if (microseconds<0){
+        microseconds+=1000000;
+        seconds--;
+    }
+    seconds+=NTP_UNIX_OFFSET;
+    fraction=(uint32_t)(((uint64_t)microseconds<<32)/1000000);
+    for(uint8_t i=0;i<4;i++){
+        buffer[i]=(uint8_t)((uint32_t)seconds>>(24-8*i));
+        buffer[4+i]=(uint8_t)(fraction>>(24-8*i));
+    }
+}
+
+//NTP timestamp to epoch_us, seconds with the MSB at 0 are after 2036 (era 1, RFC 4330)
+static int64_t ntp_get(const uint8_t *buffer){
+    uint32_t seconds=0, fraction=0;
+    int64_t epoch_seconds;
+
+    for(uint8_t i=0;i<4;i++){
+        seconds=(seconds<<8)|buffer[i];
+        fraction=(fraction<<8)|buffer[4+i];
+    }
+    epoch_seconds=(int64_t)seconds-NTP_UNIX_OFFSET;
+    if ((seconds&0x80000000u)==0){
+        epoch_seconds+=0x100000000LL;
+    }
+    return epoch_seconds*1000000+(int64_t)((((uint64_t)fraction*1000000)+0x80000000u)>>32);
+}
+
+//OFFSET predicted at local_us with the last used sample and FREQUENCY
+static int64_t predicted_offset(const time_sync_t *sync, int64_t local_us){
+    return sync->used.offset_us+(local_us-sync->used.local_us)*sync->frequency_ppb/1000000000;
+}
+
+
+/*======================================================================
+ * TIME SYNC INIT
+ ======================================================================*/
+void time_sync_init(time_sync_t *sync){
+    memset(sync,0,sizeof(time_sync_t));
+}
+
+
+/*======================================================================
+ * SNTP MESSAGES
+ ======================================================================*/
+void time_sync_ntp_request(uint8_t *packet, int64_t transmit_us){
+    memset(packet,0,TIME_SYNC_NTP_BYTES);
+    packet[0]=(NTP_VERSION<<3)|NTP_MODE_CLIENT; //LI = 0
+    ntp_put(&packet[NTP_TRANSMIT],transmit_us);
+}
+
+bool time_sync_ntp_sample(const uint8_t *packet, int64_t t1_us, int64_t t4_us, time_sync_sample_t *sample){
+    uint8_t originate[8];
+    int64_t t2_us, t3_us;
+
+    //server reply (version 3 or 4) of a synchronized server, stratum 0 = kiss-o'-death
+    if ((packet[0]&0x07)!=NTP_MODE_SERVER || ((packet[0]>>3)&0x07)<3 || (packet[0]>>6)==NTP_LEAP_UNSYNCHRONIZED
+        || packet[1]==0 || packet[1]>15){
+        return false;
+    }
+    //it is the reply of this request (the server copies T1 to ORIGINATE)
+    ntp_put(originate,t1_us);
+    if (memcmp(&packet[NTP_ORIGINATE],originate,sizeof(originate))!=0){
+        return false;
+    }
+    t2_us=ntp_get(&packet[NTP_RECEIVE]);
+    t3_us=ntp_get(&packet[NTP_TRANSMIT]);
+    if (t4_us<t1_us || t3_us<t2_us){
+        return false;
+    }
+
+    sample->offset_us=((t2_us-t1_us)+(t3_us-t4_us))/2;
+    sample->delay_us=(t4_us-t1_us)-(t3_us-t2_us);
+    if (sample->delay_us<0){
+        sample->delay_us=0; //resolution of the clocks
+    }
+    sample->local_us=t4_us;
+    return true;
+}
+
+
+/*======================================================================
+ * TIME SYNC ADD
+ *
+ * Minimum delay of the window, a synced clock only steps if
+ * STEP_CONFIRM samples in a row say so (one bad server reply is
+ * never a step). A sample votes once, also if it stays the best of
+ * the window for some polls.
+ ======================================================================*/
+uint8_t time_sync_add(time_sync_t *sync, const time_sync_sample_t *sample){
+    const time_sync_sample_t *best=&sync->window[0];
+    int64_t error;
+    int64_t span;
+
+    sync->window[sync->next]=*sample;
+    sync->next=(sync->next+1)%TIME_SYNC_WINDOW;
+    if (sync->count<TIME_SYNC_WINDOW){
+        sync->count++;
+    }
+    for(uint8_t i=1;i<sync->count;i++){
+        if (sync->window[i].delay_us<best->delay_us
+            || (sync->window[i].delay_us==best->delay_us && sync->window[i].local_us>best->local_us)){
+            best=&sync->window[i];
+        }
+    }
+    if (sync->synced && best->local_us<=sync->used.local_us){
+        return TIME_SYNC_IGNORED;
+    }
+
+    //step: OFFSET of the best sample brought to now
+    error=best->offset_us+(sample->local_us-best->local_us)*sync->frequency_ppb/1000000000-sync->correction_us;
+    if (absolute(error)>TIME_SYNC_STEP_US){
+        //one vote per sample (the same best sample stays in the window for some polls)
+        if (sync->synced && best->local_us==sync->step_local_us){
+            return TIME_SYNC_IGNORED;
+        }
+        sync->step_local_us=best->local_us;
+        sync->step_votes++;
+        if (!sync->synced || sync->step_votes>=STEP_CONFIRM){
+            sync->step_us=error;
+            return TIME_SYNC_STEP;
+        }
+        return TIME_SYNC_IGNORED;
+    }
+    sync->step_votes=0;
+
+    if (sync->synced){
+        sync->jitter_us=sync->jitter_us-sync->jitter_us/JITTER_FILTER
+            +(uint32_t)(absolute(best->offset_us-predicted_offset(sync,best->local_us))/JITTER_FILTER);
+    }
+    else{
+        sync->slewed_local_us=best->local_us; //CORRECTION starts to move now
+    }
+    sync->used=*best;
+    sync->synced=true;
+
+    //FREQUENCY = slope of OFFSET since frequency_start (the span grows, the error gets smaller)
+    span=best->local_us-sync->frequency_start.local_us;
+    if (!sync->frequency_started || span>FREQUENCY_MAX_SPAN_US){
+        //the first sample of the measurement is the best of a full window (one delayed reply is an error of the whole span)
+        if (sync->count>=TIME_SYNC_WINDOW){
+            sync->frequency_start=*best;
+            sync->frequency_started=true;
+        }
+    }
+    else if (span>=TIME_SYNC_FREQUENCY_SPAN_US){
+        sync->frequency_ppb=(int32_t)((best->offset_us-sync->frequency_start.offset_us)*1000000000/span);
+        sync->frequency_error_ppb=(uint32_t)(2*(int64_t)sync->jitter_us*1000000000/span);
+        sync->frequency_valid=true;
+    }
+    return TIME_SYNC_SLEW;
+}
+
+int64_t time_sync_step_us(const time_sync_t *sync){
+    return sync->step_us;
+}
+
+void time_sync_stepped(time_sync_t *sync){
+    sync->count=0;
+    sync->next=0;
+    sync->synced=false;
+    sync->step_votes=0;
+    sync->step_us=0;
+    sync->correction_us=0;
+    sync->frequency_started=false; //the raw clock jumped, the OFFSETs before and after aren't comparable
+}
+
+
+/*======================================================================
+ * TIME SYNC SLEW
+ ======================================================================*/
+int64_t time_sync_slew(time_sync_t *sync, int64_t local_us){
+    int64_t remaining, limit;
+
+    if (!sync->synced){
+        sync->slewed_local_us=local_us;
+        return sync->correction_us;
+    }
+    remaining=predicted_offset(sync,local_us)-sync->correction_us;
+    limit=(local_us>sync->slewed_local_us)?(local_us-sync->slewed_local_us)*TIME_SYNC_SLEW_PPM/1000000:0;
+    if (remaining>limit) remaining=limit;
+    if (remaining<-limit) remaining=-limit;
+
+    sync->correction_us+=remaining;
+    sync->slewed_local_us=local_us;
+    return sync->correction_us;
+}
+
+
+/*======================================================================
+ * TIME SYNC UNCERTAINTY
+ ======================================================================*/
+uint32_t time_sync_uncertainty(const time_sync_t *sync, int64_t local_us){
+    int64_t age, uncertainty;
+
+    if (!sync->synced){
+        return TIME_SYNC_UNKNOWN;
+    }
+    age=(local_us>sync->used.local_us)?local_us-sync->used.local_us:0;
+    uncertainty=sync->used.delay_us/2+sync->jitter_us+absolute(predicted_offset(sync,local_us)-sync->correction_us)
+        +age*TIME_SYNC_WANDER_PPB/1000000000;
+    return (uncertainty>=TIME_SYNC_UNKNOWN)?TIME_SYNC_UNKNOWN-1:(uint32_t)uncertainty;
+}
+
+
+/*======================================================================
+ * DS3231 AGING OFFSET
+ *
+ * Only a FREQUENCY measured better than half a LSB is removed. A
+ * positive LSB slows the DS3231: the raw clock is slower, FREQUENCY
+ * (+ = slow) grows TIME_SYNC_AGING_PPB.
+ ======================================================================*/
+int8_t time_sync_aging_delta(const time_sync_t *sync){
+    int32_t lsb;
+
+    if (!sync->frequency_valid || sync->frequency_error_ppb>TIME_SYNC_AGING_PPB/2){
+        return 0;
+    }
+    lsb=-(sync->frequency_ppb+((sync->frequency_ppb<0)?-TIME_SYNC_AGING_PPB/2:TIME_SYNC_AGING_PPB/2))/TIME_SYNC_AGING_PPB;
+    if (lsb>INT8_MAX) lsb=INT8_MAX;
+    if (lsb<INT8_MIN) lsb=INT8_MIN;
+    return (int8_t)lsb;
+}
+
+void time_sync_aging_applied(time_sync_t *sync, int8_t delta){
+    sync->frequency_ppb+=delta*TIME_SYNC_AGING_PPB;
+    sync->frequency_valid=false; //measured again from the next sample
+    sync->frequency_started=false;
+}
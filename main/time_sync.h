@@ -0,0 +1,118 @@
+#ifndef _TIME_SYNC_H_
+#define _TIME_SYNC_H_
+
+/*
+SNTP offsets of the station clock: filter, slew and drift of the DS3231
+
+The station clock (raw) is the software clock of soft_clock.h: the DS3231 second anchored to
+its SQW edge plus the sample timer since then (sntp_config.c). Every poll is one SNTP exchange (RFC 4330) with the times of the
+raw clock T1 (request sent) and T4 (reply received) and the ones of the server T2 and T3:
+
+    OFFSET = ((T2 - T1) + (T3 - T4)) / 2   server - raw clock
+    DELAY  = (T4 - T1) - (T3 - T2)         round trip in the network
+
+The OFFSET of one exchange has an error of up to DELAY/2 (WiFi queues, retries), so the
+last TIME_SYNC_WINDOW samples are kept and only the one with the minimum DELAY is used
+(clock filter of NTP), and never a sample older than the last one used. With that sample:
+
+    |OFFSET - CORRECTION| > TIME_SYNC_STEP_US   the DS3231 is set again (STEP, first sync)
+    else                                        CORRECTION is slewed to OFFSET (SLEW)
+
+    station time = raw + CORRECTION
+
+CORRECTION moves at most TIME_SYNC_SLEW_PPM (time_sync_slew, every second) so the packet
+times never jump, and it also follows FREQUENCY: the drift of the raw clock measured between
+two used samples at least TIME_SYNC_FREQUENCY_SPAN_US apart (the first one is the best of a
+full window). FREQUENCY is removed from the DS3231 itself with its aging offset register
+(~0.1 ppm per LSB, + = slower), the SQW edges and the sample timer locked to them
+(clock_discipline.h) follow it.
+
+UNCERTAINTY of the station time (written in every packet header): DELAY/2 of the used sample
++ JITTER (mean error of the OFFSET predicted with FREQUENCY) + CORRECTION not slewed yet +
+TIME_SYNC_WANDER_PPB since the sample. TIME_SYNC_UNKNOWN before the first sync.
+
+This file doesn't depend on ESP-IDF, it also compiles on a Linux host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIME_SYNC_NTP_BYTES 48     //SNTP message without authentication
+#define TIME_SYNC_NTP_PORT 123
+#define TIME_SYNC_WINDOW 8         //samples of the minimum delay filter
+#define TIME_SYNC_STEP_US 128000   //bigger offsets set the DS3231, smaller ones are slewed (NTP step threshold)
+#define TIME_SYNC_SLEW_PPM 500     //maximum speed of CORRECTION
+#define TIME_SYNC_WANDER_PPB 2000  //error that grows without syncs (DS3231 +-2 ppm)
+#define TIME_SYNC_FREQUENCY_SPAN_US (1024LL*1000000) //minimum time between two samples of a FREQUENCY measurement
+#define TIME_SYNC_AGING_PPB 100    //DS3231 aging offset register, ppb per LSB (25 C)
+#define TIME_SYNC_UNKNOWN UINT32_MAX //UNCERTAINTY before the first sync
+
+//Results of time_sync_add
+#define TIME_SYNC_IGNORED 0 //the sample isn't the best of the window (or it's older than the last used)
+#define TIME_SYNC_SLEW 1    //new OFFSET, CORRECTION goes to it (time_sync_slew)
+#define TIME_SYNC_STEP 2    //set the DS3231 with time_sync_step_us() then time_sync_stepped()
+
+typedef struct {
+    int64_t offset_us; //server - raw clock
+    int64_t delay_us;  //round trip without the time in the server
+    int64_t local_us;  //raw clock when the reply arrived (T4)
+} time_sync_sample_t;
+
+typedef struct {
+    time_sync_sample_t window[TIME_SYNC_WINDOW]; //last samples (minimum delay filter)
+    uint8_t count;                 //samples in the window
+    uint8_t next;                  //next position of the window
+
+    time_sync_sample_t used;       //last sample used
+    bool synced;                   //a sample was used since the last step
+    int64_t step_us;               //OFFSET - CORRECTION of a TIME_SYNC_STEP
+    uint8_t step_votes;            //samples in a row over TIME_SYNC_STEP_US
+    int64_t step_local_us;         //T4 of the last sample that voted (one vote per sample)
+
+    int64_t correction_us;         //station time = raw + correction
+    int64_t slewed_local_us;       //raw clock of the last time_sync_slew
+
+    int32_t frequency_ppb;         //drift of the raw clock, + = the raw clock is slow (OFFSET grows)
+    bool frequency_valid;          //FREQUENCY was measured
+    uint32_t frequency_error_ppb;  //error of FREQUENCY (2*JITTER / span of the measurement)
+    time_sync_sample_t frequency_start; //first sample of the current FREQUENCY measurement
+    bool frequency_started;
+
+    uint32_t jitter_us;            //mean error of the predicted OFFSET
+} time_sync_t;
+
+
+/*Empty filter, CORRECTION = 0 and FREQUENCY unknown*/
+void time_sync_init(time_sync_t *sync);
+
+/*SNTP request (client, version 4) with the transmit time T1 (raw clock, epoch_us)*/
+void time_sync_ntp_request(uint8_t *packet, int64_t transmit_us);
+
+/*SNTP reply to the request sent at t1_us and received at t4_us (raw clock), false if it isn't
+a valid reply to that request (mode, stratum, not synchronized server, other T1)*/
+bool time_sync_ntp_sample(const uint8_t *packet, int64_t t1_us, int64_t t4_us, time_sync_sample_t *sample);
+
+/*Adds a sample to the filter, returns TIME_SYNC_IGNORED, TIME_SYNC_SLEW or TIME_SYNC_STEP*/
+uint8_t time_sync_add(time_sync_t *sync, const time_sync_sample_t *sample);
+
+/*Error of the station time of a TIME_SYNC_STEP (station time + step = server time)*/
+int64_t time_sync_step_us(const time_sync_t *sync);
+
+/*The DS3231 was set (the raw clock changed): empty filter, CORRECTION = 0, FREQUENCY is kept*/
+void time_sync_stepped(time_sync_t *sync);
+
+/*Moves CORRECTION to OFFSET (+ FREQUENCY since the sample) at most TIME_SYNC_SLEW_PPM since the
+last call, local_us = raw clock now. Returns the new CORRECTION*/
+int64_t time_sync_slew(time_sync_t *sync, int64_t local_us);
+
+/*UNCERTAINTY of the station time at local_us (microseconds), TIME_SYNC_UNKNOWN if not synced*/
+uint32_t time_sync_uncertainty(const time_sync_t *sync, int64_t local_us);
+
+/*LSBs to add to the DS3231 aging offset register to remove FREQUENCY, 0 if FREQUENCY isn't
+measured better than half a LSB yet (the span of the measurement grows) or it is smaller*/
+int8_t time_sync_aging_delta(const time_sync_t *sync);
+
+/*The aging offset register changed "delta" LSBs: FREQUENCY is corrected and measured again*/
+void time_sync_aging_applied(time_sync_t *sync, int8_t delta);
+
+#endif
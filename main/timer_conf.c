@@ -6,6 +6,31 @@
 #include "task_list.h"
 
 
+//Timer counts between two samples (changed by timer_set_period)
+static volatile uint32_t period_counts=TIMER_SCALE/SAMPLE_RATE;
+
+//Next alarm value, the counter is free running (no auto reload)
+static uint64_t next_alarm_value=TIMER_SCALE/SAMPLE_RATE;
+
+//Fraction of a count added to every period (Q16, changed by timer_set_trim)
+static volatile int32_t period_trim=0;
+
+//Fractions of a count not added to the alarm yet (0 to 65535)
+static int32_t trim_accumulator=0;
+
+//Alarm value of the last tick
+static uint64_t last_tick_value=0;
+
+//Counter values latched at the beginning of the last TIMER_TICK_STAMPS ticks (real time of the ticks)
+static uint64_t tick_stamps[TIMER_TICK_STAMPS];
+
+//Ticks since conf_timer, tick n is stored in tick_stamps[n % TIMER_TICK_STAMPS]
+static uint32_t tick_count=0;
+
+//The 64 bit values can't be read in one access, the tasks of both cores read them with this lock
+static portMUX_TYPE tick_mux=portMUX_INITIALIZER_UNLOCKED;
+
+
 /*============================================================================================
  * Timer ISR handler
  *
@@ -18,9 +43,25 @@ void IRAM_ATTR timer_isr_handler(){
     /*Start the interrupt and lock timer_group 0 (i guess)*/
     timer_spinlock_take(TIMER_GROUP_0);
 
-    /* Clear the interrupt (with reload)*/
+    /*Latch the counter first, the timestamp of the samples read in this tick*/
+    uint64_t tick_stamp=timer_group_get_counter_value_in_isr(TIMER_GROUP_0, TIMER_SENSOR);
+
+    /* Clear the interrupt (without reload)*/
     timer_group_clr_intr_status_in_isr(TIMER_GROUP_0, TIMER_0);
     
+    /* Move the alarm one period forward, the period doesn't depend on the 
+       interrupt latency because it's added to the last alarm value. The whole
+       counts of the trim are added, the fraction waits for the next ticks*/
+    portENTER_CRITICAL_ISR(&tick_mux);
+    last_tick_value=next_alarm_value;
+    tick_stamps[tick_count&(TIMER_TICK_STAMPS-1)]=tick_stamp;
+    tick_count++;
+    portEXIT_CRITICAL_ISR(&tick_mux);
+    trim_accumulator+=period_trim;
+    next_alarm_value+=(uint64_t)((int64_t)period_counts+(trim_accumulator>>16));
+    trim_accumulator&=0xFFFF;
+    timer_group_set_alarm_value_in_isr(TIMER_GROUP_0, TIMER_SENSOR, next_alarm_value);
+
    /* After the alarm has been triggered
       we need enable it again, so it is triggered the next time */
     timer_group_enable_alarm_in_isr(TIMER_GROUP_0, TIMER_SENSOR);
@@ -30,14 +71,28 @@ void IRAM_ATTR timer_isr_handler(){
     */
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
     
-    //Turn on the 24 bit ADC task
+#if ACQUISITION_ENGINE==ACQUISITION_SINGLE_TASK
+#if ACQ_TASK_READS_ANY
+    //Turn on the acquisition task (one context switch for all the sensors)
+    vTaskNotifyGiveFromISR(acquisition_taskID, &xHigherPriorityTaskWoken);
+#endif
+
+#else /*ACQUISITION_THREE_TASKS*/
+#if MCP356X_ACQUISITION_MODE==MCP356X_MODE_TIMER
+    //Turn on the 24 bit ADC task (in DRDY mode the task is woken up by the ADC IRQ pin)
     vTaskNotifyGiveFromISR(get_data_adc_mcp3561_taskID, &xHigherPriorityTaskWoken);
+#endif
     
-    //Turn on the 20 bit accelerometer task
+#if ADXL355_ACQUISITION_MODE==ADXL355_MODE_TIMER
+    //Turn on the 20 bit accelerometer task (in FIFO mode the task is woken up by the sensor)
     vTaskNotifyGiveFromISR(get_data_adxl355_taskID, &xHigherPriorityTaskWoken);
+#endif
 
-    //Turn on the 14 bit accelerometer task
+#if MMA8451Q_ACQUISITION_MODE==MMA8451Q_MODE_TIMER
+    //Turn on the 14 bit accelerometer task (in FIFO mode the task wakes up by itself)
     vTaskNotifyGiveFromISR(get_data_mma8451q_taskID, &xHigherPriorityTaskWoken);
+#endif
+#endif
     
 
     if (xHigherPriorityTaskWoken) {
@@ -57,7 +112,7 @@ void IRAM_ATTR timer_isr_handler(){
  *
  * TIMER_SENSOR - the timer number to initialize
  * auto_reload - should the timer auto reload on alarm?
- * SAMPLE_RATE - the interval of alarm clock in HZ (period = 1/SAMPLE_RATE)
+ * period_counts - the interval of alarm clock in microseconds (timer_set_period)
  ============================================================================*/
 void conf_timer(){
     /* Select and initialize basic parameters of the timer */
@@ -66,7 +121,7 @@ void conf_timer(){
         .counter_dir = TIMER_COUNT_UP,
         .counter_en = TIMER_PAUSE,
         .alarm_en = TIMER_ALARM_EN,
-        .auto_reload = TEST_WITH_RELOAD,
+        .auto_reload = TEST_WITHOUT_RELOAD, //free running counter (timestamps)
     }; // default clock source is APB
     timer_init(TIMER_GROUP_0, TIMER_SENSOR, &config);
 
@@ -75,10 +130,93 @@ void conf_timer(){
     timer_set_counter_value(TIMER_GROUP_0, TIMER_SENSOR, 0x00000000ULL);
 
     /* Configure the alarm value and the interrupt on alarm. */
-    timer_set_alarm_value(TIMER_GROUP_0, TIMER_SENSOR, TIMER_SCALE/SAMPLE_RATE);
+    next_alarm_value=period_counts;
+    timer_set_alarm_value(TIMER_GROUP_0, TIMER_SENSOR, next_alarm_value);
     timer_enable_intr(TIMER_GROUP_0, TIMER_SENSOR);
     //Setting timer interrupt ESP_INTR_FLAG_IRAM = priority of timer interrupt
     //ESP_INTR_FLAG_NMI = highest priority
     timer_isr_register(TIMER_GROUP_0, TIMER_SENSOR, timer_isr_handler, NULL, ESP_INTR_FLAG_LEVEL3, NULL);
     timer_start(TIMER_GROUP_0, TIMER_SENSOR);
-}
\ No newline at end of file
+}
+
+
+/*============================================================================
+ * Timestamps (microseconds since conf_timer, the counter is never reloaded)
+ ============================================================================*/
+uint64_t timer_get_timestamp(void){
+    uint64_t counter_value=0;
+    timer_get_counter_value(TIMER_GROUP_0, TIMER_SENSOR, &counter_value);
+    return counter_value;
+}
+
+uint64_t IRAM_ATTR timer_get_timestamp_from_isr(void){
+    return timer_group_get_counter_value_in_isr(TIMER_GROUP_0, TIMER_SENSOR);
+}
+
+//Also called by the SQW ISR
+uint64_t IRAM_ATTR timer_get_last_tick(void){
+    uint64_t tick_value;
+
+    portENTER_CRITICAL_SAFE(&tick_mux);
+    tick_value=last_tick_value;
+    portEXIT_CRITICAL_SAFE(&tick_mux);
+    return tick_value;
+}
+
+
+/*============================================================================
+ * Tick stamps (one per tick, the tasks can read the ticks they missed)
+ ============================================================================*/
+uint32_t timer_get_tick_count(void){
+    uint32_t count;
+
+    portENTER_CRITICAL(&tick_mux);
+    count=tick_count;
+    portEXIT_CRITICAL(&tick_mux);
+    return count;
+}
+
+uint64_t timer_wait_tick(uint32_t *tick){
+    uint32_t count;
+    uint64_t stamp;
+
+    //the notification can arrive before or after the tick is counted, so the count decides
+    while (timer_get_tick_count()==*tick){
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    portENTER_CRITICAL(&tick_mux);
+    count=tick_count;
+    if (count-*tick>TIMER_TICK_STAMPS){
+        *tick=count-TIMER_TICK_STAMPS; //overwritten, skipped up to the oldest stamp
+    }
+    stamp=tick_stamps[*tick&(TIMER_TICK_STAMPS-1)];
+    portEXIT_CRITICAL(&tick_mux);
+
+    (*tick)++;
+    return stamp;
+}
+
+
+/*============================================================================
+ * Sample period (the ISR reads period_counts in every tick)
+ ============================================================================*/
+void timer_set_period(uint32_t new_period_counts){
+    period_counts=new_period_counts;
+}
+
+uint32_t timer_get_period(void){
+    return period_counts;
+}
+
+
+/*============================================================================
+ * Period trim (clock discipline, the ISR reads period_trim in every tick)
+ ============================================================================*/
+void timer_set_trim(int32_t trim){
+    period_trim=trim;
+}
+
+int32_t timer_get_trim(void){
+    return period_trim;
+}
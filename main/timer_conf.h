@@ -1,16 +1,98 @@
 
 /* TIMER_BASE_CLK = 80 MHZ */ 
-#define SAMPLE_RATE  100 //sample rate in HZ
+#define SAMPLE_RATE  100 //default sample rate in HZ (the current rate is stored in NVS, see sample_rate.h)
 
-//0.0025 = 400 HZ      0.004 = 250 HZ   <--- maximum recommended
+/*Sensors are sampled DECIMATION_RATIO times faster than SAMPLE_RATE and decimation_task 
+filters and downsamples them (decimator.h), 1 = no decimation. Ratios: 1, 2, 5 or 10 
+(acquisition rate = DECIMATION_RATIO*sample rate must be in the sample rate table)*/
+#define DECIMATION_RATIO 1
+
+//0.0025 = 400 HZ      0.004 = 250 HZ   <--- maximum recommended (acquisition rate)
 #define TIMER_SENSOR TIMER_0 //Timer for counting 
-#define TIMER_DIVIDER         800  //  Hardware timer clock divider
+#define TIMER_DIVIDER         80  //  Hardware timer clock divider (1 count = 1 microsecond)
 #define TIMER_SCALE           (TIMER_BASE_CLK / TIMER_DIVIDER)  // convert counter value to seconds
 #define TEST_WITHOUT_RELOAD   0        // testing will be done without auto reload
 #define TEST_WITH_RELOAD      1        // testing will be done with auto reload
 
+
+/*
+Acquisition engine (who reads the sensors that are in TIMER mode every tick)
+
+ACQUISITION_THREE_TASKS: the ISR wakes up one task per sensor (three context switches 
+                         per tick, SPI reads with interrupt based spi_device_transmit).
+ACQUISITION_SINGLE_TASK: the ISR wakes up acquisition_task, it reads the MCP3561 and the 
+                         ADXL355 with polling SPI transactions and then the MMA8451Q by I2C.
+
+Sensors in FIFO or DRDY mode always have their own task.
+*/
+#define ACQUISITION_THREE_TASKS 0
+#define ACQUISITION_SINGLE_TASK 1
+
+#define ACQUISITION_ENGINE ACQUISITION_SINGLE_TASK
+
+/*1 = the sample timer is phase locked to the 1 Hz square wave of the DS3231 (SQW pin,
+clock_discipline.h, timer_set_trim), 0 = it runs free with the APB clock*/
+#define SAMPLE_CLOCK_DISCIPLINE 1
+
+#include "spi_mcp356x.h"
+#include "spi_adxl355.h"
+#include "i2c_mma8451q.h"
+
+//Sensors read by acquisition_task 
+#define ACQ_TASK_READS_MCP356X (ACQUISITION_ENGINE==ACQUISITION_SINGLE_TASK && MCP356X_ACQUISITION_MODE==MCP356X_MODE_TIMER)
+#define ACQ_TASK_READS_ADXL355 (ACQUISITION_ENGINE==ACQUISITION_SINGLE_TASK && ADXL355_ACQUISITION_MODE==ADXL355_MODE_TIMER)
+#define ACQ_TASK_READS_MMA8451Q (ACQUISITION_ENGINE==ACQUISITION_SINGLE_TASK && MMA8451Q_ACQUISITION_MODE==MMA8451Q_MODE_TIMER)
+#define ACQ_TASK_READS_ANY (ACQ_TASK_READS_MCP356X || ACQ_TASK_READS_ADXL355 || ACQ_TASK_READS_MMA8451Q)
+
 void conf_timer();
 
+/*
+The counter is never reloaded, the alarm moves forward one period (timer counts) every 
+sample, so the counter value is a 64 bit timestamp in microseconds since conf_timer()
+*/
+
+/*Changes the timer counts between two samples (TIMER_SCALE/sample rate), it can be called 
+before or after conf_timer(), the new period starts in the next tick*/
+void timer_set_period(uint32_t period_counts);
+
+/*Returns the timer counts between two samples*/
+uint32_t timer_get_period(void);
+
+/*Fraction of a count added to every period, Q16 signed (1/65536 counts per tick), set by 
+the clock discipline. The ISR carries the fractions, so the mean period is 
+period_counts + trim/65536. It isn't changed by timer_set_period*/
+void timer_set_trim(int32_t trim);
+
+/*Returns the trim of the period (Q16 counts per tick)*/
+int32_t timer_get_trim(void);
+
+/*Returns the current value of the sample timer (microseconds), for tasks*/
+uint64_t timer_get_timestamp(void);
+
+/*Returns the current value of the sample timer (microseconds), only for ISRs*/
+uint64_t timer_get_timestamp_from_isr(void);
+
+/*Returns the alarm value (microseconds) of the last tick, call it during the tick 
+(the value changes in the next TIMER_ISR)*/
+uint64_t timer_get_last_tick(void);
+
+/*
+Tick stamps: the TIMER_ISR latches the counter at the beginning of every tick (the timestamp 
+of the samples read in that tick, it includes the interrupt latency) and numbers the ticks 
+(0 = first tick after conf_timer). It keeps the stamps of the last TIMER_TICK_STAMPS ticks, 
+so a task that falls behind still stamps every tick it reads with its own time.
+*/
+#define TIMER_TICK_STAMPS 16 //stamps kept by the TIMER_ISR (power of 2)
+
+/*Returns the number of ticks since conf_timer (the number of the next tick)*/
+uint32_t timer_get_tick_count(void);
+
+/*Waits for the tick number *tick (task notification of the TIMER_ISR) and returns its stamp, 
+then *tick moves to the next tick. If the task fell more than TIMER_TICK_STAMPS ticks behind, 
+the oldest ticks are skipped (their stamps were overwritten). Only for the tasks woken up by 
+the TIMER_ISR, start with *tick = timer_get_tick_count()*/
+uint64_t timer_wait_tick(uint32_t *tick);
+
 
 /*
 EDITED by MoustachedBird
@@ -0,0 +1,48 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+/*
+Checks of the host tests (test/Makefile). Every test is one program: CHECK prints the failed
+condition and counts it, TEST_END prints the result and gives the exit code of main. With
+"--bench" the programs also run their benchmarks (make bench).
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+static int test_failures=0;
+
+#define CHECK(condition) do{ \
+        if (!(condition)){ \
+            test_failures++; \
+            printf("%s:%d: CHECK failed: %s\n",__FILE__,__LINE__,#condition); \
+        } \
+    }while(0)
+
+#define TEST_END() (printf("%s: %s\n",__FILE__,(test_failures!=0)?"FAILED":"ok"),test_failures!=0)
+
+//monotonic seconds (benchmarks)
+static inline double test_seconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return (double)now.tv_sec+(double)now.tv_nsec*1e-9;
+}
+
+static inline bool test_bench(int argc, char **argv){
+    return argc>1 && strcmp(argv[1],"--bench")==0;
+}
+
+//repeatable pseudo random numbers (xorshift32, seed != 0)
+static inline uint32_t test_random(uint32_t *state){
+    uint32_t x=*state;
+    x^=x<<13;
+    x^=x>>17;
+    x^=x<<5;
+    *state=x;
+    return x;
+}
+
+#endif
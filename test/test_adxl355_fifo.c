@@ -0,0 +1,155 @@
+/*
+adxl355_fifo.h: decode of FIFO_DATA bursts (X markers, empty entries, samples cut between
+bursts, alignment recovery) against captured streams and generated ones.
+*/
+#include "test.h"
+#include "adxl355_fifo.h"
+
+//FIFO entry of a 20 bit axis value
+static void entry_make(uint8_t *entry, int32_t value, bool x_axis, bool empty){
+    uint32_t bits=(uint32_t)value&0xFFFFF;
+
+    entry[0]=(uint8_t)(bits>>12);
+    entry[1]=(uint8_t)(bits>>4);
+    entry[2]=(uint8_t)((bits&0x0F)<<4)|(x_axis?ADXL355_FIFO_X_MARKER:0)|(empty?ADXL355_FIFO_EMPTY_MARKER:0);
+}
+
+//axis of a decoded sample (XDATA3..XDATA1 layout)
+static int32_t axis_value(const uint8_t *sample, uint8_t axis){
+    const uint8_t *bytes=&sample[axis*ADXL355_FIFO_BYTES_PER_ENTRY];
+    int32_t value=(int32_t)(((uint32_t)bytes[0]<<12)|((uint32_t)bytes[1]<<4)|(bytes[2]>>4));
+    return (value&0x80000)?value-0x100000:value;
+}
+
+
+/*One burst of FIFO_DATA as the sensor sends it (9 entries): the first ones are the Y and Z of a
+sample whose X was read in the previous burst, then two samples, then an empty entry (0x02, the
+FIFO was read faster than it was filled)*/
+static const uint8_t capture_burst[]={
+    0x00,0x21,0x40,  0xFF,0x0B,0x20,
+    0x00,0x3A,0x51,  0x00,0x1F,0x80,  0x3E,0x81,0x70,
+    0x00,0x3A,0x61,  0x00,0x1F,0x30,  0x3E,0x80,0xF0,
+    0x00,0x00,0x02,
+};
+
+static void test_capture(void){
+    adxl355_fifo_decoder_t decoder;
+    uint8_t samples[4*ADXL355_FIFO_BYTES_PER_SAMPLE];
+    uint16_t written;
+
+    adxl355_fifo_decoder_reset(&decoder);
+    written=adxl355_fifo_decode(&decoder,capture_burst,sizeof(capture_burst)/3,samples,4);
+    CHECK(written==2);
+    CHECK(decoder.dropped_entries==2); //Y and Z without X
+    CHECK(decoder.empty_entries==1);
+    //X = 0x003A5 = 933, Y = 0x001F8 = 504, Z = 0x3E817 = 256023
+    CHECK(axis_value(samples,0)==933 && axis_value(samples,1)==504 && axis_value(samples,2)==256023);
+    CHECK(axis_value(&samples[9],0)==934 && axis_value(&samples[9],1)==499);
+    //marker bits cleared
+    CHECK((samples[2]&0x0F)==0 && (samples[11]&0x0F)==0);
+}
+
+//a sample cut between two bursts keeps its alignment
+static void test_split_sample(void){
+    adxl355_fifo_decoder_t decoder;
+    uint8_t raw[6*3], samples[2*ADXL355_FIFO_BYTES_PER_SAMPLE];
+
+    adxl355_fifo_decoder_reset(&decoder);
+    entry_make(&raw[0],100,true,false);
+    entry_make(&raw[3],-200,false,false);
+    entry_make(&raw[6],300,false,false);
+    entry_make(&raw[9],-524288,true,false);
+    entry_make(&raw[12],524287,false,false);
+    entry_make(&raw[15],-1,false,false);
+
+    CHECK(adxl355_fifo_decode(&decoder,raw,2,samples,2)==0);
+    CHECK(decoder.partial_entries==2);
+    CHECK(adxl355_fifo_decode(&decoder,&raw[6],3,samples,2)==1);
+    CHECK(axis_value(samples,0)==100 && axis_value(samples,1)==-200 && axis_value(samples,2)==300);
+    CHECK(adxl355_fifo_decode(&decoder,&raw[15],1,samples,2)==1);
+    CHECK(axis_value(samples,0)==-524288 && axis_value(samples,1)==524287 && axis_value(samples,2)==-1);
+    CHECK(decoder.samples==2 && decoder.dropped_entries==0);
+}
+
+//X before the end of a sample: the incomplete one is dropped, the new one starts
+static void test_lost_entry(void){
+    adxl355_fifo_decoder_t decoder;
+    uint8_t raw[5*3], samples[ADXL355_FIFO_BYTES_PER_SAMPLE];
+
+    adxl355_fifo_decoder_reset(&decoder);
+    entry_make(&raw[0],1,true,false);
+    entry_make(&raw[3],2,false,false);
+    entry_make(&raw[6],7,true,false);
+    entry_make(&raw[9],8,false,false);
+    entry_make(&raw[12],9,false,false);
+    CHECK(adxl355_fifo_decode(&decoder,raw,5,samples,1)==1);
+    CHECK(decoder.dropped_entries==2);
+    CHECK(axis_value(samples,0)==7 && axis_value(samples,2)==9);
+}
+
+//output full: the samples that don't fit are counted as dropped
+static void test_output_full(void){
+    adxl355_fifo_decoder_t decoder;
+    uint8_t raw[6*3], samples[ADXL355_FIFO_BYTES_PER_SAMPLE];
+
+    adxl355_fifo_decoder_reset(&decoder);
+    for (uint8_t i=0;i<6;i++){
+        entry_make(&raw[i*3],i,(i%3)==0,false);
+    }
+    CHECK(adxl355_fifo_decode(&decoder,raw,6,samples,1)==1);
+    CHECK(decoder.dropped_entries==3 && decoder.samples==1);
+}
+
+//random bursts of a long stream with empty entries: every sample once and in order
+static void test_generated_stream(void){
+    enum {SAMPLES=5000};
+    static uint8_t raw[SAMPLES*3*2*3];
+    static int32_t values[SAMPLES][3];
+    adxl355_fifo_decoder_t decoder;
+    uint8_t samples[ADXL355_FIFO_ENTRIES/3*ADXL355_FIFO_BYTES_PER_SAMPLE];
+    uint32_t state=7, entries=0, position=0, decoded=0, errors=0;
+    uint16_t burst, written;
+
+    for (uint32_t i=0;i<SAMPLES;i++){
+        for (uint8_t axis=0;axis<3;axis++){
+            values[i][axis]=(int32_t)(test_random(&state)%0x100000)-0x80000;
+            entry_make(&raw[entries*3],values[i][axis],axis==0,false);
+            entries++;
+            if (test_random(&state)%10==0){
+                entry_make(&raw[entries*3],0,false,true);
+                entries++;
+            }
+        }
+    }
+    adxl355_fifo_decoder_reset(&decoder);
+    while (position<entries){
+        burst=(uint16_t)(1+test_random(&state)%ADXL355_FIFO_ENTRIES);
+        if (burst>entries-position){
+            burst=(uint16_t)(entries-position);
+        }
+        written=adxl355_fifo_decode(&decoder,&raw[position*3],burst,samples,ADXL355_FIFO_ENTRIES/3);
+        for (uint16_t i=0;i<written;i++){
+            for (uint8_t axis=0;axis<3;axis++){
+                if (axis_value(&samples[i*9],axis)!=values[decoded][axis]){
+                    errors++;
+                }
+            }
+            decoded++;
+        }
+        position+=burst;
+    }
+    CHECK(decoded==SAMPLES);
+    CHECK(errors==0);
+    CHECK(decoder.dropped_entries==0);
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    test_capture();
+    test_split_sample();
+    test_lost_entry();
+    test_output_full();
+    test_generated_stream();
+    return TEST_END();
+}
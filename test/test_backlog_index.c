@@ -0,0 +1,497 @@
+/*
+backlog_index.c with sd_log.c: the SD tasks of main.c (slot then record, take, upload, ack,
+rewind and trim) cut by a reset at every write to the files. The program is linked with
+fopen, fwrite, fputc, fclose and fsync wrapped (test/Makefile): every file is unbuffered, so
+what a call wrote is what the card keeps, and write number N writes half of its bytes and
+jumps out of the tasks (the reset). After every reset backlog_index_open must find:
+- the same TAIL (the slots after the checkpoint, not the stale slots of the previous wrap of
+  the ring: the run starts 200 slots before the end of the BACKLOG_INDEX_SLOTS ring)
+- every record appended and not acked pending, with its record in the log, and no acked one
+- HEAD at the oldest pending slot (the acks after the checkpoint)
+- the slot of a record that wasn't appended cancelled
+and the index must keep working. The crashes in each write (both header copies, slots, ack
+bytes, records and segments of the log) are counted and every kind must have been hit. A
+lost index is made again from the log, also if that is cut by a reset.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "backlog_index.h"
+#include "crc32c.h"
+
+#define LOG_ID 1234
+#define INDEX_ID 77
+#define OPERATIONS 700
+#define FIRST_SEQ (BACKLOG_INDEX_SLOTS-200) //the run goes over the wrap of the ring
+#define MAX_RECORDS OPERATIONS
+#define MAX_TAKEN 16
+#define PACKET_BYTES 3000
+
+//crash points, by the write that was cut
+enum {CUT_HEADER_0, CUT_HEADER_1, CUT_SLOT, CUT_ACK, CUT_INDEX_OTHER, CUT_RECORD, CUT_SEGMENT, CUT_KINDS};
+static const char *cut_names[CUT_KINDS]={"header copy 0","header copy 1","slot","ack","index file","record","segment"};
+
+
+/*======================================================================
+ * RESETS (wrapped stdio)
+ ======================================================================*/
+FILE *__real_fopen(const char *path, const char *mode);
+size_t __real_fwrite(const void *data, size_t size, size_t count, FILE *file);
+int __real_fputc(int c, FILE *file);
+int __real_fclose(FILE *file);
+
+#define MAX_FILES 16
+
+static struct {
+    FILE *file;
+    bool index; //BACKLOG.IDX, else a segment of the log
+} files[MAX_FILES];
+
+static uint32_t writes;   //writes since the reset of the counter
+static uint32_t cut_at;   //write to cut (0 = none)
+static uint8_t cut_kind;
+static jmp_buf reset;
+
+FILE *__wrap_fopen(const char *path, const char *mode){
+    FILE *file=__real_fopen(path,mode);
+
+    if (file!=NULL){
+        setvbuf(file,NULL,_IONBF,0);
+        for(uint8_t i=0;i<MAX_FILES;i++){
+            if (files[i].file==NULL){
+                files[i].file=file;
+                files[i].index=strstr(path,BACKLOG_INDEX_NAME)!=NULL;
+                break;
+            }
+        }
+    }
+    return file;
+}
+
+int __wrap_fclose(FILE *file){
+    for(uint8_t i=0;i<MAX_FILES;i++){
+        if (files[i].file==file){
+            files[i].file=NULL;
+        }
+    }
+    return __real_fclose(file);
+}
+
+static uint8_t write_kind(FILE *file, size_t bytes){
+    long offset=ftell(file);
+
+    for(uint8_t i=0;i<MAX_FILES;i++){
+        if (files[i].file==file && files[i].index){
+            if (offset==0 && bytes==BACKLOG_INDEX_HEADER_BYTES) return CUT_HEADER_0;
+            if (offset==BACKLOG_INDEX_HEADER_SPACING && bytes==BACKLOG_INDEX_HEADER_BYTES) return CUT_HEADER_1;
+            if (offset>=BACKLOG_INDEX_SLOTS_OFFSET && bytes==BACKLOG_INDEX_SLOT_BYTES) return CUT_SLOT;
+            if (offset>=BACKLOG_INDEX_SLOTS_OFFSET && bytes==1 && offset<(long)BACKLOG_INDEX_FILE_BYTES-1) return CUT_ACK;
+            return CUT_INDEX_OTHER;
+        }
+    }
+    return (offset>=SD_LOG_HEADER_BYTES && offset<(long)SD_LOG_DATA_END)?CUT_RECORD:CUT_SEGMENT;
+}
+
+size_t __wrap_fwrite(const void *data, size_t size, size_t count, FILE *file){
+    if (++writes==cut_at){
+        cut_kind=write_kind(file,size*count);
+        __real_fwrite(data,1,size*count/2,file);
+        longjmp(reset,1);
+    }
+    return __real_fwrite(data,size,count,file);
+}
+
+int __wrap_fputc(int c, FILE *file){
+    if (++writes==cut_at){
+        cut_kind=write_kind(file,1);
+        longjmp(reset,1);
+    }
+    return __real_fputc(c,file);
+}
+
+//unbuffered files: the data is in the file when fwrite returns
+int __wrap_fsync(int fd){
+    (void)fd;
+    return 0;
+}
+
+//the files the tasks had open when they were reset
+static void files_close(void){
+    for(uint8_t i=0;i<MAX_FILES;i++){
+        if (files[i].file!=NULL){
+            __wrap_fclose(files[i].file);
+        }
+    }
+}
+
+
+/*======================================================================
+ * FOLDERS
+ ======================================================================*/
+static char base[SD_LOG_FOLDER_BYTES], folder[SD_LOG_FOLDER_BYTES];
+static char packet[PACKET_BYTES], buffer[PACKET_BYTES];
+
+static void folder_make(char *name){
+    strcpy(name,"/tmp/blogXXXXXX");
+    if (mkdtemp(name)==NULL){
+        perror("mkdtemp");
+        exit(1);
+    }
+}
+
+static void folder_empty(const char *name){
+    char path[300];
+    struct dirent *file;
+    DIR *directory=opendir(name);
+
+    while ((file=readdir(directory))!=NULL){
+        if (file->d_name[0]!='.'){
+            snprintf(path,sizeof(path),"%s/%s",name,file->d_name);
+            remove(path);
+        }
+    }
+    closedir(directory);
+}
+
+static void index_path(const char *name, char *path){
+    snprintf(path,BACKLOG_INDEX_PATH_BYTES,"%s/%s",name,BACKLOG_INDEX_NAME);
+}
+
+static void index_copy(const char *from, const char *to){
+    static char data[BACKLOG_INDEX_FILE_BYTES];
+    char path[BACKLOG_INDEX_PATH_BYTES];
+    FILE *file;
+
+    index_path(from,path);
+    file=__real_fopen(path,"rb");
+    CHECK(file!=NULL && fread(data,BACKLOG_INDEX_FILE_BYTES,1,file)==1);
+    __real_fclose(file);
+    index_path(to,path);
+    file=__real_fopen(path,"wb");
+    CHECK(file!=NULL && __real_fwrite(data,BACKLOG_INDEX_FILE_BYTES,1,file)==1);
+    __real_fclose(file);
+}
+
+//checkpoint in the file (newest valid header copy): HEAD, TAIL and the valid copies
+static uint8_t checkpoint_read(const char *name, uint32_t *head, uint32_t *tail){
+    char path[BACKLOG_INDEX_PATH_BYTES];
+    uint8_t header[BACKLOG_INDEX_HEADER_BYTES], valid=0;
+    uint32_t generation=0;
+    FILE *file;
+
+    index_path(name,path);
+    file=__real_fopen(path,"rb");
+    for(uint8_t copy=0;copy<2;copy++){
+        if (fseek(file,copy*BACKLOG_INDEX_HEADER_SPACING,SEEK_SET)==0 && fread(header,BACKLOG_INDEX_HEADER_BYTES,1,file)==1 &&
+            memcmp(header,"DLBI",4)==0 && crc32c(0,header,24)==(((uint32_t)header[24]<<24)|((uint32_t)header[25]<<16)|(header[26]<<8)|header[27])){
+            uint32_t value=((uint32_t)header[12]<<24)|((uint32_t)header[13]<<16)|(header[14]<<8)|header[15];
+
+            if (valid==0 || (int32_t)(value-generation)>0){
+                generation=value;
+                *head=((uint32_t)header[16]<<24)|((uint32_t)header[17]<<16)|(header[18]<<8)|header[19];
+                *tail=((uint32_t)header[20]<<24)|((uint32_t)header[21]<<16)|(header[22]<<8)|header[23];
+            }
+            valid++;
+        }
+    }
+    __real_fclose(file);
+    return valid;
+}
+
+
+/*======================================================================
+ * TASKS OF MAIN.C
+ ======================================================================*/
+static sd_log_t log;
+static backlog_index_t backlog;
+
+//state of every SEQ of the run (SEQ - FIRST_SEQ) as the tasks saw it
+enum {SEQ_NONE, SEQ_SLOT, SEQ_APPENDED, SEQ_ACKED};
+static uint8_t seq_state[MAX_RECORDS+2];
+static int64_t in_flight_ack; //SEQ of the ack being written (-1 none)
+
+static uint32_t packet_make(char *data, uint32_t seq, uint32_t *state){
+    uint32_t size=1000+test_random(state)%(PACKET_BYTES-1000);
+
+    for(uint32_t i=0;i<size;i++){
+        data[i]=(char)(seq*7+i);
+    }
+    memcpy(data,&seq,4);
+    return size;
+}
+
+//sink of the backlog (fill_buffer_with_sd_task): slot, then the record, cancelled if it failed
+static void backlog_append(uint32_t *state){
+    sd_log_location_t location;
+    uint32_t seq, size=packet_make(packet,backlog.tail,state);
+
+    location=sd_log_append_location(&log,size);
+    if (!backlog_index_add(&backlog,location,&seq)){
+        return;
+    }
+    seq_state[seq-FIRST_SEQ]=SEQ_SLOT;
+    if (!sd_log_append(&log,packet,size,seq)){
+        backlog_index_ack(&backlog,seq);
+        return;
+    }
+    seq_state[seq-FIRST_SEQ]=SEQ_APPENDED;
+}
+
+static void run(void){
+    uint32_t taken[MAX_TAKEN], taken_count=0, seq, random=7, choice;
+    sd_log_location_t location;
+
+    writes=0;
+    in_flight_ack=-1;
+    memset(seq_state,0,sizeof(seq_state));
+    CHECK(sd_log_open(&log,folder,LOG_ID) && backlog_index_open(&backlog,&log,INDEX_ID));
+    CHECK(backlog.tail==FIRST_SEQ);
+    for(uint32_t operation=0;operation<OPERATIONS;operation++){
+        choice=test_random(&random)%10;
+        if (choice<4){
+            backlog_append(&random);
+        }
+        else if (choice<7){
+            //upload (sd_data_read_task)
+            if (taken_count<MAX_TAKEN && backlog_index_take(&backlog,&location,&seq)){
+                CHECK(sd_log_read_at(&log,location,buffer,sizeof(buffer))>0 && memcmp(buffer,&seq,4)==0);
+                taken[taken_count++]=seq;
+            }
+        }
+        else if (test_random(&random)%40==0){
+            //uploads lost
+            backlog_index_rewind(&backlog);
+            taken_count=0;
+        }
+        else if (taken_count!=0){
+            uint32_t i=test_random(&random)%taken_count;
+
+            seq=taken[i];
+            taken[i]=taken[--taken_count];
+            in_flight_ack=seq;
+            if (backlog_index_ack(&backlog,seq)){
+                seq_state[seq-FIRST_SEQ]=SEQ_ACKED;
+            }
+            in_flight_ack=-1;
+            sd_log_trim(&log,backlog_index_oldest(&backlog,&location)?location.segment:log.segment);
+        }
+    }
+    backlog_index_close(&backlog);
+    sd_log_close(&log);
+}
+
+
+/*======================================================================
+ * CHECK AFTER A RESET
+ ======================================================================*/
+typedef struct {
+    uint32_t crashes[CUT_KINDS];
+    uint32_t scanned;      //slots found after the checkpoint
+    uint32_t acks_replayed; //HEAD moved by the acks after the checkpoint
+    uint32_t cancelled;    //last slot without its record
+    uint32_t after_wrap;   //resets with TAIL over the end of the ring
+    uint32_t failures;
+} coverage_t;
+
+static void recovery_check(coverage_t *coverage, uint32_t crashed_tail, bool cut_at_header){
+    sd_log_location_t location;
+    uint32_t seq, found, head=0, tail=0, first_pending=0, size, random=99;
+    bool pending[MAX_RECORDS+2]={false}, any=false;
+    int failures=test_failures;
+    uint8_t valid;
+
+    //a cut header copy: the other one is the checkpoint
+    valid=checkpoint_read(folder,&head,&tail);
+    CHECK(valid==2 || (valid==1 && cut_at_header));
+    CHECK(sd_log_open(&log,folder,LOG_ID) && backlog_index_open(&backlog,&log,INDEX_ID+1));
+    CHECK(!backlog.rebuilt && backlog.index_id==INDEX_ID);
+    CHECK(backlog.tail==crashed_tail && backlog.recovered==crashed_tail-tail); //from the newest copy
+    coverage->scanned+=(backlog.tail!=tail);
+    coverage->acks_replayed+=(backlog.head!=head);
+    coverage->after_wrap+=(crashed_tail>BACKLOG_INDEX_SLOTS);
+
+    while (backlog_index_take(&backlog,&location,&seq)){
+        CHECK(seq-FIRST_SEQ<MAX_RECORDS);
+        if (!any){
+            first_pending=seq;
+            any=true;
+        }
+        pending[seq-FIRST_SEQ]=true;
+        CHECK(sd_log_read_at(&log,location,buffer,sizeof(buffer))>0 && memcmp(buffer,&seq,4)==0);
+    }
+    CHECK(backlog.head==(any?first_pending:backlog.tail));
+    for(seq=0;seq<MAX_RECORDS;seq++){
+        if ((int64_t)(seq+FIRST_SEQ)==in_flight_ack){
+            continue;
+        }
+        CHECK(pending[seq]==(seq_state[seq]==SEQ_APPENDED));
+        if (seq_state[seq]==SEQ_SLOT && seq+FIRST_SEQ==crashed_tail-1){
+            coverage->cancelled++;
+        }
+    }
+
+    //the index keeps working: a new record is pending after a close
+    size=packet_make(packet,backlog.tail,&random);
+    location=sd_log_append_location(&log,size);
+    CHECK(backlog_index_add(&backlog,location,&seq) && sd_log_append(&log,packet,size,seq));
+    backlog_index_close(&backlog);
+    sd_log_close(&log);
+    CHECK(sd_log_open(&log,folder,LOG_ID) && backlog_index_open(&backlog,&log,INDEX_ID));
+    CHECK(backlog.tail==seq+1);
+    backlog_index_rewind(&backlog);
+    while (backlog_index_take(&backlog,&location,&found) && found!=seq){
+        //older pending slots
+    }
+    CHECK(found==seq && sd_log_read_at(&log,location,buffer,sizeof(buffer))==(int32_t)size);
+    backlog_index_close(&backlog);
+    sd_log_close(&log);
+
+    coverage->failures+=(test_failures!=failures);
+}
+
+
+/*======================================================================
+ * TESTS
+ ======================================================================*/
+/*The index of the start of every run: FIRST_SEQ slots written and acked (the slots of the
+previous wrap of the ring are valid, with older SEQ), no records in the log*/
+static void base_make(void){
+    sd_log_location_t location={1,0};
+    uint32_t seq;
+
+    folder_make(base);
+    CHECK(sd_log_open(&log,base,LOG_ID) && backlog_index_open(&backlog,&log,INDEX_ID));
+    CHECK(backlog.rebuilt && backlog.tail==0);
+    for(uint32_t i=0;i<FIRST_SEQ;i++){
+        CHECK(backlog_index_add(&backlog,location,&seq) && backlog_index_ack(&backlog,seq));
+    }
+    CHECK(backlog_index_pending(&backlog)==0);
+    backlog_index_close(&backlog);
+    sd_log_close(&log);
+}
+
+static void test_crashes(void){
+    coverage_t coverage={0};
+    uint32_t total, crashed_tail;
+
+    folder_make(folder);
+    index_copy(base,folder);
+    run();
+    total=writes;
+    CHECK(seq_state[BACKLOG_INDEX_SLOTS-FIRST_SEQ+10]!=SEQ_NONE); //the run goes over the wrap
+    recovery_check(&coverage,backlog.tail,false);
+
+    for(uint32_t point=1;point<=total && coverage.failures<=5;point++){
+        uint32_t failures=coverage.failures;
+
+        folder_empty(folder);
+        index_copy(base,folder);
+        cut_at=point;
+        if (setjmp(reset)==0){
+            run();
+            CHECK(false); //the write wasn't cut
+        }
+        cut_at=0;
+        crashed_tail=backlog.tail;
+        files_close();
+        coverage.crashes[cut_kind]++;
+        recovery_check(&coverage,crashed_tail,cut_kind==CUT_HEADER_0 || cut_kind==CUT_HEADER_1);
+        if (coverage.failures!=failures){
+            printf("reset at write %u of %u (%s): not recovered\n",point,total,cut_names[cut_kind]);
+        }
+    }
+
+    printf("%u resets:",total);
+    for(uint8_t kind=0;kind<CUT_KINDS;kind++){
+        printf(" %s %u,",cut_names[kind],coverage.crashes[kind]);
+    }
+    printf(" slots scanned %u, acks replayed %u, last slot cancelled %u, after the wrap %u\n",
+        coverage.scanned,coverage.acks_replayed,coverage.cancelled,coverage.after_wrap);
+    CHECK(coverage.failures==0);
+    for(uint8_t kind=0;kind<CUT_KINDS;kind++){
+        CHECK(kind==CUT_INDEX_OTHER || coverage.crashes[kind]!=0);
+    }
+    CHECK(coverage.scanned!=0 && coverage.acks_replayed!=0 && coverage.cancelled!=0 && coverage.after_wrap!=0);
+    folder_empty(folder);
+    rmdir(folder);
+}
+
+//the index was made again from the 20 records of the log (index_id: INDEX_ID of the new file)
+static void rebuilt_check(uint32_t index_id){
+    sd_log_location_t location;
+    uint32_t seq, count;
+
+    CHECK(sd_log_open(&log,folder,LOG_ID) && backlog_index_open(&backlog,&log,index_id));
+    //a reset after the first header copy: the index was already complete
+    CHECK(backlog.rebuilt?backlog.index_id==index_id:backlog.index_id==INDEX_ID);
+    CHECK(backlog.head==0 && backlog.tail==20);
+    for(count=0;backlog_index_take(&backlog,&location,&seq);count++){
+        CHECK(seq==count && sd_log_read_at(&log,location,buffer,sizeof(buffer))>0 && memcmp(buffer,&seq,4)==0);
+    }
+    CHECK(count==20);
+    backlog_index_close(&backlog);
+    sd_log_close(&log);
+}
+
+/*No index (or no valid header): made again from the log, every record pending, also after a
+reset in the middle of it*/
+static void test_rebuild(void){
+    char path[BACKLOG_INDEX_PATH_BYTES];
+    uint32_t seq, total, random=3;
+    FILE *file;
+
+    folder_make(folder);
+    CHECK(sd_log_open(&log,folder,LOG_ID));
+    for(seq=0;seq<20;seq++){
+        uint32_t size=packet_make(packet,seq,&random);
+
+        CHECK(sd_log_append(&log,packet,size,seq));
+    }
+    sd_log_close(&log);
+
+    writes=0;
+    CHECK(sd_log_open(&log,folder,LOG_ID) && backlog_index_open(&backlog,&log,INDEX_ID));
+    total=writes;
+    CHECK(backlog.rebuilt && backlog_index_pending(&backlog)==20);
+    backlog_index_close(&backlog);
+    sd_log_close(&log);
+
+    //both header copies not valid
+    index_path(folder,path);
+    file=__real_fopen(path,"r+b");
+    CHECK(file!=NULL && fseek(file,4,SEEK_SET)==0 && __real_fputc(9,file)==9);
+    CHECK(fseek(file,BACKLOG_INDEX_HEADER_SPACING+4,SEEK_SET)==0 && __real_fputc(9,file)==9);
+    __real_fclose(file);
+    rebuilt_check(INDEX_ID+1);
+
+    for(uint32_t point=1;point<=total;point++){
+        remove(path);
+        cut_at=point;
+        if (setjmp(reset)==0){
+            writes=0;
+            sd_log_open(&log,folder,LOG_ID);
+            backlog_index_open(&backlog,&log,INDEX_ID);
+            CHECK(false);
+        }
+        cut_at=0;
+        files_close();
+        rebuilt_check(INDEX_ID+2);
+    }
+    folder_empty(folder);
+    rmdir(folder);
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    base_make();
+    test_crashes();
+    test_rebuild();
+    folder_empty(base);
+    rmdir(base);
+    return TEST_END();
+}
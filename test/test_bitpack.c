@@ -0,0 +1,184 @@
+/*
+bitpack.h: hand packed bytes, every width from 1 to 32 bits against a bit by bit reference
+(round trip, padding, no write after the last byte), with every unpacker of this CPU
+(SSE4.1, AVX2: the same samples as the scalar one, signed and unsigned).
+--bench: pack/unpack of a channel of 20 bit samples against the bit by bit loop, unpack
+with every unpacker.
+*/
+#include <string.h>
+
+#include "test.h"
+#include "bitpack.h"
+
+#define MAX_SAMPLES 1500
+#define GUARD 8
+
+//bit by bit, most significant bit first
+static void reference_pack(const int32_t *samples, uint16_t count, uint8_t bits, uint8_t *packed){
+    uint32_t position=0;
+
+    memset(packed,0,BITPACK_BYTES(count,bits));
+    for(uint16_t n=0;n<count;n++){
+        for(int8_t bit=bits-1;bit>=0;bit--,position++){
+            if (((uint32_t)samples[n]>>bit)&1){
+                packed[position/8]|=(uint8_t)(0x80>>(position%8));
+            }
+        }
+    }
+}
+
+static void reference_unpack(const uint8_t *packed, uint16_t count, uint8_t bits, int32_t *samples){
+    uint32_t position=0;
+
+    for(uint16_t n=0;n<count;n++){
+        uint32_t value=0;
+
+        for(uint8_t bit=0;bit<bits;bit++,position++){
+            value=(value<<1)|((packed[position/8]>>(7-position%8))&1);
+        }
+        samples[n]=bits<32 && (value>>(bits-1))&1?(int32_t)(value|(0xFFFFFFFFu<<bits)):(int32_t)value;
+    }
+}
+
+static void test_golden(void){
+    const int32_t samples20[2]={0x12345,-1};
+    const uint8_t bytes20[5]={0x12,0x34,0x5F,0xFF,0xFF};
+    const int32_t samples14[3]={-8192,8191,1};
+    const uint8_t bytes14[6]={0x80,0x01,0xFF,0xF0,0x00,0x40}; //10000000000000 01111111111111 00000000000001 00
+    uint8_t packed[8];
+    int32_t samples[4];
+    uint32_t values[2];
+
+    CHECK(bitpack_pack(samples20,2,20,packed)==5 && memcmp(packed,bytes20,5)==0);
+    CHECK(bitpack_unpack(bytes20,2,20,samples)==5 && samples[0]==0x12345 && samples[1]==-1);
+    CHECK(bitpack_unpack_unsigned(bytes20,2,20,values)==5 && values[0]==0x12345 && values[1]==0xFFFFF);
+    CHECK(bitpack_pack(samples14,3,14,packed)==6 && memcmp(packed,bytes14,6)==0);
+    CHECK(bitpack_unpack(bytes14,3,14,samples)==6 && memcmp(samples,samples14,sizeof(samples14))==0);
+    CHECK(bitpack_pack(samples14,3,0,packed)==0 && bitpack_pack(samples14,3,33,packed)==0);
+    CHECK(bitpack_unpack(bytes14,3,0,samples)==0 && bitpack_unpack(bytes14,3,33,samples)==0);
+    CHECK(bitpack_unpack_unsigned(bytes14,3,0,values)==0);
+}
+
+static void test_widths(void){
+    static int32_t samples[MAX_SAMPLES], decoded[MAX_SAMPLES+GUARD], reference[MAX_SAMPLES];
+    static uint32_t values[MAX_SAMPLES];
+    static uint8_t packed[BITPACK_BYTES(MAX_SAMPLES,32)+GUARD], expected[BITPACK_BYTES(MAX_SAMPLES,32)];
+    uint32_t state=61, errors=0, mask;
+
+    for(uint8_t bits=1;bits<=BITPACK_MAX_BITS;bits++){
+        for(uint8_t round=0;round<20;round++){
+            uint16_t count=(uint16_t)(round<3?round+1u:1+test_random(&state)%MAX_SAMPLES);
+            uint32_t bytes=BITPACK_BYTES(count,bits);
+
+            //values in range, the extremes included
+            for(uint16_t n=0;n<count;n++){
+                uint32_t value=test_random(&state);
+
+                if (bits<32){
+                    value&=(1u<<bits)-1;
+                }
+                samples[n]=bits<32 && (value>>(bits-1))&1?(int32_t)(value|(0xFFFFFFFFu<<bits)):(int32_t)value;
+            }
+            samples[0]=bits==32?INT32_MIN:-(1<<(bits-1));
+            samples[count-1]=bits==32?INT32_MAX:(int32_t)((1u<<(bits-1))-1);
+
+            memset(packed,0xA5,sizeof(packed));
+            reference_pack(samples,count,bits,expected);
+            errors+=bitpack_pack(samples,count,bits,packed)!=bytes;
+            errors+=memcmp(packed,expected,bytes)!=0;
+            for(uint32_t n=bytes;n<bytes+GUARD;n++){
+                errors+=packed[n]!=0xA5;
+            }
+            errors+=bitpack_unpack(packed,count,bits,decoded)!=bytes;
+            reference_unpack(packed,count,bits,reference);
+            errors+=memcmp(decoded,samples,count*sizeof(int32_t))!=0;
+            errors+=memcmp(reference,samples,count*sizeof(int32_t))!=0;
+
+            //every unpacker, no write after the last sample
+            for(uint8_t unpacker=BITPACK_UNPACKER_SCALAR;unpacker<=bitpack_unpacker();unpacker++){
+                memset(decoded,0xA5,sizeof(decoded));
+                errors+=bitpack_unpack_with(unpacker,packed,count,bits,decoded)!=bytes;
+                errors+=memcmp(decoded,samples,count*sizeof(int32_t))!=0;
+                for(uint32_t n=count;n<(uint32_t)count+GUARD;n++){
+                    errors+=(uint32_t)decoded[n]!=0xA5A5A5A5u;
+                }
+            }
+            mask=0xFFFFFFFFu>>(32-bits);
+            errors+=bitpack_unpack_unsigned(packed,count,bits,values)!=bytes;
+            for(uint16_t n=0;n<count;n++){
+                errors+=values[n]!=((uint32_t)samples[n]&mask);
+            }
+        }
+    }
+    CHECK(errors==0);
+
+    //values out of range keep their low bits
+    samples[0]=0x7FFFFF;
+    samples[1]=-0x800000;
+    CHECK(bitpack_pack(samples,2,20,packed)==5);
+    CHECK(bitpack_unpack(packed,2,20,decoded)==5 && decoded[0]==-1 && decoded[1]==0);
+    CHECK(bitpack_unpack_with(bitpack_unpacker()+1,packed,2,20,decoded)==0);
+    printf("unpackers: scalar");
+    for(uint8_t unpacker=BITPACK_UNPACKER_SCALAR+1;unpacker<=bitpack_unpacker();unpacker++){
+        printf(", %s",bitpack_unpacker_name(unpacker));
+    }
+    printf("\n");
+}
+
+static void bench(void){
+    enum {ROUNDS=5000};
+    static int32_t samples[MAX_SAMPLES], decoded[MAX_SAMPLES];
+    static uint8_t packed[BITPACK_BYTES(MAX_SAMPLES,20)];
+    uint32_t state=63;
+    double start, times[4], unpack_times[BITPACK_UNPACKER_AVX2+1];
+
+    for(uint16_t n=0;n<MAX_SAMPLES;n++){
+        samples[n]=(int32_t)(test_random(&state)&0xFFFFF)-0x80000;
+    }
+    start=test_seconds();
+    for(uint32_t n=0;n<ROUNDS;n++){
+        bitpack_pack(samples,MAX_SAMPLES,20,packed);
+        __asm__ volatile("" : : "r"(packed) : "memory");
+    }
+    times[0]=test_seconds()-start;
+    start=test_seconds();
+    for(uint32_t n=0;n<ROUNDS;n++){
+        reference_pack(samples,MAX_SAMPLES,20,packed);
+        __asm__ volatile("" : : "r"(packed) : "memory");
+    }
+    times[1]=test_seconds()-start;
+    start=test_seconds();
+    for(uint32_t n=0;n<ROUNDS;n++){
+        bitpack_unpack(packed,MAX_SAMPLES,20,decoded);
+        __asm__ volatile("" : : "r"(decoded) : "memory");
+    }
+    times[2]=test_seconds()-start;
+    start=test_seconds();
+    for(uint32_t n=0;n<ROUNDS;n++){
+        reference_unpack(packed,MAX_SAMPLES,20,decoded);
+        __asm__ volatile("" : : "r"(decoded) : "memory");
+    }
+    times[3]=test_seconds()-start;
+    for(uint8_t unpacker=BITPACK_UNPACKER_SCALAR;unpacker<=bitpack_unpacker();unpacker++){
+        start=test_seconds();
+        for(uint32_t n=0;n<ROUNDS;n++){
+            bitpack_unpack_with(unpacker,packed,MAX_SAMPLES,20,decoded);
+            __asm__ volatile("" : : "r"(decoded) : "memory");
+        }
+        unpack_times[unpacker]=test_seconds()-start;
+    }
+    printf("bench %d samples of 20 bits: pack %.2f us (bit by bit %.2f us), unpack %.2f us (bit by bit %.2f us)\n",MAX_SAMPLES,
+        times[0]*1e6/ROUNDS,times[1]*1e6/ROUNDS,times[2]*1e6/ROUNDS,times[3]*1e6/ROUNDS);
+    for(uint8_t unpacker=BITPACK_UNPACKER_SCALAR;unpacker<=bitpack_unpacker();unpacker++){
+        printf("    unpack %-6s %.2f us\n",bitpack_unpacker_name(unpacker),unpack_times[unpacker]*1e6/ROUNDS);
+    }
+}
+
+int main(int argc, char **argv){
+    test_golden();
+    test_widths();
+    if (test_bench(argc,argv)){
+        bench();
+    }
+    return TEST_END();
+}
@@ -0,0 +1,376 @@
+/*
+buffer_pool.h: hold/release/abandon rules in one thread, then a stress test with the tasks
+of the firmware as threads: the selection task holds a random set of sinks and sends the
+buffer to their queues, three sink threads read it and release it (or abandon it, then it
+is selected again). Every packet is delivered to each of its sinks, no buffer is reused
+while a sink still reads it and every buffer is empty at the end.
+Cold tier: sizing from the free PSRAM and the route of every full packet (the table of
+buffer_pool.h) for every state.
+*/
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "test.h"
+#include "buffer_pool.h"
+
+#define BUFFERS 6
+#define BUFFER_BYTES 256
+#define SINKS 3
+
+static void test_rules(void){
+    buffer_pool_t pool;
+    char other[4];
+    char *buffer;
+
+    buffer_pool_init(&pool,BUFFER_BYTES);
+    CHECK(buffer_pool_add(&pool,2,BUFFER_TIER_HOT,malloc)==2);
+    CHECK(buffer_pool_add(&pool,3,BUFFER_TIER_COLD,malloc)==3);
+    CHECK(buffer_pool_add(&pool,1,7,malloc)==0);
+    CHECK(pool.count==5 && pool.tier_count[BUFFER_TIER_HOT]==2 && pool.tier_count[BUFFER_TIER_COLD]==3);
+    CHECK(buffer_pool_get(&pool,5)==NULL);
+    CHECK(buffer_pool_index(&pool,buffer_pool_get(&pool,3))==3 && buffer_pool_index(&pool,other)==-1);
+    CHECK(buffer_pool_tier(&pool,buffer_pool_get(&pool,1))==BUFFER_TIER_HOT);
+    CHECK(buffer_pool_tier(&pool,buffer_pool_get(&pool,2))==BUFFER_TIER_COLD);
+
+    buffer=buffer_pool_get(&pool,0);
+    CHECK(buffer_pool_hold(&pool,buffer,BUFFER_SINK_WIFI|BUFFER_SINK_SD_ARCHIVE));
+    //a sink twice, an unknown sink or buffer
+    CHECK(!buffer_pool_hold(&pool,buffer,BUFFER_SINK_WIFI|BUFFER_SINK_SD_BACKLOG));
+    CHECK(!buffer_pool_hold(&pool,buffer,1u<<5) && !buffer_pool_hold(&pool,other,BUFFER_SINK_WIFI));
+    CHECK(buffer_pool_pending(&pool,buffer)==(BUFFER_SINK_WIFI|BUFFER_SINK_SD_ARCHIVE));
+    CHECK(buffer_pool_release(&pool,buffer,BUFFER_SINK_SD_BACKLOG)==BUFFER_POOL_ERROR);
+    CHECK(buffer_pool_release(&pool,buffer,BUFFER_SINK_WIFI|BUFFER_SINK_SD_ARCHIVE)==BUFFER_POOL_ERROR);
+    CHECK(buffer_pool_release(&pool,buffer,BUFFER_SINK_WIFI)==BUFFER_POOL_HELD);
+    CHECK(buffer_pool_release(&pool,buffer,BUFFER_SINK_WIFI)==BUFFER_POOL_ERROR);
+    //a sink that still holds its reference adds another one
+    CHECK(buffer_pool_hold(&pool,buffer,BUFFER_SINK_SD_BACKLOG));
+    CHECK(buffer_pool_release(&pool,buffer,BUFFER_SINK_SD_ARCHIVE)==BUFFER_POOL_HELD);
+    CHECK(buffer_pool_release(&pool,buffer,BUFFER_SINK_SD_BACKLOG)==BUFFER_POOL_FREE);
+    CHECK(buffer_pool_pending(&pool,buffer)==0);
+
+    //abandoned by one sink: the last release redelivers, once
+    CHECK(buffer_pool_hold(&pool,buffer,BUFFER_SINK_WIFI|BUFFER_SINK_SD_ARCHIVE));
+    CHECK(buffer_pool_abandon(&pool,buffer,BUFFER_SINK_WIFI)==BUFFER_POOL_HELD);
+    CHECK(buffer_pool_release(&pool,buffer,BUFFER_SINK_SD_ARCHIVE)==BUFFER_POOL_REDELIVER);
+    CHECK(buffer_pool_hold(&pool,buffer,BUFFER_SINK_WIFI));
+    CHECK(buffer_pool_release(&pool,buffer,BUFFER_SINK_WIFI)==BUFFER_POOL_FREE);
+
+    for(uint16_t i=0;i<pool.count;i++){
+        free(buffer_pool_get(&pool,i));
+    }
+}
+
+static void test_cold_count(void){
+    //4 MB of PSRAM, 32 KB buffers, 512 KB for the rest of the firmware
+    CHECK(buffer_pool_cold_count(4u<<20,4u<<20,512u<<10,32768,BUFFER_POOL_MAX)==(3584u<<10)/(32768+BUFFER_POOL_ALLOC_OVERHEAD));
+    CHECK(buffer_pool_cold_count(4u<<20,4u<<20,512u<<10,32768,20)==20);
+    //short packets: many buffers, BUFFER_POOL_MAX at most
+    CHECK(buffer_pool_cold_count(4u<<20,4u<<20,0,1000,BUFFER_POOL_MAX)==BUFFER_POOL_MAX);
+    //no PSRAM, not more than the reserve, fragmented or a buffer of 0 bytes
+    CHECK(buffer_pool_cold_count(0,0,0,32768,BUFFER_POOL_MAX)==0);
+    CHECK(buffer_pool_cold_count(512u<<10,512u<<10,512u<<10,32768,BUFFER_POOL_MAX)==0);
+    CHECK(buffer_pool_cold_count(4u<<20,32767,0,32768,BUFFER_POOL_MAX)==0);
+    CHECK(buffer_pool_cold_count(4u<<20,4u<<20,0,0,BUFFER_POOL_MAX)==0);
+    //exactly one buffer with its heap overhead
+    CHECK(buffer_pool_cold_count(100+32768+BUFFER_POOL_ALLOC_OVERHEAD,32768,100,32768,BUFFER_POOL_MAX)==1);
+    CHECK(buffer_pool_cold_count(100+32768+BUFFER_POOL_ALLOC_OVERHEAD-1,32768,100,32768,BUFFER_POOL_MAX)==0);
+}
+
+//the route table of buffer_pool.h written again, for every state
+static uint8_t expected_route(const buffer_route_state_t *state, uint32_t *sinks){
+    uint32_t target=state->wifi?BUFFER_SINK_WIFI:state->sd?BUFFER_SINK_SD_BACKLOG:0;
+    bool busy=state->wifi?state->wifi_waiting>=state->busy_waiting:state->sd_waiting>=state->busy_waiting;
+
+    if (state->wifi && state->sd && state->archive && state->sensor_data){
+        target|=BUFFER_SINK_SD_ARCHIVE;
+    }
+    *sinks=0;
+    if (target!=0 && (!busy || (!state->cold && state->cold_free==0))){
+        *sinks=target;
+        return BUFFER_ROUTE_SINKS;
+    }
+    if (state->cold){
+        return BUFFER_ROUTE_KEEP;
+    }
+    if (state->cold_free!=0){
+        return BUFFER_ROUTE_COLD;
+    }
+    return state->cold_used!=0?BUFFER_ROUTE_RECYCLE:BUFFER_ROUTE_DROP;
+}
+
+static void test_route(void){
+    buffer_route_state_t state={0};
+    uint32_t sinks, expected_sinks, errors=0, count[5]={0};
+
+    state.busy_waiting=2;
+    for(uint32_t bits=0;bits<(1u<<9);bits++){
+        uint8_t route;
+
+        state.wifi=bits&1;
+        state.sd=(bits>>1)&1;
+        state.archive=(bits>>2)&1;
+        state.sensor_data=(bits>>3)&1;
+        state.cold=(bits>>4)&1;
+        state.wifi_waiting=(bits>>5)&1?2:1;
+        state.sd_waiting=(bits>>6)&1?3:0;
+        state.cold_free=(bits>>7)&1?5:0;
+        state.cold_used=(bits>>8)&1?7:0;
+        //a cold packet doesn't take a cold buffer
+        if (state.cold && state.cold_used==0){
+            continue;
+        }
+        route=buffer_pool_route(&state,&sinks);
+        errors+=route!=expected_route(&state,&expected_sinks) || sinks!=expected_sinks;
+        count[route]++;
+    }
+    CHECK(errors==0);
+    for(uint8_t route=0;route<5;route++){
+        CHECK(count[route]!=0);
+    }
+
+    //the cases of the table
+    memset(&state,0,sizeof(state));
+    state.busy_waiting=2;
+    state.wifi=state.sd=state.archive=state.sensor_data=true;
+    CHECK(buffer_pool_route(&state,&sinks)==BUFFER_ROUTE_SINKS && sinks==(BUFFER_SINK_WIFI|BUFFER_SINK_SD_ARCHIVE));
+    state.sensor_data=false; //a packet of the SD backlog isn't archived again
+    CHECK(buffer_pool_route(&state,&sinks)==BUFFER_ROUTE_SINKS && sinks==BUFFER_SINK_WIFI);
+    state.wifi=false;
+    CHECK(buffer_pool_route(&state,&sinks)==BUFFER_ROUTE_SINKS && sinks==BUFFER_SINK_SD_BACKLOG);
+    state.sd_waiting=2;
+    state.cold_free=1;
+    CHECK(buffer_pool_route(&state,&sinks)==BUFFER_ROUTE_COLD && sinks==0);
+    state.cold_free=0;
+    CHECK(buffer_pool_route(&state,&sinks)==BUFFER_ROUTE_SINKS && sinks==BUFFER_SINK_SD_BACKLOG);
+    state.sd=false;
+    state.cold_used=3;
+    CHECK(buffer_pool_route(&state,&sinks)==BUFFER_ROUTE_RECYCLE);
+    state.cold=true;
+    CHECK(buffer_pool_route(&state,&sinks)==BUFFER_ROUTE_KEEP);
+    state.cold=false;
+    state.cold_used=0;
+    CHECK(buffer_pool_route(&state,&sinks)==BUFFER_ROUTE_DROP);
+}
+
+/*======================================================================
+ * STRESS TEST
+ ======================================================================*/
+//blocking queue of pointers (the FreeRTOS queues of main.c)
+typedef struct {
+    char *items[BUFFERS+1]; //the end message of the sinks too
+    uint32_t head, count;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+} queue_t;
+
+static void queue_init(queue_t *queue){
+    memset(queue,0,sizeof(queue_t));
+    pthread_mutex_init(&queue->mutex,NULL);
+    pthread_cond_init(&queue->changed,NULL);
+}
+
+static atomic_uint errors;
+
+//a buffer in two places at once fills a queue
+static void queue_send(queue_t *queue, char *item){
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->count==BUFFERS+1){
+        atomic_fetch_add(&errors,1);
+        pthread_mutex_unlock(&queue->mutex);
+        return;
+    }
+    queue->items[(queue->head+queue->count)%(BUFFERS+1)]=item;
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+//NULL after timeout_ms (0 = wait forever, QUEUE_NO_WAIT = only if there is one)
+#define QUEUE_NO_WAIT UINT32_MAX
+
+static char *queue_receive(queue_t *queue, uint32_t timeout_ms){
+    struct timespec deadline;
+    char *item=NULL;
+
+    clock_gettime(CLOCK_REALTIME,&deadline);
+    deadline.tv_nsec+=(long)(timeout_ms%1000)*1000000;
+    deadline.tv_sec+=timeout_ms/1000+deadline.tv_nsec/1000000000;
+    deadline.tv_nsec%=1000000000;
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->count==0 && timeout_ms!=QUEUE_NO_WAIT){
+        if (timeout_ms==0){
+            pthread_cond_wait(&queue->changed,&queue->mutex);
+        }
+        else if (pthread_cond_timedwait(&queue->changed,&queue->mutex,&deadline)!=0){
+            break;
+        }
+    }
+    if (queue->count!=0){
+        item=queue->items[queue->head];
+        queue->head=(queue->head+1)%(BUFFERS+1);
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+enum {PACKETS=200000};
+
+static buffer_pool_t pool;
+static queue_t queue_empty, queue_full, queue_sink[SINKS];
+static const uint32_t sink_bits[SINKS]={BUFFER_SINK_WIFI,BUFFER_SINK_SD_ARCHIVE,BUFFER_SINK_SD_BACKLOG};
+static uint32_t targets[PACKETS];                  //sinks of every packet
+static atomic_uint delivered[PACKETS];             //sinks that delivered it
+static atomic_uint abandoned_sinks[BUFFERS];        //sinks that abandoned the packet of a buffer
+static atomic_uint corrupted, redelivered, abandons;
+
+//packet "sequence" in the whole buffer
+static void packet_fill(char *buffer, uint32_t sequence){
+    for(uint32_t i=0;i<BUFFER_BYTES;i+=4){
+        memcpy(&buffer[i],&sequence,4);
+    }
+}
+
+static bool packet_valid(const char *buffer, uint32_t *sequence){
+    memcpy(sequence,buffer,4);
+    for(uint32_t i=4;i<BUFFER_BYTES;i+=4){
+        if (memcmp(&buffer[i],sequence,4)!=0){
+            return false;
+        }
+    }
+    return *sequence<PACKETS;
+}
+
+static void *sink_thread(void *argument){
+    uint8_t sink=(uint8_t)(uintptr_t)argument;
+    uint32_t state=101+sink, sequence;
+    char *buffer;
+    int8_t result;
+
+    while((buffer=queue_receive(&queue_sink[sink],0))!=NULL){
+        if (buffer==(char *)&queue_sink[sink]){
+            break; //end
+        }
+        if (!packet_valid(buffer,&sequence)){
+            atomic_fetch_add(&corrupted,1);
+            continue;
+        }
+        if ((test_random(&state)&31)==0){
+            atomic_fetch_or(&abandoned_sinks[buffer_pool_index(&pool,buffer)],sink_bits[sink]);
+            atomic_fetch_add(&abandons,1);
+            result=buffer_pool_abandon(&pool,buffer,sink_bits[sink]);
+        }
+        else{
+            atomic_fetch_or(&delivered[sequence],sink_bits[sink]);
+            //read it again after the release of the other sinks (no reuse while it's held)
+            if (!packet_valid(buffer,&sequence)){
+                atomic_fetch_add(&corrupted,1);
+            }
+            result=buffer_pool_release(&pool,buffer,sink_bits[sink]);
+        }
+        if ((test_random(&state)&7)==0){
+            sched_yield();
+        }
+        if (result==BUFFER_POOL_FREE){
+            queue_send(&queue_empty,buffer);
+        }
+        else if (result==BUFFER_POOL_REDELIVER){
+            queue_send(&queue_full,buffer);
+        }
+        else if (result==BUFFER_POOL_ERROR){
+            atomic_fetch_add(&errors,1);
+        }
+    }
+    return NULL;
+}
+
+//selection task: a redelivered packet to the sinks that abandoned it, else a new packet
+static void select_buffer(char *buffer, uint32_t sinks){
+    if (!buffer_pool_hold(&pool,buffer,sinks)){
+        atomic_fetch_add(&errors,1);
+        return;
+    }
+    for(uint8_t sink=0;sink<SINKS;sink++){
+        if (sinks & sink_bits[sink]){
+            queue_send(&queue_sink[sink],buffer);
+        }
+    }
+}
+
+static void test_stress(void){
+    pthread_t threads[SINKS];
+    uint32_t state=99, sequence=0, missing=0, empty=0;
+    char *buffer;
+
+    buffer_pool_init(&pool,BUFFER_BYTES);
+    buffer_pool_add(&pool,BUFFERS,BUFFER_TIER_HOT,malloc);
+    queue_init(&queue_empty);
+    queue_init(&queue_full);
+    for(uint8_t sink=0;sink<SINKS;sink++){
+        queue_init(&queue_sink[sink]);
+    }
+    for(uint16_t i=0;i<BUFFERS;i++){
+        queue_send(&queue_empty,buffer_pool_get(&pool,i));
+    }
+    for(uint8_t sink=0;sink<SINKS;sink++){
+        pthread_create(&threads[sink],NULL,sink_thread,(void *)(uintptr_t)sink);
+    }
+
+    while(sequence<PACKETS && errors==0){
+        if ((buffer=queue_receive(&queue_full,QUEUE_NO_WAIT))!=NULL){
+            int16_t index=buffer_pool_index(&pool,buffer);
+
+            atomic_fetch_add(&redelivered,1);
+            select_buffer(buffer,atomic_exchange(&abandoned_sinks[index],0));
+            continue;
+        }
+        if ((buffer=queue_receive(&queue_empty,1))==NULL){
+            continue;
+        }
+        targets[sequence]=sink_bits[test_random(&state)%SINKS];
+        targets[sequence]|=(test_random(&state)&1)?sink_bits[test_random(&state)%SINKS]:0;
+        packet_fill(buffer,sequence);
+        select_buffer(buffer,targets[sequence]);
+        sequence++;
+    }
+    //every buffer back to the empty queue (the last redeliveries included)
+    while(empty<BUFFERS && errors==0){
+        if ((buffer=queue_receive(&queue_full,QUEUE_NO_WAIT))!=NULL){
+            select_buffer(buffer,atomic_exchange(&abandoned_sinks[buffer_pool_index(&pool,buffer)],0));
+        }
+        if (queue_receive(&queue_empty,1)!=NULL){
+            empty++;
+        }
+    }
+    if (errors!=0){
+        CHECK(errors==0); //the sink threads may be blocked, they end with the program
+        return;
+    }
+    for(uint8_t sink=0;sink<SINKS;sink++){
+        queue_send(&queue_sink[sink],(char *)&queue_sink[sink]);
+        pthread_join(threads[sink],NULL);
+    }
+
+    for(uint32_t n=0;n<PACKETS;n++){
+        missing+=atomic_load(&delivered[n])!=targets[n];
+    }
+    for(uint16_t i=0;i<BUFFERS;i++){
+        CHECK(buffer_pool_pending(&pool,buffer_pool_get(&pool,i))==0);
+        CHECK(atomic_load(&pool.slots[i].references)==0);
+        free(buffer_pool_get(&pool,i));
+    }
+    CHECK(errors==0 && corrupted==0 && missing==0);
+    CHECK(abandons>0 && redelivered>0);
+    printf("stress: %u packets, %u abandoned by a sink and redelivered %u times\n",PACKETS,abandons,redelivered);
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    test_rules();
+    test_cold_count();
+    test_route();
+    test_stress();
+    return TEST_END();
+}
@@ -0,0 +1,308 @@
+/*
+clock_discipline.c: the servo against a simulated sample timer (the alarm and the Q16 trim
+accumulator of timer_isr_handler) and simulated SQW edges with injected drift, jitter, a
+temperature ramp, lost and spurious edges, holdover and out of range crystals.
+*/
+#include <math.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "clock_discipline.h"
+
+#define COUNTS_PER_SECOND 1000000 //TIMER_SCALE (1 count = 1 us)
+#define RATE 100
+#define PERIOD (COUNTS_PER_SECOND/RATE)
+#define TASK_LATENCY 2000 //counts between the edge and timer_set_trim (clock_discipline_task)
+
+typedef struct {
+    //timer (timer_conf.c)
+    uint64_t alarm;         //next alarm value
+    uint64_t last_tick;     //alarm value of the last tick
+    int32_t accumulator;    //trim_accumulator
+    int32_t trim;           //period_trim
+    int32_t pending_trim;   //trim set TASK_LATENCY counts after the edge
+    uint64_t pending_at;
+
+    //crystal of the timer: counts = rate_ppm of COUNTS_PER_SECOND per real second
+    double drift_ppm;
+    double counter;         //counter value at "second"
+    double rtc_phase;       //real time of the first RTC edge (s)
+    uint32_t second;        //RTC seconds simulated
+    uint32_t random;
+    uint32_t jitter;        //counts of ISR latency, 0..jitter
+
+    clock_discipline_t clock;
+    double offset_max;      //max |OFFSET| since reset_stats
+    double offset_sum2;
+    uint32_t offset_count;
+} sim_t;
+
+static void sim_init(sim_t *sim, double drift_ppm, uint32_t jitter, uint32_t seed){
+    sim->alarm=PERIOD;
+    sim->last_tick=0;
+    sim->accumulator=0;
+    sim->trim=0;
+    sim->pending_trim=0;
+    sim->pending_at=0;
+    sim->drift_ppm=drift_ppm;
+    sim->rtc_phase=0.3731; //edges aren't on a tick at the start
+    sim->counter=sim->rtc_phase*COUNTS_PER_SECOND*(1+drift_ppm*1e-6);
+    sim->second=0;
+    sim->random=seed;
+    sim->jitter=jitter;
+    clock_discipline_init(&sim->clock,PERIOD,RATE,COUNTS_PER_SECOND);
+}
+
+static void reset_stats(sim_t *sim){
+    sim->offset_max=0;
+    sim->offset_sum2=0;
+    sim->offset_count=0;
+}
+
+//ticks of the timer until "counter" (timer_isr_handler)
+static void run_timer(sim_t *sim, uint64_t counter){
+    while (sim->alarm<=counter){
+        if (sim->pending_at!=0 && sim->alarm>=sim->pending_at){
+            sim->trim=sim->pending_trim;
+            sim->pending_at=0;
+        }
+        sim->last_tick=sim->alarm;
+        sim->accumulator+=sim->trim;
+        sim->alarm+=(uint64_t)((int64_t)PERIOD+(sim->accumulator>>16));
+        sim->accumulator&=0xFFFF;
+    }
+}
+
+/*One RTC second: the counter goes forward with the crystal, the edge (if "edge") is latched
+with the ISR latency and given to the servo*/
+static void sim_second(sim_t *sim, bool edge){
+    uint64_t latched;
+
+    sim->counter+=COUNTS_PER_SECOND*(1+sim->drift_ppm*1e-6);
+    sim->second++;
+    latched=(uint64_t)sim->counter+(sim->jitter!=0?test_random(&sim->random)%(sim->jitter+1):0);
+    run_timer(sim,latched);
+    if (!edge){
+        return;
+    }
+    sim->pending_trim=clock_discipline_edge(&sim->clock,latched,sim->last_tick);
+    sim->pending_at=latched+TASK_LATENCY;
+
+    if (fabs((double)sim->clock.offset)>sim->offset_max){
+        sim->offset_max=fabs((double)sim->clock.offset);
+    }
+    sim->offset_sum2+=(double)sim->clock.offset*sim->clock.offset;
+    sim->offset_count++;
+}
+
+static double offset_rms(const sim_t *sim){
+    return sim->offset_count!=0?sqrt(sim->offset_sum2/sim->offset_count):0;
+}
+
+//seconds until the servo is locked (0 = never within "seconds")
+static uint32_t run_until_locked(sim_t *sim, uint32_t seconds){
+    for(uint32_t i=0;i<seconds;i++){
+        sim_second(sim,true);
+        if (sim->clock.locked){
+            return i+1;
+        }
+    }
+    return 0;
+}
+
+
+/*======================================================================
+ * TESTS
+ ======================================================================*/
+/*Constant drift without jitter: lock, OFFSET ~0, the trim measures the crystal*/
+static void test_drift(void){
+    static const double drifts[]={0,30,-45,120,-300};
+    sim_t sim;
+
+    for(uint8_t i=0;i<sizeof(drifts)/sizeof(drifts[0]);i++){
+        uint32_t locked;
+
+        sim_init(&sim,drifts[i],0,1);
+        locked=run_until_locked(&sim,300);
+        CHECK(locked!=0 && locked<150);
+        for(uint32_t s=0;s<300;s++){
+            sim_second(&sim,true);
+        }
+        reset_stats(&sim);
+        for(uint32_t s=0;s<600;s++){
+            sim_second(&sim,true);
+        }
+        CHECK(sim.clock.locked);
+        CHECK(sim.offset_max<=1);
+        CHECK(fabs(clock_discipline_ppb(&sim.clock)-drifts[i]*1000)<100); //0.1 ppm
+        CHECK(sim.clock.rejected==0);
+    }
+}
+
+/*Step response from half a period of phase error: critically damped PI, the overshoot of
+its zero (~15 %) and no ringing*/
+static void test_step(void){
+    sim_t sim;
+    int32_t first=0, overshoot=0;
+    uint8_t crossings=0;
+
+    sim_init(&sim,0,0,1);
+    sim.rtc_phase=0;
+    sim.counter=PERIOD/2-1; //edges in the middle of two ticks
+    for(uint32_t s=0;s<200;s++){
+        sim_second(&sim,true);
+        if (sim.clock.edges==1){
+            first=sim.clock.offset;
+        }
+        if (first!=0 && (int64_t)sim.clock.offset*first<0 && abs(sim.clock.offset)>overshoot){
+            overshoot=abs(sim.clock.offset);
+        }
+        if (first!=0 && abs(sim.clock.offset)>2 && (int64_t)sim.clock.offset*first<0 && crossings%2==0){
+            crossings++;
+        }
+        if (first!=0 && abs(sim.clock.offset)>2 && (int64_t)sim.clock.offset*first>0 && crossings%2==1){
+            crossings++;
+        }
+    }
+    CHECK(abs(first)>=PERIOD/2-2);
+    CHECK(overshoot<abs(first)/5);
+    CHECK(crossings==1);
+    CHECK(sim.clock.locked && abs(sim.clock.offset)<=1);
+}
+
+/*ISR latency jitter: the loop filters it, the residual is about the jitter*/
+static void test_jitter(void){
+    sim_t sim;
+
+    sim_init(&sim,37.5,10,5);
+    CHECK(run_until_locked(&sim,300)!=0);
+    reset_stats(&sim);
+    for(uint32_t s=0;s<3600;s++){
+        sim_second(&sim,true);
+    }
+    CHECK(sim.offset_max<=CLOCK_DISCIPLINE_LOCK_COUNTS);
+    CHECK(offset_rms(&sim)<8);
+    CHECK(sim.clock.locked);
+    CHECK(abs(clock_discipline_ppb(&sim.clock)-37500)<2000);
+    //offset_mean (1/16 counts) of a uniform jitter of 0..10 counts
+    CHECK((sim.clock.offset_mean>>4)>=1 && (sim.clock.offset_mean>>4)<=10);
+    printf("jitter 0..10 counts: offset rms %.2f max %.0f counts\n",offset_rms(&sim),sim.offset_max);
+}
+
+/*Temperature: the crystal changes 0.02 ppm per second (10 ppm in 500 s)*/
+static void test_ramp(void){
+    sim_t sim;
+
+    sim_init(&sim,-20,3,9);
+    CHECK(run_until_locked(&sim,300)!=0);
+    reset_stats(&sim);
+    for(uint32_t s=0;s<500;s++){
+        sim.drift_ppm+=0.02;
+        sim_second(&sim,true);
+    }
+    CHECK(sim.clock.locked);
+    CHECK(sim.offset_max<=CLOCK_DISCIPLINE_LOCK_COUNTS);
+    CHECK(abs(clock_discipline_ppb(&sim.clock)+10000)<1500);
+    printf("ramp 0.02 ppm/s: offset max %.0f counts\n",sim.offset_max);
+}
+
+/*One edge of every 7 lost (measurement of two seconds) and spurious edges in the middle of
+the seconds (noise in the SQW line): rejected, the lock is kept*/
+static void test_lost_and_spurious(void){
+    sim_t sim;
+    uint32_t rejected;
+
+    sim_init(&sim,55,2,3);
+    CHECK(run_until_locked(&sim,300)!=0);
+    reset_stats(&sim);
+    for(uint32_t s=0;s<1000;s++){
+        sim_second(&sim,s%7!=0);
+    }
+    CHECK(sim.clock.locked && sim.offset_max<=CLOCK_DISCIPLINE_LOCK_COUNTS);
+    CHECK(sim.clock.rejected==0);
+
+    for(uint32_t s=0;s<100;s++){
+        uint64_t noise=(uint64_t)sim.counter+COUNTS_PER_SECOND/3+test_random(&sim.random)%1000;
+        int32_t trim=sim.clock.trim;
+
+        CHECK(clock_discipline_edge(&sim.clock,noise,sim.last_tick)==trim);
+        sim_second(&sim,true);
+    }
+    rejected=sim.clock.rejected;
+    CHECK(rejected==100);
+    CHECK(sim.clock.locked && sim.offset_max<=CLOCK_DISCIPLINE_LOCK_COUNTS);
+}
+
+/*No edges for 10 minutes: the trim is kept (holdover), the phase error grows only with the
+error of the frequency, the next edges lock again*/
+static void test_holdover(void){
+    sim_t sim;
+    int32_t trim;
+
+    sim_init(&sim,-80,1,4);
+    CHECK(run_until_locked(&sim,300)!=0);
+    for(uint32_t s=0;s<300;s++){
+        sim_second(&sim,true);
+    }
+    trim=sim.clock.trim;
+    clock_discipline_lost(&sim.clock);
+    CHECK(!sim.clock.locked);
+    for(uint32_t s=0;s<600;s++){
+        sim_second(&sim,false);
+    }
+    CHECK(sim.trim==trim);
+
+    //first edge: only the start, the second one measures the phase of the holdover
+    sim_second(&sim,true);
+    sim_second(&sim,true);
+    CHECK(abs(sim.clock.offset)<=20);
+    reset_stats(&sim);
+    CHECK(run_until_locked(&sim,300)!=0);
+    CHECK(sim.offset_max<=20);
+
+    //a new crystal error after the holdover (the board warmed up)
+    clock_discipline_lost(&sim.clock);
+    sim.drift_ppm=-60;
+    for(uint32_t s=0;s<60;s++){
+        sim_second(&sim,false);
+    }
+    CHECK(run_until_locked(&sim,300)!=0);
+    for(uint32_t s=0;s<300;s++){
+        sim_second(&sim,true);
+    }
+    CHECK(abs(clock_discipline_ppb(&sim.clock)+60000)<300); //1 count of jitter = 125 ppb of KP
+}
+
+/*A crystal near CLOCK_DISCIPLINE_MAX_PPM is still locked, further than MAX_PPM every edge
+is rejected (the trim isn't changed)*/
+static void test_limits(void){
+    sim_t sim;
+
+    //the trim near its limit leaves little to pull the phase in, slower lock
+    sim_init(&sim,CLOCK_DISCIPLINE_MAX_PPM-20,0,6);
+    CHECK(run_until_locked(&sim,600)!=0);
+    for(uint32_t s=0;s<300;s++){
+        sim_second(&sim,true);
+    }
+    CHECK(abs(clock_discipline_ppb(&sim.clock)-(CLOCK_DISCIPLINE_MAX_PPM-20)*1000)<100);
+    CHECK(abs(clock_discipline_ppb(&sim.clock))<=CLOCK_DISCIPLINE_MAX_PPM*1000);
+
+    sim_init(&sim,CLOCK_DISCIPLINE_MAX_PPM*1.5,0,6);
+    for(uint32_t s=0;s<100;s++){
+        sim_second(&sim,true);
+    }
+    CHECK(!sim.clock.locked && sim.clock.edges==0 && sim.clock.rejected==99 && sim.clock.trim==0);
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    test_drift();
+    test_step();
+    test_jitter();
+    test_ramp();
+    test_lost_and_spurious();
+    test_holdover();
+    test_limits();
+    return TEST_END();
+}
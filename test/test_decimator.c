@@ -0,0 +1,214 @@
+/*
+decimator.h: bit-exact against a direct-form reference, frequency response of the built-in
+coefficient sets (pass band and the band that aliases into it) and pack/unpack.
+--bench: cost of decimator_push per input sample and channel.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "test.h"
+#include "decimator.h"
+
+#define CHANNELS 3
+#define MAX_TAPS 81
+
+static const uint8_t ratios[3]={2,5,10};
+
+//direct form: output m is the window that ends with input (m+1)*ratio-1 (zeros before input 0)
+static int32_t reference(const int16_t *coeffs, uint16_t taps, const int32_t *x, uint32_t newest){
+    int64_t sum=0;
+
+    for(uint16_t k=0;k<taps;k++){
+        int64_t n=(int64_t)newest-taps+1+k;
+
+        sum+=n<0?0:(int64_t)coeffs[k]*x[n];
+    }
+    return (int32_t)((sum+(1<<14))>>15);
+}
+
+static void test_coefficients(void){
+    uint16_t taps;
+
+    for(uint8_t i=0;i<3;i++){
+        const int16_t *coeffs=decimator_coefficients(ratios[i],&taps);
+        int32_t sum=0;
+
+        CHECK(coeffs!=NULL && taps==8*ratios[i]+1);
+        for(uint16_t k=0;k<taps;k++){
+            sum+=coeffs[k];
+            CHECK(coeffs[k]==coeffs[taps-1-k]); //linear phase
+        }
+        CHECK(sum==32768); //DC gain 1
+    }
+    CHECK(decimator_coefficients(3,&taps)==NULL && taps==0);
+}
+
+static void test_bit_exact(void){
+    enum {INPUTS=20000};
+    static int32_t x[CHANNELS][INPUTS];
+    int32_t history[DECIMATOR_HISTORY_SIZE(CHANNELS,MAX_TAPS)];
+    int32_t input[CHANNELS], output[CHANNELS];
+    uint32_t state=5, errors=0, outputs;
+    decimator_t decimator;
+    uint16_t taps;
+
+    //full scale 24 bit noise and the extreme values
+    for(uint32_t n=0;n<INPUTS;n++){
+        for(uint8_t channel=0;channel<CHANNELS;channel++){
+            x[channel][n]=(int32_t)(test_random(&state)&0xFFFFFF)-0x800000;
+        }
+        x[1][n]=(n/50)%2?0x7FFFFF:-0x800000;
+    }
+    for(uint8_t i=0;i<3;i++){
+        const int16_t *coeffs=decimator_coefficients(ratios[i],&taps);
+
+        CHECK(decimator_init(&decimator,coeffs,taps,ratios[i],CHANNELS,history));
+        outputs=0;
+        for(uint32_t n=0;n<INPUTS;n++){
+            for(uint8_t channel=0;channel<CHANNELS;channel++){
+                input[channel]=x[channel][n];
+            }
+            if (decimator_push(&decimator,input,output)){
+                CHECK((n+1)%ratios[i]==0);
+                for(uint8_t channel=0;channel<CHANNELS;channel++){
+                    errors+=output[channel]!=reference(coeffs,taps,x[channel],n);
+                }
+                outputs++;
+            }
+        }
+        CHECK(errors==0);
+        CHECK(outputs==INPUTS/ratios[i] && decimator.outputs==outputs && decimator.inputs==INPUTS);
+
+        //after a reset the history is zeros again
+        decimator_reset(&decimator);
+        for(uint32_t n=0;n<ratios[i];n++){
+            input[0]=input[1]=input[2]=1000000;
+            if (decimator_push(&decimator,input,output)){
+                CHECK(output[0]==reference(coeffs,taps,(int32_t[]){1000000,1000000,1000000,1000000,1000000,1000000,1000000,1000000,1000000,1000000},n));
+            }
+        }
+    }
+}
+
+//gain of a sine of "frequency" (fraction of the input rate): correlation of the outputs in
+//steady state with the sine at the same input samples
+static double gain(uint8_t ratio, double frequency){
+    int32_t history[DECIMATOR_HISTORY_SIZE(1,MAX_TAPS)];
+    int32_t input, output;
+    double in_phase=0, quadrature=0;
+    uint32_t count=0;
+    decimator_t decimator;
+    uint16_t taps;
+    const int16_t *coeffs=decimator_coefficients(ratio,&taps);
+
+    decimator_init(&decimator,coeffs,taps,ratio,1,history);
+    for(uint32_t n=0;n<200000;n++){
+        input=(int32_t)lround(4000000.0*sin(2*M_PI*frequency*n));
+        if (decimator_push(&decimator,&input,&output) && n>taps){
+            in_phase+=output*sin(2*M_PI*frequency*n);
+            quadrature+=output*cos(2*M_PI*frequency*n);
+            count++;
+        }
+    }
+    return 2*sqrt(in_phase*in_phase+quadrature*quadrature)/count/4000000.0;
+}
+
+/*Pass band up to 80% of the output Nyquist frequency (0.4 of the output rate): the lower half
+is flat within 0.5 dB (the Blackman window rolls off slowly) and the frequencies that alias into
+it are attenuated more than 60 dB*/
+static void test_response(void){
+    for(uint8_t i=0;i<3;i++){
+        double output_rate=1.0/ratios[i];
+        double pass=1, stop=0;
+
+        for(double f=0.01;f<=0.2;f+=0.01){
+            double g=gain(ratios[i],(f+0.0013)*output_rate);
+
+            pass=fabs(20*log10(g))>fabs(20*log10(pass))?g:pass;
+        }
+        //aliases into 0-0.2 of the output rate: 0.8-1.2, 1.8-2.2 ... (a bit off the grid, no
+        //alias on DC or the output Nyquist frequency where the correlation doesn't work)
+        for(double f=0.8;f<0.5*ratios[i];f+=0.05){
+            if (fmod(f+0.2,1.0)<=0.4+1e-9){
+                double g=gain(ratios[i],(f+0.0013)*output_rate);
+
+                stop=g>stop?g:stop;
+            }
+        }
+        printf("ratio %d: pass band ripple %.3f dB (0-0.2 of the output rate), aliases into it %.1f dB\n",
+            ratios[i],20*log10(pass),20*log10(stop));
+        CHECK(fabs(20*log10(pass))<0.5);
+        CHECK(20*log10(stop)<-60);
+    }
+}
+
+static void test_pack(void){
+    uint8_t data[3];
+
+    decimator_pack(-2,3,data);
+    CHECK(data[0]==0xFF && data[1]==0xFF && data[2]==0xFE && decimator_unpack(data,3)==-2);
+    decimator_pack(0x900000,3,data);
+    CHECK(decimator_unpack(data,3)==0x7FFFFF);
+    decimator_pack(-0x900000,3,data);
+    CHECK(decimator_unpack(data,3)==-0x800000);
+    decimator_pack(40000,2,data);
+    CHECK(decimator_unpack(data,2)==INT16_MAX);
+    decimator_pack(-40000,2,data);
+    CHECK(decimator_unpack(data,2)==INT16_MIN);
+    decimator_pack(-300,2,data);
+    CHECK(decimator_unpack(data,2)==-300);
+}
+
+static void test_init(void){
+    int32_t history[DECIMATOR_HISTORY_SIZE(1,MAX_TAPS)];
+    decimator_t decimator;
+    uint16_t taps;
+    const int16_t *coeffs=decimator_coefficients(2,&taps);
+
+    CHECK(!decimator_init(&decimator,NULL,taps,2,1,history));
+    CHECK(!decimator_init(&decimator,coeffs,taps,2,1,NULL));
+    CHECK(!decimator_init(&decimator,coeffs,0,2,1,history));
+    CHECK(!decimator_init(&decimator,coeffs,taps,0,1,history));
+    CHECK(!decimator_init(&decimator,coeffs,taps,2,0,history));
+    CHECK(!decimator_init(&decimator,coeffs,taps,2,DECIMATOR_MAX_CHANNELS+1,history));
+}
+
+static void bench(void){
+    enum {INPUTS=2000000};
+    static int32_t history[DECIMATOR_HISTORY_SIZE(DECIMATOR_MAX_CHANNELS,MAX_TAPS)];
+    int32_t input[DECIMATOR_MAX_CHANNELS]={0}, output[DECIMATOR_MAX_CHANNELS];
+    volatile int32_t sink=0;
+    uint32_t state=9;
+    decimator_t decimator;
+    uint16_t taps;
+    double start;
+
+    for(uint8_t i=0;i<3;i++){
+        const int16_t *coeffs=decimator_coefficients(ratios[i],&taps);
+
+        decimator_init(&decimator,coeffs,taps,ratios[i],DECIMATOR_MAX_CHANNELS,history);
+        start=test_seconds();
+        for(uint32_t n=0;n<INPUTS;n++){
+            input[n%DECIMATOR_MAX_CHANNELS]=(int32_t)(test_random(&state)&0xFFFFFF)-0x800000;
+            if (decimator_push(&decimator,input,output)){
+                sink+=output[0];
+            }
+        }
+        printf("bench ratio %d (%d taps): %.2f ns per input sample and channel\n",ratios[i],taps,
+            (test_seconds()-start)*1e9/((double)INPUTS*DECIMATOR_MAX_CHANNELS));
+    }
+    (void)sink;
+}
+
+int main(int argc, char **argv){
+    test_coefficients();
+    test_bit_exact();
+    test_response();
+    test_pack();
+    test_init();
+    if (test_bench(argc,argv)){
+        bench();
+    }
+    return TEST_END();
+}
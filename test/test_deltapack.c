@@ -0,0 +1,205 @@
+/*
+deltapack.h: round trip fuzz (every block width, wrap around differences, partial blocks),
+exact size of the stream, truncated and random streams. Every decoder of this CPU (SSE2,
+AVX2) gives the same samples and result as the scalar one.
+--bench: ratio and throughput against Steim-2 on a synthetic quiet site channel (microseism
++ noise of a few counts + an event), decode with every decoder.
+*/
+#include <string.h>
+#include <math.h>
+
+#include "test.h"
+#include "deltapack.h"
+#include "bitpack.h"
+#include "steim.h"
+
+#define MAX_SAMPLES 1500
+
+//size of the stream from the samples (width of every block)
+static uint32_t expected_size(const int32_t *samples, uint16_t count){
+    uint32_t size=DELTAPACK_X0_BYTES;
+
+    for(uint16_t first=0;first<count;first+=DELTAPACK_BLOCK){
+        uint16_t block_count=count-first<DELTAPACK_BLOCK?count-first:DELTAPACK_BLOCK;
+        uint32_t all_bits=0;
+        uint8_t width=0;
+
+        for(uint16_t n=first;n<first+block_count;n++){
+            uint32_t difference=(uint32_t)samples[n]-(uint32_t)(n?samples[n-1]:samples[0]);
+
+            all_bits|=(difference<<1)^(0u-(difference>>31));
+        }
+        while(width<32 && (all_bits>>width)!=0){
+            width++;
+        }
+        size+=1+BITPACK_BYTES(block_count,width);
+    }
+    return size;
+}
+
+//the decoders after the scalar one give the same result and the same bytes
+static uint32_t decoders_differ(const uint8_t *encoded, uint32_t size, uint16_t count){
+    static int32_t scalar[MAX_SAMPLES], vector[MAX_SAMPLES];
+    uint32_t result, differ=0;
+
+    memset(scalar,0x5A,sizeof(scalar));
+    result=deltapack_decode_with(DELTAPACK_DECODER_SCALAR,encoded,size,count,scalar);
+    for(uint8_t decoder=DELTAPACK_DECODER_SCALAR+1;decoder<=deltapack_decoder();decoder++){
+        memset(vector,0x5A,sizeof(vector));
+        differ+=deltapack_decode_with(decoder,encoded,size,count,vector)!=result;
+        differ+=result!=0 && memcmp(vector,scalar,count*sizeof(int32_t))!=0;
+    }
+    return differ;
+}
+
+static void test_fuzz(void){
+    static int32_t samples[MAX_SAMPLES], copy[MAX_SAMPLES], decoded[MAX_SAMPLES];
+    static uint8_t encoded[DELTAPACK_MAX_BYTES(MAX_SAMPLES)];
+    uint32_t state=71, errors=0;
+
+    for(uint32_t round=0;round<5000;round++){
+        uint16_t count=(uint16_t)(1+test_random(&state)%MAX_SAMPLES);
+        uint8_t step_bits=(uint8_t)(round%34); //0 = constant, 33 = any 32 bit value
+        uint32_t size;
+
+        samples[0]=(int32_t)test_random(&state);
+        for(uint16_t n=1;n<count;n++){
+            uint32_t step=test_random(&state);
+
+            if (step_bits<32){
+                step&=(1u<<step_bits)-1;
+                step-=step_bits?1u<<(step_bits-1):0;
+            }
+            samples[n]=(int32_t)((uint32_t)samples[n-1]+step);
+            if (step_bits==33 && n%7==0){
+                samples[n]=(n&8)?INT32_MIN:INT32_MAX;
+            }
+        }
+        memcpy(copy,samples,count*sizeof(int32_t));
+        size=deltapack_encode(copy,count,encoded,sizeof(encoded));
+        errors+=size==0 || size!=expected_size(samples,count) || size>DELTAPACK_MAX_BYTES(count);
+        memset(decoded,0x5A,sizeof(decoded));
+        errors+=deltapack_decode(encoded,size,count,decoded)!=size;
+        errors+=memcmp(decoded,samples,count*sizeof(int32_t))!=0;
+        errors+=decoders_differ(encoded,size,count);
+        //one byte less: invalid
+        errors+=deltapack_decode(encoded,size-1,count,decoded)!=0;
+        //no space for the last block
+        memcpy(copy,samples,count*sizeof(int32_t));
+        errors+=deltapack_encode(copy,count,encoded,size-1)!=0;
+    }
+    CHECK(errors==0);
+
+    //constant channel: X0 and one WIDTH byte of 0 per block
+    for(uint16_t n=0;n<MAX_SAMPLES;n++){
+        samples[n]=-123456;
+    }
+    CHECK(deltapack_encode(samples,MAX_SAMPLES,encoded,sizeof(encoded))==DELTAPACK_X0_BYTES+(MAX_SAMPLES+DELTAPACK_BLOCK-1)/DELTAPACK_BLOCK);
+    CHECK(deltapack_decode(encoded,sizeof(encoded),MAX_SAMPLES,decoded)!=0 && decoded[0]==-123456 && decoded[MAX_SAMPLES-1]==-123456);
+    CHECK(deltapack_encode(samples,0,encoded,sizeof(encoded))==0);
+    CHECK(deltapack_decode(encoded,3,1,decoded)==0);
+    CHECK(deltapack_decode_with(deltapack_decoder()+1,encoded,sizeof(encoded),1,decoded)==0);
+    printf("decoders: scalar");
+    for(uint8_t decoder=DELTAPACK_DECODER_SCALAR+1;decoder<=deltapack_decoder();decoder++){
+        printf(", %s",deltapack_decoder_name(decoder));
+    }
+    printf("\n");
+}
+
+static void test_random_streams(void){
+    static uint8_t encoded[DELTAPACK_MAX_BYTES(MAX_SAMPLES)];
+    static int32_t decoded[MAX_SAMPLES];
+    uint32_t state=73, invalid=0, differ=0;
+
+    //never reads after "size", a WIDTH bigger than 32 is invalid
+    for(uint32_t round=0;round<20000;round++){
+        uint32_t size=test_random(&state)%200;
+        uint16_t count=(uint16_t)(1+test_random(&state)%MAX_SAMPLES);
+        uint32_t result;
+
+        for(uint32_t n=0;n<size;n++){
+            encoded[n]=(uint8_t)test_random(&state);
+        }
+        result=deltapack_decode(encoded,size,count,decoded);
+        invalid+=result>size;
+        differ+=decoders_differ(encoded,size,count);
+    }
+    CHECK(invalid==0 && differ==0);
+    encoded[4]=33;
+    CHECK(deltapack_decode(encoded,sizeof(encoded),1,decoded)==0);
+}
+
+//100 Hz: microseism of 0.2 Hz (200 counts), noise of +-4 counts, an event of 20 s
+static void station_make(int32_t *samples, uint32_t count, uint32_t start, uint32_t *state){
+    for(uint32_t n=0;n<count;n++){
+        double t=(start+n)/100.0;
+        double event=(t>60 && t<80)?50000*exp(-(t-60)/4)*sin(2*M_PI*3*t):0;
+
+        samples[n]=(int32_t)lround(200*sin(2*M_PI*0.2*t)+event)+(int32_t)(test_random(state)%9)-4;
+    }
+}
+
+static void bench(void){
+    enum {PACKETS=100};
+    static int32_t samples[PACKETS][MAX_SAMPLES], work[MAX_SAMPLES], decoded[MAX_SAMPLES];
+    static uint8_t encoded[PACKETS][DELTAPACK_MAX_BYTES(MAX_SAMPLES)];
+    static uint8_t frames[PACKETS][STEIM_MAX_FRAMES(MAX_SAMPLES)*STEIM_FRAME_BYTES];
+    uint32_t sizes[PACKETS], frame_counts[PACKETS], delta_bytes=0, steim_bytes=0;
+    uint32_t state=75;
+    double start, times[4], decode_times[DELTAPACK_DECODER_AVX2+1];
+
+    for(uint32_t p=0;p<PACKETS;p++){
+        station_make(samples[p],MAX_SAMPLES,p*MAX_SAMPLES,&state);
+    }
+    start=test_seconds();
+    for(uint32_t p=0;p<PACKETS;p++){
+        memcpy(work,samples[p],sizeof(work));
+        sizes[p]=deltapack_encode(work,MAX_SAMPLES,encoded[p],sizeof(encoded[p]));
+        delta_bytes+=sizes[p];
+    }
+    times[0]=test_seconds()-start;
+    start=test_seconds();
+    for(uint32_t p=0;p<PACKETS;p++){
+        frame_counts[p]=steim_encode(STEIM_2,samples[p],MAX_SAMPLES,p?samples[p-1][MAX_SAMPLES-1]:0,frames[p],STEIM_MAX_FRAMES(MAX_SAMPLES));
+        steim_bytes+=frame_counts[p]*STEIM_FRAME_BYTES;
+    }
+    times[1]=test_seconds()-start;
+    start=test_seconds();
+    for(uint32_t p=0;p<PACKETS;p++){
+        deltapack_decode(encoded[p],sizes[p],MAX_SAMPLES,decoded);
+        __asm__ volatile("" : : "r"(decoded) : "memory");
+    }
+    times[2]=test_seconds()-start;
+    start=test_seconds();
+    for(uint32_t p=0;p<PACKETS;p++){
+        steim_decode(STEIM_2,frames[p],(uint16_t)frame_counts[p],MAX_SAMPLES,decoded);
+        __asm__ volatile("" : : "r"(decoded) : "memory");
+    }
+    times[3]=test_seconds()-start;
+    for(uint8_t decoder=DELTAPACK_DECODER_SCALAR;decoder<=deltapack_decoder();decoder++){
+        start=test_seconds();
+        for(uint32_t p=0;p<PACKETS;p++){
+            deltapack_decode_with(decoder,encoded[p],sizes[p],MAX_SAMPLES,decoded);
+            __asm__ volatile("" : : "r"(decoded) : "memory");
+        }
+        decode_times[decoder]=test_seconds()-start;
+    }
+    //the encoders include the memcpy of the samples (deltapack overwrites them)
+    printf("bench %d packets of %d samples of 24 bits (%d bytes)\n",PACKETS,MAX_SAMPLES,3*MAX_SAMPLES);
+    printf("    deltapack %.2f:1, encode %.0f Msamples/s, decode %.0f Msamples/s\n",3.0*PACKETS*MAX_SAMPLES/delta_bytes,
+        PACKETS*MAX_SAMPLES/times[0]/1e6,PACKETS*MAX_SAMPLES/times[2]/1e6);
+    printf("    Steim-2   %.2f:1, encode %.0f Msamples/s, decode %.0f Msamples/s\n",3.0*PACKETS*MAX_SAMPLES/steim_bytes,
+        PACKETS*MAX_SAMPLES/times[1]/1e6,PACKETS*MAX_SAMPLES/times[3]/1e6);
+    for(uint8_t decoder=DELTAPACK_DECODER_SCALAR;decoder<=deltapack_decoder();decoder++){
+        printf("    deltapack decode %-6s %.0f Msamples/s\n",deltapack_decoder_name(decoder),PACKETS*MAX_SAMPLES/decode_times[decoder]/1e6);
+    }
+}
+
+int main(int argc, char **argv){
+    test_fuzz();
+    test_random_streams();
+    if (test_bench(argc,argv)){
+        bench();
+    }
+    return TEST_END();
+}
@@ -0,0 +1,241 @@
+/*
+epoch_time.c: the calendar against timegm/gmtime of the C library, the times before 1970,
+the DS3231 BCD registers (golden values, 12 hour mode, invalid values, day of week) and
+the rollovers of second, day, month, year and century, also in the registers.
+*/
+#define _GNU_SOURCE //timegm
+#include <time.h>
+#include <string.h>
+
+#include "test.h"
+#include "epoch_time.h"
+
+#define US EPOCH_US_PER_SECOND
+
+static int64_t epoch_of(int32_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second, uint32_t microsecond){
+    epoch_datetime_t datetime={year,month,day,hour,minute,second,microsecond};
+    return epoch_from_datetime(&datetime);
+}
+
+static bool datetime_is(const epoch_datetime_t *datetime, int32_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second, uint32_t microsecond){
+    return datetime->year==year && datetime->month==month && datetime->day==day && datetime->hour==hour
+        && datetime->minute==minute && datetime->second==second && datetime->microsecond==microsecond;
+}
+
+/*Every day from 1600 to 2400 against timegm, and the round trip of the days*/
+static void test_calendar(void){
+    struct tm tm;
+    int32_t year, days;
+    uint8_t month, day;
+
+    for(int32_t y=1600;y<=2400;y++){
+        for(uint8_t m=1;m<=12;m++){
+            CHECK(epoch_days_in_month(y,m)>=28 && epoch_days_in_month(y,m)<=31);
+            for(uint8_t d=1;d<=epoch_days_in_month(y,m);d++){
+                memset(&tm,0,sizeof(tm));
+                tm.tm_year=y-1900;
+                tm.tm_mon=m-1;
+                tm.tm_mday=d;
+                days=epoch_days_from_civil(y,m,d);
+                CHECK((int64_t)days*EPOCH_SECONDS_PER_DAY==(int64_t)timegm(&tm));
+                epoch_civil_from_days(days,&year,&month,&day);
+                CHECK(year==y && month==m && day==d);
+            }
+        }
+    }
+    CHECK(epoch_days_from_civil(1970,1,1)==0);
+    CHECK(epoch_days_from_civil(1969,12,31)==-1);
+    CHECK(epoch_days_from_civil(2000,3,1)==11017);
+
+    //leap years
+    CHECK(epoch_days_in_month(2000,2)==29 && epoch_days_in_month(1900,2)==28);
+    CHECK(epoch_days_in_month(2024,2)==29 && epoch_days_in_month(2100,2)==28);
+    CHECK(epoch_days_in_month(2023,0)==0 && epoch_days_in_month(2023,13)==0);
+}
+
+static void test_datetime(void){
+    epoch_datetime_t datetime;
+    struct tm tm;
+    uint32_t state=7;
+
+    //before 1970 (floor divisions)
+    epoch_to_datetime(-1,&datetime);
+    CHECK(datetime_is(&datetime,1969,12,31,23,59,59,999999));
+    epoch_to_datetime(-US,&datetime);
+    CHECK(datetime_is(&datetime,1969,12,31,23,59,59,0));
+    epoch_to_datetime(0,&datetime);
+    CHECK(datetime_is(&datetime,1970,1,1,0,0,0,0));
+
+    //random times against gmtime, and back
+    for(uint32_t i=0;i<200000;i++){
+        int64_t seconds=(int64_t)(test_random(&state)%(300u*366*86400))-(int64_t)100*366*86400; //1870-2170
+        uint32_t microsecond=test_random(&state)%1000000;
+        time_t t=(time_t)seconds;
+
+        epoch_to_datetime(seconds*US+microsecond,&datetime);
+        gmtime_r(&t,&tm);
+        CHECK(datetime_is(&datetime,tm.tm_year+1900,(uint8_t)(tm.tm_mon+1),(uint8_t)tm.tm_mday,(uint8_t)tm.tm_hour,(uint8_t)tm.tm_min,(uint8_t)tm.tm_sec,microsecond));
+        CHECK(epoch_datetime_valid(&datetime));
+        CHECK(epoch_from_datetime(&datetime)==seconds*US+microsecond);
+    }
+
+    //fields out of range
+    datetime=(epoch_datetime_t){2023,2,29,0,0,0,0};
+    CHECK(!epoch_datetime_valid(&datetime));
+    datetime=(epoch_datetime_t){2024,2,29,23,59,59,999999};
+    CHECK(epoch_datetime_valid(&datetime));
+    datetime=(epoch_datetime_t){2024,4,31,0,0,0,0};
+    CHECK(!epoch_datetime_valid(&datetime));
+    datetime=(epoch_datetime_t){2024,1,1,24,0,0,0};
+    CHECK(!epoch_datetime_valid(&datetime));
+    datetime=(epoch_datetime_t){2024,1,1,0,60,0,0};
+    CHECK(!epoch_datetime_valid(&datetime));
+    datetime=(epoch_datetime_t){2024,1,1,0,0,0,1000000};
+    CHECK(!epoch_datetime_valid(&datetime));
+}
+
+/*One microsecond before and after the ends of the day, month, year and century*/
+static void test_rollover(void){
+    static const struct {
+        int32_t year; uint8_t month, day;  //last day
+        int32_t next_year; uint8_t next_month;
+    } ends[]={
+        {2023,1,31,2023,2},{2023,2,28,2023,3},{2024,2,29,2024,3},{2100,2,28,2100,3},{2000,2,29,2000,3},
+        {2023,4,30,2023,5},{2023,12,31,2024,1},{2099,12,31,2100,1},{1969,12,31,1970,1},{2199,12,31,2200,1},
+    };
+    epoch_datetime_t datetime;
+    int64_t last;
+
+    for(uint8_t i=0;i<sizeof(ends)/sizeof(ends[0]);i++){
+        last=epoch_of(ends[i].year,ends[i].month,ends[i].day,23,59,59,999999);
+        epoch_to_datetime(last,&datetime);
+        CHECK(datetime_is(&datetime,ends[i].year,ends[i].month,ends[i].day,23,59,59,999999));
+        epoch_to_datetime(last+1,&datetime);
+        CHECK(datetime_is(&datetime,ends[i].next_year,ends[i].next_month,1,0,0,0,0));
+    }
+    //the day after 28 February of a leap year
+    epoch_to_datetime(epoch_of(2024,2,28,12,0,0,0)+86400*US,&datetime);
+    CHECK(datetime_is(&datetime,2024,2,29,12,0,0,0));
+}
+
+
+/*======================================================================
+ * DS3231 REGISTERS
+ ======================================================================*/
+static void test_ds3231(void){
+    uint8_t registers[EPOCH_DS3231_REGISTERS];
+    int64_t epoch_us;
+
+    //2024-03-09 17:45:30 (Saturday), 24 hour mode
+    const uint8_t golden[EPOCH_DS3231_REGISTERS]={0x30,0x45,0x17,6,0x09,0x03,0x24};
+    CHECK(epoch_from_ds3231(golden,&epoch_us) && epoch_us==epoch_of(2024,3,9,17,45,30,0));
+    CHECK(epoch_to_ds3231(epoch_us+999999,registers)); //the microseconds are truncated
+    CHECK(memcmp(registers,golden,EPOCH_DS3231_REGISTERS)==0);
+
+    //12 hour mode: 12 AM = 0 h, 12 PM = 12 h, 5 PM = 17 h
+    memcpy(registers,golden,EPOCH_DS3231_REGISTERS);
+    registers[2]=0x40|0x12;
+    CHECK(epoch_from_ds3231(registers,&epoch_us) && epoch_us==epoch_of(2024,3,9,0,45,30,0));
+    registers[2]=0x40|0x20|0x12;
+    CHECK(epoch_from_ds3231(registers,&epoch_us) && epoch_us==epoch_of(2024,3,9,12,45,30,0));
+    registers[2]=0x40|0x20|0x05;
+    CHECK(epoch_from_ds3231(registers,&epoch_us) && epoch_us==epoch_of(2024,3,9,17,45,30,0));
+    registers[2]=0x40|0x00; //0 isn't an hour of the 12 hour mode
+    CHECK(!epoch_from_ds3231(registers,&epoch_us));
+    registers[2]=0x40|0x13;
+    CHECK(!epoch_from_ds3231(registers,&epoch_us));
+
+    //century bit: 2100 + YY
+    memcpy(registers,golden,EPOCH_DS3231_REGISTERS);
+    registers[5]|=0x80;
+    CHECK(epoch_from_ds3231(registers,&epoch_us) && epoch_us==epoch_of(2124,3,9,17,45,30,0));
+
+    //invalid BCD digits, out of range values, days that don't exist (stopped oscillator, noise)
+    static const struct {uint8_t reg, value;} invalid[]={
+        {0,0x5A},{0,0x60},{1,0x60},{1,0x0F},{2,0x24},{2,0x1A},{4,0x00},{4,0x32},
+        {5,0x00},{5,0x13},{5,0x1A},{6,0xA0},{6,0x0B},
+    };
+    for(uint8_t i=0;i<sizeof(invalid)/sizeof(invalid[0]);i++){
+        memcpy(registers,golden,EPOCH_DS3231_REGISTERS);
+        registers[invalid[i].reg]=invalid[i].value;
+        CHECK(!epoch_from_ds3231(registers,&epoch_us));
+    }
+    const uint8_t april[EPOCH_DS3231_REGISTERS]={0,0,0,1,0x31,0x04,0x24}; //31 April
+    CHECK(!epoch_from_ds3231(april,&epoch_us));
+    const uint8_t february[EPOCH_DS3231_REGISTERS]={0,0,0,4,0x29,0x02,0x23}; //29 February 2023
+    CHECK(!epoch_from_ds3231(february,&epoch_us));
+    const uint8_t leap[EPOCH_DS3231_REGISTERS]={0,0,0,4,0x29,0x02,0x24};
+    CHECK(epoch_from_ds3231(leap,&epoch_us) && epoch_us==epoch_of(2024,2,29,0,0,0,0));
+
+    //range of the DS3231
+    CHECK(!epoch_to_ds3231(epoch_of(1999,12,31,23,59,59,999999),registers));
+    CHECK(!epoch_to_ds3231(epoch_of(2200,1,1,0,0,0,0),registers));
+    CHECK(epoch_to_ds3231(epoch_of(2000,1,1,0,0,0,0),registers));
+    CHECK(epoch_to_ds3231(epoch_of(2199,12,31,23,59,59,0),registers));
+}
+
+/*The registers of the second before and after a rollover (the DS3231 counts them in BCD)*/
+static void test_ds3231_rollover(void){
+    uint8_t registers[EPOCH_DS3231_REGISTERS];
+    int64_t epoch_us;
+
+    //2099-12-31 23:59:59 Thursday -> 2100-01-01 00:00:00 Friday, the century bit toggles
+    CHECK(epoch_to_ds3231(epoch_of(2099,12,31,23,59,59,0),registers));
+    const uint8_t before[EPOCH_DS3231_REGISTERS]={0x59,0x59,0x23,4,0x31,0x12,0x99};
+    CHECK(memcmp(registers,before,EPOCH_DS3231_REGISTERS)==0);
+    CHECK(epoch_to_ds3231(epoch_of(2099,12,31,23,59,59,0)+US,registers));
+    const uint8_t after[EPOCH_DS3231_REGISTERS]={0x00,0x00,0x00,5,0x01,0x81,0x00};
+    CHECK(memcmp(registers,after,EPOCH_DS3231_REGISTERS)==0);
+    CHECK(epoch_from_ds3231(after,&epoch_us) && epoch_us==epoch_of(2100,1,1,0,0,0,0));
+
+    //2023-12-31 -> 2024-01-01 (Sunday -> Monday), 2024-02-28 -> 29
+    CHECK(epoch_to_ds3231(epoch_of(2024,1,1,0,0,0,0),registers));
+    const uint8_t new_year[EPOCH_DS3231_REGISTERS]={0,0,0,1,0x01,0x01,0x24};
+    CHECK(memcmp(registers,new_year,EPOCH_DS3231_REGISTERS)==0);
+    CHECK(epoch_to_ds3231(epoch_of(2024,2,28,23,59,59,0)+US,registers));
+    const uint8_t leap_day[EPOCH_DS3231_REGISTERS]={0,0,0,4,0x29,0x02,0x24};
+    CHECK(memcmp(registers,leap_day,EPOCH_DS3231_REGISTERS)==0);
+}
+
+/*Every hour of 2000-2199 (and random seconds): registers and back, day of week of gmtime*/
+static void test_ds3231_round_trip(void){
+    uint8_t registers[EPOCH_DS3231_REGISTERS];
+    int64_t first=epoch_of(2000,1,1,0,0,0,0), last=epoch_of(2199,12,31,23,59,59,0);
+    int64_t epoch_us, back;
+    uint32_t state=99;
+    struct tm tm;
+
+    for(epoch_us=first;epoch_us<=last;epoch_us+=3600*US+(int64_t)(test_random(&state)%3600)*US){
+        time_t t=(time_t)(epoch_us/US);
+
+        CHECK(epoch_to_ds3231(epoch_us,registers));
+        CHECK(epoch_from_ds3231(registers,&back) && back==epoch_us);
+        gmtime_r(&t,&tm);
+        CHECK(registers[3]==(tm.tm_wday==0?7:tm.tm_wday)); //1 = Monday ... 7 = Sunday
+    }
+}
+
+static void test_format(void){
+    char text[EPOCH_FORMAT_BYTES];
+
+    epoch_format(epoch_of(2024,3,9,17,45,30,123456),text);
+    CHECK(strcmp(text,"2024-03-09T17:45:30.123456Z")==0);
+    epoch_format(-1,text);
+    CHECK(strcmp(text,"1969-12-31T23:59:59.999999Z")==0);
+    epoch_format(0,text);
+    CHECK(strcmp(text,"1970-01-01T00:00:00.000000Z")==0);
+    CHECK(strlen(text)==EPOCH_FORMAT_BYTES-1);
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    test_calendar();
+    test_datetime();
+    test_rollover();
+    test_ds3231();
+    test_ds3231_rollover();
+    test_ds3231_round_trip();
+    test_format();
+    return TEST_END();
+}
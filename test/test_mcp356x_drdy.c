@@ -0,0 +1,83 @@
+/*
+mcp356x_drdy.h: association of ADCDATA reads with the IRQ stamps, with simulated conversion
+times (ADC clock != nominal rate, jitter) and a reading task that is sometimes late.
+*/
+#include "test.h"
+#include "mcp356x_drdy.h"
+
+#define NOMINAL_PERIOD 10000 //timer counts (100 Hz with a 1 MHz timer)
+
+static void test_basic(void){
+    mcp356x_drdy_tracker_t tracker;
+    uint64_t stamps[3], stamp=0;
+
+    mcp356x_drdy_init(&tracker,NOMINAL_PERIOD);
+    //no stamp: duplicate
+    CHECK(!mcp356x_drdy_associate(&tracker,stamps,0,&stamp));
+    CHECK(tracker.duplicated==1);
+
+    stamps[0]=5000;
+    CHECK(mcp356x_drdy_associate(&tracker,stamps,1,&stamp) && stamp==5000);
+    stamps[0]=15000;
+    CHECK(mcp356x_drdy_associate(&tracker,stamps,1,&stamp) && stamp==15000);
+    //late read: three stamps, the data is the last conversion
+    stamps[0]=25000;
+    stamps[1]=35000;
+    stamps[2]=45000;
+    CHECK(mcp356x_drdy_associate(&tracker,stamps,3,&stamp) && stamp==45000);
+    CHECK(tracker.missed==2 && tracker.samples==3);
+    //lost IRQ edges: 3 periods between two stamps
+    stamps[0]=75000;
+    CHECK(mcp356x_drdy_associate(&tracker,stamps,1,&stamp) && stamp==75000);
+    CHECK(tracker.missed==4);
+}
+
+/*ADC at 139 Hz of its internal clock (the old setup) with +-20 counts of jitter, the task
+wakes up after every IRQ with a latency of 0-3 periods, 1 of 200 IRQ edges isn't seen by the
+ISR. Every read gets the stamp of its conversion, every conversion is counted once*/
+static void test_simulated(void){
+    enum {CONVERSIONS=200000};
+    const double true_period=1e6/139.0;
+    mcp356x_drdy_tracker_t tracker;
+    uint64_t pending[16], stamp, conversion_time, wake_time=0;
+    uint32_t state=3, total=0, lost=0, read=0, errors=0;
+
+    mcp356x_drdy_init(&tracker,7000);
+    for (uint32_t k=0;k<CONVERSIONS;k++){
+        conversion_time=(uint64_t)(1000+k*true_period)+test_random(&state)%41-20;
+        //the task reads ADCDATA before this conversion
+        if (total!=0 && conversion_time>wake_time){
+            if (mcp356x_drdy_associate(&tracker,pending,total,&stamp)){
+                read++;
+                if (stamp!=pending[total-1]){
+                    errors++;
+                }
+            }
+            total=0;
+        }
+        if (test_random(&state)%200==0){
+            lost++;
+        }
+        else if (total<16){
+            pending[total++]=conversion_time;
+            wake_time=conversion_time+(uint64_t)(test_random(&state)%(uint32_t)(3*true_period));
+        }
+    }
+    CHECK(errors==0);
+    //every conversion is a sample read or a missed one (the last batch isn't read, 1 sample of error
+    //for the lost edges at the start before the period estimation)
+    CHECK(tracker.samples==read);
+    CHECK(read+tracker.missed+total+1>=CONVERSIONS && read+tracker.missed+total<=CONVERSIONS);
+    //period estimation within 0.1 %
+    CHECK(tracker.period>true_period*0.999 && tracker.period<true_period*1.001);
+    printf("simulated: %u conversions, %u read, %u missed (%u IRQ edges lost), period %u counts (real %.1f)\n",
+        CONVERSIONS,read,tracker.missed,lost,tracker.period,true_period);
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    test_basic();
+    test_simulated();
+    return TEST_END();
+}
@@ -0,0 +1,136 @@
+/*
+mcp356x_scan.h: demultiplexing of a stream of ADCDATA reads (32 bit format with channel ID)
+with the faults of a real bus: lost conversions, the same conversion read twice and
+reads with a CHID that isn't scanned.
+*/
+#include <string.h>
+
+#include "test.h"
+#include "mcp356x_scan.h"
+
+static const uint8_t channel_ids[3]={MCP356X_CHID_DIF_CH0_CH1,MCP356X_CHID_DIF_CH2_CH3,MCP356X_CHID_DIF_CH4_CH5};
+
+//ADCDATA of a conversion: CHID, sign extension and 24 bit value
+static void read_make(uint8_t *raw, uint8_t chid, int32_t value){
+    raw[0]=(uint8_t)(chid<<4)|(value<0?0x0F:0x00);
+    raw[1]=(uint8_t)(value>>16);
+    raw[2]=(uint8_t)(value>>8);
+    raw[3]=(uint8_t)value;
+}
+
+static int32_t frame_value(const uint8_t *frame, uint8_t channel){
+    const uint8_t *data=&frame[channel*MCP356X_SCAN_BYTES_PER_CHANNEL];
+    int32_t value=(int32_t)(((uint32_t)data[0]<<16)|((uint32_t)data[1]<<8)|data[2]);
+
+    return value&0x800000?value-0x1000000:value;
+}
+
+static void test_basic(void){
+    mcp356x_scan_demux_t demux;
+    uint8_t raw[4], frame[MCP356X_SCAN_MAX_CHANNELS*MCP356X_SCAN_BYTES_PER_CHANNEL];
+    uint64_t stamp=0;
+
+    mcp356x_scan_demux_init(&demux,channel_ids,3);
+    read_make(raw,channel_ids[0],-5);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,100,frame,&stamp));
+    read_make(raw,channel_ids[1],8388607);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,110,frame,&stamp));
+    //read again before the next conversion
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,115,frame,&stamp));
+    read_make(raw,MCP356X_CHID_DIF_CH6_CH7,1);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,117,frame,&stamp));
+    read_make(raw,channel_ids[2],-8388608);
+    CHECK(mcp356x_scan_demux_push(&demux,raw,120,frame,&stamp));
+    CHECK(stamp==100);
+    CHECK(frame_value(frame,0)==-5 && frame_value(frame,1)==8388607 && frame_value(frame,2)==-8388608);
+    CHECK(demux.frames==1 && demux.duplicated_reads==1 && demux.unknown_reads==1 && demux.dropped_reads==0);
+
+    //channel 1 lost: the frame is dropped, the next one starts with channel 0
+    read_make(raw,channel_ids[0],1);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,200,frame,&stamp));
+    read_make(raw,channel_ids[2],3);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,220,frame,&stamp));
+    CHECK(demux.dropped_reads==2);
+    //channel 2 and the next channel 0 lost: channel 1 again is a new conversion, not a re-read
+    read_make(raw,channel_ids[0],7);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,240,frame,&stamp));
+    read_make(raw,channel_ids[1],8);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,250,frame,&stamp));
+    read_make(raw,channel_ids[1],9);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,280,frame,&stamp));
+    read_make(raw,channel_ids[2],10);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,290,frame,&stamp));
+    CHECK(demux.frames==1 && demux.duplicated_reads==1);
+    read_make(raw,channel_ids[0],4);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,300,frame,&stamp));
+    read_make(raw,channel_ids[1],5);
+    CHECK(!mcp356x_scan_demux_push(&demux,raw,310,frame,&stamp));
+    read_make(raw,channel_ids[2],6);
+    CHECK(mcp356x_scan_demux_push(&demux,raw,320,frame,&stamp));
+    CHECK(stamp==300 && frame_value(frame,0)==4 && frame_value(frame,2)==6);
+}
+
+/*Random stream: every frame out of the demultiplexer is one whole SCAN cycle (the
+value of every channel is cycle*8+channel) and every cycle with no lost read gives its frame.
+At most 2 reads in a row are lost (3 would be a whole cycle, the channel IDs can't show it)*/
+static void test_stream(void){
+    enum {CYCLES=100000};
+    mcp356x_scan_demux_t demux;
+    uint8_t raw[4], frame[MCP356X_SCAN_MAX_CHANNELS*MCP356X_SCAN_BYTES_PER_CHANNEL];
+    uint64_t stamp;
+    uint32_t state=11, complete=0, frames=0, errors=0, lost_row=0;
+
+    mcp356x_scan_demux_init(&demux,channel_ids,3);
+    for(int32_t cycle=0;cycle<CYCLES;cycle++){
+        bool lost=false;
+
+        for(uint8_t channel=0;channel<3;channel++){
+            int32_t value=(cycle*8+channel)%8388608;
+            uint32_t fault=test_random(&state)%100;
+
+            if (fault<2 && lost_row<2){
+                lost=true;
+                lost_row++;
+                continue;
+            }
+            lost_row=0;
+            read_make(raw,channel_ids[channel],(fault&1)?-value:value);
+            for(uint8_t repeat=0;repeat<(fault<5?2:1);repeat++){
+                if (mcp356x_scan_demux_push(&demux,raw,(uint64_t)cycle*1000+channel,frame,&stamp)){
+                    int32_t first=frame_value(frame,0);
+
+                    first=first<0?-first:first;
+                    frames++;
+                    if (stamp%1000!=0 || first!=(int32_t)(stamp/1000*8)%8388608){
+                        errors++;
+                    }
+                    for(uint8_t i=1;i<3;i++){
+                        int32_t other=frame_value(frame,i);
+
+                        if ((other<0?-other:other)!=first+i){
+                            errors++;
+                        }
+                    }
+                }
+            }
+            if (fault==5){
+                read_make(raw,MCP356X_CHID_DIF_CH6_CH7,0);
+                CHECK(!mcp356x_scan_demux_push(&demux,raw,0,frame,&stamp));
+            }
+        }
+        complete+=lost?0:1;
+    }
+    CHECK(errors==0);
+    CHECK(frames==complete && demux.frames==complete);
+    CHECK(demux.duplicated_reads>0 && demux.dropped_reads>0 && demux.unknown_reads>0);
+    printf("stream: %u cycles, %u frames, %u dropped, %u duplicated, %u unknown\n",
+        CYCLES,frames,demux.dropped_reads,demux.duplicated_reads,demux.unknown_reads);
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    test_basic();
+    test_stream();
+    return TEST_END();
+}
@@ -0,0 +1,144 @@
+/*
+mseed.h: records read back by a reader written from the miniSEED 3 specification (libc
+timegm for the start time, bitwise CRC-32C), start times around leap days and before 1970,
+the SID and the band codes.
+*/
+#define _GNU_SOURCE //timegm
+#include <string.h>
+#include <time.h>
+
+#include "test.h"
+#include "mseed.h"
+#include "steim.h"
+
+#define MAX_SAMPLES 1500
+
+//CRC-32C bit by bit (Castagnoli, reflected polynomial 0x82F63B78)
+static uint32_t reference_crc32c(const uint8_t *data, uint32_t length){
+    uint32_t crc=0xFFFFFFFF;
+
+    for(uint32_t i=0;i<length;i++){
+        crc^=data[i];
+        for(uint8_t bit=0;bit<8;bit++){
+            crc=(crc>>1)^(crc&1?0x82F63B78:0);
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t le(const uint8_t *data, uint8_t bytes){
+    uint32_t value=0;
+
+    for(int8_t i=bytes-1;i>=0;i--){
+        value=(value<<8)|data[i];
+    }
+    return value;
+}
+
+typedef struct {
+    int64_t start_us;
+    uint8_t encoding;
+    double rate;
+    uint32_t count;
+    char sid[MSEED_SID_MAX+1];
+    const uint8_t *payload;
+    uint32_t payload_length;
+    uint32_t length;
+} record_t;
+
+//reads the fixed header, false if it isn't a valid record
+static bool record_read(const uint8_t *data, uint32_t size, record_t *record){
+    static uint8_t copy[MSEED_FIXED_HEADER+MSEED_SID_MAX+STEIM_MAX_FRAMES(MAX_SAMPLES)*STEIM_FRAME_BYTES];
+    struct tm start={0};
+    uint64_t rate_bits;
+
+    if (size<MSEED_FIXED_HEADER || data[0]!='M' || data[1]!='S' || data[2]!=3 || data[32]!=MSEED_PUBLICATION_VERSION){
+        return false;
+    }
+    record->length=MSEED_FIXED_HEADER+data[33]+le(&data[34],2)+le(&data[36],4);
+    if (record->length>size || record->length>sizeof(copy) || data[33]>MSEED_SID_MAX){
+        return false;
+    }
+    memcpy(copy,data,record->length);
+    memset(&copy[28],0,4);
+    if (reference_crc32c(copy,record->length)!=le(&data[28],4)){
+        return false;
+    }
+    start.tm_year=(int)le(&data[8],2)-1900;
+    start.tm_mday=(int)le(&data[10],2); //day of the year, timegm normalizes it
+    start.tm_hour=data[12];
+    start.tm_min=data[13];
+    start.tm_sec=data[14];
+    record->start_us=(int64_t)timegm(&start)*1000000+le(&data[4],4)/1000;
+    record->encoding=data[15];
+    rate_bits=le(&data[16],4)|((uint64_t)le(&data[20],4)<<32);
+    memcpy(&record->rate,&rate_bits,sizeof(double));
+    record->count=le(&data[24],4);
+    memcpy(record->sid,&data[MSEED_FIXED_HEADER],data[33]);
+    record->sid[data[33]]='\0';
+    record->payload=&data[MSEED_FIXED_HEADER+data[33]+le(&data[34],2)];
+    record->payload_length=le(&data[36],4);
+    return true;
+}
+
+static void test_records(void){
+    //2024-02-29 12:34:56.789012, 2000-12-31 (day 366), 1969-12-31 23:59:59.5, 1970-01-01, 2099-12-31
+    static const int64_t starts[]={1709210096789012,978220800000001,-500000,0,4102358399999999};
+    static uint8_t data[MSEED_FIXED_HEADER+MSEED_SID_MAX+STEIM_MAX_FRAMES(MAX_SAMPLES)*STEIM_FRAME_BYTES];
+    static int32_t samples[MAX_SAMPLES], decoded[MAX_SAMPLES];
+    char sid[MSEED_SID_MAX];
+    uint8_t sid_length;
+    uint32_t state=51, length;
+    record_t record;
+
+    sid_length=mseed_sid(sid,"XX","ST01","00",mseed_band_code(100),'H','Z');
+    CHECK(sid_length==strlen("FDSN:XX_ST01_00_E_H_Z") && memcmp(sid,"FDSN:XX_ST01_00_E_H_Z",sid_length)==0);
+
+    for(uint8_t i=0;i<sizeof(starts)/sizeof(starts[0]);i++){
+        uint8_t level=(i&1)?STEIM_1:STEIM_2;
+        uint16_t count=(uint16_t)(1+test_random(&state)%MAX_SAMPLES);
+
+        for(uint16_t n=0;n<count;n++){
+            samples[n]=(int32_t)(test_random(&state)%2001)-1000+(n?samples[n-1]:0);
+        }
+        length=mseed_write_record(data,sizeof(data),sid,sid_length,starts[i],100,level,samples,count);
+        CHECK(length!=0 && mseed_record_length(data)==length);
+        CHECK(record_read(data,length,&record));
+        CHECK(record.length==length);
+        CHECK(record.start_us==starts[i] && mseed_record_start_us(data)==starts[i]);
+        CHECK(record.encoding==(level==STEIM_1?MSEED_ENCODING_STEIM1:MSEED_ENCODING_STEIM2));
+        CHECK(record.rate==100.0 && record.count==count);
+        CHECK(strcmp(record.sid,"FDSN:XX_ST01_00_E_H_Z")==0);
+        CHECK(record.payload_length%STEIM_FRAME_BYTES==0 && record.payload+record.payload_length==data+length);
+        CHECK(steim_decode(level,record.payload,(uint16_t)(record.payload_length/STEIM_FRAME_BYTES),count,decoded)==count);
+        CHECK(memcmp(decoded,samples,count*sizeof(int32_t))==0);
+
+        //one changed byte: the CRC
+        data[length/2]^=0x10;
+        CHECK(!record_read(data,length,&record));
+    }
+
+    //too small for the header and one frame or for the samples
+    CHECK(mseed_write_record(data,MSEED_FIXED_HEADER+sid_length+STEIM_FRAME_BYTES-1,sid,sid_length,0,100,STEIM_2,samples,1)==0);
+    CHECK(mseed_write_record(data,MSEED_FIXED_HEADER+sid_length+STEIM_FRAME_BYTES,sid,sid_length,0,100,STEIM_2,samples,100)==0);
+    data[0]='X';
+    CHECK(mseed_record_length(data)==0);
+}
+
+static void test_sid(void){
+    char sid[MSEED_SID_MAX];
+
+    CHECK(mseed_band_code(1000)=='G' && mseed_band_code(250)=='D' && mseed_band_code(200)=='E');
+    CHECK(mseed_band_code(80)=='E' && mseed_band_code(50)=='S' && mseed_band_code(10)=='S' && mseed_band_code(5)=='?');
+    //"FDSN:" + 3 "_" + location + 6 bytes of band, source and subsource
+    CHECK(mseed_sid(sid,"NETWORKNET","STATIONSTATIONSTATION","0000",'E','H','Z')==MSEED_SID_MAX);
+    CHECK(mseed_sid(sid,"NETWORKNET","STATIONSTATIONSTATION","00000",'E','H','Z')==0);
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    test_records();
+    test_sid();
+    return TEST_END();
+}
@@ -0,0 +1,236 @@
+/*
+Short packets (packet_duration.c, PACKET_DURATION_MS): items and buffers of every
+duration, packets of every length through packet_codec.c
+(every encoding, decode gives the raw packet back), the overhead of the header, and a
+simulation of the pipeline (sensors -> hot buffers -> HTTP POST) that measures the latency
+of the samples for 12 s, 1 s and 0.5 s packets.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "packet_codec.h"
+#include "packet_header.h"
+#include "packet_duration.h"
+#include "decimator.h"
+
+//main.c
+#define RATE 100 //packet rate (Hz)
+#define NUMBER_OF_BUFFERS 3 //hot buffers, PACKET_BUFFER_SIZE bytes with every duration
+
+static char raw[PACKET_SIZE], encoded[PACKET_SIZE], decoded[PACKET_SIZE];
+static int32_t work[PACKET_CODEC_WORK_SAMPLES];
+
+//raw packet of "items" items like fill_buffer_with_sensor_task (random walk, sensor resolution)
+static void raw_make(uint16_t items, uint32_t *state){
+    packet_layout_t layout={0};
+    packet_header_t header={0};
+    int32_t value;
+
+    memset(raw,0,sizeof(raw));
+    packet_layout_init(&layout,items);
+    header.encoding=PACKET_ENCODING_RAW;
+    header.items=items;
+    header.sensors=PACKET_CHANNEL_COUNT;
+    header.station='A';
+    header.rate=RATE;
+    header.sequence=test_random(state);
+    header.start_us=1700000000000000LL;
+    header.time_quality=1000;
+    packet_header_write(raw,&header);
+
+    for(uint8_t i=0;i<PACKET_CHANNEL_COUNT;i++){
+        const packet_channel_t *channel=&layout.channels[i];
+        uint8_t shift=8*channel->bytes-channel->bits;
+
+        raw[channel->id_offset]=(char)channel->id;
+        value=0;
+        for(uint16_t n=0;n<items;n++){
+            value+=(int32_t)(test_random(state)%201)-100;
+            decimator_pack((int32_t)((uint32_t)value<<shift),channel->bytes,(uint8_t *)&raw[channel->data_offset+n*channel->bytes]);
+        }
+    }
+    for(uint32_t n=layout.timing_offset;n<layout.size;n++){
+        raw[n]=(char)test_random(state);
+    }
+    packet_header_seal(raw,layout.size);
+}
+
+/*Every encoding of packets from 1 to ITEMS_PER_SENSOR items: the ITEMS of the header give
+the layout, decode gives the same raw packet*/
+static void test_codec(void){
+    static const uint16_t lengths[]={1,2,3,50,63,64,65,100,1000,ITEMS_PER_SENSOR};
+    static const uint8_t encodings[]={PACKET_ENCODING_STEIM1,PACKET_ENCODING_STEIM2,PACKET_ENCODING_PACKED,PACKET_ENCODING_DELTA};
+    packet_layout_t layout={0};
+    uint16_t size;
+    uint32_t state=19;
+
+    for(uint8_t j=0;j<sizeof(lengths)/sizeof(lengths[0]);j++){
+        raw_make(lengths[j],&state);
+        packet_layout_init(&layout,lengths[j]);
+        CHECK(packet_encoded_size(raw)==layout.size);
+        CHECK(packet_header_check(raw,PACKET_SIZE));
+        memset(decoded,0,sizeof(decoded));
+        CHECK(packet_decode(raw,decoded,work));
+        CHECK(memcmp(raw,decoded,layout.size)==0);
+
+        for(uint8_t e=0;e<sizeof(encodings);e++){
+            size=packet_encode(raw,encoded,encodings[e],layout.size,work);
+            //0: the encoded packet isn't smaller (it is sent raw), the block headers of very short ones
+            CHECK(size!=0 || lengths[j]<100);
+            if (size==0){
+                continue;
+            }
+            CHECK(size<layout.size && size==packet_encoded_size(encoded));
+            //size of packet_codec.h
+            CHECK(MCP356X_SCAN_CHANNELS!=1 || lengths[j]!=1200 || encodings[e]!=PACKET_ENCODING_PACKED || size==21364);
+            memset(decoded,0,sizeof(decoded));
+            CHECK(packet_decode(encoded,decoded,work));
+            CHECK(memcmp(raw,decoded,layout.size)==0);
+        }
+    }
+
+    //ITEMS bigger than the buffers of this firmware
+    raw_make(10,&state);
+    raw[PACKET_HEADER_ITEMS]=(char)((ITEMS_PER_SENSOR+1)>>8);
+    raw[PACKET_HEADER_ITEMS+1]=(char)((ITEMS_PER_SENSOR+1)&0xFF);
+    packet_header_seal(raw,PACKET_SIZE_ITEMS(10));
+    CHECK(!packet_decode(raw,decoded,work));
+    CHECK(packet_encode(raw,encoded,PACKET_ENCODING_STEIM2,PACKET_SIZE,work)==0);
+}
+
+/*packet_items and packet_duration_valid, and the overhead of main.c
+(CONTROL_BYTES, IDs, START_TIME and DATETIME_TIME at 100 Hz)*/
+static void test_items(void){
+    static const uint16_t durations[]={12000,1000,500};
+    static const double overhead[]={0.2,2.8,5.4}; //% (main.c)
+    uint32_t fixed=CONTROL_BYTES+PACKET_CHANNEL_COUNT+16;
+
+    CHECK(packet_items(RATE,12000)==1200 || ITEMS_PER_SENSOR<1200);
+    CHECK(packet_items(RATE,500)==50);
+    CHECK(packet_items(RATE,1004)==100);
+    CHECK(packet_items(RATE,1005)==101);
+    CHECK(packet_items(1,400)==1);
+    CHECK(packet_items(RATE,60000)==ITEMS_PER_SENSOR);
+    CHECK(!packet_items_limited(RATE,12000) && packet_items_limited(RATE,12010));
+    CHECK(!packet_items_limited(RATE,500) && packet_items_limited(1000,60000));
+    CHECK(packet_items(1000,PACKET_DURATION_MIN_MS)==500);
+
+    CHECK(!packet_duration_valid(0) && !packet_duration_valid(PACKET_DURATION_MIN_MS-1));
+    CHECK(packet_duration_valid(PACKET_DURATION_MIN_MS) && packet_duration_valid(PACKET_DURATION_MAX_MS));
+    CHECK(!packet_duration_valid(PACKET_DURATION_MAX_MS+1) && packet_duration_valid(PACKET_DURATION_MS));
+
+    //every packet fits in the buffers (the backlog of any duration and rate can be read back)
+    CHECK(PACKET_BUFFER_SIZE==PACKET_SIZE && PACKET_BUFFER_SIZE<=PACKET_MAX_BYTES);
+    for(uint16_t rate=1;rate<=1000;rate=(rate<10)?rate+1:rate*2){
+        for(uint16_t duration_ms=PACKET_DURATION_MIN_MS;duration_ms<=PACKET_DURATION_MAX_MS;duration_ms+=500){
+            uint16_t items=packet_items(rate,duration_ms);
+
+            CHECK(items>=1 && PACKET_SIZE_ITEMS(items)<=PACKET_BUFFER_SIZE);
+            CHECK(packet_items_limited(rate,duration_ms)==(items==ITEMS_PER_SENSOR && (uint32_t)rate*duration_ms>=ITEMS_PER_SENSOR*1000u+500));
+        }
+    }
+
+#if MCP356X_SCAN_CHANNELS==1
+    CHECK(fixed==57);
+    CHECK(PACKET_SIZE==24057); //max_buffer_size of main.c
+    for(uint8_t j=0;j<sizeof(durations)/sizeof(durations[0]);j++){
+        uint16_t items=packet_items(RATE,durations[j]);
+        double percent=100.0*fixed/PACKET_SIZE_ITEMS(items);
+        CHECK(percent>overhead[j]-0.05 && percent<overhead[j]+0.05);
+    }
+#else
+    (void)durations; (void)overhead; (void)fixed;
+#endif
+}
+
+
+/*======================================================================
+ * PIPELINE SIMULATION
+ *
+ * Samples at RATE, the fill task takes them one tick later. A packet
+ * takes a hot buffer with its first sample and is queued to WiFi when
+ * it is full. WiFi sends one POST at a time (round trip + bytes at the
+ * link rate), the buffer is free again after the POST. Latency = time
+ * the POST ends - time of the sample. Without a free buffer the samples
+ * of the packet are lost (the cold tier isn't simulated).
+ ======================================================================*/
+#define SIM_SECONDS 600
+#define LINK_BYTES_S 20000.0 //slow WiFi uplink
+#define POST_ROUND_TRIP_S 0.05 //keep-alive: request and response
+#define TLS_HANDSHAKE_S 1.2 //a new connection for every POST
+
+typedef struct {
+    double first_mean; //latency of the first sample of the packets
+    double last_max; //latency of the last sample (worst case of the newest data)
+    double first_max;
+    uint32_t packets;
+    uint32_t lost; //packets without a free buffer
+} latency_t;
+
+static latency_t simulate(uint16_t duration_ms, double post_overhead_s){
+    uint16_t items=packet_items(RATE,duration_ms);
+    uint16_t buffers=NUMBER_OF_BUFFERS;
+    double packet_s=(double)items/RATE, tick_s=1.0/RATE;
+    double post_s=post_overhead_s+PACKET_SIZE_ITEMS(items)/LINK_BYTES_S;
+    double *free_at=calloc(buffers,sizeof(double)); //time every buffer is free again
+    double link_free=0, start, full, sent, sum=0;
+    latency_t latency={0};
+
+    for(start=0;start+packet_s<=SIM_SECONDS;start+=packet_s){
+        uint16_t buffer=0;
+
+        for(uint16_t i=1;i<buffers;i++){
+            if (free_at[i]<free_at[buffer]) buffer=i;
+        }
+        if (free_at[buffer]>start+tick_s){
+            latency.lost++;
+            continue;
+        }
+        full=start+packet_s+tick_s; //the last sample is taken one tick after it
+        sent=(full>link_free?full:link_free)+post_s;
+        link_free=sent;
+        free_at[buffer]=sent;
+
+        latency.packets++;
+        sum+=sent-start;
+        if (sent-start>latency.first_max) latency.first_max=sent-start;
+        if (sent-(start+packet_s-tick_s)>latency.last_max) latency.last_max=sent-(start+packet_s-tick_s);
+    }
+    latency.first_mean=(latency.packets!=0)?sum/latency.packets:0;
+    free(free_at);
+    return latency;
+}
+
+static void test_latency(void){
+    static const uint16_t durations[]={12000,1000,500};
+    latency_t latency[3], handshake;
+
+    printf("duration  items  buffers  first sample mean/max (s)  last sample max (s)\n");
+    for(uint8_t j=0;j<3;j++){
+        uint16_t items=packet_items(RATE,durations[j]);
+
+        latency[j]=simulate(durations[j],POST_ROUND_TRIP_S);
+        printf("%6d ms  %5d  %7d  %12.2f / %-12.2f  %8.2f\n",durations[j],items,NUMBER_OF_BUFFERS,
+            latency[j].first_mean,latency[j].first_max,latency[j].last_max);
+        CHECK(latency[j].lost==0);
+        //a packet leaves once it is full: the first sample waits the whole duration
+        CHECK(latency[j].first_mean>=durations[j]/1000.0);
+    }
+    //early warning: the data is at the server in less than 2 packet durations
+    CHECK(latency[1].first_max<2*1.0 && latency[2].first_max<2*0.5);
+    CHECK(latency[0].first_max>12.0);
+    CHECK(latency[2].last_max<latency[1].last_max && latency[1].last_max<latency[0].last_max);
+
+    //a TLS handshake per POST doesn't keep up with 0.5 s packets (keep-alive of http_post_send)
+    handshake=simulate(500,TLS_HANDSHAKE_S+POST_ROUND_TRIP_S);
+    printf("  500 ms with a handshake per POST: %u packets lost of %u\n",handshake.lost,handshake.lost+handshake.packets);
+    CHECK(handshake.lost!=0);
+}
+
+int main(void){
+    test_codec();
+    test_items();
+    test_latency();
+    return TEST_END();
+}
@@ -0,0 +1,183 @@
+/*
+packet_header.h and crc32c.h: CRC-32C check values (RFC 3720), CRC in parts, every field of
+the header at its offset (big endian), versions, seal and check of corrupted packets.
+--bench: crc32c against a bit by bit CRC, header write + seal + check of a full packet.
+*/
+#include <string.h>
+
+#include "test.h"
+#include "packet_header.h"
+#include "crc32c.h"
+
+#define PACKET_BYTES 30000
+
+static uint32_t reference_crc32c(uint32_t crc, const uint8_t *data, uint32_t length){
+    crc=~crc;
+    for(uint32_t i=0;i<length;i++){
+        crc^=data[i];
+        for(uint8_t bit=0;bit<8;bit++){
+            crc=(crc>>1)^(crc&1?0x82F63B78:0);
+        }
+    }
+    return ~crc;
+}
+
+static uint64_t be(const char *data, uint8_t bytes){
+    uint64_t value=0;
+
+    for(uint8_t i=0;i<bytes;i++){
+        value=(value<<8)|(uint8_t)data[i];
+    }
+    return value;
+}
+
+static void test_crc(void){
+    static uint8_t data[4096];
+    uint8_t vector[32];
+    uint32_t state=81, errors=0;
+
+    //check value and the iSCSI vectors (RFC 3720 B.4)
+    CHECK(crc32c(0,(const uint8_t *)"123456789",9)==0xE3069283);
+    memset(vector,0,32);
+    CHECK(crc32c(0,vector,32)==0x8A9136AA);
+    memset(vector,0xFF,32);
+    CHECK(crc32c(0,vector,32)==0x62A8AB43);
+    for(uint8_t i=0;i<32;i++){
+        vector[i]=i;
+    }
+    CHECK(crc32c(0,vector,32)==0x46DD794E);
+    for(uint8_t i=0;i<32;i++){
+        vector[i]=31-i;
+    }
+    CHECK(crc32c(0,vector,32)==0x113FDB5C);
+    CHECK(crc32c(0,vector,0)==0 && crc32c(0x12345678,vector,0)==0x12345678);
+
+    //random lengths and alignments against the bit by bit CRC, in parts
+    for(uint32_t n=0;n<sizeof(data);n++){
+        data[n]=(uint8_t)test_random(&state);
+    }
+    for(uint32_t round=0;round<2000;round++){
+        uint32_t offset=test_random(&state)%64;
+        uint32_t length=test_random(&state)%(sizeof(data)-offset);
+        uint32_t split=length?test_random(&state)%length:0;
+        uint32_t crc=reference_crc32c(0,&data[offset],length);
+
+        errors+=crc32c(0,&data[offset],length)!=crc;
+        errors+=crc32c(crc32c(0,&data[offset],split),&data[offset+split],length-split)!=crc;
+    }
+    CHECK(errors==0);
+}
+
+static void test_header(void){
+    static char buffer[PACKET_BYTES];
+    packet_header_t header={2,1500,7,'A',100,0xFEDCBA98,-1234567890123,PACKET_HEADER_QUALITY_UNKNOWN,0,0};
+    packet_header_t read;
+
+    memset(buffer,0x33,sizeof(buffer));
+    packet_header_write(buffer,&header);
+    CHECK(memcmp(buffer,"DL",2)==0 && buffer[PACKET_HEADER_VERSION_OFFSET]==4);
+    CHECK(buffer[PACKET_HEADER_ENCODING]==2 && be(&buffer[PACKET_HEADER_ITEMS],2)==1500);
+    CHECK(buffer[PACKET_HEADER_SENSORS]==7 && buffer[PACKET_HEADER_STATION]=='A');
+    CHECK(be(&buffer[PACKET_HEADER_RATE],2)==100 && be(&buffer[PACKET_HEADER_SEQUENCE],4)==0xFEDCBA98);
+    CHECK((int64_t)be(&buffer[PACKET_HEADER_START],8)==-1234567890123);
+    CHECK(be(&buffer[PACKET_HEADER_TIME_QUALITY],4)==0xFFFFFFFF);
+    //the fields are one after the other, LENGTH and CRC are not written yet
+    CHECK(PACKET_HEADER_START+8==PACKET_HEADER_TIME_QUALITY && PACKET_HEADER_TIME_QUALITY+4==PACKET_HEADER_LENGTH);
+    CHECK(PACKET_HEADER_LENGTH+4==PACKET_HEADER_CRC && PACKET_HEADER_CRC+4==PACKET_HEADER_BYTES);
+    CHECK(be(&buffer[PACKET_HEADER_LENGTH],4)==0x33333333);
+
+    packet_header_seal(buffer,1000);
+    CHECK(be(&buffer[PACKET_HEADER_LENGTH],4)==1000-PACKET_HEADER_BYTES);
+    CHECK(packet_header_packet_size(buffer)==1000);
+    CHECK(packet_header_read(buffer,&read));
+    CHECK(read.encoding==header.encoding && read.items==header.items && read.sensors==header.sensors);
+    CHECK(read.station==header.station && read.rate==header.rate && read.sequence==header.sequence);
+    CHECK(read.start_us==header.start_us && read.time_quality==header.time_quality);
+    CHECK(read.length==1000-PACKET_HEADER_BYTES);
+    CHECK(read.crc==reference_crc32c(reference_crc32c(0,(const uint8_t *)buffer,PACKET_HEADER_CRC),
+        (const uint8_t *)&buffer[PACKET_HEADER_BYTES],1000-PACKET_HEADER_BYTES));
+
+    //versions: 1 (no MAGIC), 2 and 3 (a header, not valid), 4
+    CHECK(packet_header_present(buffer) && packet_header_current(buffer));
+    buffer[PACKET_HEADER_VERSION_OFFSET]=3;
+    CHECK(packet_header_present(buffer) && !packet_header_current(buffer) && !packet_header_read(buffer,&read));
+    CHECK(packet_header_packet_size(buffer)==0 && !packet_header_check(buffer,sizeof(buffer)));
+    buffer[PACKET_HEADER_VERSION_OFFSET]=4;
+    buffer[0]=0x05; //ITEMS_PER_SENSOR 1500 of version 1
+    buffer[1]=(char)0xDC;
+    CHECK(!packet_header_present(buffer) && !packet_header_current(buffer));
+}
+
+static void test_check(void){
+    static char buffer[PACKET_BYTES];
+    packet_header_t header={0,1500,7,'A',100,1,0,10,0,0};
+    uint32_t state=83, errors=0;
+
+    for(uint32_t n=0;n<sizeof(buffer);n++){
+        buffer[n]=(char)test_random(&state);
+    }
+    packet_header_write(buffer,&header);
+    packet_header_seal(buffer,PACKET_BYTES);
+    CHECK(packet_header_check(buffer,PACKET_BYTES));
+    //shorter buffer than LENGTH, no header
+    CHECK(!packet_header_check(buffer,PACKET_BYTES-1) && !packet_header_check(buffer,PACKET_HEADER_BYTES-1));
+    //a bit changed anywhere (but VERSION and MAGIC, already checked)
+    for(uint32_t round=0;round<300;round++){
+        uint32_t position=test_random(&state)%PACKET_BYTES;
+        uint8_t bit=(uint8_t)(1<<(test_random(&state)%8));
+
+        buffer[position]^=(char)bit;
+        errors+=packet_header_check(buffer,PACKET_BYTES);
+        buffer[position]^=(char)bit;
+    }
+    CHECK(errors==0);
+    CHECK(packet_header_check(buffer,PACKET_BYTES));
+    //an empty payload
+    packet_header_seal(buffer,PACKET_HEADER_BYTES);
+    CHECK(packet_header_check(buffer,PACKET_HEADER_BYTES) && packet_header_packet_size(buffer)==PACKET_HEADER_BYTES);
+}
+
+static void bench(void){
+    enum {ROUNDS=2000};
+    static char buffer[PACKET_BYTES];
+    packet_header_t header={0,1500,7,'A',100,1,0,10,0,0};
+    uint32_t state=85, valid=0;
+    volatile uint32_t sink=0;
+    double start, table_time, bit_time, packet_time;
+
+    for(uint32_t n=0;n<sizeof(buffer);n++){
+        buffer[n]=(char)test_random(&state);
+    }
+    start=test_seconds();
+    for(uint32_t n=0;n<ROUNDS;n++){
+        sink+=crc32c(n,(const uint8_t *)buffer,PACKET_BYTES);
+    }
+    table_time=(test_seconds()-start)/ROUNDS;
+    start=test_seconds();
+    for(uint32_t n=0;n<ROUNDS/20;n++){
+        sink+=reference_crc32c(n,(const uint8_t *)buffer,PACKET_BYTES);
+    }
+    bit_time=(test_seconds()-start)/(ROUNDS/20);
+    start=test_seconds();
+    for(uint32_t n=0;n<ROUNDS;n++){
+        header.sequence=n;
+        packet_header_write(buffer,&header);
+        packet_header_seal(buffer,PACKET_BYTES);
+        valid+=packet_header_check(buffer,PACKET_BYTES);
+    }
+    packet_time=(test_seconds()-start)/ROUNDS;
+    (void)sink;
+    CHECK(valid==ROUNDS);
+    printf("bench crc32c %.0f MB/s (bit by bit %.0f MB/s), header write + seal + check of %d bytes %.1f us\n",
+        PACKET_BYTES/table_time/1e6,PACKET_BYTES/bit_time/1e6,PACKET_BYTES,packet_time*1e6);
+}
+
+int main(int argc, char **argv){
+    test_crc();
+    test_header();
+    test_check();
+    if (test_bench(argc,argv)){
+        bench();
+    }
+    return TEST_END();
+}
@@ -0,0 +1,244 @@
+/*
+packet_layout.h: the generated offsets and packing against the runtime calculation of the
+first firmware (buffer_general_calc and the byte by byte copy of fill_buffer_with_sensor_task),
+byte for byte, for every packet length.
+--bench: one packet with the old loop and with packet_pack_channel.
+*/
+#include <string.h>
+
+#include "test.h"
+#include "packet_layout.h"
+
+#define BYTES_SAMPLE_ADXL355 9 //main.c
+#define BYTES_SAMPLE_MMA8451Q 6
+#define BATCH 64 //SAMPLE_RING_BATCH
+
+//tables of the first firmware (main.c), same order as the packet
+#if MCP356X_SCAN_CHANNELS==1
+static const uint8_t id_sensor[] = {0,1,2,3,4,5,6};
+static const uint8_t bytes_p_item[] = {3,3,3,3,2,2,2};
+#else
+static const uint8_t id_sensor[] = {0,7,8,1,2,3,4,5,6};
+static const uint8_t bytes_p_item[] = {3,3,3,3,3,3,2,2,2};
+#endif
+#define NUMBER_OF_SENSORS (sizeof(id_sensor))
+
+typedef struct {
+    uint32_t offset_buffer_per_sensor[NUMBER_OF_SENSORS];
+    uint32_t offset_buffer_timing;
+    uint32_t max_buffer_size;
+    uint32_t total_bytes_sensors;
+} old_layout_t;
+
+//buffer_general_calc with "items" instead of ITEMS_PER_SENSOR
+static void buffer_general_calc(old_layout_t *old, uint32_t items){
+    memset(old,0,sizeof(old_layout_t));
+    old->max_buffer_size=CONTROL_BYTES+NUMBER_OF_SENSORS;
+    old->offset_buffer_per_sensor[0]=CONTROL_BYTES+1;
+    for(uint32_t each_sensor=0;each_sensor<NUMBER_OF_SENSORS-1;each_sensor++){
+        old->offset_buffer_per_sensor[each_sensor+1]=old->offset_buffer_per_sensor[each_sensor]+1+bytes_p_item[each_sensor]*items;
+        old->max_buffer_size+=items*bytes_p_item[each_sensor];
+        old->total_bytes_sensors+=bytes_p_item[each_sensor];
+    }
+    old->max_buffer_size+=items*bytes_p_item[NUMBER_OF_SENSORS-1];
+    old->total_bytes_sensors+=bytes_p_item[NUMBER_OF_SENSORS-1];
+    old->offset_buffer_timing=old->max_buffer_size;
+    old->max_buffer_size+=PACKET_TIMING_BYTES(items);
+}
+
+static void test_offsets(void){
+    static const uint16_t lengths[]={1,2,7,100,1000,ITEMS_PER_SENSOR};
+    packet_layout_t layout={0};
+    old_layout_t old;
+
+    CHECK(PACKET_CHANNEL_COUNT==NUMBER_OF_SENSORS);
+    //longest packet, compile time values
+    buffer_general_calc(&old,ITEMS_PER_SENSOR);
+    CHECK(PACKET_SIZE==old.max_buffer_size);
+    CHECK(PACKET_TIMING_OFFSET==old.offset_buffer_timing);
+    CHECK(PACKET_BYTES_PER_ITEM==old.total_bytes_sensors);
+    for(uint8_t i=0;i<PACKET_CHANNEL_COUNT;i++){
+        CHECK(packet_channels[i].id==id_sensor[i]);
+        CHECK(packet_channels[i].bytes==bytes_p_item[i]);
+        CHECK(packet_channels[i].data_offset==old.offset_buffer_per_sensor[i]);
+        CHECK(packet_channels[i].id_offset==old.offset_buffer_per_sensor[i]-1);
+    }
+    CHECK(PACKET_DATA_OFFSET(adxl355_x)==packet_channels[PACKET_INDEX_adxl355_x].data_offset);
+    CHECK(PACKET_ID_OFFSET(mma8451q_z)==packet_channels[PACKET_INDEX_mma8451q_z].id_offset);
+
+    //shorter packets (runtime layout)
+    for(uint8_t j=0;j<sizeof(lengths)/sizeof(lengths[0]);j++){
+        buffer_general_calc(&old,lengths[j]);
+        CHECK(packet_layout_init(&layout,lengths[j]));
+        CHECK(layout.items==lengths[j] && layout.size==old.max_buffer_size && layout.timing_offset==old.offset_buffer_timing);
+        CHECK(layout.timing_bytes==PACKET_TIMING_BYTES(lengths[j]));
+        for(uint8_t i=0;i<PACKET_CHANNEL_COUNT;i++){
+            CHECK(layout.channels[i].data_offset==old.offset_buffer_per_sensor[i]);
+            CHECK(layout.channels[i].id_offset==old.offset_buffer_per_sensor[i]-1);
+            CHECK(layout.channels[i].item_offset==packet_channels[i].item_offset);
+        }
+    }
+    CHECK(!packet_layout_init(&layout,0));
+    CHECK(!packet_layout_init(&layout,ITEMS_PER_SENSOR+1));
+}
+
+/*A packet filled the old way (data_queue of every item copied byte by byte) and with
+packet_pack_channel (blocks of samples, one channel at a time) are the same*/
+static void test_pack(void){
+    static const uint16_t lengths[]={1,37,ITEMS_PER_SENSOR};
+    static packet_item_t items[ITEMS_PER_SENSOR];
+    static char old_packet[PACKET_SIZE], new_packet[PACKET_SIZE];
+    packet_layout_t layout;
+    old_layout_t old;
+    uint32_t state=21;
+
+    for(uint8_t j=0;j<sizeof(lengths)/sizeof(lengths[0]);j++){
+        uint16_t length=lengths[j];
+
+        for(uint32_t n=0;n<sizeof(items);n++){
+            ((uint8_t *)items)[n]=(uint8_t)test_random(&state);
+        }
+        memset(old_packet,0x55,sizeof(old_packet));
+        memset(new_packet,0x55,sizeof(new_packet));
+
+        buffer_general_calc(&old,length);
+        for(uint16_t each_item=0;each_item<length;each_item++){
+            const uint8_t *data_queue=(const uint8_t *)&items[each_item];
+            uint32_t data_buff_pos=0;
+
+            for(uint8_t each_sensor=0;each_sensor<NUMBER_OF_SENSORS;each_sensor++){
+                uint32_t empty_buff_pos=old.offset_buffer_per_sensor[each_sensor]+each_item*bytes_p_item[each_sensor];
+
+                for(uint8_t each_byte_per_item=0;each_byte_per_item<bytes_p_item[each_sensor];each_byte_per_item++){
+                    old_packet[empty_buff_pos+each_byte_per_item]=(char)data_queue[data_buff_pos++];
+                }
+            }
+        }
+
+        //in blocks of different sizes, like the batches of the rings
+        packet_layout_init(&layout,length);
+        for(uint16_t first=0,count;first<length;first+=count){
+            count=(uint16_t)(1+test_random(&state)%64);
+            count=count>length-first?length-first:count;
+            for(uint8_t i=0;i<PACKET_CHANNEL_COUNT;i++){
+                packet_pack_channel(new_packet,&layout.channels[i],first,count,
+                    (const uint8_t *)&items[first]+layout.channels[i].item_offset,sizeof(packet_item_t));
+            }
+        }
+        CHECK(memcmp(old_packet,new_packet,sizeof(old_packet))==0);
+    }
+}
+
+//the old loop: data_queue (one item of every sensor) copied byte by byte to every sensor
+static void old_fill(char *packet, const old_layout_t *old, const mcp356x_sample_t *adc, const uint8_t *adxl355, const uint8_t *mma8451q, uint16_t length){
+    uint8_t data_queue[PACKET_BYTES_PER_ITEM];
+
+    for(uint16_t each_item=0;each_item<length;each_item++){
+        uint32_t data_buff_pos=0;
+
+        memcpy(data_queue,adc[each_item].data,3*MCP356X_SCAN_CHANNELS);
+        memcpy(&data_queue[3*MCP356X_SCAN_CHANNELS],&adxl355[each_item*BYTES_SAMPLE_ADXL355],BYTES_SAMPLE_ADXL355);
+        memcpy(&data_queue[3*MCP356X_SCAN_CHANNELS+BYTES_SAMPLE_ADXL355],&mma8451q[each_item*BYTES_SAMPLE_MMA8451Q],BYTES_SAMPLE_MMA8451Q);
+        for(uint8_t each_sensor=0;each_sensor<NUMBER_OF_SENSORS;each_sensor++){
+            uint32_t empty_buff_pos=old->offset_buffer_per_sensor[each_sensor]+each_item*bytes_p_item[each_sensor];
+
+            for(uint8_t each_byte_per_item=0;each_byte_per_item<bytes_p_item[each_sensor];each_byte_per_item++){
+                packet[empty_buff_pos+each_byte_per_item]=(char)data_queue[data_buff_pos++];
+            }
+        }
+    }
+}
+
+//fill_buffer_with_sensor_task: batches of the rings, one packet_pack_channel per channel
+static void new_fill(char *packet, const packet_layout_t *layout, const mcp356x_sample_t *adc, const uint8_t *adxl355, const uint8_t *mma8451q, uint16_t length){
+    for(uint16_t each_item=0,batch_size;each_item<length;each_item+=batch_size){
+        batch_size=length-each_item<BATCH?length-each_item:BATCH;
+        for(uint8_t each_channel=0;each_channel<MCP356X_SCAN_CHANNELS;each_channel++){
+            packet_pack_channel(packet,&layout->channels[each_channel],each_item,batch_size,
+                &adc[each_item].data[3*each_channel],sizeof(mcp356x_sample_t));
+        }
+        for(uint8_t each_channel=0;each_channel<3;each_channel++){
+            packet_pack_channel(packet,&layout->channels[PACKET_INDEX_adxl355_x+each_channel],each_item,batch_size,
+                &adxl355[each_item*BYTES_SAMPLE_ADXL355+3*each_channel],BYTES_SAMPLE_ADXL355);
+            packet_pack_channel(packet,&layout->channels[PACKET_INDEX_mma8451q_x+each_channel],each_item,batch_size,
+                &mma8451q[each_item*BYTES_SAMPLE_MMA8451Q+2*each_channel],BYTES_SAMPLE_MMA8451Q);
+        }
+    }
+}
+
+static mcp356x_sample_t adc[ITEMS_PER_SENSOR];
+static uint8_t adxl355[ITEMS_PER_SENSOR*BYTES_SAMPLE_ADXL355];
+static uint8_t mma8451q[ITEMS_PER_SENSOR*BYTES_SAMPLE_MMA8451Q];
+static char old_packet[PACKET_SIZE], new_packet[PACKET_SIZE];
+
+static void samples_make(uint32_t *state){
+    for(uint32_t n=0;n<ITEMS_PER_SENSOR;n++){
+        adc[n].timestamp=n;
+        for(uint8_t i=0;i<sizeof(adc[n].data);i++){
+            adc[n].data[i]=(uint8_t)test_random(state);
+        }
+    }
+    for(uint32_t n=0;n<sizeof(adxl355);n++){
+        adxl355[n]=(uint8_t)test_random(state);
+    }
+    for(uint32_t n=0;n<sizeof(mma8451q);n++){
+        mma8451q[n]=(uint8_t)test_random(state);
+    }
+}
+
+/*Golden output: the samples of the rings packed by the fill task are the same bytes as
+with the old loop*/
+static void test_fill(void){
+    static const uint16_t lengths[]={1,63,64,65,ITEMS_PER_SENSOR};
+    packet_layout_t layout;
+    old_layout_t old;
+    uint32_t state=33;
+
+    for(uint8_t j=0;j<sizeof(lengths)/sizeof(lengths[0]);j++){
+        samples_make(&state);
+        memset(old_packet,0,sizeof(old_packet));
+        memset(new_packet,0,sizeof(new_packet));
+        buffer_general_calc(&old,lengths[j]);
+        packet_layout_init(&layout,lengths[j]);
+        old_fill(old_packet,&old,adc,adxl355,mma8451q,lengths[j]);
+        new_fill(new_packet,&layout,adc,adxl355,mma8451q,lengths[j]);
+        CHECK(memcmp(old_packet,new_packet,sizeof(old_packet))==0);
+    }
+}
+
+static void bench(void){
+    enum {PACKETS=2000};
+    packet_layout_t layout;
+    old_layout_t old;
+    uint32_t state=35;
+    double start, old_time, new_time;
+
+    samples_make(&state);
+    buffer_general_calc(&old,ITEMS_PER_SENSOR);
+    packet_layout_init(&layout,ITEMS_PER_SENSOR);
+
+    start=test_seconds();
+    for(uint32_t n=0;n<PACKETS;n++){
+        old_fill(old_packet,&old,adc,adxl355,mma8451q,ITEMS_PER_SENSOR);
+        __asm__ volatile("" : : "r"(old_packet) : "memory");
+    }
+    old_time=(test_seconds()-start)/PACKETS;
+    start=test_seconds();
+    for(uint32_t n=0;n<PACKETS;n++){
+        new_fill(new_packet,&layout,adc,adxl355,mma8451q,ITEMS_PER_SENSOR);
+        __asm__ volatile("" : : "r"(new_packet) : "memory");
+    }
+    new_time=(test_seconds()-start)/PACKETS;
+    printf("bench packet of %d items x %d channels: old loop %.1f us, packet_pack_channel %.1f us (%.1fx)\n",
+        ITEMS_PER_SENSOR,PACKET_CHANNEL_COUNT,old_time*1e6,new_time*1e6,old_time/new_time);
+}
+
+int main(int argc, char **argv){
+    test_offsets();
+    test_pack();
+    test_fill();
+    if (test_bench(argc,argv)){
+        bench();
+    }
+    return TEST_END();
+}
@@ -0,0 +1,91 @@
+/*
+sample_rate.h: every row of the table against the limits of the sensors, the MCP356x OSR and
+SCAN TIMER (one SCAN cycle per sample period) and the FIFO mode rules.
+*/
+#include "test.h"
+#include "sample_rate.h"
+#include "spi_mcp356x.h"
+
+#define SETTLING_DMCLK 64
+
+//DMCLK periods of one SCAN cycle
+static uint32_t scan_cycle(uint16_t osr, uint8_t channels){
+    return (uint32_t)channels*(osr+SETTLING_DMCLK);
+}
+
+static void test_table(void){
+    uint8_t size=sample_rate_table_size();
+    uint16_t previous=0;
+
+    CHECK(size>0);
+    CHECK(sample_rate_table_entry(size)==NULL);
+    CHECK(sample_rate_lookup(0)==NULL && sample_rate_lookup(123)==NULL);
+    for(uint8_t i=0;i<size;i++){
+        const sample_rate_entry_t *entry=sample_rate_table_entry(i);
+        uint32_t period_dmclk=MCP356X_DMCLK_HZ/entry->rate;
+
+        CHECK(entry->rate>previous);
+        previous=entry->rate;
+        CHECK(sample_rate_lookup(entry->rate)==entry);
+        CHECK(entry->adxl355_odr_mhz>=(uint32_t)entry->rate*1000);
+        CHECK(entry->mma8451q_odr_mhz>=(uint32_t)entry->rate*1000 || entry->mma8451q_odr_mhz==800000);
+        CHECK(sample_rate_timer_period(entry)*entry->rate==SAMPLE_RATE_TIMER_SCALE);
+        //the biggest OSR whose conversion fits in one period
+        CHECK(scan_cycle(entry->mcp356x_osr,1)<=period_dmclk);
+        CHECK(scan_cycle(entry->mcp356x_osr*2,1)>period_dmclk);
+        CHECK(sample_rate_mcp356x_osr(entry,MCP356X_DMCLK_HZ,1)==entry->mcp356x_osr);
+        CHECK(sample_rate_mcp356x_config1(entry,MCP356X_DMCLK_HZ,1)==entry->mcp356x_config1);
+    }
+}
+
+static void test_scan(void){
+    for(uint8_t i=0;i<sample_rate_table_size();i++){
+        const sample_rate_entry_t *entry=sample_rate_table_entry(i);
+        uint32_t period_dmclk=MCP356X_DMCLK_HZ/entry->rate;
+
+        for(uint8_t channels=1;channels<=8;channels++){
+            uint16_t osr=sample_rate_mcp356x_osr(entry,MCP356X_DMCLK_HZ,channels);
+            uint8_t config1=sample_rate_mcp356x_config1(entry,MCP356X_DMCLK_HZ,channels);
+            uint32_t timer=sample_rate_mcp356x_scan_timer(entry,MCP356X_DMCLK_HZ,channels);
+
+            if (osr==0){
+                //not even OSR 32 fits: the rate isn't valid with these channels
+                CHECK(scan_cycle(32,channels)>period_dmclk);
+                continue;
+            }
+            CHECK(osr>=32 && osr<=entry->mcp356x_osr && (osr&(osr-1))==0);
+            CHECK(scan_cycle(osr,channels)<=period_dmclk);
+            CHECK(osr==entry->mcp356x_osr || scan_cycle(osr*2,channels)>period_dmclk);
+            //CONFIG1: PRESCALER_8 and OSR_32 = 0 ... OSR_8192 = 8
+            CHECK((config1&~(0B1111<<OSR))==PRESCALER_8_MCLK);
+            CHECK((32u<<((config1>>OSR)&0B1111))==osr);
+            //the TIMER stretches the cycle to the sample period
+            CHECK(scan_cycle(osr,channels)+timer==period_dmclk);
+        }
+    }
+    //two channels don't fit in 1 ms (sample_rate_valid refuses the rate)
+    CHECK(sample_rate_mcp356x_osr(sample_rate_lookup(1000),MCP356X_DMCLK_HZ,2)==0);
+}
+
+static void test_fifo(void){
+    CHECK(!sample_rate_supported(NULL,false,false));
+    for(uint8_t i=0;i<sample_rate_table_size();i++){
+        const sample_rate_entry_t *entry=sample_rate_table_entry(i);
+
+        CHECK(sample_rate_supported(entry,false,false));
+        CHECK(sample_rate_supported(entry,true,false)==(entry->adxl355_odr_mhz==(uint32_t)entry->rate*1000));
+        CHECK(sample_rate_supported(entry,false,true)==(entry->mma8451q_odr_mhz==(uint32_t)entry->rate*1000));
+    }
+    CHECK(!sample_rate_supported(sample_rate_lookup(100),true,false)); //ADXL355 at 125 Hz
+    CHECK(sample_rate_supported(sample_rate_lookup(250),true,false));
+    CHECK(!sample_rate_supported(sample_rate_lookup(1000),false,true)); //MMA8451Q at 800 Hz
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    test_table();
+    test_scan();
+    test_fifo();
+    return TEST_END();
+}
@@ -0,0 +1,329 @@
+/*
+sample_ring.h: order, wrap around, batches, overruns, and a producer / consumer stress test with
+two threads. A ring that follows another one with a different clock and FIFO bursts stays
+aligned. --bench compares it with a queue of one mutex (the per-sample FreeRTOS queues).
+*/
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "test.h"
+#include "sample_ring.h"
+
+#define STRESS_ITEMS 4000000
+#define SLIP_PERIOD 10000      //us between two samples of the reference (100 Hz, TIMER mode)
+#define SLIP_BURST 200000      //us between two FIFO reads of the follower
+#define SLIP_DRAIN 100000      //us between two batches of the consumer (SAMPLE_RING_DRAIN_MS)
+#define SLIP_SECONDS 1200
+#define STRESS_CAPACITY 64
+#define BENCH_ITEMS 10000000
+
+typedef struct {
+    uint8_t bytes[9]; //like one ADXL355 sample: sequence (4 bytes) and a pattern
+} item_t;
+
+static void item_make(item_t *item, uint32_t sequence){
+    memcpy(item->bytes,&sequence,4);
+    for (uint8_t i=4;i<sizeof(item->bytes);i++){
+        item->bytes[i]=(uint8_t)(sequence*7+i);
+    }
+}
+
+static bool item_valid(const item_t *item, uint32_t sequence){
+    item_t expected;
+    item_make(&expected,sequence);
+    return memcmp(item,&expected,sizeof(item_t))==0;
+}
+
+
+/*======================================================================
+ * SINGLE THREAD
+ ======================================================================*/
+static void test_init(void){
+    sample_ring_t ring;
+    uint8_t storage[64];
+
+    CHECK(!sample_ring_init(&ring,storage,4,12));  //not a power of 2
+    CHECK(!sample_ring_init(&ring,storage,0,8));
+    CHECK(!sample_ring_init(&ring,NULL,4,8));
+    CHECK(sample_ring_init(&ring,storage,4,16));
+    CHECK(sample_ring_count(&ring)==0);
+}
+
+static void test_order_and_overrun(void){
+    sample_ring_t ring;
+    item_t storage[8], item;
+
+    sample_ring_init(&ring,storage,sizeof(item_t),8);
+    CHECK(!sample_ring_pop(&ring,&item));
+    for (uint32_t i=0;i<8;i++){
+        item_make(&item,i);
+        CHECK(sample_ring_push(&ring,&item));
+    }
+    //full: dropped and counted
+    item_make(&item,8);
+    CHECK(!sample_ring_push(&ring,&item));
+    CHECK(ring.overruns==1);
+    CHECK(sample_ring_count(&ring)==8);
+    for (uint32_t i=0;i<8;i++){
+        CHECK(sample_ring_pop(&ring,&item) && item_valid(&item,i));
+    }
+    CHECK(sample_ring_count(&ring)==0);
+}
+
+//batches that cross the end of the storage, and counters that overflow
+static void test_batch_wrap(void){
+    sample_ring_t ring;
+    item_t storage[16], item, batch[16];
+    uint32_t pushed=0, popped=0, count;
+    uint32_t state=1;
+
+    sample_ring_init(&ring,storage,sizeof(item_t),16);
+    atomic_store(&ring.head,UINT32_MAX-40);
+    atomic_store(&ring.tail,UINT32_MAX-40);
+    for (uint32_t round=0;round<1000;round++){
+        count=test_random(&state)%17;
+        for (uint32_t i=0;i<count && sample_ring_count(&ring)<16;i++){
+            item_make(&item,pushed);
+            CHECK(sample_ring_push(&ring,&item));
+            pushed++;
+        }
+        count=sample_ring_pop_batch(&ring,batch,1+test_random(&state)%16);
+        for (uint32_t i=0;i<count;i++){
+            CHECK(item_valid(&batch[i],popped));
+            popped++;
+        }
+    }
+    popped+=sample_ring_pop_batch(&ring,batch,16);
+    CHECK(popped==pushed);
+    CHECK(ring.overruns==0);
+}
+
+
+/*======================================================================
+ * FOLLOW: a sensor with its own clock (FIFO read in bursts) against the
+ * reference ring (one push per timer tick). Every item is the time of its
+ * sample, the items taken together have to be the same time.
+ ======================================================================*/
+typedef struct {
+    uint32_t max_error;  //us between the two items of a pair (after the start)
+    uint32_t pairs;
+    uint32_t slips;
+} slip_result_t;
+
+static slip_result_t slip_run(double drift_ppm, uint32_t start_delay, bool follow){
+    static uint32_t reference_storage[512], follower_storage[512];
+    sample_ring_t reference, follower;
+    uint32_t batch_reference[64], batch_follower[64], last=0;
+    uint64_t next_reference=0, next_burst=start_delay+SLIP_BURST, next_drain=SLIP_DRAIN;
+    double follower_period=SLIP_PERIOD/(1+drift_ppm*1e-6), next_sample=start_delay;
+    slip_result_t result={0,0,0};
+
+    sample_ring_init(&reference,reference_storage,sizeof(uint32_t),512);
+    sample_ring_init(&follower,follower_storage,sizeof(uint32_t),512);
+    if (follow){
+        sample_ring_follow(&follower,&reference);
+    }
+    for (uint64_t now=0;now<(uint64_t)SLIP_SECONDS*1000000;now+=100){
+        if (now>=next_reference){
+            uint32_t time=(uint32_t)next_reference;
+            sample_ring_push(&reference,&time);
+            next_reference+=SLIP_PERIOD;
+        }
+        //FIFO read: every sample of the sensor since the last one
+        if (now>=next_burst){
+            while (next_sample<=(double)now){
+                uint32_t time=(uint32_t)next_sample;
+                sample_ring_push(&follower,&time);
+                next_sample+=follower_period;
+            }
+            next_burst+=SLIP_BURST;
+        }
+        if (now>=next_drain){
+            int32_t slip=sample_ring_slip(&follower);
+            uint32_t batch=64;
+
+            if (batch>sample_ring_count(&reference)) batch=sample_ring_count(&reference);
+            if (batch>sample_ring_count_slipped(&follower,slip)) batch=sample_ring_count_slipped(&follower,slip);
+            if (batch!=0){
+                CHECK(sample_ring_pop_batch(&reference,batch_reference,batch)==batch);
+                CHECK(sample_ring_pop_slipped(&follower,batch_follower,batch,slip,&last)==batch);
+            }
+            for (uint32_t i=0;i<batch && now>start_delay+10*SLIP_BURST;i++){
+                uint32_t error=(batch_follower[i]>batch_reference[i])?batch_follower[i]-batch_reference[i]:batch_reference[i]-batch_follower[i];
+                if (error>result.max_error) result.max_error=error;
+                result.pairs++;
+            }
+            next_drain+=SLIP_DRAIN;
+        }
+    }
+    CHECK(reference.overruns==0);
+    result.slips=follower.slips;
+    return result;
+}
+
+static void test_follow(void){
+    static const double drifts[]={0,150,-150,30000,-30000};
+    slip_result_t result;
+
+    for (uint8_t i=0;i<sizeof(drifts)/sizeof(drifts[0]);i++){
+        //the sensor starts 1.3 s after the reference (its items are repeated until then)
+        result=slip_run(drifts[i],1300000,true);
+        CHECK(result.pairs>SLIP_SECONDS*1000000/SLIP_PERIOD-500); //all but the first 3.3 s
+        //the last sample of the FIFO can be 1 period old, plus the slip margin and 1 repeated item
+        CHECK(result.max_error<=(SAMPLE_RING_SLIP_ITEMS+2)*SLIP_PERIOD);
+        //one item every 1/drift items, not more (the bursts aren't slipped)
+        CHECK(result.slips<=130+10+(uint32_t)(fabs(drifts[i])*1e-6*SLIP_SECONDS*1000000/SLIP_PERIOD)*11/10);
+        printf("follow %+.0f ppm: %u pairs, max error %.1f periods, %u slips\n",drifts[i],result.pairs,
+            (double)result.max_error/SLIP_PERIOD,result.slips);
+    }
+    //the same rings without follow: the sensor with 150 ppm is 18 samples ahead after 20 minutes
+    result=slip_run(150,0,false);
+    CHECK(result.max_error>15*SLIP_PERIOD);
+}
+
+
+/*======================================================================
+ * TWO THREADS: every item arrives once and in order
+ ======================================================================*/
+static sample_ring_t stress_ring;
+static item_t stress_storage[STRESS_CAPACITY];
+
+static void *stress_producer(void *argument){
+    item_t item;
+    (void)argument;
+
+    for (uint32_t i=0;i<STRESS_ITEMS;i++){
+        item_make(&item,i);
+        while (!sample_ring_push(&stress_ring,&item)){
+            //full: the sensor task would drop it, here it is pushed again
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void test_stress(void){
+    pthread_t producer;
+    item_t batch[32];
+    uint32_t received=0, errors=0, count;
+
+    sample_ring_init(&stress_ring,stress_storage,sizeof(item_t),STRESS_CAPACITY);
+    pthread_create(&producer,NULL,stress_producer,NULL);
+    while (received<STRESS_ITEMS){
+        count=sample_ring_pop_batch(&stress_ring,batch,1+received%32);
+        for (uint32_t i=0;i<count;i++){
+            if (!item_valid(&batch[i],received+i)){
+                errors++;
+            }
+        }
+        received+=count;
+        if (count==0){
+            sched_yield();
+        }
+    }
+    pthread_join(producer,NULL);
+    CHECK(errors==0);
+    CHECK(sample_ring_count(&stress_ring)==0);
+    printf("stress: %u items through a ring of %u, %u overruns (retried)\n",STRESS_ITEMS,STRESS_CAPACITY,stress_ring.overruns);
+}
+
+
+/*======================================================================
+ * BENCHMARK: ring (batch pop) vs one mutex per push and per pop
+ ======================================================================*/
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty, not_full;
+    item_t items[STRESS_CAPACITY];
+    uint32_t head, tail;
+} locked_queue_t;
+
+static locked_queue_t queue;
+
+static void *queue_producer(void *argument){
+    item_t item;
+    (void)argument;
+
+    for (uint32_t i=0;i<BENCH_ITEMS;i++){
+        item_make(&item,i);
+        pthread_mutex_lock(&queue.mutex);
+        while (queue.head-queue.tail==STRESS_CAPACITY){
+            pthread_cond_wait(&queue.not_full,&queue.mutex);
+        }
+        queue.items[queue.head%STRESS_CAPACITY]=item;
+        queue.head++;
+        pthread_cond_signal(&queue.not_empty);
+        pthread_mutex_unlock(&queue.mutex);
+    }
+    return NULL;
+}
+
+static void *ring_producer(void *argument){
+    item_t item;
+    (void)argument;
+
+    for (uint32_t i=0;i<BENCH_ITEMS;i++){
+        item_make(&item,i);
+        while (!sample_ring_push(&stress_ring,&item)){
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void bench(void){
+    pthread_t producer;
+    item_t item, batch[32];
+    uint32_t received=0, count;
+    double start, ring_s, queue_s;
+
+    sample_ring_init(&stress_ring,stress_storage,sizeof(item_t),STRESS_CAPACITY);
+    start=test_seconds();
+    pthread_create(&producer,NULL,ring_producer,NULL);
+    while (received<BENCH_ITEMS){
+        count=sample_ring_pop_batch(&stress_ring,batch,32);
+        received+=count;
+        if (count==0){
+            sched_yield();
+        }
+    }
+    pthread_join(producer,NULL);
+    ring_s=test_seconds()-start;
+
+    pthread_mutex_init(&queue.mutex,NULL);
+    pthread_cond_init(&queue.not_empty,NULL);
+    pthread_cond_init(&queue.not_full,NULL);
+    received=0;
+    start=test_seconds();
+    pthread_create(&producer,NULL,queue_producer,NULL);
+    while (received<BENCH_ITEMS){
+        pthread_mutex_lock(&queue.mutex);
+        while (queue.head==queue.tail){
+            pthread_cond_wait(&queue.not_empty,&queue.mutex);
+        }
+        item=queue.items[queue.tail%STRESS_CAPACITY];
+        queue.tail++;
+        pthread_cond_signal(&queue.not_full);
+        pthread_mutex_unlock(&queue.mutex);
+        received++;
+    }
+    pthread_join(producer,NULL);
+    queue_s=test_seconds()-start;
+    (void)item;
+
+    printf("bench: ring %.1f ns/item, mutex queue %.1f ns/item (%.1fx), %u items of %u bytes\n",
+        ring_s*1e9/BENCH_ITEMS,queue_s*1e9/BENCH_ITEMS,queue_s/ring_s,BENCH_ITEMS,(unsigned)sizeof(item_t));
+}
+
+int main(int argc, char **argv){
+    test_init();
+    test_order_and_overrun();
+    test_batch_wrap();
+    test_follow();
+    test_stress();
+    if (test_bench(argc,argv)){
+        bench();
+    }
+    return TEST_END();
+}
@@ -0,0 +1,437 @@
+/*
+sd_log.c in a temporary folder: packets of many sizes over several segments read back in
+order, by location and by time. Crashes are left on the files the way a reset leaves them
+on the card: a record cut in the middle (segment_scan ends the segment before it and the
+next append writes it again), a segment cut before its header was written, and old records
+and indexes in the clusters of a new preallocated segment (rejected by the SALT). The
+smallest packets fill a segment before SD_LOG_SEGMENT_RECORDS.
+--bench: sd_log_append and sd_log_read_at against fopen/fwrite/fclose of one file per packet
+(the old SD task), both with the data flushed to the disk.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test.h"
+#include "sd_log.h"
+
+#define PACKET_BYTES 30000
+
+static char packet[PACKET_BYTES], expected[PACKET_BYTES];
+static sd_log_t log;
+
+//folder of the log, its name must fit in SD_LOG_FOLDER_BYTES
+static void folder_make(char *folder){
+    strcpy(folder,"/tmp/sdlogXXXXXX");
+    if (mkdtemp(folder)==NULL){
+        perror("mkdtemp");
+        exit(1);
+    }
+}
+
+static void folder_remove(const char *folder){
+    char path[300];
+    struct dirent *file;
+    DIR *directory=opendir(folder);
+
+    while (directory!=NULL && (file=readdir(directory))!=NULL){
+        if (file->d_name[0]!='.'){
+            snprintf(path,sizeof(path),"%s/%s",folder,file->d_name);
+            remove(path);
+        }
+    }
+    if (directory!=NULL){
+        closedir(directory);
+    }
+    rmdir(folder);
+}
+
+static uint16_t folder_files(const char *folder){
+    struct dirent *file;
+    DIR *directory=opendir(folder);
+    uint16_t files=0;
+
+    while ((file=readdir(directory))!=NULL){
+        files+=(file->d_name[0]!='.');
+    }
+    closedir(directory);
+    return files;
+}
+
+static void segment_file(const char *folder, uint32_t segment, char *path){
+    snprintf(path,64,"%s/%08X.LOG",folder,(unsigned int)segment);
+}
+
+//bytes of a segment file (as a reset left them on the card)
+static void file_write(const char *path, uint32_t offset, const void *data, uint32_t bytes){
+    FILE *file=fopen(path,"r+b");
+
+    CHECK(file!=NULL && fseek(file,(long)offset,SEEK_SET)==0 && fwrite(data,bytes,1,file)==1);
+    fclose(file);
+}
+
+static void file_read(const char *path, uint32_t offset, void *data, uint32_t bytes){
+    FILE *file=fopen(path,"rb");
+
+    CHECK(file!=NULL && fseek(file,(long)offset,SEEK_SET)==0 && fread(data,bytes,1,file)==1);
+    fclose(file);
+}
+
+//packet "number": its size and bytes
+static uint32_t packet_size(uint32_t number){
+    return 1000+(number*7919)%27000;
+}
+
+static void packet_make(char *buffer, uint32_t number, uint32_t size){
+    uint32_t state=number+1;
+
+    for(uint32_t i=0;i<size;i++){
+        buffer[i]=(char)test_random(&state);
+    }
+}
+
+static bool append(uint32_t number, uint32_t size){
+    packet_make(packet,number,size);
+    return sd_log_append(&log,packet,size,1000000LL*number);
+}
+
+//the record at location is packet "number"
+static bool record_is(sd_log_location_t location, uint32_t number, uint32_t size){
+    packet_make(expected,number,size);
+    return sd_log_read_at(&log,location,packet,sizeof(packet))==(int32_t)size && memcmp(packet,expected,size)==0;
+}
+
+
+/*======================================================================
+ * TESTS
+ ======================================================================*/
+/*600 packets over several segments: the location of every append, the order after a reopen,
+a new append seen by the reader, packets longer than the buffer, seek and trim*/
+static void test_append_read(void){
+    static sd_log_location_t locations[600];
+    char folder[SD_LOG_FOLDER_BYTES];
+    sd_log_location_t location;
+    uint32_t number;
+    int32_t result;
+
+    folder_make(folder);
+    CHECK(sd_log_open(&log,folder,0x1234));
+    CHECK(!sd_log_pending(&log) && sd_log_read(&log,packet,sizeof(packet),&location)==SD_LOG_EMPTY);
+    for(number=0;number<600;number++){
+        locations[number]=sd_log_append_location(&log,packet_size(number));
+        CHECK(append(number,packet_size(number)));
+        CHECK(locations[number].segment==log.segment && locations[number].record==log.count-1);
+    }
+    CHECK(log.segment>=3 && folder_files(folder)==log.segment);
+    sd_log_close(&log);
+
+    //the LOG_ID of the segments, not the one of a new log
+    CHECK(sd_log_open(&log,folder,0x9999) && log.log_id==0x1234 && log.first==1);
+    for(number=0;number<600;number++){
+        result=sd_log_read(&log,packet,sizeof(packet),&location);
+        packet_make(expected,number,packet_size(number));
+        CHECK(result==(int32_t)packet_size(number) && memcmp(packet,expected,packet_size(number))==0);
+        CHECK(location.segment==locations[number].segment && location.record==locations[number].record);
+    }
+    CHECK(sd_log_read(&log,packet,sizeof(packet),&location)==SD_LOG_EMPTY && !sd_log_pending(&log));
+    for(number=0;number<600;number+=37){
+        CHECK(record_is(locations[number],number,packet_size(number)));
+    }
+
+    CHECK(append(600,500) && sd_log_pending(&log));
+    CHECK(sd_log_read(&log,packet,sizeof(packet),&location)==500);
+    CHECK(append(601,20000));
+    CHECK(sd_log_read(&log,packet,1000,&location)==SD_LOG_TOO_LONG && !sd_log_pending(&log));
+
+    //seek: the first packet at the time or after it
+    for(int64_t start_us=0;start_us<=601000000LL;start_us+=7777777){
+        number=(uint32_t)((start_us+999999)/1000000);
+        CHECK(sd_log_seek(&log,start_us));
+        CHECK(sd_log_read(&log,packet,sizeof(packet),&location)>0);
+        CHECK(number>=600 || (location.segment==locations[number].segment && location.record==locations[number].record));
+    }
+    CHECK(!sd_log_seek(&log,602000000LL));
+
+    //trim: the oldest segments are removed, never the newest one
+    sd_log_trim(&log,3);
+    CHECK(log.first==3 && folder_files(folder)==log.segment-2);
+    location=locations[0];
+    CHECK(sd_log_read_at(&log,location,packet,sizeof(packet))==SD_LOG_CORRUPTED);
+    CHECK(sd_log_locate(&log,&location) && location.segment==3 && location.record==0);
+    sd_log_trim(&log,UINT32_MAX);
+    CHECK(log.first==log.segment && folder_files(folder)==1);
+    sd_log_close(&log);
+    CHECK(sd_log_open(&log,folder,1) && log.first==log.segment);
+    sd_log_close(&log);
+    folder_remove(folder);
+}
+
+/*Reset in the middle of sd_log_append: the end of the records of the segment is the record
+that was cut, the next append writes over it and the rest of the cut record isn't a record*/
+static void test_torn_record(void){
+    static const uint32_t cuts[]={1,10,SD_LOG_RECORD_BYTES-1,SD_LOG_RECORD_BYTES,SD_LOG_RECORD_BYTES+3000,SD_LOG_RECORD_BYTES+5999};
+    char folder[SD_LOG_FOLDER_BYTES], path[64];
+    static char zero[SD_LOG_RECORD_BYTES+6000];
+    uint32_t tail;
+
+    for(uint8_t i=0;i<sizeof(cuts)/sizeof(cuts[0]);i++){
+        folder_make(folder);
+        CHECK(sd_log_open(&log,folder,7));
+        for(uint32_t number=0;number<5;number++){
+            CHECK(append(number,4000));
+        }
+        tail=log.tail;
+        CHECK(append(5,6000));
+        sd_log_close(&log);
+
+        //only the first cuts[i] bytes of the last record reached the card, and not the
+        //entries of the last two records (segment_scan writes them again)
+        segment_file(folder,1,path);
+        file_write(path,tail+cuts[i],zero,SD_LOG_RECORD_BYTES+6000-cuts[i]);
+        file_write(path,SD_LOG_DATA_END+12+4*SD_LOG_ENTRY_BYTES,zero,2*SD_LOG_ENTRY_BYTES);
+        CHECK(sd_log_open(&log,folder,7) && log.file!=NULL);
+        CHECK(log.count==5 && log.tail==tail);
+        CHECK(record_is((sd_log_location_t){1,4},4,4000));
+        CHECK(sd_log_append_location(&log,3000).record==5);
+
+        //written again, shorter: the end of the old record after it isn't read as a record
+        CHECK(append(6,3000));
+        sd_log_close(&log);
+        CHECK(sd_log_open(&log,folder,7) && log.count==6 && log.tail==tail+SD_LOG_RECORD_BYTES+3000);
+        CHECK(record_is((sd_log_location_t){1,5},6,3000) && record_is((sd_log_location_t){1,4},4,4000));
+        sd_log_close(&log);
+        folder_remove(folder);
+    }
+}
+
+/*Reset while a new segment was created (the previous one is sealed): without a complete
+header the file is removed and the segment is created again by the next append, with the
+header but not extended yet it is an empty segment*/
+static void test_segment_cut(void){
+    static const uint32_t sizes[]={0,4,SD_LOG_HEADER_BYTES-1,SD_LOG_HEADER_BYTES};
+    char folder[SD_LOG_FOLDER_BYTES], path[64];
+    sd_log_location_t location;
+    uint32_t count;
+
+    for(uint8_t i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++){
+        folder_make(folder);
+        CHECK(sd_log_open(&log,folder,9));
+        for(uint32_t number=0;number<=SD_LOG_SEGMENT_RECORDS;number++){
+            CHECK(append(number,100));
+        }
+        CHECK(log.segment==2 && log.count==1);
+        sd_log_close(&log);
+        segment_file(folder,2,path);
+        CHECK(truncate(path,sizes[i])==0);
+
+        CHECK(sd_log_open(&log,folder,9));
+        if (sizes[i]<SD_LOG_HEADER_BYTES){
+            CHECK(log.segment==1 && log.file==NULL && log.count==SD_LOG_SEGMENT_RECORDS);
+            CHECK(access(path,F_OK)!=0);
+            location=sd_log_append_location(&log,100);
+            CHECK(location.segment==2 && location.record==0);
+        }
+        else{
+            CHECK(log.segment==2 && log.file!=NULL && log.count==0 && log.tail==SD_LOG_HEADER_BYTES);
+        }
+        for(count=0;sd_log_read(&log,packet,sizeof(packet),&location)>0;count++);
+        CHECK(count==SD_LOG_SEGMENT_RECORDS && log.skipped==0);
+
+        CHECK(append(1000,100));
+        sd_log_close(&log);
+        CHECK(sd_log_open(&log,folder,9) && log.segment==2 && log.count==1);
+        CHECK(record_is((sd_log_location_t){2,0},1000,100));
+        sd_log_close(&log);
+        folder_remove(folder);
+    }
+}
+
+/*A new segment keeps the old clusters of the card: records and the index of an older segment
+of the same log (other SEGMENT) or of another log (other LOG_ID) at the same offsets are
+valid records except for the SALT, the segment ends at its own last record and isn't sealed*/
+static void test_stale_clusters(void){
+    static char old[SD_LOG_SEGMENT_BYTES];
+    char folder[SD_LOG_FOLDER_BYTES], path[64];
+    uint32_t tail;
+    uint8_t header[SD_LOG_RECORD_BYTES];
+
+    for(uint8_t other_log=0;other_log<2;other_log++){
+        //the old data: a sealed segment 1 of the same size of packets
+        folder_make(folder);
+        CHECK(sd_log_open(&log,folder,11));
+        for(uint32_t number=0;sd_log_append_location(&log,1000).segment<2;number++){
+            CHECK(append(number,1000));
+        }
+        CHECK(append(5000,1000) && log.segment==2); //1 sealed
+        sd_log_close(&log);
+        segment_file(folder,1,path);
+        file_read(path,0,old,SD_LOG_SEGMENT_BYTES);
+        folder_remove(folder);
+
+        //new segment: segment 3 of the same log or segment 1 of another one, 2 records
+        folder_make(folder);
+        CHECK(sd_log_open(&log,folder,other_log?12:11));
+        if (!other_log){
+            for(uint32_t number=0;sd_log_append_location(&log,1000).segment<3;number++){
+                CHECK(append(number,1000));
+            }
+        }
+        CHECK(append(5000,1000) && append(5001,1000));
+        tail=log.tail;
+        sd_log_close(&log);
+        segment_file(folder,other_log?1:3,path);
+        file_write(path,tail,&old[tail],SD_LOG_SEGMENT_BYTES-tail);
+
+        //without the SALT the old record at the tail would be taken
+        memcpy(header,&old[tail],SD_LOG_RECORD_BYTES);
+        CHECK(memcmp(header,"DR",2)==0 && header[6]==(1000>>8) && header[7]==(1000&0xFF));
+
+        CHECK(sd_log_open(&log,folder,13));
+        CHECK(log.file!=NULL && log.count==2 && log.tail==tail); //not sealed by the old index
+        CHECK(sd_log_read_at(&log,(sd_log_location_t){log.segment,2},packet,sizeof(packet))==SD_LOG_CORRUPTED);
+        CHECK(record_is((sd_log_location_t){log.segment,1},5001,1000));
+        CHECK(append(5002,999));
+        CHECK(record_is((sd_log_location_t){log.segment,2},5002,999));
+        sd_log_close(&log);
+        folder_remove(folder);
+    }
+}
+
+/*Packets of 500 ms at 50 Hz (557 bytes raw, main.c): the records fill the segment, the 
+index in the card has room for all of them. Read back by location and by time after a reopen*/
+static void test_short_packets(void){
+    char folder[SD_LOG_FOLDER_BYTES];
+    sd_log_location_t location;
+    uint32_t number, count;
+
+    folder_make(folder);
+    CHECK(sd_log_open(&log,folder,21));
+    for(number=0;sd_log_append_location(&log,557).segment<2;number++){
+        CHECK(append(number,557));
+    }
+    count=number;
+    CHECK(append(count,557) && log.segment==2);
+    //not more than one more record fits in the data of the segment
+    CHECK(count<SD_LOG_SEGMENT_RECORDS && SD_LOG_HEADER_BYTES+(count+1)*(SD_LOG_RECORD_BYTES+557)>SD_LOG_DATA_END);
+    printf("%u records of 557 bytes in a segment (%.1f%% of the data used)\n",count,
+        100.0*count*(SD_LOG_RECORD_BYTES+557)/SD_LOG_SEGMENT_BYTES);
+    sd_log_close(&log);
+
+    CHECK(sd_log_open(&log,folder,21) && log.segment==2 && log.count==1);
+    for(number=0;number<=count;number+=997){
+        CHECK(record_is((sd_log_location_t){1,(uint16_t)number},number,557));
+    }
+    CHECK(record_is((sd_log_location_t){2,0},count,557));
+    CHECK(sd_log_seek(&log,1000000LL*(count-1)) && sd_log_read(&log,packet,sizeof(packet),&location)==557);
+    CHECK(location.segment==1 && location.record==count-1);
+    sd_log_close(&log);
+    folder_remove(folder);
+}
+
+/*A record of a sealed segment damaged on the card: sd_log_read gives SD_LOG_CORRUPTED once
+and goes on with the next one*/
+static void test_corrupted_record(void){
+    char folder[SD_LOG_FOLDER_BYTES], path[64];
+    sd_log_location_t location;
+    uint32_t good=0, bad=0;
+    int32_t result;
+
+    folder_make(folder);
+    CHECK(sd_log_open(&log,folder,5));
+    for(uint32_t number=0;number<200;number++){
+        CHECK(append(number,27000));
+    }
+    sd_log_close(&log);
+    segment_file(folder,1,path);
+    file_write(path,SD_LOG_HEADER_BYTES+3*(SD_LOG_RECORD_BYTES+27000)+500,"\x55",1);
+
+    CHECK(sd_log_open(&log,folder,5));
+    while ((result=sd_log_read(&log,packet,sizeof(packet),&location))!=SD_LOG_EMPTY){
+        if (result>0){
+            good++;
+        }
+        else{
+            bad++;
+            CHECK(result==SD_LOG_CORRUPTED && location.segment==1 && location.record==3);
+        }
+    }
+    CHECK(good==199 && bad==1 && log.skipped==1);
+    sd_log_close(&log);
+    folder_remove(folder);
+}
+
+
+/*======================================================================
+ * BENCHMARK
+ *
+ * On the host the card is the page cache and fsync of the disk, the
+ * difference is the file system work of every packet (a new directory
+ * entry and clusters against a write inside a preallocated file) and
+ * the CRC-32C that sd_log computes of every record (the files have none).
+ ======================================================================*/
+static void bench(void){
+    static const uint32_t sizes[]={27000,1200};
+    char folder[SD_LOG_FOLDER_BYTES], path[64];
+    enum {PACKETS=2000};
+    static sd_log_location_t locations[PACKETS];
+    double start, files_write, files_read, log_write, log_read;
+    FILE *file;
+
+    for(uint8_t i=0;i<2;i++){
+        folder_make(folder);
+        packet_make(packet,0,sizes[i]);
+        start=test_seconds();
+        for(uint32_t n=0;n<PACKETS;n++){
+            snprintf(path,sizeof(path),"%s/%012X",folder,(unsigned int)n*15000);
+            file=fopen(path,"wb");
+            fwrite(packet,sizes[i],1,file);
+            fflush(file);
+            fsync(fileno(file));
+            fclose(file);
+        }
+        files_write=test_seconds()-start;
+        start=test_seconds();
+        for(uint32_t n=0;n<PACKETS;n++){
+            snprintf(path,sizeof(path),"%s/%012X",folder,(unsigned int)n*15000);
+            file=fopen(path,"rb");
+            CHECK(fread(expected,sizes[i],1,file)==1);
+            fclose(file);
+        }
+        files_read=test_seconds()-start;
+        folder_remove(folder);
+
+        folder_make(folder);
+        CHECK(sd_log_open(&log,folder,1));
+        start=test_seconds();
+        for(uint32_t n=0;n<PACKETS;n++){
+            locations[n]=sd_log_append_location(&log,sizes[i]);
+            sd_log_append(&log,packet,sizes[i],n);
+        }
+        log_write=test_seconds()-start;
+        start=test_seconds();
+        for(uint32_t n=0;n<PACKETS;n++){
+            CHECK(sd_log_read_at(&log,locations[n],expected,sizeof(expected))==(int32_t)sizes[i]);
+        }
+        log_read=test_seconds()-start;
+        sd_log_close(&log);
+        folder_remove(folder);
+
+        printf("bench %5u B packets: file per packet write %6.0f/s read %6.0f/s, sd_log append %6.0f/s read_at %6.0f/s\n",
+            sizes[i],PACKETS/files_write,PACKETS/files_read,PACKETS/log_write,PACKETS/log_read);
+    }
+}
+
+int main(int argc, char **argv){
+    test_append_read();
+    test_torn_record();
+    test_segment_cut();
+    test_stale_clusters();
+    test_short_packets();
+    test_corrupted_record();
+    if (test_bench(argc,argv)){
+        bench();
+    }
+    return TEST_END();
+}
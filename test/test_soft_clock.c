@@ -0,0 +1,284 @@
+/*
+soft_clock.c: anchors of a simulated DS3231 (SQW edges at every second, a perfect clock) to a
+sample timer with a crystal drift. The re-anchors every 60 s (TIME_SERVICE_ANCHOR_S) must not
+make the clock jump or go back, the rollover of the 64 bit timer and of 32 bit seconds (2038)
+must be invisible, RATE must converge to the drift and the error must stay in microseconds.
+*/
+#include <stdlib.h>
+
+#include "test.h"
+#include "soft_clock.h"
+
+#define ANCHOR_S 60                      //sntp_config.h TIME_SERVICE_ANCHOR_S
+#define EPOCH_2024 1704067200000000LL    //2024-01-01 00:00:00 (epoch_us)
+#define EPOCH_2038 2147483648000000LL    //2038-01-19 03:14:08, 2^31 seconds
+
+typedef struct {
+    soft_clock_t clock;
+    uint64_t timer0;   //timer at epoch0
+    int64_t epoch0;
+    double drift_ppm;  //+ = the timer is slow (soft_clock.h RATE)
+} sim_t;
+
+static void sim_init(sim_t *sim, uint64_t timer0, int64_t epoch0, double drift_ppm){
+    soft_clock_init(&sim->clock);
+    sim->timer0=timer0;
+    sim->epoch0=epoch0;
+    sim->drift_ppm=drift_ppm;
+}
+
+//sample timer at the true time epoch_us (it wraps like the hardware counter would)
+static uint64_t sim_timer(const sim_t *sim, int64_t epoch_us){
+    double elapsed=(double)(epoch_us-sim->epoch0)*(1-sim->drift_ppm*1e-6);
+
+    return sim->timer0+(uint64_t)(int64_t)(elapsed>=0?elapsed+0.5:elapsed-0.5);
+}
+
+//anchor at the SQW edge of the DS3231 second epoch_us
+static uint8_t sim_anchor(sim_t *sim, int64_t epoch_us){
+    return soft_clock_anchor(&sim->clock,sim_timer(sim,epoch_us),epoch_us,true);
+}
+
+/*The clock around an anchor: the segment before and the new one give the same time at the
+anchor (within the rounding of one microsecond), and the time never goes back from 2 ms
+before to 2 ms after it*/
+static bool continuous_anchor(sim_t *sim, int64_t epoch_us, uint8_t *result){
+    uint64_t timer=sim_timer(sim,epoch_us);
+    int64_t before=soft_clock_time(&sim->clock,timer), last;
+    bool ok=true;
+
+    *result=soft_clock_anchor(&sim->clock,timer,epoch_us,true);
+    if (*result==SOFT_CLOCK_SLEWED){
+        ok=llabs(soft_clock_time(&sim->clock,timer)-before)<=1;
+    }
+    last=soft_clock_time(&sim->clock,timer-2000);
+    for(uint64_t t=timer-2000;t<=timer+2000;t++){
+        int64_t now=soft_clock_time(&sim->clock,t);
+
+        if (now<last) ok=false;
+        last=now;
+    }
+    return ok;
+}
+
+
+/*======================================================================
+ * TESTS
+ ======================================================================*/
+/*Not anchored: 0. The first anchor is a step to the DS3231, the clock counts the timer*/
+static void test_first_anchor(void){
+    soft_clock_t clock;
+
+    soft_clock_init(&clock);
+    CHECK(soft_clock_time(&clock,123456)==0);
+    CHECK(soft_clock_anchor(&clock,5000000,EPOCH_2024,true)==SOFT_CLOCK_STEPPED);
+    CHECK(clock.anchored && clock.steps==1 && clock.anchors==1 && clock.error_us==0);
+    CHECK(soft_clock_time(&clock,5000000)==EPOCH_2024);
+    CHECK(soft_clock_time(&clock,5000000+1234567)==EPOCH_2024+1234567);
+    CHECK(soft_clock_time(&clock,5000000-1000)==EPOCH_2024-1000); //before the anchor
+}
+
+/*Drifting crystals anchored every 60 s for 6 hours: every re-anchor is continuous and
+monotonic, RATE converges to the drift and the error at the anchors stays small*/
+static void test_reanchor(void){
+    static const double drifts[]={0,23.7,-41.2,95,-150};
+    sim_t sim;
+
+    for(uint8_t i=0;i<sizeof(drifts)/sizeof(drifts[0]);i++){
+        int64_t epoch, error_max=0;
+        uint32_t slewed=0, not_continuous=0;
+        uint8_t result;
+
+        sim_init(&sim,1000000,EPOCH_2024,drifts[i]);
+        CHECK(sim_anchor(&sim,EPOCH_2024)==SOFT_CLOCK_STEPPED);
+        for(epoch=EPOCH_2024+ANCHOR_S*1000000LL;epoch<=EPOCH_2024+6*3600*1000000LL;epoch+=ANCHOR_S*1000000LL){
+            if (!continuous_anchor(&sim,epoch,&result)) not_continuous++;
+            if (result==SOFT_CLOCK_SLEWED) slewed++;
+            //error of the clock at the anchor once RATE is known (10 measurements)
+            if (epoch>=EPOCH_2024+11*ANCHOR_S*1000000LL && llabs(sim.clock.error_us)>error_max){
+                error_max=llabs(sim.clock.error_us);
+            }
+        }
+        CHECK(not_continuous==0);
+        CHECK(sim.clock.steps==1 && slewed==6*60); //150 ppm over 60 s = 9 ms: slewed, never a step
+        CHECK(sim.clock.rate_known);
+        CHECK(llabs(sim.clock.rate_ppb-(int64_t)(drifts[i]*1000/(1-drifts[i]*1e-6)))<=2);
+        CHECK(error_max<=2);
+
+        //the minute after the last anchor the clock agrees with the true time
+        epoch-=ANCHOR_S*1000000LL;
+        for(int64_t t=0;t<ANCHOR_S*1000000LL;t+=997331){
+            CHECK(llabs(soft_clock_time(&sim.clock,sim_timer(&sim,epoch+t))-(epoch+t))<=3);
+        }
+        printf("drift %7.1f ppm: RATE %7d ppb, error at the anchors <= %lld us\n",drifts[i],sim.clock.rate_ppb,(long long)error_max);
+    }
+}
+
+/*The 64 bit timer wraps between two anchors (and between the anchor and the samples): the
+unsigned difference keeps the clock continuous*/
+static void test_timer_rollover(void){
+    sim_t sim;
+    uint8_t result;
+    int64_t last=0;
+    bool monotonic=true;
+
+    sim_init(&sim,UINT64_MAX-90000000ULL,EPOCH_2024,35);
+    CHECK(sim_anchor(&sim,EPOCH_2024)==SOFT_CLOCK_STEPPED);
+    for(int64_t epoch=EPOCH_2024;epoch<EPOCH_2024+1800*1000000LL;epoch+=ANCHOR_S*1000000LL){
+        if (epoch!=EPOCH_2024){
+            CHECK(continuous_anchor(&sim,epoch,&result) && result==SOFT_CLOCK_SLEWED);
+        }
+        //samples every 10 ms, over the wrap of the timer in the second segment
+        for(int64_t t=0;t<ANCHOR_S*1000000LL;t+=10000){
+            uint64_t timer=sim_timer(&sim,epoch+t);
+            int64_t now=soft_clock_time(&sim.clock,timer);
+
+            if (now<=last) monotonic=false;
+            last=now;
+            CHECK(llabs(now-(epoch+t))<=3000); //the drift of 35 ppm before RATE is known
+        }
+    }
+    CHECK(monotonic);
+    CHECK(sim.clock.base_timer<UINT64_MAX-90000000ULL); //the timer wrapped
+    CHECK(sim.clock.rate_known && abs(sim.clock.rate_ppb-35001)<=2);
+
+    //an anchor just after the wrap, samples taken just before it (first sample of a packet)
+    soft_clock_init(&sim.clock);
+    CHECK(soft_clock_anchor(&sim.clock,20,EPOCH_2024,true)==SOFT_CLOCK_STEPPED);
+    CHECK(soft_clock_time(&sim.clock,UINT64_MAX-9)==EPOCH_2024-30);
+}
+
+/*2^31 seconds (19 January 2038) between two anchors: epoch_us is 64 bit*/
+static void test_epoch_2038(void){
+    sim_t sim;
+    uint8_t result;
+
+    sim_init(&sim,777,EPOCH_2038-600*1000000LL,-12);
+    CHECK(sim_anchor(&sim,EPOCH_2038-600*1000000LL)==SOFT_CLOCK_STEPPED);
+    for(int64_t epoch=EPOCH_2038-540*1000000LL;epoch<=EPOCH_2038+600*1000000LL;epoch+=ANCHOR_S*1000000LL){
+        CHECK(continuous_anchor(&sim,epoch,&result) && result==SOFT_CLOCK_SLEWED);
+    }
+    CHECK(llabs(soft_clock_time(&sim.clock,sim_timer(&sim,EPOCH_2038+630*1000000LL))-(EPOCH_2038+630*1000000LL))<=3);
+    CHECK(sim.clock.steps==1);
+}
+
+/*Errors up to SOFT_CLOCK_STEP_US are slewed in SOFT_CLOCK_SLEW_SPAN_US at no more than
+SOFT_CLOCK_SLEW_PPB, bigger ones are a step; RATE is kept by the steps*/
+static void test_slew_and_step(void){
+    soft_clock_t clock;
+    uint64_t timer=1000000;
+    int64_t epoch=EPOCH_2024, start;
+    int32_t rate;
+
+    soft_clock_init(&clock);
+    soft_clock_anchor(&clock,timer,epoch,true);
+    soft_clock_anchor(&clock,timer+20000000,epoch+20000000+400,true); //RATE 20 ppm
+    CHECK(clock.rate_known && clock.rate_ppb==20000);
+    rate=clock.rate_ppb;
+
+    //9 ms late at the next edge: slewed (300 ppm), the clock meets the DS3231 30 s later
+    timer+=40000000;
+    epoch+=40000000;
+    start=soft_clock_time(&clock,timer);
+    CHECK(soft_clock_anchor(&clock,timer,start+9000,true)==SOFT_CLOCK_SLEWED);
+    CHECK(clock.error_us==9000 && clock.slew_ppb==300000);
+    CHECK(soft_clock_time(&clock,timer)==start);
+    rate=clock.rate_ppb; //measured again at this edge
+    CHECK(soft_clock_time(&clock,timer+SOFT_CLOCK_SLEW_SPAN_US)-(start+9000+SOFT_CLOCK_SLEW_SPAN_US+SOFT_CLOCK_SLEW_SPAN_US*rate/1000000000)==0);
+    //after the slew span only RATE
+    CHECK(llabs(soft_clock_time(&clock,timer+2*SOFT_CLOCK_SLEW_SPAN_US)-soft_clock_time(&clock,timer+SOFT_CLOCK_SLEW_SPAN_US)
+        -(SOFT_CLOCK_SLEW_SPAN_US+SOFT_CLOCK_SLEW_SPAN_US*rate/1000000000))<=1); //rounding of the two times
+
+    //the slew never goes over SOFT_CLOCK_SLEW_PPB
+    timer+=60000000;
+    start=soft_clock_time(&clock,timer);
+    CHECK(soft_clock_anchor(&clock,timer,start-SOFT_CLOCK_STEP_US,true)==SOFT_CLOCK_SLEWED);
+    CHECK(clock.slew_ppb==-SOFT_CLOCK_SLEW_PPB*2/3 && clock.slew_ppb>=-SOFT_CLOCK_SLEW_PPB);
+
+    //11 ms: step, RATE is kept and the next edge starts a new RATE measurement
+    timer+=60000000;
+    rate=clock.rate_ppb;
+    start=soft_clock_time(&clock,timer);
+    CHECK(soft_clock_anchor(&clock,timer,start+11000,true)==SOFT_CLOCK_STEPPED);
+    CHECK(soft_clock_time(&clock,timer)==start+11000);
+    CHECK(clock.steps==2 && clock.slew_ppb==0 && clock.error_us==0 && clock.rate_ppb==rate);
+    CHECK(clock.rate_started);
+
+    //a step of the DS3231 (set by SNTP): the clock jumps, RATE is kept
+    soft_clock_step(&clock,timer+1000,EPOCH_2038);
+    CHECK(soft_clock_time(&clock,timer+1000)==EPOCH_2038 && clock.rate_ppb==rate && !clock.rate_started);
+}
+
+/*Without SQW edges the read gives the second that started up to 1 s before: the clock is
+kept inside that second, outside it is a step. No RATE without edges*/
+static void test_without_edges(void){
+    soft_clock_t clock;
+    int64_t now;
+
+    soft_clock_init(&clock);
+    CHECK(soft_clock_anchor(&clock,3000000,EPOCH_2024,false)==SOFT_CLOCK_STEPPED);
+    for(uint64_t t=1;t<=100;t++){
+        now=soft_clock_time(&clock,3000000+t*ANCHOR_S*1000000ULL+t*7777);
+        //the read of the second that started before "now"
+        CHECK(soft_clock_anchor(&clock,3000000+t*ANCHOR_S*1000000ULL+t*7777,now-now%1000000,false)==SOFT_CLOCK_KEPT);
+    }
+    CHECK(clock.steps==1 && clock.anchors==101 && !clock.rate_started && !clock.rate_known);
+
+    now=soft_clock_time(&clock,900000000000ULL);
+    CHECK(soft_clock_anchor(&clock,900000000000ULL,now-now%1000000+1000000,false)==SOFT_CLOCK_STEPPED);
+    CHECK(soft_clock_time(&clock,900000000000ULL)==now-now%1000000+1000000);
+}
+
+/*A RATE over SOFT_CLOCK_MAX_RATE_PPB isn't used, anchors closer
+than SOFT_CLOCK_RATE_SPAN_US don't measure RATE*/
+static void test_rate_limits(void){
+    static const double drifts[]={250,500,750,950,1200};
+    soft_clock_t clock;
+    sim_t sim;
+    int32_t rate=0;
+
+    soft_clock_init(&clock);
+    soft_clock_anchor(&clock,0,EPOCH_2024,true);
+    soft_clock_anchor(&clock,10000000,EPOCH_2024+10000100,true);
+    CHECK(!clock.rate_known); //10 s
+    soft_clock_anchor(&clock,20000000,EPOCH_2024+20000000+25000,true); //25 ms: a step, RATE starts again
+    CHECK(!clock.rate_known && clock.steps==2);
+    soft_clock_anchor(&clock,40000000,EPOCH_2024+40000000+25000+400,true); //20 ppm from the step
+    CHECK(clock.rate_known && clock.rate_ppb==20000);
+
+    //filter: 1/SOFT_CLOCK_RATE_FILTER of every new measurement
+    CHECK(soft_clock_anchor(&clock,60000000,EPOCH_2024+60000000+25400+1600,true)==SOFT_CLOCK_SLEWED); //80 ppm
+    CHECK(clock.rate_ppb==20000+(80000-20000)/SOFT_CLOCK_RATE_FILTER);
+
+    //a crystal going 250 ppm at a time to 950 ppm (anchors every second keep the error under
+    //SOFT_CLOCK_STEP_US), then 1200 ppm: the clock is slewed but that RATE isn't used
+    sim_init(&sim,0,EPOCH_2024,250);
+    sim_anchor(&sim,EPOCH_2024);
+    for(uint32_t s=1;s<1500;s++){
+        int64_t epoch=EPOCH_2024+s*1000000LL;
+
+        if (s%300==0){
+            //new drift from here on
+            sim.timer0=sim_timer(&sim,epoch);
+            sim.epoch0=epoch;
+            sim.drift_ppm=drifts[s/300];
+            rate=sim.clock.rate_ppb;
+        }
+        CHECK(sim_anchor(&sim,epoch)==SOFT_CLOCK_SLEWED);
+    }
+    CHECK(sim.clock.steps==1);
+    CHECK(abs(rate-950000)<2000 && sim.clock.rate_ppb==rate);
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    test_first_anchor();
+    test_reanchor();
+    test_timer_rollover();
+    test_epoch_2038();
+    test_slew_and_step();
+    test_without_edges();
+    test_rate_limits();
+    return TEST_END();
+}
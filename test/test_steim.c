@@ -0,0 +1,177 @@
+/*
+steim.h: words of hand encoded blocks (SEED manual rules), round trip of both levels with
+every difference size, the errors of the decoder and corrupted frames.
+--bench: encode and decode throughput and compression ratio of a seismic-like signal.
+*/
+#include <string.h>
+
+#include "test.h"
+#include "steim.h"
+
+#define MAX_SAMPLES 1500
+
+static uint32_t word_at(const uint8_t *frames, uint32_t word){
+    return ((uint32_t)frames[4*word]<<24)|((uint32_t)frames[4*word+1]<<16)|((uint32_t)frames[4*word+2]<<8)|frames[4*word+3];
+}
+
+static void test_golden(void){
+    uint8_t frames[2*STEIM_FRAME_BYTES];
+    int32_t decoded[8];
+
+    //Steim-1: differences 10, 2 | -3, 291 (16 bit) | 1 | -70301 (32 bit)
+    const int32_t steim1_samples[6]={10,12,9,300,301,-70000};
+    const uint32_t steim1_words[7]={0x02BC0000,0x0000000A,0xFFFEEE90,0x000A0002,0xFFFD0123,0x00000001,0xFFFEED63};
+
+    CHECK(steim_encode(STEIM_1,steim1_samples,6,0,frames,2)==1);
+    for(uint8_t i=0;i<STEIM_FRAME_WORDS;i++){
+        CHECK(word_at(frames,i)==(i<7?steim1_words[i]:0));
+    }
+    CHECK(steim_decode(STEIM_1,frames,1,6,decoded)==6 && memcmp(decoded,steim1_samples,sizeof(steim1_samples))==0);
+
+    //Steim-2: seven 4 bit differences (code 11, dnib 10) and one 30 bit (code 10, dnib 01)
+    const int32_t steim2_samples[8]={1,2,3,4,5,6,7,8};
+    const uint32_t steim2_words[5]={0x03800000,0x00000001,0x00000008,0x81111111,0x40000001};
+
+    CHECK(steim_encode(STEIM_2,steim2_samples,8,0,frames,2)==1);
+    for(uint8_t i=0;i<STEIM_FRAME_WORDS;i++){
+        CHECK(word_at(frames,i)==(i<5?steim2_words[i]:0));
+    }
+    CHECK(steim_decode(STEIM_2,frames,1,8,decoded)==8 && memcmp(decoded,steim2_samples,sizeof(steim2_samples))==0);
+}
+
+//random walk whose steps have a random size of 1 to "bits" bits
+static void signal_make(int32_t *samples, uint16_t count, uint8_t bits, uint32_t *state){
+    int64_t value=0;
+
+    for(uint16_t n=0;n<count;n++){
+        uint8_t size=(uint8_t)(1+test_random(state)%bits);
+        int64_t step=(int64_t)(test_random(state)&((1u<<(size-1))-1))-((test_random(state)&1)?(1<<(size-1)):0);
+
+        value+=step;
+        if (value>0x7FFFFF || value<-0x800000){
+            value=0;
+        }
+        samples[n]=(int32_t)value;
+    }
+}
+
+static void test_round_trip(void){
+    static uint8_t frames[STEIM_MAX_FRAMES(MAX_SAMPLES)*STEIM_FRAME_BYTES];
+    static int32_t samples[MAX_SAMPLES], decoded[MAX_SAMPLES];
+    uint32_t state=41, errors=0;
+
+    for(uint32_t round=0;round<3000;round++){
+        uint8_t level=(round&1)?STEIM_2:STEIM_1;
+        uint16_t count=(uint16_t)(1+test_random(&state)%MAX_SAMPLES);
+        uint16_t frame_count;
+        int32_t previous=(int32_t)(test_random(&state)%1000)-500;
+
+        signal_make(samples,count,(uint8_t)(1+round%24),&state);
+        frame_count=steim_encode(level,samples,count,previous,frames,STEIM_MAX_FRAMES(count));
+        if (frame_count==0 || frame_count>STEIM_MAX_FRAMES(count)){
+            errors++;
+            continue;
+        }
+        memset(decoded,0x5A,sizeof(decoded));
+        errors+=steim_decode(level,frames,frame_count,count,decoded)!=count;
+        errors+=memcmp(decoded,samples,count*sizeof(int32_t))!=0;
+    }
+    CHECK(errors==0);
+
+    //Steim-1: any 32 bit difference (modulo 2^32)
+    samples[0]=INT32_MAX;
+    samples[1]=INT32_MIN;
+    samples[2]=INT32_MAX;
+    CHECK(steim_encode(STEIM_1,samples,3,INT32_MIN,frames,1)==1);
+    CHECK(steim_decode(STEIM_1,frames,1,3,decoded)==3 && memcmp(decoded,samples,3*sizeof(int32_t))==0);
+    //Steim-2: 30 bits at most
+    samples[0]=0;
+    samples[1]=1<<29;
+    CHECK(steim_encode(STEIM_2,samples,2,0,frames,1)==0);
+    samples[1]=(1<<29)-1;
+    CHECK(steim_encode(STEIM_2,samples,2,0,frames,1)==1);
+    samples[1]=-(1<<29);
+    CHECK(steim_encode(STEIM_2,samples,2,0,frames,1)==1);
+    CHECK(steim_decode(STEIM_2,frames,1,2,decoded)==2 && decoded[1]==-(1<<29));
+}
+
+static void test_errors(void){
+    static uint8_t frames[STEIM_MAX_FRAMES(MAX_SAMPLES)*STEIM_FRAME_BYTES];
+    static int32_t samples[MAX_SAMPLES], decoded[MAX_SAMPLES];
+    uint32_t state=43, crashes=0;
+    uint16_t frame_count;
+
+    signal_make(samples,MAX_SAMPLES,20,&state);
+    CHECK(steim_encode(3,samples,10,0,frames,1)==0);
+    CHECK(steim_encode(STEIM_1,samples,0,0,frames,1)==0);
+    //full scale 24 bit steps need more than one frame per 15 samples
+    CHECK(steim_encode(STEIM_1,samples,MAX_SAMPLES,0,frames,2)==0);
+
+    frame_count=steim_encode(STEIM_2,samples,MAX_SAMPLES,0,frames,STEIM_MAX_FRAMES(MAX_SAMPLES));
+    CHECK(frame_count!=0);
+    CHECK(steim_decode(3,frames,frame_count,MAX_SAMPLES,decoded)==STEIM_ERROR_LEVEL);
+    CHECK(steim_decode(STEIM_2,frames,frame_count-1,MAX_SAMPLES,decoded)==STEIM_ERROR_SHORT);
+    CHECK(steim_decode(STEIM_2,frames,frame_count,0,decoded)==STEIM_ERROR_SHORT);
+    //a changed data word: a wrong XN or (a dnib changed) an invalid code
+    frames[STEIM_FRAME_BYTES+8]^=0x01;
+    CHECK(steim_decode(STEIM_2,frames,frame_count,MAX_SAMPLES,decoded)==STEIM_ERROR_XN);
+    frames[STEIM_FRAME_BYTES+8]^=0x01;
+    for(uint8_t word=1;word<STEIM_FRAME_WORDS;word++){
+        if ((word_at(&frames[STEIM_FRAME_BYTES],0)>>(30-2*word)&3)==2){
+            frames[STEIM_FRAME_BYTES+4*word]&=0x3F; //dnib 00
+            CHECK(steim_decode(STEIM_2,frames,frame_count,MAX_SAMPLES,decoded)==STEIM_ERROR_CODE);
+            break;
+        }
+    }
+
+    //random bytes: always a valid result or an error, never out of the buffers
+    for(uint32_t round=0;round<20000;round++){
+        int32_t result;
+
+        for(uint32_t n=0;n<4*STEIM_FRAME_BYTES;n++){
+            frames[n]=(uint8_t)test_random(&state);
+        }
+        result=steim_decode((round&1)?STEIM_2:STEIM_1,frames,4,(uint16_t)(1+test_random(&state)%200),decoded);
+        crashes+=result>200 || (result<0 && result<STEIM_ERROR_XN);
+    }
+    CHECK(crashes==0);
+}
+
+static void bench(void){
+    enum {ROUNDS=2000};
+    static uint8_t frames[STEIM_MAX_FRAMES(MAX_SAMPLES)*STEIM_FRAME_BYTES];
+    static int32_t samples[MAX_SAMPLES], decoded[MAX_SAMPLES];
+    static const uint8_t step_bits[3]={6,12,20};
+    uint32_t state=47;
+    uint16_t frame_count=0;
+    double start, encode_time, decode_time;
+
+    for(uint8_t i=0;i<3;i++){
+        signal_make(samples,MAX_SAMPLES,step_bits[i],&state);
+        for(uint8_t level=STEIM_1;level<=STEIM_2;level++){
+            start=test_seconds();
+            for(uint32_t n=0;n<ROUNDS;n++){
+                frame_count=steim_encode(level,samples,MAX_SAMPLES,0,frames,STEIM_MAX_FRAMES(MAX_SAMPLES));
+            }
+            encode_time=(test_seconds()-start)/ROUNDS;
+            start=test_seconds();
+            for(uint32_t n=0;n<ROUNDS;n++){
+                steim_decode(level,frames,frame_count,MAX_SAMPLES,decoded);
+            }
+            decode_time=(test_seconds()-start)/ROUNDS;
+            printf("bench Steim-%d, steps of %2d bits: %4.2f:1 of 24 bit samples, encode %.1f Msamples/s, decode %.1f Msamples/s\n",
+                level,step_bits[i],3.0*MAX_SAMPLES/(frame_count*STEIM_FRAME_BYTES),
+                MAX_SAMPLES/encode_time/1e6,MAX_SAMPLES/decode_time/1e6);
+        }
+    }
+}
+
+int main(int argc, char **argv){
+    test_golden();
+    test_round_trip();
+    test_errors();
+    if (test_bench(argc,argv)){
+        bench();
+    }
+    return TEST_END();
+}
@@ -0,0 +1,418 @@
+/*
+time_sync.c: the SNTP messages against a local stand-in NTP server (UDP on 127.0.0.1, a
+thread with a known offset), invalid replies, the NTP era of 2036, and day long traces of
+a drifting station clock with WiFi delays: minimum delay filter, step and slew, FREQUENCY,
+the DS3231 aging offset and the UNCERTAINTY written in the packets.
+*/
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "test.h"
+#include "time_sync.h"
+
+#define NTP_UNIX_OFFSET 2208988800LL
+#define SERVER_OFFSET_US 2500000LL //stand-in server = this host + 2.5 s
+#define S 1000000LL
+
+static void ntp_write(uint8_t *buffer, int64_t epoch_us){
+    uint64_t seconds=(uint64_t)(epoch_us/S+NTP_UNIX_OFFSET);
+    uint32_t fraction=(uint32_t)(((uint64_t)(epoch_us%S)<<32)/S);
+
+    for(uint8_t i=0;i<4;i++){
+        buffer[i]=(uint8_t)((uint32_t)seconds>>(24-8*i));
+        buffer[4+i]=(uint8_t)(fraction>>(24-8*i));
+    }
+}
+
+//reply of a stratum 2 server: T1 copied to ORIGINATE, T2 and T3 of the server
+static void server_reply(const uint8_t *request, uint8_t *reply, int64_t t2_us, int64_t t3_us){
+    memset(reply,0,TIME_SYNC_NTP_BYTES);
+    reply[0]=(4<<3)|4;
+    reply[1]=2;
+    memcpy(&reply[24],&request[40],8);
+    ntp_write(&reply[32],t2_us);
+    ntp_write(&reply[40],t3_us);
+}
+
+static int64_t host_us(void){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME,&now);
+    return (int64_t)now.tv_sec*S+now.tv_nsec/1000;
+}
+
+
+/*======================================================================
+ * STAND-IN SERVER (UDP, 127.0.0.1)
+ ======================================================================*/
+static void *server_task(void *parameter){
+    int socket_fd=*(int *)parameter;
+    uint8_t request[TIME_SYNC_NTP_BYTES], reply[TIME_SYNC_NTP_BYTES];
+    struct sockaddr_in client;
+    socklen_t length=sizeof(client);
+
+    for(;;){
+        ssize_t bytes=recvfrom(socket_fd,request,sizeof(request),0,(struct sockaddr *)&client,&length);
+        int64_t t2=host_us()+SERVER_OFFSET_US;
+        if (bytes!=TIME_SYNC_NTP_BYTES){
+            break; //an empty datagram ends the server
+        }
+        server_reply(request,reply,t2,host_us()+SERVER_OFFSET_US);
+        sendto(socket_fd,reply,sizeof(reply),0,(struct sockaddr *)&client,length);
+    }
+    return NULL;
+}
+
+/*The exchange of sntp_config.c with a real socket: OFFSET of the server within DELAY/2*/
+static void test_server(void){
+    int server_fd=socket(AF_INET,SOCK_DGRAM,0), client_fd=socket(AF_INET,SOCK_DGRAM,0);
+    struct sockaddr_in address={0};
+    socklen_t length=sizeof(address);
+    uint8_t packet[TIME_SYNC_NTP_BYTES];
+    time_sync_sample_t sample;
+    time_sync_t sync;
+    pthread_t server;
+    int64_t stepped=0; //raw clock = this host + DS3231 settings
+    uint8_t used=0;
+
+    address.sin_family=AF_INET;
+    address.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+    address.sin_port=0; //any free port (not 123, no root)
+    CHECK(server_fd>=0 && client_fd>=0);
+    CHECK(bind(server_fd,(struct sockaddr *)&address,sizeof(address))==0);
+    CHECK(getsockname(server_fd,(struct sockaddr *)&address,&length)==0);
+    pthread_create(&server,NULL,server_task,&server_fd);
+
+    time_sync_init(&sync);
+    CHECK(time_sync_uncertainty(&sync,host_us())==TIME_SYNC_UNKNOWN);
+    for(uint8_t i=0;i<16;i++){
+        int64_t t1=host_us()+stepped, t4;
+
+        time_sync_ntp_request(packet,t1);
+        CHECK(packet[0]==((4<<3)|3));
+        sendto(client_fd,packet,sizeof(packet),0,(struct sockaddr *)&address,sizeof(address));
+        CHECK(recv(client_fd,packet,sizeof(packet),0)==TIME_SYNC_NTP_BYTES);
+        t4=host_us()+stepped;
+        CHECK(time_sync_ntp_sample(packet,t1,t4,&sample));
+        CHECK(sample.local_us==t4 && sample.delay_us>=0 && sample.delay_us<=t4-t1);
+        CHECK(llabs(sample.offset_us-(SERVER_OFFSET_US-stepped))<=sample.delay_us/2+1);
+
+        //2.5 s: the first sample steps the clock, then it is synced
+        switch(time_sync_add(&sync,&sample)){
+            case TIME_SYNC_STEP:
+                CHECK(used==0 && llabs(time_sync_step_us(&sync)-SERVER_OFFSET_US)<=sample.delay_us/2+1);
+                stepped+=sync.correction_us+time_sync_step_us(&sync);
+                time_sync_stepped(&sync);
+                break;
+            case TIME_SYNC_SLEW:
+                used++;
+                break;
+        }
+        usleep(1000);
+    }
+    CHECK(used!=0 && llabs(stepped-SERVER_OFFSET_US)<1000);
+    CHECK(time_sync_uncertainty(&sync,host_us()+stepped)<1000);
+    sendto(client_fd,packet,0,0,(struct sockaddr *)&address,sizeof(address));
+    pthread_join(server,NULL);
+    close(server_fd);
+    close(client_fd);
+}
+
+
+/*======================================================================
+ * SNTP MESSAGES
+ ======================================================================*/
+static void test_messages(void){
+    uint8_t request[TIME_SYNC_NTP_BYTES], reply[TIME_SYNC_NTP_BYTES];
+    time_sync_sample_t sample;
+    int64_t t1=1700000000123456LL;
+
+    time_sync_ntp_request(request,t1);
+    for(uint8_t i=1;i<40;i++){
+        CHECK(request[i]==0);
+    }
+
+    //100 ms out and 20 ms back, 5 ms in the server, server 1 s ahead
+    server_reply(request,reply,t1+S+100000,t1+S+105000);
+    CHECK(time_sync_ntp_sample(reply,t1,t1+125000,&sample));
+    CHECK(llabs(sample.offset_us-(S+40000))<=1); //the asymmetry is an error of 40 ms = DELAY/2 - 20 ms
+    CHECK(llabs(sample.delay_us-120000)<=1);
+
+    //not a valid reply: mode, version 2, leap 3, kiss-o'-death, other T1, T3 before T2
+    server_reply(request,reply,t1+10,t1+20);
+    reply[0]=(4<<3)|3;
+    CHECK(!time_sync_ntp_sample(reply,t1,t1+30,&sample));
+    reply[0]=(2<<3)|4;
+    CHECK(!time_sync_ntp_sample(reply,t1,t1+30,&sample));
+    reply[0]=(3<<6)|(4<<3)|4;
+    CHECK(!time_sync_ntp_sample(reply,t1,t1+30,&sample));
+    reply[0]=(3<<3)|4; //version 3 is accepted
+    CHECK(time_sync_ntp_sample(reply,t1,t1+30,&sample));
+    reply[1]=0;
+    CHECK(!time_sync_ntp_sample(reply,t1,t1+30,&sample));
+    reply[1]=16;
+    CHECK(!time_sync_ntp_sample(reply,t1,t1+30,&sample));
+    server_reply(request,reply,t1+10,t1+20);
+    CHECK(!time_sync_ntp_sample(reply,t1+1,t1+30,&sample));
+    CHECK(!time_sync_ntp_sample(reply,t1,t1-1,&sample));
+    server_reply(request,reply,t1+20,t1+10);
+    CHECK(!time_sync_ntp_sample(reply,t1,t1+30,&sample));
+
+    //after 2036-02-07 06:28:16 the NTP seconds start again (era 1)
+    t1=2150000000LL*S; //2038
+    time_sync_ntp_request(request,t1);
+    server_reply(request,reply,t1+S+10,t1+S+20);
+    CHECK(time_sync_ntp_sample(reply,t1,t1+30,&sample));
+    CHECK(llabs(sample.offset_us-S)<=1 && llabs(sample.delay_us-20)<=1);
+}
+
+
+/*======================================================================
+ * TRACES
+ *
+ * True time t, raw clock of the station = raw0 + t*(1 - slow_ppb)
+ * (+ = slow, OFFSET grows). One poll every POLL_S with WiFi delays:
+ * base 4 ms each way, exponential queues, and 1 of 10 exchanges
+ * delayed 50-400 ms in one direction (retries). time_sync_slew every
+ * second, like the time service.
+ ======================================================================*/
+#define POLL_S 64
+
+typedef struct {
+    double raw0_us;       //raw - true at start_us
+    double slow_ppb;      //raw clock slower than the true time
+    int64_t start_us;
+    double stepped_us;    //DS3231 settings
+    int64_t true_us;
+    uint32_t random;
+
+    time_sync_t sync;
+    int64_t correction_us;
+    uint32_t steps, slews, ignored;
+    int64_t aging;        //LSBs of the aging offset register
+} trace_t;
+
+static double uniform(uint32_t *random){
+    return (test_random(random)+0.5)/4294967296.0;
+}
+
+static int64_t raw_of(const trace_t *trace, int64_t true_us){
+    return true_us+(int64_t)llround(trace->raw0_us+trace->stepped_us-(double)(true_us-trace->start_us)*trace->slow_ppb*1e-9);
+}
+
+static int64_t network_us(uint32_t *random){
+    double delay=4000-1500*log(uniform(random));
+
+    if (test_random(random)%10==0){
+        delay+=50000+uniform(random)*350000;
+    }
+    return (int64_t)delay;
+}
+
+static void trace_init(trace_t *trace, double raw0_us, double slow_ppb, uint32_t seed){
+    memset(trace,0,sizeof(trace_t));
+    trace->raw0_us=raw0_us;
+    trace->slow_ppb=slow_ppb;
+    trace->random=seed;
+    trace->true_us=1700000000LL*S;
+    trace->start_us=trace->true_us;
+    time_sync_init(&trace->sync);
+}
+
+//one exchange at the current time, server_error_us = error of the server
+static void trace_poll(trace_t *trace, int64_t server_error_us){
+    uint8_t request[TIME_SYNC_NTP_BYTES], reply[TIME_SYNC_NTP_BYTES];
+    time_sync_sample_t sample;
+    int64_t out=network_us(&trace->random), back=network_us(&trace->random);
+    int64_t t1=raw_of(trace,trace->true_us), t4=raw_of(trace,trace->true_us+out+1000+back);
+
+    time_sync_ntp_request(request,t1);
+    server_reply(request,reply,trace->true_us+out+server_error_us,trace->true_us+out+1000+server_error_us);
+    CHECK(time_sync_ntp_sample(reply,t1,t4,&sample));
+
+    switch(time_sync_add(&trace->sync,&sample)){
+        case TIME_SYNC_STEP:
+            //time_service_step: station time + step
+            trace->stepped_us+=(double)(trace->correction_us+time_sync_step_us(&trace->sync));
+            time_sync_stepped(&trace->sync);
+            trace->correction_us=0;
+            trace->steps++;
+            break;
+        case TIME_SYNC_SLEW:
+            trace->slews++;
+            break;
+        default:
+            trace->ignored++;
+    }
+}
+
+typedef struct {
+    double error_max_us;  //|station - true|
+    double error_rms_us;
+    uint32_t under;       //seconds with UNCERTAINTY < |error|
+    double slew_max_ppm;  //speed of CORRECTION
+    uint32_t uncertainty_max;
+} trace_stats_t;
+
+//"seconds" of slews, a poll every POLL_S (server_error_us from "bad_from" to "bad_to" s)
+static trace_stats_t trace_run(trace_t *trace, uint32_t seconds, int64_t server_error_us, uint32_t bad_from, uint32_t bad_to){
+    trace_stats_t stats={0};
+    double sum2=0;
+
+    for(uint32_t s=0;s<seconds;s++){
+        int64_t raw, previous=trace->correction_us;
+        double error, speed;
+        uint32_t uncertainty;
+
+        if (s%POLL_S==0){
+            trace_poll(trace,(s>=bad_from && s<bad_to)?server_error_us:0);
+        }
+        trace->true_us+=S;
+        raw=raw_of(trace,trace->true_us);
+        trace->correction_us=time_sync_slew(&trace->sync,raw);
+        speed=fabs((double)(trace->correction_us-previous));
+        if (previous!=0 && speed>stats.slew_max_ppm){
+            stats.slew_max_ppm=speed;
+        }
+
+        error=fabs((double)(raw+trace->correction_us-trace->true_us));
+        uncertainty=time_sync_uncertainty(&trace->sync,raw);
+        if (error>stats.error_max_us) stats.error_max_us=error;
+        sum2+=error*error;
+        if (uncertainty<error) stats.under++;
+        if (uncertainty>stats.uncertainty_max) stats.uncertainty_max=uncertainty;
+    }
+    stats.error_rms_us=sqrt(sum2/seconds);
+    return stats;
+}
+
+/*A station 3 s late with a DS3231 1.7 ppm slow: one step, then slews within a few ms of the
+true time, and UNCERTAINTY covers the error*/
+static void test_trace(void){
+    trace_t trace;
+    trace_stats_t stats;
+
+    trace_init(&trace,-3*S,1700,11);
+    trace_run(&trace,2*3600,0,0,0); //first sync, FREQUENCY measured
+    CHECK(trace.steps==1);
+    CHECK(trace.sync.frequency_valid);
+
+    stats=trace_run(&trace,22*3600,0,0,0);
+    printf("1.7 ppm slow, 22 h: error rms %.0f us max %.0f us, uncertainty max %u us, under the error %u s, slew max %.0f ppm\n",
+        stats.error_rms_us,stats.error_max_us,stats.uncertainty_max,stats.under,stats.slew_max_ppm);
+    CHECK(trace.steps==1);
+    CHECK(stats.error_max_us<5000);
+    CHECK(stats.under<22*36); //UNCERTAINTY under the real error less than 1 % of the time
+    CHECK(stats.slew_max_ppm<=TIME_SYNC_SLEW_PPM);
+    CHECK(abs(trace.sync.frequency_ppb-1700)<200);
+}
+
+/*Only the minimum delay sample of the window is used: delayed exchanges don't move the time*/
+static void test_filter(void){
+    time_sync_t sync;
+    time_sync_sample_t sample={0,20000,0};
+
+    time_sync_init(&sync);
+    sample.local_us=1*S;
+    CHECK(time_sync_add(&sync,&sample)==TIME_SYNC_SLEW && sync.used.offset_us==0);
+    //bigger delays: the first sample is still the best one
+    for(uint8_t i=0;i<TIME_SYNC_WINDOW-1;i++){
+        sample=(time_sync_sample_t){50000+(int64_t)i*1000,100000,(2+i)*S};
+        CHECK(time_sync_add(&sync,&sample)==TIME_SYNC_IGNORED);
+    }
+    //the first one leaves the window, the best of the others (the newest of the same delay) is used once
+    sample=(time_sync_sample_t){90000,300000,20*S};
+    CHECK(time_sync_add(&sync,&sample)==TIME_SYNC_SLEW && sync.used.offset_us==56000);
+    sample=(time_sync_sample_t){1000,10000,21*S};
+    CHECK(time_sync_add(&sync,&sample)==TIME_SYNC_SLEW && sync.used.offset_us==1000);
+    //an older sample than the last used is never used again
+    sample=(time_sync_sample_t){5000,400000,22*S};
+    CHECK(time_sync_add(&sync,&sample)==TIME_SYNC_IGNORED);
+
+    //CORRECTION moves at most TIME_SYNC_SLEW_PPM from the first sync
+    time_sync_init(&sync);
+    CHECK(time_sync_slew(&sync,0)==0);
+    sample=(time_sync_sample_t){5000,10000,1*S};
+    CHECK(time_sync_add(&sync,&sample)==TIME_SYNC_SLEW);
+    CHECK(time_sync_slew(&sync,1*S)==0);
+    CHECK(time_sync_slew(&sync,2*S)==TIME_SYNC_SLEW_PPM);
+    CHECK(time_sync_slew(&sync,3*S)==2*TIME_SYNC_SLEW_PPM);
+    CHECK(time_sync_slew(&sync,20*S)==5000);
+}
+
+/*A server wrong for one or two polls isn't a step, a jump of the raw clock (DS3231 glitch)
+is stepped back once STEP_CONFIRM samples over TIME_SYNC_STEP_US are the best of the window*/
+static void test_step(void){
+    trace_t trace;
+    trace_stats_t stats;
+
+    trace_init(&trace,0,500,21);
+    trace_run(&trace,3600,0,0,0);
+    CHECK(trace.steps==0);
+
+    stats=trace_run(&trace,3600,700000,600,600+2*POLL_S);
+    CHECK(trace.steps==0 && stats.error_max_us<5000);
+
+    trace.stepped_us+=700000;
+    trace_run(&trace,(TIME_SYNC_WINDOW+4)*POLL_S,0,0,0);
+    CHECK(trace.steps==1);
+    stats=trace_run(&trace,3600,0,0,0);
+    CHECK(trace.steps==1 && stats.error_max_us<5000 && stats.slew_max_ppm<=TIME_SYNC_SLEW_PPM);
+}
+
+/*FREQUENCY removed with the DS3231 aging offset register (+1 LSB = 100 ppb slower)*/
+static void test_aging(void){
+    trace_t trace;
+    trace_stats_t stats;
+    int8_t delta;
+
+    trace_init(&trace,5000,-2300,31); //2.3 ppm fast
+    trace_run(&trace,3600,0,0,0);
+    CHECK(time_sync_aging_delta(&trace.sync)==0); //measured for 1 h, not good enough yet
+    trace_run(&trace,6*3600,0,0,0);
+    delta=time_sync_aging_delta(&trace.sync);
+    CHECK(delta>=21 && delta<=25);
+
+    //the raw clock keeps its time at the change
+    trace.raw0_us+=(double)(trace.true_us-trace.start_us)*delta*TIME_SYNC_AGING_PPB*1e-9;
+    trace.slow_ppb+=delta*TIME_SYNC_AGING_PPB;
+    time_sync_aging_applied(&trace.sync,delta);
+    CHECK(abs(trace.sync.frequency_ppb)<200);
+
+    stats=trace_run(&trace,12*3600,0,0,0);
+    CHECK(trace.steps==0 && stats.error_max_us<5000);
+    CHECK(abs(trace.sync.frequency_ppb)<150);
+    CHECK(time_sync_aging_delta(&trace.sync)>=-1 && time_sync_aging_delta(&trace.sync)<=1);
+}
+
+/*No polls (WiFi lost): UNCERTAINTY grows with TIME_SYNC_WANDER_PPB*/
+static void test_holdover(void){
+    trace_t trace;
+    uint32_t before, after;
+    int64_t raw;
+
+    trace_init(&trace,0,800,41);
+    trace_run(&trace,6*3600,0,0,0);
+    raw=raw_of(&trace,trace.true_us);
+    before=time_sync_uncertainty(&trace.sync,raw);
+    after=time_sync_uncertainty(&trace.sync,raw+3600*S);
+    CHECK(after>=before+3600*TIME_SYNC_WANDER_PPB/1000-1);
+    CHECK(time_sync_uncertainty(&trace.sync,raw+3600*S*24*365)<TIME_SYNC_UNKNOWN);
+}
+
+int main(int argc, char **argv){
+    (void)argc;
+    (void)argv;
+    test_messages();
+    test_server();
+    test_filter();
+    test_trace();
+    test_step();
+    test_aging();
+    test_holdover();
+    return TEST_END();
+}